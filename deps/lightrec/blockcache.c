@@ -7,61 +7,512 @@
 #include "debug.h"
 #include "lightrec-private.h"
 #include "memmanager.h"
+#include "optimizer.h"
 #include "reaper.h"
 #include "recompiler.h"
 
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if ENABLE_THREADED_COMPILER
+#include <pthread.h>
+#endif
+
+/* Initial number of slots of the block index. Must be power of two */
+#define INDEX_INIT_BITS		14
+
+/* Initial number of entries in the sorted block list */
+#define SORTED_INIT_SIZE	0x800
 
 /* Must be power of two */
 #define LUT_SIZE 0x4000
 
+/* Number of code buffer evictions a block must survive while in use, to be
+ * part of the old generation */
+#define BLOCK_HEAT_OLD		4
+
+/*
+ * Blocks are registered in two structures:
+ * - an open-addressed hash table using linear probing, keyed by the
+ *   (unsegmented) PC of the block, to quickly find a block from its entry
+ *   point;
+ * - an array of blocks sorted by PC, to find the block(s) that contain a given
+ *   address with a binary search.
+ *
+ * Several blocks can share the same PC, when an outdated block is waiting to
+ * be reaped. In that case, only the most recent one is present in the hash
+ * table.
+ *
+ * With the threaded compiler, the blocks are only registered and unregistered
+ * by the main thread, with the mutex held. Lookups don't take the mutex: they
+ * read the structures between two reads of a sequence counter, which the
+ * writers make odd while they modify them, and retry if it changed. Each
+ * structure is published with a single pointer along with its size, and the
+ * ones replaced when growing are only freed by the reaper, once the compiler
+ * thread cannot be reading them anymore. The blocks themselves are never
+ * freed while the compiler thread runs.
+ */
+/* The PC is kept next to the block, so that probing does not have to read
+ * the blocks it skips */
+struct index_slot {
+	u32 pc;
+	struct block *block;
+};
+
+struct block_index {
+	struct block_index *retired_next;
+	unsigned int bits;
+	struct index_slot slots[];
+};
+
+struct block_list {
+	struct block_list *retired_next;
+	unsigned int size, nb;
+	struct block *blocks[];
+};
+
 struct blockcache {
 	struct lightrec_state *state;
-	struct block * lut[LUT_SIZE];
+
+	struct block_index *_Atomic index;
+	unsigned int nb_indexed;
+
+	struct block_list *_Atomic sorted;
+
+	/* Size in bytes of the largest registered block */
+	u32 max_block_len;
+
+	/* Bitmap of the entry points of the blocks evicted from the code
+	 * buffer, to count the ones that have to be compiled again */
+	u32 *evicted;
+	unsigned int nb_evictions;
+	unsigned int nb_recompiles;
+
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_t mutex;
+	atomic_uint seq;
+
+	/* Replaced structures, waiting for the reaper to free them */
+	struct block_index *retired_index;
+	struct block_list *retired_sorted;
+#endif
 };
 
+static inline void blockcache_lock(struct blockcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_lock(&cache->mutex);
+#endif
+}
+
+static inline void blockcache_unlock(struct blockcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_unlock(&cache->mutex);
+#endif
+}
+
+static inline void blockcache_write_begin(struct blockcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	atomic_fetch_add_explicit(&cache->seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+#endif
+}
+
+static inline void blockcache_write_end(struct blockcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	atomic_fetch_add_explicit(&cache->seq, 1, memory_order_release);
+#endif
+}
+
+static inline unsigned int blockcache_read_begin(struct blockcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	unsigned int seq;
+
+	/* Wait for the writer to be done */
+	while ((seq = atomic_load_explicit(&cache->seq,
+					   memory_order_acquire)) & 1);
+
+	return seq;
+#else
+	return 0;
+#endif
+}
+
+static inline bool blockcache_read_retry(struct blockcache *cache,
+					 unsigned int seq)
+{
+#if ENABLE_THREADED_COMPILER
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&cache->seq, memory_order_relaxed) != seq;
+#else
+	return false;
+#endif
+}
+
+static inline struct block_index * get_index(struct blockcache *cache)
+{
+	return atomic_load_explicit(&cache->index, memory_order_acquire);
+}
+
+static inline struct block_list * get_sorted(struct blockcache *cache)
+{
+	return atomic_load_explicit(&cache->sorted, memory_order_acquire);
+}
+
+static inline size_t index_alloc_size(unsigned int bits)
+{
+	return sizeof(struct block_index) + (sizeof(struct index_slot) << bits);
+}
+
+static inline size_t list_alloc_size(unsigned int size)
+{
+	return sizeof(struct block_list) + sizeof(struct block *) * size;
+}
+
+#if ENABLE_THREADED_COMPILER
+static void lightrec_free_retired(struct blockcache *cache)
+{
+	struct lightrec_state *state = cache->state;
+	struct block_index *index;
+	struct block_list *list;
+
+	for (; (index = cache->retired_index); ) {
+		cache->retired_index = index->retired_next;
+		lightrec_free(state, MEM_FOR_LIGHTREC,
+			      index_alloc_size(index->bits), index);
+	}
+
+	for (; (list = cache->retired_sorted); ) {
+		cache->retired_sorted = list->retired_next;
+		lightrec_free(state, MEM_FOR_LIGHTREC,
+			      list_alloc_size(list->size), list);
+	}
+}
+
+static void lightrec_reap_retired(struct lightrec_state *state, void *data)
+{
+	struct blockcache *cache = data;
+
+	blockcache_lock(cache);
+	lightrec_free_retired(cache);
+	blockcache_unlock(cache);
+}
+#endif
+
+static void retire_index(struct blockcache *cache, struct block_index *index)
+{
+#if ENABLE_THREADED_COMPILER
+	index->retired_next = cache->retired_index;
+	cache->retired_index = index;
+	lightrec_reaper_add(cache->state->reaper, lightrec_reap_retired, cache);
+#else
+	lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+		      index_alloc_size(index->bits), index);
+#endif
+}
+
+static void retire_list(struct blockcache *cache, struct block_list *list)
+{
+#if ENABLE_THREADED_COMPILER
+	list->retired_next = cache->retired_sorted;
+	cache->retired_sorted = list;
+	lightrec_reaper_add(cache->state->reaper, lightrec_reap_retired, cache);
+#else
+	lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+		      list_alloc_size(list->size), list);
+#endif
+}
+
+#ifdef BLOCKCACHE_TRACE
+/* Records the block cache operations to the file named by
+ * $LIGHTREC_BLOCKCACHE_TRACE, to be replayed by host/blockcache_bench.c */
+static void blockcache_trace(u32 op, u32 pc, u32 len, const struct block *block)
+{
+	static FILE *f;
+	struct blockcache_trace rec = { op, pc, len, (u32)(uintptr_t)block };
+
+	if (!f) {
+		const char *path = getenv("LIGHTREC_BLOCKCACHE_TRACE");
+
+		f = fopen(path ? path : "blockcache.trace", "wb");
+		if (!f)
+			return;
+	}
+
+	fwrite(&rec, sizeof(rec), 1, f);
+}
+#else
+#define blockcache_trace(...)
+#endif
+
 u16 lightrec_get_lut_entry(const struct block *block)
 {
 	return (kunseg(block->pc) >> 2) & (LUT_SIZE - 1);
 }
 
+static inline unsigned int index_hash(unsigned int bits, u32 pc)
+{
+	/* Fibonacci hashing */
+	return ((pc >> 2) * 0x9e3779b1) >> (32 - bits);
+}
+
+static unsigned int index_find_slot(const struct block_index *index, u32 pc)
+{
+	unsigned int mask = (1 << index->bits) - 1;
+	unsigned int slot = index_hash(index->bits, pc);
+
+	for (; index->slots[slot].block; slot = (slot + 1) & mask)
+		if (index->slots[slot].pc == pc)
+			break;
+
+	return slot;
+}
+
+static void index_insert(struct blockcache *cache, struct block_index *index,
+			 struct block *block)
+{
+	u32 pc = kunseg(block->pc);
+	unsigned int slot = index_find_slot(index, pc);
+
+	if (!index->slots[slot].block)
+		cache->nb_indexed++;
+
+	index->slots[slot].pc = pc;
+	index->slots[slot].block = block;
+}
+
+static void index_remove(struct blockcache *cache, struct block_index *index,
+			 unsigned int slot)
+{
+	unsigned int mask = (1 << index->bits) - 1;
+	unsigned int next, ideal;
+
+	index->slots[slot].block = NULL;
+	cache->nb_indexed--;
+
+	/* Backward-shift the following entries, so that no tombstone is needed */
+	for (next = (slot + 1) & mask; index->slots[next].block;
+	     next = (next + 1) & mask) {
+		ideal = index_hash(index->bits, index->slots[next].pc);
+
+		/* Move the entry only if its ideal slot is not between the
+		 * hole and its current slot */
+		if (((next - ideal) & mask) >= ((next - slot) & mask)) {
+			index->slots[slot] = index->slots[next];
+			index->slots[next].block = NULL;
+			slot = next;
+		}
+	}
+}
+
+static struct block_index * index_alloc(struct blockcache *cache,
+					unsigned int bits)
+{
+	struct block_index *index;
+
+	index = lightrec_calloc(cache->state, MEM_FOR_LIGHTREC,
+				index_alloc_size(bits));
+	if (index)
+		index->bits = bits;
+
+	return index;
+}
+
+static int index_grow(struct blockcache *cache)
+{
+	struct block_index *index, *old_index = get_index(cache);
+	unsigned int i;
+
+	index = index_alloc(cache, old_index->bits + 1);
+	if (!index)
+		return -ENOMEM;
+
+	cache->nb_indexed = 0;
+
+	for (i = 0; i < 1u << old_index->bits; i++)
+		if (old_index->slots[i].block)
+			index_insert(cache, index, old_index->slots[i].block);
+
+	atomic_store_explicit(&cache->index, index, memory_order_release);
+	retire_index(cache, old_index);
+
+	return 0;
+}
+
+/* Returns the index of the first block whose PC is greater than 'pc' */
+static unsigned int sorted_upper_bound(const struct block_list *list, u32 pc)
+{
+	unsigned int low = 0, high = list->nb, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+
+		if (kunseg(list->blocks[mid]->pc) <= pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static struct block_list * list_alloc(struct blockcache *cache,
+				      unsigned int size)
+{
+	struct block_list *list;
+
+	list = lightrec_malloc(cache->state, MEM_FOR_LIGHTREC,
+			       list_alloc_size(size));
+	if (list) {
+		list->size = size;
+		list->nb = 0;
+	}
+
+	return list;
+}
+
+static int sorted_insert(struct blockcache *cache, struct block *block)
+{
+	struct block_list *new_list, *list = get_sorted(cache);
+	unsigned int pos;
+
+	if (list->nb == list->size) {
+		new_list = list_alloc(cache, list->size * 2);
+		if (!new_list)
+			return -ENOMEM;
+
+		memcpy(new_list->blocks, list->blocks,
+		       sizeof(*list->blocks) * list->nb);
+		new_list->nb = list->nb;
+
+		atomic_store_explicit(&cache->sorted, new_list,
+				      memory_order_release);
+		retire_list(cache, list);
+		list = new_list;
+	}
+
+	pos = sorted_upper_bound(list, kunseg(block->pc));
+
+	memmove(&list->blocks[pos + 1], &list->blocks[pos],
+		sizeof(*list->blocks) * (list->nb - pos));
+	list->blocks[pos] = block;
+	list->nb++;
+
+	return 0;
+}
+
+static bool sorted_remove(struct blockcache *cache, const struct block *block)
+{
+	struct block_list *list = get_sorted(cache);
+	u32 pc = kunseg(block->pc);
+	unsigned int pos = sorted_upper_bound(list, pc);
+
+	while (pos-- > 0 && kunseg(list->blocks[pos]->pc) == pc) {
+		if (list->blocks[pos] == block) {
+			list->nb--;
+			memmove(&list->blocks[pos], &list->blocks[pos + 1],
+				sizeof(*list->blocks) * (list->nb - pos));
+			return true;
+		}
+	}
+
+	return false;
+}
+
 struct block * lightrec_find_block(struct blockcache *cache, u32 pc)
 {
+	struct block_index *index;
 	struct block *block;
+	unsigned int seq;
 
 	pc = kunseg(pc);
+	blockcache_trace(BLOCKCACHE_TRACE_FIND, pc, 0, NULL);
 
-	for (block = cache->lut[(pc >> 2) & (LUT_SIZE - 1)];
-	     block; block = block->next)
-		if (kunseg(block->pc) == pc)
-			return block;
+	do {
+		seq = blockcache_read_begin(cache);
 
-	return NULL;
+		index = get_index(cache);
+		block = index->slots[index_find_slot(index, pc)].block;
+	} while (blockcache_read_retry(cache, seq));
+
+	return block;
+}
+
+struct block ** lightrec_get_all_blocks(struct blockcache *cache,
+					unsigned int *nb_blocks)
+{
+	struct block_list *list;
+	struct block **blocks = NULL;
+
+	blockcache_lock(cache);
+
+	list = get_sorted(cache);
+	*nb_blocks = list->nb;
+
+	if (list->nb) {
+		blocks = lightrec_malloc(cache->state, MEM_FOR_LIGHTREC,
+					 sizeof(*blocks) * list->nb);
+		if (blocks)
+			memcpy(blocks, list->blocks, sizeof(*blocks) * list->nb);
+	}
+
+	blockcache_unlock(cache);
+
+	return blocks;
 }
 
 struct block * lightrec_find_block_from_lut(struct blockcache *cache,
 					    u16 lut_entry, u32 addr_in_block)
 {
+	struct block_list *list;
 	struct block *block;
-	u32 pc;
+	unsigned int pos, seq;
+	u32 pc, max_len;
 
 	addr_in_block = kunseg(addr_in_block);
+	blockcache_trace(BLOCKCACHE_TRACE_FIND_FROM_LUT, addr_in_block,
+			 lut_entry, NULL);
 
-	for (block = cache->lut[lut_entry]; block; block = block->next) {
-		pc = kunseg(block->pc);
-		if (addr_in_block >= pc &&
-		    addr_in_block < pc + (block->nb_ops << 2))
-			return block;
-	}
+	do {
+		seq = blockcache_read_begin(cache);
 
-	return NULL;
+		list = get_sorted(cache);
+		max_len = cache->max_block_len;
+		block = NULL;
+
+		/* Walk back the blocks that start at or before the address, as
+		 * long as they are close enough to contain it */
+		for (pos = sorted_upper_bound(list, addr_in_block); pos-- > 0; ) {
+			block = list->blocks[pos];
+			pc = kunseg(block->pc);
+
+			if (addr_in_block - pc >= max_len) {
+				block = NULL;
+				break;
+			}
+
+			if (lightrec_get_lut_entry(block) == lut_entry &&
+			    addr_in_block < pc + (block->nb_ops << 2))
+				break;
+
+			block = NULL;
+		}
+	} while (blockcache_read_retry(cache, seq));
+
+	return block;
 }
 
-void remove_from_code_lut(struct blockcache *cache, struct block *block)
+static void clear_code_lut(struct lightrec_state *state,
+			   const struct block *block)
 {
-	struct lightrec_state *state = cache->state;
 	u32 offset = lut_offset(block->pc);
 
 	if (block->function) {
@@ -70,38 +521,229 @@ void remove_from_code_lut(struct blockcache *cache, struct block *block)
 	}
 }
 
-void lightrec_register_block(struct blockcache *cache, struct block *block)
+/*
+ * With OPT_SKIP_DEAD_STORES, the exits of a block to a known target don't
+ * store back the registers that the target block overwrites before reading
+ * them. The compiled code is then only valid as long as the target block is,
+ * so each block records the block it depends on, and each block keeps a list
+ * of its dependents. Once a block is invalidated, its dependents are removed
+ * from the code LUT and flagged as outdated, so that they are recompiled.
+ *
+ * The exits check at run-time that the target's LUT entry is set, before
+ * skipping the stores; the entry is cleared as soon as the target's code is
+ * overwritten, before the block itself is found outdated.
+ *
+ * Must be called with the block cache locked.
+ */
+static void lightrec_invalidate_dependents(struct blockcache *cache,
+					   struct block *block)
 {
-	u32 pc = kunseg(block->pc);
-	struct block *old;
+	struct block *dependent, *next;
 
-	old = cache->lut[(pc >> 2) & (LUT_SIZE - 1)];
-	if (old)
-		block->next = old;
+	for (dependent = block->dependents; dependent; dependent = next) {
+		next = dependent->dep_next;
 
-	cache->lut[(pc >> 2) & (LUT_SIZE - 1)] = block;
+		pr_debug("Block "PC_FMT" depends on invalidated block "PC_FMT"\n",
+			 dependent->pc, block->pc);
 
-	remove_from_code_lut(cache, block);
+		dependent->dep = NULL;
+		dependent->dep_next = NULL;
+		dependent->dep_outdated = true;
+		clear_code_lut(cache->state, dependent);
+	}
+
+	block->dependents = NULL;
 }
 
-void lightrec_unregister_block(struct blockcache *cache, struct block *block)
+static void lightrec_remove_dependency(struct block *block)
 {
-	u32 pc = kunseg(block->pc);
-	struct block *old = cache->lut[(pc >> 2) & (LUT_SIZE - 1)];
+	struct block **prev;
 
-	if (old == block) {
-		cache->lut[(pc >> 2) & (LUT_SIZE - 1)] = old->next;
+	if (!block->dep)
 		return;
+
+	for (prev = &block->dep->dependents; *prev; prev = &(*prev)->dep_next) {
+		if (*prev == block) {
+			*prev = block->dep_next;
+			break;
+		}
 	}
 
-	for (; old; old = old->next) {
-		if (old->next == block) {
-			old->next = block->next;
+	block->dep = NULL;
+	block->dep_next = NULL;
+}
+
+void lightrec_drop_dependents(struct blockcache *cache, struct block *block)
+{
+	blockcache_lock(cache);
+	lightrec_invalidate_dependents(cache, block);
+	blockcache_unlock(cache);
+}
+
+void remove_from_code_lut(struct blockcache *cache, struct block *block)
+{
+	lightrec_drop_dependents(cache, block);
+	clear_code_lut(cache->state, block);
+}
+
+u64 lightrec_get_dead_regs_at(struct blockcache *cache,
+			      struct block *block, u32 pc)
+{
+	struct block_index *index;
+	struct block *target;
+	u64 dead = 0;
+
+	blockcache_lock(cache);
+
+	index = get_index(cache);
+	target = index->slots[index_find_slot(index, kunseg(pc))].block;
+
+	/* A block can only depend on one other block */
+	if (!target || block->dep_outdated || (block->dep && block->dep != target))
+		goto out_unlock;
+
+	/* The memset replacement does not overwrite the registers that the
+	 * code would */
+	if (block_has_flag(target, BLOCK_IS_DEAD | BLOCK_IS_MEMSET))
+		goto out_unlock;
+
+	/* Don't trust a block whose code changed since it was created */
+	if (target->hash != lightrec_calculate_block_hash(target))
+		goto out_unlock;
+
+	dead = lightrec_get_dead_regs(target->code, target->nb_ops);
+
+	if (dead && !block->dep) {
+		block->dep = target;
+		block->dep_next = target->dependents;
+		target->dependents = block;
+	}
+
+out_unlock:
+	blockcache_unlock(cache);
+
+	return dead;
+}
+
+void lightrec_validate_deps(struct blockcache *cache, struct block *block)
+{
+	/* If the block it depends on was invalidated while the block was
+	 * being compiled, its new code must not be used */
+	blockcache_lock(cache);
+
+	if (block->dep_outdated)
+		clear_code_lut(cache->state, block);
+
+	blockcache_unlock(cache);
+}
+
+static void lightrec_mark_evicted(struct blockcache *cache,
+				  const struct block *block)
+{
+	u32 offset = lut_offset(block->pc);
+
+	if (!cache->evicted) {
+		cache->evicted = lightrec_calloc(cache->state, MEM_FOR_LIGHTREC,
+						 CODE_LUT_SIZE / 8);
+		if (!cache->evicted)
 			return;
+	}
+
+	cache->evicted[offset / 32] |= 1u << (offset % 32);
+	cache->nb_evictions++;
+}
+
+static void lightrec_check_evicted(struct blockcache *cache,
+				   const struct block *block)
+{
+	u32 offset = lut_offset(block->pc);
+	u32 mask = 1u << (offset % 32);
+
+	if (cache->evicted && (cache->evicted[offset / 32] & mask)) {
+		cache->evicted[offset / 32] &= ~mask;
+		cache->nb_recompiles++;
+	}
+}
+
+int lightrec_register_block(struct blockcache *cache, struct block *block)
+{
+	u32 len = block->nb_ops << 2;
+	int ret = 0;
+
+	blockcache_trace(BLOCKCACHE_TRACE_REGISTER, kunseg(block->pc), len, block);
+
+	blockcache_lock(cache);
+	blockcache_write_begin(cache);
+
+	/* Keep the load factor of the index under 50% */
+	if ((cache->nb_indexed + 1) * 2 > (1u << get_index(cache)->bits))
+		ret = index_grow(cache);
+
+	if (!ret)
+		ret = sorted_insert(cache, block);
+
+	if (!ret) {
+		index_insert(cache, get_index(cache), block);
+		lightrec_check_evicted(cache, block);
+
+		if (len > cache->max_block_len)
+			cache->max_block_len = len;
+	}
+
+	blockcache_write_end(cache);
+	blockcache_unlock(cache);
+
+	if (ret) {
+		pr_err("Unable to register block at "PC_FMT"\n", block->pc);
+		return ret;
+	}
+
+	remove_from_code_lut(cache, block);
+
+	return 0;
+}
+
+void lightrec_unregister_block(struct blockcache *cache, struct block *block)
+{
+	u32 pc = kunseg(block->pc);
+	struct block_index *index;
+	struct block_list *list;
+	unsigned int pos, slot;
+	bool found;
+
+	blockcache_trace(BLOCKCACHE_TRACE_UNREGISTER, pc, 0, block);
+
+	blockcache_lock(cache);
+	blockcache_write_begin(cache);
+
+	found = sorted_remove(cache, block);
+	if (found) {
+		index = get_index(cache);
+		slot = index_find_slot(index, pc);
+
+		if (index->slots[slot].block == block) {
+			index_remove(cache, index, slot);
+
+			/* If an older block with the same PC is still
+			 * registered, make it visible again */
+			list = get_sorted(cache);
+			pos = sorted_upper_bound(list, pc);
+			if (pos > 0 && kunseg(list->blocks[pos - 1]->pc) == pc)
+				index_insert(cache, index, list->blocks[pos - 1]);
 		}
 	}
 
-	pr_err("Block at "PC_FMT" is not in cache\n", block->pc);
+	blockcache_write_end(cache);
+
+	if (found) {
+		lightrec_remove_dependency(block);
+		lightrec_invalidate_dependents(cache, block);
+	}
+
+	blockcache_unlock(cache);
+
+	if (!found)
+		pr_err("Block at "PC_FMT" is not in cache\n", block->pc);
 }
 
 static bool lightrec_block_is_old(const struct lightrec_state *state,
@@ -112,66 +754,205 @@ static bool lightrec_block_is_old(const struct lightrec_state *state,
 	return diff > (1 << 27); /* About 4 seconds */
 }
 
-static void lightrec_free_blocks(struct blockcache *cache,
-				 const struct block *except, bool all)
+enum block_free_mode {
+	/* Free the outdated blocks, and evict the cold ones */
+	FREE_COLD,
+	/* Free the outdated blocks, and evict the least recently created blocks
+	 * of the young generation */
+	FREE_YOUNG,
+	/* Evict all the blocks */
+	FREE_EVICT_ALL,
+	/* Free all the blocks, e.g. on shutdown */
+	FREE_ALL,
+};
+
+static inline u32 lightrec_block_age(const struct lightrec_state *state,
+				     const struct block *block)
+{
+	return state->current_cycle - block->precompile_date;
+}
+
+/*
+ * When the code buffer is full, the compiled blocks are aged using a
+ * second-chance scheme: the generated code of each block sets its 'ran' flag
+ * when it is entered, and each cleaning of the code buffer clears it.
+ *
+ * Blocks whose flag is still cleared at the next cleaning did not run in
+ * between, and are evicted, unless they survived enough cleanings while in use
+ * (old generation), in which case they only cool down. This keeps the hot
+ * blocks in the code buffer, instead of evicting them based on their age.
+ */
+static bool lightrec_block_is_cold(struct block *block)
+{
+	if (!block->ran) {
+		if (block->heat < BLOCK_HEAT_OLD)
+			return true;
+
+		block->heat /= 2;
+		return false;
+	}
+
+	if (block->heat < 0xff)
+		block->heat++;
+
+	block->ran = 0;
+
+	return false;
+}
+
+static unsigned int lightrec_free_blocks(struct blockcache *cache,
+					 const struct block *except,
+					 enum block_free_mode mode,
+					 u32 *young_age)
 {
 	struct lightrec_state *state = cache->state;
-	struct block *block, *next;
-	bool outdated = all;
-	unsigned int i;
+	bool all = mode >= FREE_EVICT_ALL;
+	unsigned int nb_evicted = 0;
+	bool outdated = all, cold;
+	struct block **blocks, *block;
+	unsigned int i, nb;
 	u8 old_flags;
 
-	for (i = 0; i < LUT_SIZE; i++) {
-		for (block = cache->lut[i]; block; block = next) {
-			next = block->next;
+	/* Walk a snapshot of the list: the lock cannot be held for the whole
+	 * loop, as lightrec_recompiler_remove() may have to wait for the
+	 * compiler thread, which looks up and registers blocks too. The blocks
+	 * are only freed from here or from the reaper, which does not run
+	 * concurrently, so the snapshot's pointers stay valid. */
+	blocks = lightrec_get_all_blocks(cache, &nb);
+	if (!blocks) {
+		if (nb)
+			pr_err("Unable to snapshot the block cache\n");
+		return 0;
+	}
 
-			if (except && block == except)
-				continue;
+	for (i = 0; i < nb; i++) {
+		block = blocks[i];
 
-			if (!all) {
-				outdated = lightrec_block_is_old(state, block) ||
-					lightrec_block_is_outdated(state, block);
-			}
+		if (except && block == except)
+			continue;
+
+		cold = all;
+
+		if (!all) {
+			outdated = lightrec_block_is_outdated(state, block);
+
+			if (outdated || block_has_flag(block, BLOCK_IS_DEAD))
+				cold = false;
+			else if (!block->function)
+				cold = lightrec_block_is_old(state, block);
+			else if (mode == FREE_YOUNG)
+				cold = block->heat < BLOCK_HEAT_OLD &&
+					lightrec_block_age(state, block) >= *young_age;
+			else
+				cold = lightrec_block_is_cold(block);
+
+			/* Record the age of the oldest young block kept */
+			if (mode == FREE_COLD && !cold && block->function &&
+			    block->heat < BLOCK_HEAT_OLD &&
+			    lightrec_block_age(state, block) > *young_age)
+				*young_age = lightrec_block_age(state, block);
+		}
 
-			if (!outdated)
-				continue;
+		if (!outdated && !cold)
+			continue;
 
-			old_flags = block_set_flags(block, BLOCK_IS_DEAD);
+		old_flags = block_set_flags(block, BLOCK_IS_DEAD);
 
-			if (!(old_flags & BLOCK_IS_DEAD)) {
-				if (ENABLE_THREADED_COMPILER)
-					lightrec_recompiler_remove(state->rec, block);
+		if (!(old_flags & BLOCK_IS_DEAD)) {
+			if (ENABLE_THREADED_COMPILER)
+				lightrec_recompiler_remove(state->rec, block);
 
-				pr_debug("Freeing outdated block at "PC_FMT"\n", block->pc);
-				remove_from_code_lut(cache, block);
-				lightrec_unregister_block(cache, block);
-				lightrec_free_block(state, block);
+			if (mode != FREE_ALL && cold && block->function) {
+				blockcache_lock(cache);
+				lightrec_mark_evicted(cache, block);
+				blockcache_unlock(cache);
+				nb_evicted++;
 			}
+
+			pr_debug("Freeing %s block at "PC_FMT"\n",
+				 cold ? "cold" : "outdated", block->pc);
+			remove_from_code_lut(cache, block);
+			lightrec_unregister_block(cache, block);
+			lightrec_free_block(state, block);
 		}
 	}
+
+	lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*blocks) * nb, blocks);
+
+	return nb_evicted;
 }
 
 void lightrec_remove_outdated_blocks(struct blockcache *cache,
 				     const struct block *except)
 {
+	unsigned int nb_evicted;
+	u32 young_age = 0;
+
 	pr_info("Running out of code space. Cleaning block cache...\n");
 
-	lightrec_free_blocks(cache, except, false);
+	nb_evicted = lightrec_free_blocks(cache, except, FREE_COLD, &young_age);
+
+	if (!nb_evicted && young_age) {
+		/* All the blocks ran since the last eviction. Evict the oldest
+		 * half of the young generation, the other half will have to
+		 * prove itself until the next eviction. */
+		young_age /= 2;
+		nb_evicted = lightrec_free_blocks(cache, except,
+						  FREE_YOUNG, &young_age);
+	}
+
+	if (!nb_evicted) {
+		pr_info("No cold block to evict, flushing the block cache\n");
+		lightrec_evict_all_blocks(cache, except);
+	}
+}
+
+void lightrec_evict_all_blocks(struct blockcache *cache,
+			       const struct block *except)
+{
+	lightrec_free_blocks(cache, except, FREE_EVICT_ALL, NULL);
 }
 
 void lightrec_free_all_blocks(struct blockcache *cache)
 {
-	lightrec_free_blocks(cache, NULL, true);
+	lightrec_free_blocks(cache, NULL, FREE_ALL, NULL);
+}
+
+void lightrec_blockcache_get_stats(struct blockcache *cache,
+				   unsigned int *evictions,
+				   unsigned int *recompiles)
+{
+	*evictions = cache->nb_evictions;
+	*recompiles = cache->nb_recompiles;
 }
 
 void lightrec_free_block_cache(struct blockcache *cache)
 {
+	struct lightrec_state *state = cache->state;
+
 	lightrec_free_all_blocks(cache);
-	lightrec_free(cache->state, MEM_FOR_LIGHTREC, sizeof(*cache), cache);
+
+#if ENABLE_THREADED_COMPILER
+	lightrec_free_retired(cache);
+	pthread_mutex_destroy(&cache->mutex);
+#endif
+
+	if (cache->evicted) {
+		lightrec_free(state, MEM_FOR_LIGHTREC,
+			      CODE_LUT_SIZE / 8, cache->evicted);
+	}
+
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      list_alloc_size(get_sorted(cache)->size), get_sorted(cache));
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      index_alloc_size(get_index(cache)->bits), get_index(cache));
+	lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*cache), cache);
 }
 
 struct blockcache * lightrec_blockcache_init(struct lightrec_state *state)
 {
+	struct block_index *index;
+	struct block_list *sorted;
 	struct blockcache *cache;
 
 	cache = lightrec_calloc(state, MEM_FOR_LIGHTREC, sizeof(*cache));
@@ -180,7 +961,37 @@ struct blockcache * lightrec_blockcache_init(struct lightrec_state *state)
 
 	cache->state = state;
 
+	index = index_alloc(cache, INDEX_INIT_BITS);
+	if (!index)
+		goto err_free_cache;
+
+	sorted = list_alloc(cache, SORTED_INIT_SIZE);
+	if (!sorted)
+		goto err_free_index;
+
+	atomic_init(&cache->index, index);
+	atomic_init(&cache->sorted, sorted);
+
+#if ENABLE_THREADED_COMPILER
+	if (pthread_mutex_init(&cache->mutex, NULL)) {
+		pr_err("Cannot init block cache mutex\n");
+		goto err_free_sorted;
+	}
+#endif
+
 	return cache;
+
+#if ENABLE_THREADED_COMPILER
+err_free_sorted:
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      list_alloc_size(sorted->size), sorted);
+#endif
+err_free_index:
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      index_alloc_size(index->bits), index);
+err_free_cache:
+	lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*cache), cache);
+	return NULL;
 }
 
 u32 lightrec_calculate_block_hash(const struct block *block)
@@ -213,7 +1024,7 @@ static void lightrec_reset_lut_offset(struct lightrec_state *state, void *d)
 	if (!block)
 		return;
 
-	if (block_has_flag(block, BLOCK_IS_DEAD))
+	if (block_has_flag(block, BLOCK_IS_DEAD) || block->dep_outdated)
 		return;
 
 	addr = block->function ?: state->get_next_block;
@@ -228,7 +1039,8 @@ bool lightrec_block_is_outdated(struct lightrec_state *state, struct block *bloc
 	if (lut_read(state, offset))
 		return false;
 
-	outdated = block->hash != lightrec_calculate_block_hash(block);
+	outdated = block->dep_outdated
+		|| block->hash != lightrec_calculate_block_hash(block);
 	if (likely(!outdated)) {
 		/* The block was marked as outdated, but the content is still
 		 * the same */
@@ -10,12 +10,30 @@
 
 struct blockcache;
 
+/* Operations recorded by a build with BLOCKCACHE_TRACE */
+enum blockcache_trace_op {
+	BLOCKCACHE_TRACE_REGISTER,
+	BLOCKCACHE_TRACE_UNREGISTER,
+	BLOCKCACHE_TRACE_FIND,
+	BLOCKCACHE_TRACE_FIND_FROM_LUT,
+};
+
+struct blockcache_trace {
+	u32 op;
+	u32 pc;			/* kunseg'd PC, or address in the block */
+	u32 len;		/* length in bytes, or LUT entry */
+	u32 id;			/* identifies the registered block */
+};
+
 struct block * lightrec_find_block(struct blockcache *cache, u32 pc);
 struct block * lightrec_find_block_from_lut(struct blockcache *cache,
 					    u16 lut_entry, u32 addr_in_block);
 u16 lightrec_get_lut_entry(const struct block *block);
 
-void lightrec_register_block(struct blockcache *cache, struct block *block);
+struct block ** lightrec_get_all_blocks(struct blockcache *cache,
+					unsigned int *nb_blocks);
+
+int lightrec_register_block(struct blockcache *cache, struct block *block);
 void lightrec_unregister_block(struct blockcache *cache, struct block *block);
 
 struct blockcache * lightrec_blockcache_init(struct lightrec_state *state);
@@ -28,5 +46,16 @@ _Bool lightrec_block_is_outdated(struct lightrec_state *state, struct block *blo
 
 void lightrec_remove_outdated_blocks(struct blockcache *cache,
 				     const struct block *except);
+void lightrec_evict_all_blocks(struct blockcache *cache,
+			       const struct block *except);
+
+u64 lightrec_get_dead_regs_at(struct blockcache *cache,
+			      struct block *block, u32 pc);
+void lightrec_validate_deps(struct blockcache *cache, struct block *block);
+void lightrec_drop_dependents(struct blockcache *cache, struct block *block);
+
+void lightrec_blockcache_get_stats(struct blockcache *cache,
+				   unsigned int *evictions,
+				   unsigned int *recompiles);
 
 #endif /* __BLOCKCACHE_H__ */
@@ -154,12 +154,14 @@ static const char * const opcode_io_modes[] = {
 	"RAM access",
 	"BIOS access",
 	"Scratchpad access",
-	"Mapped I/O access"
+	"Mapped I/O access",
+	"I/O handler call",
 };
 
 static const char * const opcode_branch_flags[] = {
 	"emulate branch",
 	"local branch",
+	"idle loop",
 };
 
 static const char * const opcode_movi_flags[] = {
@@ -491,7 +493,8 @@ static int print_op(union code c, u32 pc, char *buf, size_t len,
 	}
 }
 
-void lightrec_print_disassembly(const struct block *block, const u32 *code_ptr)
+void lightrec_fprint_disassembly(FILE *f, const struct block *block,
+				 const u32 *code_ptr)
 {
 	const struct opcode *op;
 	const char * const *flags_ptr;
@@ -526,7 +529,12 @@ void lightrec_print_disassembly(const struct block *block, const u32 *code_ptr)
 		nb_spaces1 = (*buf2 || *buf3) ? 30 - (int)count : 0;
 		nb_spaces2 = *buf3 ? 30 - (int)count2 : 0;
 
-		printf(X32_FMT" (0x%x)\t%s%*c%s%*c%s\n", pc, i << 2,
-		       buf, nb_spaces1, ' ', buf2, nb_spaces2, ' ', buf3);
+		fprintf(f, X32_FMT" (0x%x)\t%s%*c%s%*c%s\n", pc, i << 2,
+			buf, nb_spaces1, ' ', buf2, nb_spaces2, ' ', buf3);
 	}
 }
+
+void lightrec_print_disassembly(const struct block *block, const u32 *code_ptr)
+{
+	lightrec_fprint_disassembly(stdout, block, code_ptr);
+}
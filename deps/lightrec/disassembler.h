@@ -39,13 +39,22 @@
 #define LIGHTREC_IO_BIOS	0x4
 #define LIGHTREC_IO_SCRATCH	0x5
 #define LIGHTREC_IO_DIRECT_HW	0x6
+#define LIGHTREC_IO_HW_CALL	0x7
 #define LIGHTREC_IO_MASK	LIGHTREC_IO_MODE(0x7)
 #define LIGHTREC_FLAGS_GET_IO_MODE(x) \
 	(((x) & LIGHTREC_IO_MASK) >> LIGHTREC_IO_MODE_LSB)
 
+/* Index of the registered I/O handler, for LIGHTREC_IO_HW_CALL */
+#define LIGHTREC_IO_HANDLER_LSB	9
+#define LIGHTREC_IO_HANDLER(x)	((x) << LIGHTREC_IO_HANDLER_LSB)
+#define LIGHTREC_IO_HANDLER_MASK	LIGHTREC_IO_HANDLER(0x1f)
+#define LIGHTREC_FLAGS_GET_IO_HANDLER(x) \
+	(((x) & LIGHTREC_IO_HANDLER_MASK) >> LIGHTREC_IO_HANDLER_LSB)
+
 /* Flags for branches */
 #define LIGHTREC_EMULATE_BRANCH	BIT(2)
 #define LIGHTREC_LOCAL_BRANCH	BIT(3)
+#define LIGHTREC_IDLE_LOOP	BIT(4)
 
 /* Flags for div/mult opcodes */
 #define LIGHTREC_NO_LO		BIT(2)
@@ -293,12 +302,18 @@ struct opcode {
 	u32 flags;
 };
 
+struct interpreter;
+
 struct opcode_list {
 	u16 nb_ops;
+	/* Interpreter handler of each opcode, predecoded on first use */
+	u32 (**handlers)(struct interpreter *inter);
 	struct opcode ops[];
 };
 
 void lightrec_print_disassembly(const struct block *block, const u32 *code);
+void lightrec_fprint_disassembly(FILE *f, const struct block *block,
+				 const u32 *code);
 
 static inline _Bool op_flag_no_ds(u32 flags)
 {
@@ -341,6 +356,11 @@ static inline _Bool op_flag_local_branch(u32 flags)
 	return OPT_LOCAL_BRANCHES && (flags & LIGHTREC_LOCAL_BRANCH);
 }
 
+static inline _Bool op_flag_idle_loop(u32 flags)
+{
+	return OPT_DETECT_IDLE_LOOPS && (flags & LIGHTREC_IDLE_LOOP);
+}
+
 static inline _Bool op_flag_no_lo(u32 flags)
 {
 	return OPT_FLAG_MULT_DIV && (flags & LIGHTREC_NO_LO);
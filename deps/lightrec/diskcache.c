@@ -0,0 +1,443 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include "debug.h"
+#include "diskcache.h"
+#include "disassembler.h"
+#include "lightrec-private.h"
+#include "memmanager.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#if ENABLE_THREADED_COMPILER
+#include <pthread.h>
+#endif
+
+/*
+ * The disk cache stores the run-time profiling data of the blocks (the I/O
+ * mode of each load/store opcode, as detected by the first pass or by the
+ * rw_generic wrapper), keyed by the block's PC and hash.
+ *
+ * The native code itself cannot be cached, as the code generated by
+ * Lightning contains absolute addresses (dispatcher entry points, C wrappers,
+ * block pointers) that are only valid for the current session. However, with
+ * the profiling data available, a block can be compiled immediately with
+ * direct memory accesses, skipping the first pass and the subsequent
+ * re-compilations caused by untagged opcodes.
+ */
+
+#define DISKCACHE_MAGIC		0x4344524c /* "LRDC" */
+#define DISKCACHE_VERSION	1
+
+/* Must be power of two */
+#define DISKCACHE_LUT_SIZE	0x1000
+
+struct diskcache_entry {
+	struct diskcache_entry *next;
+	u32 pc;
+	u32 hash;
+	u16 nb_ops;
+	u8 io_modes[];
+};
+
+struct diskcache_header {
+	u32 magic;
+	u32 version;
+	u32 nb_entries;
+};
+
+struct diskcache_entry_header {
+	u32 pc;
+	u32 hash;
+	u16 nb_ops;
+	u16 pad;
+};
+
+struct diskcache {
+	struct lightrec_state *state;
+	struct diskcache_entry *lut[DISKCACHE_LUT_SIZE];
+	unsigned int nb_entries;
+	unsigned int hits, misses;
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_t mutex;
+#endif
+};
+
+static inline void diskcache_lock(struct diskcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_lock(&cache->mutex);
+#endif
+}
+
+static inline void diskcache_unlock(struct diskcache *cache)
+{
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_unlock(&cache->mutex);
+#endif
+}
+
+static inline unsigned int diskcache_lut_entry(u32 pc)
+{
+	return (kunseg(pc) >> 2) & (DISKCACHE_LUT_SIZE - 1);
+}
+
+static inline unsigned int diskcache_entry_size(u16 nb_ops)
+{
+	return sizeof(struct diskcache_entry) + nb_ops;
+}
+
+static struct diskcache_entry *
+diskcache_find(struct diskcache *cache, u32 pc)
+{
+	struct diskcache_entry *entry;
+
+	pc = kunseg(pc);
+
+	for (entry = cache->lut[diskcache_lut_entry(pc)];
+	     entry; entry = entry->next)
+		if (kunseg(entry->pc) == pc)
+			return entry;
+
+	return NULL;
+}
+
+static void diskcache_remove(struct diskcache *cache,
+			     struct diskcache_entry *entry)
+{
+	struct diskcache_entry **prev = &cache->lut[diskcache_lut_entry(entry->pc)];
+
+	for (; *prev; prev = &(*prev)->next) {
+		if (*prev == entry) {
+			*prev = entry->next;
+			cache->nb_entries--;
+			break;
+		}
+	}
+
+	lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+		      diskcache_entry_size(entry->nb_ops), entry);
+}
+
+static void diskcache_insert(struct diskcache *cache,
+			     struct diskcache_entry *entry)
+{
+	unsigned int idx = diskcache_lut_entry(entry->pc);
+
+	entry->next = cache->lut[idx];
+	cache->lut[idx] = entry;
+	cache->nb_entries++;
+}
+
+static void diskcache_clear(struct diskcache *cache)
+{
+	struct diskcache_entry *entry, *next;
+	unsigned int i;
+
+	for (i = 0; i < DISKCACHE_LUT_SIZE; i++) {
+		for (entry = cache->lut[i]; entry; entry = next) {
+			next = entry->next;
+			lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+				      diskcache_entry_size(entry->nb_ops), entry);
+		}
+
+		cache->lut[i] = NULL;
+	}
+
+	cache->nb_entries = 0;
+}
+
+static bool opcode_is_tagged_io(const struct opcode *op)
+{
+	switch (op->i.op) {
+	case OP_LB:
+	case OP_LH:
+	case OP_LWL:
+	case OP_LW:
+	case OP_LBU:
+	case OP_LHU:
+	case OP_LWR:
+	case OP_SB:
+	case OP_SH:
+	case OP_SWL:
+	case OP_SW:
+	case OP_SWR:
+	case OP_LWC2:
+	case OP_SWC2:
+	case OP_META_LWU:
+	case OP_META_SWU:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool diskcache_modes_valid(const struct diskcache_entry *entry)
+{
+	unsigned int i;
+
+	/* LIGHTREC_IO_HW_CALL is never saved, as it needs a handler index */
+	for (i = 0; i < entry->nb_ops; i++)
+		if (entry->io_modes[i] > LIGHTREC_IO_DIRECT_HW)
+			return false;
+
+	return true;
+}
+
+bool lightrec_diskcache_apply(struct diskcache *cache, struct block *block)
+{
+	struct diskcache_entry *entry;
+	struct opcode *op;
+	unsigned int i;
+	u8 mode;
+
+	diskcache_lock(cache);
+
+	entry = diskcache_find(cache, block->pc);
+	if (!entry || entry->hash != block->hash
+	    || entry->nb_ops != block->nb_ops) {
+		cache->misses++;
+		diskcache_unlock(cache);
+		return false;
+	}
+
+	for (i = 0; i < block->nb_ops; i++) {
+		op = &block->opcode_list[i];
+		mode = entry->io_modes[i];
+
+		if (mode && opcode_is_tagged_io(op)
+		    && !LIGHTREC_FLAGS_GET_IO_MODE(op->flags))
+			op->flags |= LIGHTREC_IO_MODE(mode);
+	}
+
+	cache->hits++;
+	diskcache_unlock(cache);
+
+	pr_debug("Disk cache hit for block "PC_FMT"\n", block->pc);
+
+	return true;
+}
+
+void lightrec_diskcache_record(struct diskcache *cache,
+			       const struct block *block)
+{
+	struct diskcache_entry *entry;
+	unsigned int i;
+	u8 mode;
+
+	diskcache_lock(cache);
+
+	entry = diskcache_find(cache, block->pc);
+	if (entry && entry->nb_ops != block->nb_ops) {
+		diskcache_remove(cache, entry);
+		entry = NULL;
+	}
+
+	if (!entry) {
+		entry = lightrec_malloc(cache->state, MEM_FOR_LIGHTREC,
+					diskcache_entry_size(block->nb_ops));
+		if (!entry) {
+			diskcache_unlock(cache);
+			return;
+		}
+
+		entry->pc = block->pc;
+		entry->nb_ops = block->nb_ops;
+		diskcache_insert(cache, entry);
+	}
+
+	entry->hash = block->hash;
+
+	for (i = 0; i < block->nb_ops; i++) {
+		mode = LIGHTREC_FLAGS_GET_IO_MODE(block->opcode_list[i].flags);
+
+		/* The handler index is not saved; the handler will be bound
+		 * again when the optimizer sees the constant address. */
+		if (mode == LIGHTREC_IO_HW_CALL)
+			mode = LIGHTREC_IO_HW;
+
+		entry->io_modes[i] = mode;
+	}
+
+	diskcache_unlock(cache);
+}
+
+int lightrec_diskcache_load(struct diskcache *cache, const char *path)
+{
+	struct diskcache_entry_header ehdr;
+	struct diskcache_header hdr;
+	struct diskcache_entry *entry;
+	unsigned int i;
+	int ret = 0;
+	FILE *f;
+
+	/* Drop the entries of the previous game, even if this one has no
+	 * cache file yet */
+	diskcache_lock(cache);
+	diskcache_clear(cache);
+	diskcache_unlock(cache);
+
+	f = fopen(path, "rb");
+	if (!f)
+		return errno == ENOENT ? 0 : -errno;
+
+	diskcache_lock(cache);
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+	    || LE32TOH(hdr.magic) != DISKCACHE_MAGIC
+	    || LE32TOH(hdr.version) != DISKCACHE_VERSION) {
+		pr_warn("Ignoring invalid block cache file %s\n", path);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < LE32TOH(hdr.nb_entries); i++) {
+		if (fread(&ehdr, sizeof(ehdr), 1, f) != 1) {
+			ret = -EIO;
+			break;
+		}
+
+		entry = lightrec_malloc(cache->state, MEM_FOR_LIGHTREC,
+					diskcache_entry_size(LE16TOH(ehdr.nb_ops)));
+		if (!entry) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		entry->pc = LE32TOH(ehdr.pc);
+		entry->hash = LE32TOH(ehdr.hash);
+		entry->nb_ops = LE16TOH(ehdr.nb_ops);
+
+		if (fread(entry->io_modes, 1, entry->nb_ops, f) != entry->nb_ops) {
+			lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+				      diskcache_entry_size(entry->nb_ops), entry);
+			ret = -EIO;
+			break;
+		}
+
+		if (!diskcache_modes_valid(entry)) {
+			lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+				      diskcache_entry_size(entry->nb_ops), entry);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (diskcache_find(cache, entry->pc)) {
+			lightrec_free(cache->state, MEM_FOR_LIGHTREC,
+				      diskcache_entry_size(entry->nb_ops), entry);
+			continue;
+		}
+
+		diskcache_insert(cache, entry);
+	}
+
+	if (ret == -EINVAL) {
+		pr_warn("Ignoring corrupted block cache file %s\n", path);
+		diskcache_clear(cache);
+		goto out_unlock;
+	}
+
+	if (ret)
+		pr_warn("Block cache file %s is truncated\n", path);
+
+	pr_info("Loaded %u entries from block cache %s\n",
+		cache->nb_entries, path);
+
+out_unlock:
+	diskcache_unlock(cache);
+	fclose(f);
+	return ret;
+}
+
+int lightrec_diskcache_save(struct diskcache *cache, const char *path)
+{
+	struct diskcache_entry_header ehdr = {};
+	struct diskcache_header hdr;
+	struct diskcache_entry *entry;
+	unsigned int i;
+	int ret = 0;
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return -errno;
+
+	diskcache_lock(cache);
+
+	hdr.magic = HTOLE32(DISKCACHE_MAGIC);
+	hdr.version = HTOLE32(DISKCACHE_VERSION);
+	hdr.nb_entries = HTOLE32(cache->nb_entries);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		ret = -EIO;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < DISKCACHE_LUT_SIZE; i++) {
+		for (entry = cache->lut[i]; entry; entry = entry->next) {
+			ehdr.pc = HTOLE32(entry->pc);
+			ehdr.hash = HTOLE32(entry->hash);
+			ehdr.nb_ops = HTOLE16(entry->nb_ops);
+
+			if (fwrite(&ehdr, sizeof(ehdr), 1, f) != 1
+			    || fwrite(entry->io_modes, 1, entry->nb_ops, f) != entry->nb_ops) {
+				ret = -EIO;
+				goto out_unlock;
+			}
+		}
+	}
+
+	pr_info("Saved %u entries to block cache %s\n",
+		cache->nb_entries, path);
+
+out_unlock:
+	diskcache_unlock(cache);
+
+	if (fclose(f) && !ret)
+		ret = -errno;
+
+	return ret;
+}
+
+void lightrec_diskcache_get_stats(struct diskcache *cache,
+				  unsigned int *hits, unsigned int *misses)
+{
+	*hits = cache->hits;
+	*misses = cache->misses;
+}
+
+struct diskcache * lightrec_diskcache_init(struct lightrec_state *state)
+{
+	struct diskcache *cache;
+
+	cache = lightrec_calloc(state, MEM_FOR_LIGHTREC, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->state = state;
+
+#if ENABLE_THREADED_COMPILER
+	if (pthread_mutex_init(&cache->mutex, NULL)) {
+		pr_err("Cannot init disk cache mutex\n");
+		lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*cache), cache);
+		return NULL;
+	}
+#endif
+
+	return cache;
+}
+
+void lightrec_free_diskcache(struct diskcache *cache)
+{
+	diskcache_clear(cache);
+
+#if ENABLE_THREADED_COMPILER
+	pthread_mutex_destroy(&cache->mutex);
+#endif
+
+	lightrec_free(cache->state, MEM_FOR_LIGHTREC, sizeof(*cache), cache);
+}
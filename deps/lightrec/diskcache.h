@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#ifndef __LIGHTREC_DISKCACHE_H__
+#define __LIGHTREC_DISKCACHE_H__
+
+#include "lightrec.h"
+
+struct block;
+struct diskcache;
+struct lightrec_state;
+
+struct diskcache * lightrec_diskcache_init(struct lightrec_state *state);
+void lightrec_free_diskcache(struct diskcache *cache);
+
+int lightrec_diskcache_load(struct diskcache *cache, const char *path);
+int lightrec_diskcache_save(struct diskcache *cache, const char *path);
+
+_Bool lightrec_diskcache_apply(struct diskcache *cache, struct block *block);
+void lightrec_diskcache_record(struct diskcache *cache,
+			       const struct block *block);
+
+void lightrec_diskcache_get_stats(struct diskcache *cache,
+				  unsigned int *hits, unsigned int *misses);
+
+#endif /* __LIGHTREC_DISKCACHE_H__ */
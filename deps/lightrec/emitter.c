@@ -52,6 +52,123 @@ lightrec_jump_to_ds_check(struct lightrec_cstate *state, jit_state_t *_jit)
 	lightrec_jump_to_fn(_jit, state->state->ds_check_func);
 }
 
+static void
+lightrec_load_lut_entry(struct lightrec_state *state, jit_state_t *_jit,
+			u8 reg, u32 pc)
+{
+	jit_movi(reg, (uintptr_t)lut_address(state, lut_offset(pc)));
+	if (lut_is_32bit(state))
+		jit_ldxi_ui(reg, reg, 0);
+	else
+		jit_ldxi(reg, reg, 0);
+}
+
+static void
+lightrec_jump_to_lut_entry(jit_state_t *_jit)
+{
+	/* Same environment as the dispatcher's loop */
+	jit_stxi_i(lightrec_offset(curr_pc), LIGHTREC_REG_STATE, JIT_V0);
+	if (!arch_has_fast_mask())
+		jit_movi(JIT_R1, 0x1fffffff);
+
+	jit_live(LIGHTREC_REG_CYCLE);
+	jit_jmpr(JIT_V1);
+}
+
+static void
+lightrec_emit_chained_jump(struct lightrec_cstate *state, jit_state_t *_jit,
+			   u32 pc)
+{
+	jit_node_t *to_eob, *to_eob2;
+
+	if (lightrec_store_next_pc())
+		jit_movi(JIT_V0, pc);
+
+	/* Go through the dispatcher if we ran out of cycles */
+	to_eob = jit_blei(LIGHTREC_REG_CYCLE, 0);
+
+	/* The target PC is known - read its code LUT entry directly. Since the
+	 * LUT is always kept up to date when blocks are invalidated or
+	 * destroyed, there is no link to undo. */
+	lightrec_load_lut_entry(state->state, _jit, JIT_V1, pc);
+
+	to_eob2 = jit_beqi(JIT_V1, 0);
+
+	lightrec_jump_to_lut_entry(_jit);
+
+	jit_patch(to_eob);
+	jit_patch(to_eob2);
+	lightrec_jump_to_eob(state, _jit);
+}
+
+static void
+lightrec_emit_chained_jump_skip_dead(struct lightrec_cstate *state,
+				     const struct block *block, u32 pc)
+{
+	struct regcache *reg_cache = state->reg_cache;
+	struct native_register *regs_backup;
+	jit_state_t *_jit = block->_jit;
+	jit_node_t *to_eob, *to_eob2, *to_eob3;
+	unsigned int i, skipped = 0;
+	u64 dead;
+	u8 tmp;
+
+	dead = lightrec_get_dead_regs_at(state->state->block_cache,
+					 (struct block *)block, pc);
+	if (!dead)
+		return;
+
+	/* Registers that the next block overwrites before reading them don't
+	 * need to be stored back. The next block is known to be the one that
+	 * was analyzed if its LUT entry still points to compiled code; if it is
+	 * cleared or points to get_next_block() (the C lookup, which may run
+	 * another version of the block), take the slow path that stores back
+	 * all the registers. */
+	tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+	for (i = 1; i <= REG_HI; i++)
+		if ((dead & BIT(i)) && lightrec_reg_is_dirty(reg_cache, i))
+			skipped++;
+
+	if (!skipped) {
+		lightrec_free_reg(reg_cache, tmp);
+		return;
+	}
+
+	to_eob = jit_blei(LIGHTREC_REG_CYCLE, 0);
+	lightrec_load_lut_entry(state->state, _jit, tmp, pc);
+	to_eob2 = jit_beqi(tmp, 0);
+	to_eob3 = jit_beqi(tmp, (jit_word_t)state->state->get_next_block);
+
+	regs_backup = lightrec_regcache_enter_branch(reg_cache);
+
+	for (i = 1; i <= REG_HI; i++)
+		if (dead & BIT(i))
+			lightrec_discard_reg_if_loaded(reg_cache, i);
+
+	lightrec_clean_regs(reg_cache, _jit);
+
+	jit_movr(JIT_V1, tmp);
+	if (lightrec_store_next_pc())
+		jit_movi(JIT_V0, pc);
+
+	lightrec_jump_to_lut_entry(_jit);
+
+	lightrec_regcache_leave_branch(reg_cache, regs_backup);
+	lightrec_free_reg(reg_cache, tmp);
+
+	jit_patch(to_eob);
+	jit_patch(to_eob2);
+	jit_patch(to_eob3);
+
+	pr_debug("Skipping %u dead register(s) on exit to "PC_FMT"\n",
+		 skipped, pc);
+
+#if ENABLE_PROFILER
+	((struct block *)block)->profile.skipped_stores += skipped;
+#endif
+}
+
 static void update_ra_register(struct regcache *reg_cache, jit_state_t *_jit,
 			       u8 ra_reg, u32 pc, u32 link)
 {
@@ -72,7 +189,7 @@ static void lightrec_emit_end_of_block(struct lightrec_cstate *state,
 	const struct opcode *op = &block->opcode_list[offset],
 			    *ds = get_delay_slot(block->opcode_list, offset);
 	u32 cycles = state->cycles + lightrec_cycles_of_opcode(state->state, op->c);
-	bool has_ds = has_delay_slot(op->c);
+	bool has_ds = has_delay_slot(op->c), load_delay;
 
 	jit_note(__FILE__, __LINE__);
 
@@ -99,16 +216,23 @@ static void lightrec_emit_end_of_block(struct lightrec_cstate *state,
 			lightrec_rec_opcode(state, block, offset + 1);
 	}
 
-	/* Clean the remaining registers */
-	lightrec_clean_regs(reg_cache, _jit);
-
 	if (cycles && update_cycles) {
 		jit_subi(LIGHTREC_REG_CYCLE, LIGHTREC_REG_CYCLE, cycles);
 		pr_debug("EOB: %"PRIu32" cycles\n", cycles);
 	}
 
-	if (has_ds && op_flag_load_delay(ds->flags)
-	    && opcode_has_load_delay(ds->c) && !state->no_load_delay) {
+	load_delay = has_ds && op_flag_load_delay(ds->flags)
+		&& opcode_has_load_delay(ds->c) && !state->no_load_delay;
+
+	/* Exits of local branches are only taken when running out of cycles */
+	if (OPT_CHAIN_BLOCKS && OPT_SKIP_DEAD_STORES && reg_new_pc < 0
+	    && !load_delay && !op_flag_local_branch(op->flags))
+		lightrec_emit_chained_jump_skip_dead(state, block, imm);
+
+	/* Clean the remaining registers */
+	lightrec_clean_regs(reg_cache, _jit);
+
+	if (load_delay) {
 		/* If the delay slot is a load opcode, its target register
 		 * will be written after the first opcode of the target is
 		 * executed. Handle this by jumping to a special section of
@@ -117,6 +241,8 @@ static void lightrec_emit_end_of_block(struct lightrec_cstate *state,
 		jit_movi(JIT_V1, ds->c.i.rt);
 
 		lightrec_jump_to_ds_check(state, _jit);
+	} else if (OPT_CHAIN_BLOCKS && reg_new_pc < 0) {
+		lightrec_emit_chained_jump(state, _jit, imm);
 	} else {
 		lightrec_jump_to_eob(state, _jit);
 	}
@@ -239,6 +365,117 @@ static void lightrec_do_early_unload(struct lightrec_cstate *state,
 	}
 }
 
+#if ENABLE_PROFILER
+static void lightrec_emit_profile_add(struct lightrec_cstate *state,
+				      jit_state_t *_jit, u64 *counter, u32 value)
+{
+	struct regcache *reg_cache = state->reg_cache;
+	u32 *lo = (u32 *)counter + is_big_endian(),
+	    *hi = (u32 *)counter + !is_big_endian();
+	u8 tmp, tmp2;
+
+	tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+	if (__WORDSIZE == 64) {
+		jit_ldi(tmp, counter);
+		jit_addi(tmp, tmp, value);
+		jit_sti(counter, tmp);
+	} else {
+		tmp2 = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+		jit_ldi_i(tmp, lo);
+		jit_ldi_i(tmp2, hi);
+		jit_addci(tmp, tmp, value);
+		jit_addxi(tmp2, tmp2, 0);
+		jit_sti_i(lo, tmp);
+		jit_sti_i(hi, tmp2);
+
+		lightrec_free_reg(reg_cache, tmp2);
+	}
+
+	lightrec_free_reg(reg_cache, tmp);
+}
+
+void lightrec_emit_profile_entry(struct lightrec_cstate *state,
+				 struct block *block)
+{
+	lightrec_emit_profile_add(state, block->_jit,
+				  &block->profile.exec_count, 1);
+}
+
+static void lightrec_emit_profile_loop(struct lightrec_cstate *state,
+				       const struct block *block,
+				       u16 offset, u32 target_offset)
+{
+	struct block_profile *profile = (struct block_profile *)&block->profile;
+	const struct opcode *op = &block->opcode_list[offset];
+	u32 cycles = 0;
+	unsigned int i;
+
+	/* Cycles of the loop's body, from the target to the delay slot */
+	for (i = target_offset; i <= offset; i++)
+		cycles += lightrec_cycles_of_opcode(state->state,
+						    block->opcode_list[i].c);
+
+	if (!op_flag_no_ds(op->flags))
+		cycles += lightrec_cycles_of_opcode(state->state,
+			get_delay_slot(block->opcode_list, offset)->c);
+
+	lightrec_emit_profile_add(state, block->_jit,
+				  &profile->loop_cycles, cycles);
+}
+#endif
+
+void lightrec_emit_ran_flag(struct lightrec_cstate *state,
+			    struct block *block)
+{
+	struct regcache *reg_cache = state->reg_cache;
+	jit_state_t *_jit = block->_jit;
+	u8 tmp;
+
+	/* Flag the block as used, so that it is not evicted at the next
+	 * cleaning of the code buffer */
+	tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+	jit_movi(tmp, 1);
+	jit_sti_c(&block->ran, tmp);
+
+	lightrec_free_reg(reg_cache, tmp);
+}
+
+void lightrec_emit_hot_counter(struct lightrec_cstate *state,
+			       struct block *block)
+{
+	struct lightrec_state *lstate = state->state;
+	struct regcache *reg_cache = state->reg_cache;
+	void *lut_entry = lut_address(lstate, lut_offset(block->pc));
+	jit_state_t *_jit = block->_jit;
+	jit_node_t *to_end, *to_end2;
+	u8 tmp;
+
+	/* Count down the entries into the block. When the counter reaches
+	 * zero, clear the block's LUT entry, so that the next lookup goes
+	 * through C, which will request the block to be recompiled. */
+	tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+	jit_ldi_us(tmp, &block->hot_count);
+	to_end = jit_beqi(tmp, 0);
+
+	jit_subi(tmp, tmp, 1);
+	jit_sti_s(&block->hot_count, tmp);
+	to_end2 = jit_bnei(tmp, 0);
+
+	if (lut_is_32bit(lstate))
+		jit_sti_i(lut_entry, tmp);
+	else
+		jit_sti(lut_entry, tmp);
+
+	jit_patch(to_end);
+	jit_patch(to_end2);
+
+	lightrec_free_reg(reg_cache, tmp);
+}
+
 static void rec_b(struct lightrec_cstate *state, const struct block *block, u16 offset,
 		  jit_code_t code, jit_code_t code2, u32 link, bool unconditional, bool bz)
 {
@@ -252,7 +489,7 @@ static void rec_b(struct lightrec_cstate *state, const struct block *block, u16
 	int op_cycles = lightrec_cycles_of_opcode(state->state, op->c);
 	u32 target_offset, cycles = state->cycles + op_cycles;
 	bool no_indirection = false;
-	jit_node_t *addr = NULL;
+	jit_node_t *addr = NULL, *idle;
 	u32 next_pc;
 	u8 rs, rt;
 
@@ -293,6 +530,18 @@ static void rec_b(struct lightrec_cstate *state, const struct block *block, u16
 		regs_backup = lightrec_regcache_enter_branch(reg_cache);
 	}
 
+	if (op_flag_idle_loop(op->flags) &&
+	    lightrec_idle_loop_is_safe(block, offset)) {
+		/* Nothing the loop reads can change before the next event;
+		 * skip the remaining cycles to exit to the dispatcher. */
+		pr_debug("Skipping cycles in idle loop at offset 0x%hx\n",
+			 offset << 2);
+
+		idle = jit_blei(LIGHTREC_REG_CYCLE, 0);
+		jit_movi(LIGHTREC_REG_CYCLE, 0);
+		jit_patch(idle);
+	}
+
 	if (op_flag_local_branch(op->flags)) {
 		/* Recompile the delay slot */
 		if (!op_flag_no_ds(op->flags) && ds->opcode) {
@@ -316,6 +565,12 @@ static void rec_b(struct lightrec_cstate *state, const struct block *block, u16
 
 		branch->target = target_offset;
 
+#if ENABLE_PROFILER
+		if (!is_forward)
+			lightrec_emit_profile_loop(state, block, offset,
+						   target_offset);
+#endif
+
 		if (no_indirection)
 			branch->branch = jit_new_node_pww(code2, NULL, rs, rt);
 		else if (is_forward)
@@ -1216,7 +1471,7 @@ static void rec_io(struct lightrec_cstate *state,
 	u32 flags = block->opcode_list[offset].flags;
 	bool is_tagged = LIGHTREC_FLAGS_GET_IO_MODE(flags);
 	bool load_delay = op_flag_load_delay(flags) && !state->no_load_delay;
-	u8 zero, reg = load_delay ? REG_TEMP : c.i.rt;
+	u8 zero, tmp, reg = load_delay ? REG_TEMP : c.i.rt;
 	u32 lut_entry;
 
 	jit_note(__FILE__, __LINE__);
@@ -1242,7 +1497,17 @@ static void rec_io(struct lightrec_cstate *state,
 		lightrec_free_reg(reg_cache, zero);
 	}
 
-	if (is_tagged) {
+	if (LIGHTREC_FLAGS_GET_IO_MODE(flags) == LIGHTREC_IO_HW_CALL) {
+		/* The handler is known at compile time - store it where the
+		 * wrapper will find it, and skip the memory map lookup. */
+		tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+		jit_movi(tmp, (intptr_t) state->state->hw_handlers[
+			 LIGHTREC_FLAGS_GET_IO_HANDLER(flags)].ops);
+		jit_stxi(lightrec_offset(hw_call_ops), LIGHTREC_REG_STATE, tmp);
+		lightrec_free_reg(reg_cache, tmp);
+
+		call_to_c_wrapper(state, block, c.opcode, C_WRAPPER_HW_CALL);
+	} else if (is_tagged) {
 		call_to_c_wrapper(state, block, c.opcode, C_WRAPPER_RW);
 	} else {
 		lut_entry = lightrec_get_lut_entry(block);
@@ -2573,6 +2838,160 @@ static void rec_cp2_basic_CTC2(struct lightrec_cstate *state,
 	lightrec_free_reg(reg_cache, rt);
 }
 
+static unsigned int cp2d_s_hi_offset(u8 reg)
+{
+	return cp2d_i_offset(reg) + !is_big_endian() * 2;
+}
+
+static void rec_cp2_flag_F(jit_state_t *_jit, u8 flag, u8 lo, u8 hi, u8 tmp)
+{
+	/* Compute the GTE flags of a MAC0 result, given as a 64-bit value
+	 * in $lo on 64-bit hosts, or in $lo/$hi on 32-bit hosts. On overflow,
+	 * bits 31 and 16 are set; on underflow, bits 31 and 15 are set.
+	 * $lo is preserved, $hi and $tmp are clobbered. */
+	if (__WORDSIZE == 64) {
+		jit_extr_i(tmp, lo);
+		jit_ner(tmp, tmp, lo);
+		jit_lti(hi, lo, 0);
+	} else {
+		jit_rshi(tmp, lo, 31);
+		jit_ner(tmp, tmp, hi);
+		jit_lti(hi, hi, 0);
+	}
+
+	/* flag = overflow ? (0x80000000 | (0x10000 >> negative)) : 0 */
+	jit_movi(flag, 0x10000);
+	jit_rshr_u(flag, flag, hi);
+	jit_ori(flag, flag, 0x80000000);
+	jit_negr(tmp, tmp);
+	jit_andr(flag, flag, tmp);
+}
+
+static void rec_cp2_nclip_term(jit_state_t *_jit, u8 dst, u8 tmp,
+			       u8 sx, u8 sya, u8 syb)
+{
+	/* dst = SXn * (SYa - SYb); the result always fits in 32 bits. */
+	jit_ldxi_s(dst, LIGHTREC_REG_STATE, cp2d_s_hi_offset(sya));
+	jit_ldxi_s(tmp, LIGHTREC_REG_STATE, cp2d_s_hi_offset(syb));
+	jit_subr(dst, dst, tmp);
+	jit_ldxi_s(tmp, LIGHTREC_REG_STATE, cp2d_s_offset(sx));
+	jit_mulr(dst, dst, tmp);
+}
+
+static void rec_cp2_NCLIP(struct lightrec_cstate *state,
+			  const struct block *block, u16 offset)
+{
+	struct regcache *reg_cache = state->reg_cache;
+	jit_state_t *_jit = block->_jit;
+	u8 lo, hi, tmp, tmp2;
+	unsigned int i;
+
+	_jit_name(block->_jit, __func__);
+	jit_note(__FILE__, __LINE__);
+
+	lo = lightrec_alloc_reg_temp(reg_cache, _jit);
+	hi = lightrec_alloc_reg_temp(reg_cache, _jit);
+	tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+	tmp2 = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+	/* MAC0 = SX0 * (SY1 - SY2) + SX1 * (SY2 - SY0) + SX2 * (SY0 - SY1) */
+	rec_cp2_nclip_term(_jit, lo, tmp, 12, 13, 14);
+	if (__WORDSIZE == 32)
+		jit_rshi(hi, lo, 31);
+
+	for (i = 1; i < 3; i++) {
+		rec_cp2_nclip_term(_jit, tmp, tmp2, 12 + i,
+				   12 + (i + 1) % 3, 12 + (i + 2) % 3);
+
+		if (__WORDSIZE == 64) {
+			jit_addr(lo, lo, tmp);
+		} else {
+			jit_rshi(tmp2, tmp, 31);
+			jit_addcr(lo, lo, tmp);
+			jit_addxr(hi, hi, tmp2);
+		}
+	}
+
+	jit_stxi_i(cp2d_i_offset(24), LIGHTREC_REG_STATE, lo);
+
+	rec_cp2_flag_F(_jit, tmp2, lo, hi, tmp);
+	jit_stxi_i(cp2c_i_offset(31), LIGHTREC_REG_STATE, tmp2);
+
+	lightrec_free_reg(reg_cache, lo);
+	lightrec_free_reg(reg_cache, hi);
+	lightrec_free_reg(reg_cache, tmp);
+	lightrec_free_reg(reg_cache, tmp2);
+}
+
+static void rec_cp2_avsz(struct lightrec_cstate *state,
+			 const struct block *block, bool avsz4)
+{
+	struct regcache *reg_cache = state->reg_cache;
+	jit_state_t *_jit = block->_jit;
+	u8 lo, hi, tmp, flag;
+	jit_node_t *in_range;
+	unsigned int i;
+
+	jit_note(__FILE__, __LINE__);
+
+	lo = lightrec_alloc_reg_temp(reg_cache, _jit);
+	hi = lightrec_alloc_reg_temp(reg_cache, _jit);
+	tmp = lightrec_alloc_reg_temp(reg_cache, _jit);
+	flag = lightrec_alloc_reg_temp(reg_cache, _jit);
+
+	/* MAC0 = ZSF3 * (SZ1 + SZ2 + SZ3), or ZSF4 * (SZ0 + ... + SZ3) */
+	jit_ldxi_us(tmp, LIGHTREC_REG_STATE, cp2d_s_offset(19));
+
+	for (i = avsz4 ? 16 : 17; i < 19; i++) {
+		jit_ldxi_us(flag, LIGHTREC_REG_STATE, cp2d_s_offset(i));
+		jit_addr(tmp, tmp, flag);
+	}
+
+	jit_ldxi_s(flag, LIGHTREC_REG_STATE, cp2c_s_offset(avsz4 ? 30 : 29));
+
+	if (__WORDSIZE == 64)
+		jit_mulr(lo, tmp, flag);
+	else
+		jit_qmulr(lo, hi, tmp, flag);
+
+	jit_stxi_i(cp2d_i_offset(24), LIGHTREC_REG_STATE, lo);
+
+	rec_cp2_flag_F(_jit, flag, lo, hi, tmp);
+
+	/* OTZ = limD(MAC0 >> 12) */
+	jit_extr_i(tmp, lo);
+	jit_rshi(tmp, tmp, 12);
+
+	in_range = jit_blei_u(tmp, 0xffff);
+	jit_ori(flag, flag, 0x80040000);
+	jit_lti(tmp, tmp, 0);
+	jit_subi(tmp, tmp, 1);
+	jit_andi(tmp, tmp, 0xffff);
+	jit_patch(in_range);
+
+	jit_stxi_s(cp2d_s_offset(7), LIGHTREC_REG_STATE, tmp);
+	jit_stxi_i(cp2c_i_offset(31), LIGHTREC_REG_STATE, flag);
+
+	lightrec_free_reg(reg_cache, lo);
+	lightrec_free_reg(reg_cache, hi);
+	lightrec_free_reg(reg_cache, tmp);
+	lightrec_free_reg(reg_cache, flag);
+}
+
+static void rec_cp2_AVSZ3(struct lightrec_cstate *state,
+			  const struct block *block, u16 offset)
+{
+	_jit_name(block->_jit, __func__);
+	rec_cp2_avsz(state, block, false);
+}
+
+static void rec_cp2_AVSZ4(struct lightrec_cstate *state,
+			  const struct block *block, u16 offset)
+{
+	_jit_name(block->_jit, __func__);
+	rec_cp2_avsz(state, block, true);
+}
+
 static void rec_cp0_RFE(struct lightrec_cstate *state,
 			const struct block *block, u16 offset)
 {
@@ -2934,6 +3353,13 @@ static const lightrec_rec_func_t rec_cp2_basic[64] = {
 	[OP_CP2_BASIC_CTC2]	= rec_cp2_basic_CTC2,
 };
 
+static const lightrec_rec_func_t rec_cp2[64] = {
+	SET_DEFAULT_ELM(rec_cp2, rec_CP),
+	[OP_CP2_NCLIP]		= rec_cp2_NCLIP,
+	[OP_CP2_AVSZ3]		= rec_cp2_AVSZ3,
+	[OP_CP2_AVSZ4]		= rec_cp2_AVSZ4,
+};
+
 static const lightrec_rec_func_t rec_meta[64] = {
 	SET_DEFAULT_ELM(rec_meta, unknown_opcode),
 	[OP_META_MOV]		= rec_meta_MOV,
@@ -2986,6 +3412,13 @@ static void rec_CP2(struct lightrec_cstate *state,
 	if (c.r.op == OP_CP2_BASIC) {
 		lightrec_rec_func_t f = rec_cp2_basic[c.r.rs];
 
+		if (HAS_DEFAULT_ELM || likely(f)) {
+			(*f)(state, block, offset);
+			return;
+		}
+	} else if (OPT_INLINE_GTE) {
+		lightrec_rec_func_t f = rec_cp2[c.r.op];
+
 		if (HAS_DEFAULT_ELM || likely(f)) {
 			(*f)(state, block, offset);
 			return;
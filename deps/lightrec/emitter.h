@@ -15,5 +15,11 @@ struct opcode;
 void lightrec_rec_opcode(struct lightrec_cstate *state, const struct block *block, u16 offset);
 void lightrec_emit_jump_to_interpreter(struct lightrec_cstate *state,
 				       const struct block *block, u16 offset);
+void lightrec_emit_profile_entry(struct lightrec_cstate *state,
+				 struct block *block);
+void lightrec_emit_ran_flag(struct lightrec_cstate *state,
+			    struct block *block);
+void lightrec_emit_hot_counter(struct lightrec_cstate *state,
+			       struct block *block);
 
 #endif /* __EMITTER_H__ */
@@ -6,6 +6,7 @@
 #include "disassembler.h"
 #include "interpreter.h"
 #include "lightrec-private.h"
+#include "memmanager.h"
 #include "optimizer.h"
 #include "regcache.h"
 
@@ -13,25 +14,25 @@
 
 struct interpreter;
 
-static u32 int_CP0(struct interpreter *inter);
-static u32 int_CP2(struct interpreter *inter);
-static u32 int_SPECIAL(struct interpreter *inter);
-static u32 int_META(struct interpreter *inter);
-static u32 int_REGIMM(struct interpreter *inter);
 static u32 int_branch(struct interpreter *inter, u32 pc,
 		      union code code, bool branch);
 
 typedef u32 (*lightrec_int_func_t)(struct interpreter *inter);
 
-static const lightrec_int_func_t int_standard[64];
+static lightrec_int_func_t int_decode(union code c);
 
 struct interpreter {
 	struct lightrec_state *state;
 	struct block *block;
 	struct opcode *op;
+	/* Predecoded handlers of the block's opcodes, or NULL if 'op' does not
+	 * point to the block's opcode list */
+	const lightrec_int_func_t *handlers;
 	u32 cycles;
 	bool delay_slot;
 	bool load_delay;
+	/* Set when local branches are followed by the caller's loop */
+	bool follow_loops;
 	u16 offset;
 };
 
@@ -57,7 +58,14 @@ static inline u32 execute(lightrec_int_func_t func, struct interpreter *inter)
 
 static inline u32 lightrec_int_op(struct interpreter *inter)
 {
-	return execute(int_standard[inter->op->i.op], inter);
+	lightrec_int_func_t f;
+
+	if (likely(inter->handlers))
+		f = inter->handlers[inter->offset];
+	else
+		f = int_decode(inter->op->c);
+
+	return execute(f, inter);
 }
 
 static inline u32 jump_skip(struct interpreter *inter)
@@ -269,6 +277,7 @@ static u32 int_delay_slot(struct interpreter *inter, u32 pc, bool branch)
 	}
 
 	inter2.block = inter->block;
+	inter2.handlers = inter->handlers;
 	inter2.op = op;
 	inter2.cycles = inter->cycles;
 	inter2.offset = inter->offset + 1;
@@ -315,6 +324,7 @@ static u32 int_delay_slot(struct interpreter *inter, u32 pc, bool branch)
 		new_op.flags = 0;
 		inter2.op = &new_op;
 		inter2.block = NULL;
+		inter2.handlers = NULL;
 
 		inter->cycles += lightrec_cycles_of_opcode(inter->state, op_next);
 
@@ -388,7 +398,10 @@ static u32 int_do_branch(struct interpreter *inter, u32 old_pc, u32 next_pc)
 	if (!inter->delay_slot && op_flag_local_branch(inter->op->flags) &&
 	    (s16)inter->op->c.i.imm >= 0) {
 		next_pc = old_pc + ((1 + (s16)inter->op->c.i.imm) << 2);
-		next_pc = lightrec_emulate_block(inter->state, inter->block, next_pc);
+
+		if (!inter->follow_loops)
+			next_pc = lightrec_emulate_block(inter->state,
+							 inter->block, next_pc);
 	}
 
 	return next_pc;
@@ -653,15 +666,17 @@ static u32 int_LWC2(struct interpreter *inter)
 	return int_io(inter, false);
 }
 
+static u32 int_NOP(struct interpreter *inter)
+{
+	return jump_next(inter);
+}
+
 static u32 int_special_SLL(struct interpreter *inter)
 {
 	struct opcode *op = inter->op;
-	u32 rt;
+	u32 rt = inter->state->regs.gpr[op->r.rt];
 
-	if (op->opcode) { /* Handle NOPs */
-		rt = inter->state->regs.gpr[op->r.rt];
-		inter->state->regs.gpr[op->r.rd] = rt << op->r.imm;
-	}
+	inter->state->regs.gpr[op->r.rd] = rt << op->r.imm;
 
 	return jump_next(inter);
 }
@@ -1039,8 +1054,6 @@ static u32 int_META_COM(struct interpreter *inter)
 
 static const lightrec_int_func_t int_standard[64] = {
 	SET_DEFAULT_ELM(int_standard, int_unimplemented),
-	[OP_SPECIAL]		= int_SPECIAL,
-	[OP_REGIMM]		= int_REGIMM,
 	[OP_J]			= int_J,
 	[OP_JAL]		= int_JAL,
 	[OP_BEQ]		= int_BEQ,
@@ -1055,8 +1068,6 @@ static const lightrec_int_func_t int_standard[64] = {
 	[OP_ORI]		= int_ORI,
 	[OP_XORI]		= int_XORI,
 	[OP_LUI]		= int_LUI,
-	[OP_CP0]		= int_CP0,
-	[OP_CP2]		= int_CP2,
 	[OP_LB]			= int_load,
 	[OP_LH]			= int_load,
 	[OP_LWL]		= int_load,
@@ -1072,7 +1083,6 @@ static const lightrec_int_func_t int_standard[64] = {
 	[OP_LWC2]		= int_LWC2,
 	[OP_SWC2]		= int_store,
 
-	[OP_META]		= int_META,
 	[OP_META_MULT2]		= int_META_MULT2,
 	[OP_META_MULTU2]	= int_META_MULT2,
 	[OP_META_LWU]		= int_load,
@@ -1144,84 +1154,140 @@ static const lightrec_int_func_t int_meta[64] = {
 	[OP_META_COM]		= int_META_COM,
 };
 
-static u32 int_SPECIAL(struct interpreter *inter)
+static lightrec_int_func_t int_decode(union code c)
 {
-	lightrec_int_func_t f = int_special[inter->op->r.op];
+	lightrec_int_func_t f;
 
-	if (!HAS_DEFAULT_ELM && unlikely(!f))
-		return int_unimplemented(inter);
+	switch (c.i.op) {
+	case OP_SPECIAL:
+		/* Handle NOPs */
+		if (!c.opcode)
+			return int_NOP;
 
-	return execute(f, inter);
-}
+		f = int_special[c.r.op];
+		break;
+	case OP_REGIMM:
+		f = int_regimm[c.r.rt];
+		break;
+	case OP_CP0:
+		f = int_cp0[c.r.rs];
+		if (!HAS_DEFAULT_ELM && unlikely(!f))
+			return int_CP;
+		break;
+	case OP_CP2:
+		if (c.r.op != OP_CP2_BASIC)
+			return int_CP;
 
-static u32 int_REGIMM(struct interpreter *inter)
-{
-	lightrec_int_func_t f = int_regimm[inter->op->r.rt];
+		f = int_cp2_basic[c.r.rs];
+		if (!HAS_DEFAULT_ELM && unlikely(!f))
+			return int_CP;
+		break;
+	case OP_META:
+		f = int_meta[c.m.op];
+		break;
+	default:
+		f = int_standard[c.i.op];
+		break;
+	}
 
 	if (!HAS_DEFAULT_ELM && unlikely(!f))
-		return int_unimplemented(inter);
+		return int_unimplemented;
 
-	return execute(f, inter);
+	return f;
 }
 
-static u32 int_CP0(struct interpreter *inter)
+static void lightrec_predecode_ops(lightrec_int_func_t *handlers,
+				   const struct opcode *list,
+				   unsigned int nb_ops)
 {
-	lightrec_int_func_t f = int_cp0[inter->op->r.rs];
+	unsigned int i;
 
-	if (!HAS_DEFAULT_ELM && unlikely(!f))
-		return int_CP(inter);
-
-	return execute(f, inter);
+	for (i = 0; i < nb_ops; i++)
+		handlers[i] = int_decode(list[i].c);
 }
 
-static u32 int_CP2(struct interpreter *inter)
+static const lightrec_int_func_t *
+lightrec_get_handlers(struct lightrec_state *state, struct opcode *ops)
 {
-	if (inter->op->r.op == OP_CP2_BASIC) {
-		lightrec_int_func_t f = int_cp2_basic[inter->op->r.rs];
-		if (HAS_DEFAULT_ELM || likely(f))
-			return execute(f, inter);
+	struct opcode_list *list = container_of(ops, struct opcode_list, ops);
+
+	/* Resolve the handler of each opcode once, the first time the block
+	 * is interpreted, so that the interpreter does not have to go through
+	 * the opcode tables every time it runs the block. */
+	if (unlikely(!list->handlers)) {
+		list->handlers = lightrec_malloc(state, MEM_FOR_IR,
+						 list->nb_ops * sizeof(*list->handlers));
+		if (!list->handlers)
+			return NULL;
+
+		lightrec_predecode_ops(list->handlers, list->ops, list->nb_ops);
 	}
 
-	return int_CP(inter);
+	return list->handlers;
 }
 
-static u32 int_META(struct interpreter *inter)
+static bool int_follow_branch(const struct interpreter *inter, u32 pc)
 {
-	lightrec_int_func_t f = int_meta[inter->op->m.op];
+	const struct lightrec_state *state = inter->state;
+	const struct opcode *op = inter->op;
+	s16 imm = (s16)op->c.i.imm;
 
-	if (!HAS_DEFAULT_ELM && unlikely(!f))
-		return int_unimplemented(inter);
+	if (inter->delay_slot || !op_flag_local_branch(op->flags)
+	    || op_flag_emulate_branch(op->flags)
+	    || pc != int_get_branch_pc(inter) + 4 + (imm << 2))
+		return false;
 
-	return execute(f, inter);
+	/* Taken backward branches are followed as long as the block is still
+	 * interpreted and the target cycle has not been reached, like the
+	 * generated code would do. */
+	return imm >= 0 || (state->current_cycle < state->target_cycle
+			    && !inter->block->function);
 }
 
 static u32 lightrec_emulate_block_list(struct lightrec_state *state,
-				       struct block *block, u32 offset)
+				       struct block *block, u32 offset,
+				       bool follow_loops)
 {
+	/* The compiler thread may swap in a rewritten opcode list, so use the
+	 * same one (and its handlers) until the end */
+	struct opcode *ops = block->opcode_list;
 	struct interpreter inter = {
 		.block = block,
 		.state = state,
 		.offset = offset,
-		.op = &block->opcode_list[offset],
+		.op = &ops[offset],
+		.handlers = lightrec_get_handlers(state, ops),
+		.follow_loops = follow_loops,
 	};
 	u32 pc;
 
-	pc = lightrec_int_op(&inter);
+	atomic_thread_fence(memory_order_acquire);
 
-	/* Add the cycles of the last branch */
-	inter.cycles += lightrec_cycles_of_opcode(inter.state, inter.op->c);
+	for (;;) {
+		pc = lightrec_int_op(&inter);
 
-	state->current_cycle += inter.cycles;
+		/* Add the cycles of the last branch */
+		inter.cycles += lightrec_cycles_of_opcode(inter.state, inter.op->c);
 
-	return pc;
+		state->current_cycle += inter.cycles;
+
+		if (!follow_loops || !int_follow_branch(&inter, pc))
+			return pc;
+
+		inter.offset = (kunseg(pc) - kunseg(block->pc)) >> 2;
+		inter.op = &ops[inter.offset];
+		inter.cycles = 0;
+	}
 }
 
-u32 lightrec_emulate_block(struct lightrec_state *state, struct block *block, u32 pc)
+static u32 int_emulate_block(struct lightrec_state *state, struct block *block,
+			     u32 pc, bool follow_loops)
 {
 	u32 offset = (kunseg(pc) - kunseg(block->pc)) >> 2;
 
 	if (offset < block->nb_ops)
-		return lightrec_emulate_block_list(state, block, offset);
+		return lightrec_emulate_block_list(state, block, offset,
+						   follow_loops);
 
 	pr_err(PC_FMT" is outside block at "PC_FMT"\n", pc, block->pc);
 
@@ -1230,6 +1296,17 @@ u32 lightrec_emulate_block(struct lightrec_state *state, struct block *block, u3
 	return 0;
 }
 
+u32 lightrec_emulate_block(struct lightrec_state *state, struct block *block, u32 pc)
+{
+	return int_emulate_block(state, block, pc, false);
+}
+
+u32 lightrec_emulate_block_loops(struct lightrec_state *state,
+				 struct block *block, u32 pc)
+{
+	return int_emulate_block(state, block, pc, true);
+}
+
 static u32 branch_get_next_pc(struct lightrec_state *state, union code c, u32 pc)
 {
 	switch (c.i.op) {
@@ -11,6 +11,8 @@
 struct block;
 
 u32 lightrec_emulate_block(struct lightrec_state *state, struct block *block, u32 pc);
+u32 lightrec_emulate_block_loops(struct lightrec_state *state,
+				 struct block *block, u32 pc);
 u32 lightrec_handle_load_delay(struct lightrec_state *state,
 			       struct block *block, u32 pc, u32 reg);
 
@@ -90,6 +90,13 @@
 
 #define CODE_LUT_SIZE	((RAM_SIZE + BIOS_SIZE) >> 2)
 
+/* Granularity of the tracking of RAM pages that contain code */
+#define CODE_PAGE_SHIFT	12
+#define NB_CODE_PAGES	(RAM_SIZE >> CODE_PAGE_SHIFT)
+
+/* Maximum number of I/O handlers registered by the frontend */
+#define NB_HW_HANDLERS	32
+
 #define REG_LO 32
 #define REG_HI 33
 #define REG_TEMP (offsetof(struct lightrec_state, temp_reg) / sizeof(u32))
@@ -100,6 +107,7 @@ struct jit_state;
 typedef struct jit_state jit_state_t;
 
 struct blockcache;
+struct diskcache;
 struct recompiler;
 struct regcache;
 struct opcode;
@@ -113,12 +121,25 @@ struct u16x2 {
 #endif
 };
 
+struct block_profile {
+	/* Updated by the generated code: number of times the block was
+	 * entered, and cycles spent looping back through local branches */
+	u64 exec_count;
+	u64 loop_cycles;
+	/* Emulated cycles of one full pass through the block */
+	u32 cycles;
+	u32 compile_time_us;
+	u32 nb_compiles;
+	/* Register stores skipped at the exits, as the next block overwrites
+	 * the registers */
+	u32 skipped_stores;
+};
+
 struct block {
 	jit_state_t *_jit;
 	struct opcode *opcode_list;
 	void (*function)(void);
 	const u32 *code;
-	struct block *next;
 	u32 pc;
 	u32 hash;
 	u32 precompile_date;
@@ -126,8 +147,34 @@ struct block {
 	u16 nb_ops;
 #if ENABLE_THREADED_COMPILER
 	_Atomic u8 flags;
+	struct block_rec *block_rec;
 #else
 	u8 flags;
+#endif
+	/* Number of code buffer evictions survived while in use */
+	u8 heat;
+	/* Set by the generated code when the block runs, cleared when the code
+	 * buffer is cleaned */
+	u8 ran;
+	/* Set once the block has been recompiled as a hot block */
+	_Bool is_hot;
+	/* Entries left before the block is recompiled as a hot block;
+	 * decremented by the generated code */
+	u16 hot_count;
+	/* Set when the block did not become hot in time; it stops counting
+	 * and is never recompiled as a hot block */
+	_Bool hot_expired;
+	/* Set when the block assumed the register usage of a block that has
+	 * been invalidated since */
+	_Bool dep_outdated;
+	/* Block whose register usage is assumed by this one's exits, and link
+	 * in the list of the blocks that depend on it */
+	struct block *dep;
+	struct block *dep_next;
+	/* List of the blocks that assume this one's register usage */
+	struct block *dependents;
+#if ENABLE_PROFILER
+	struct block_profile profile;
 #endif
 };
 
@@ -147,6 +194,7 @@ enum c_wrappers {
 	C_WRAPPER_MFC,
 	C_WRAPPER_MTC,
 	C_WRAPPER_CP,
+	C_WRAPPER_HW_CALL,
 	C_WRAPPERS_COUNT,
 };
 
@@ -163,6 +211,15 @@ struct lightrec_cstate {
 	struct regcache *reg_cache;
 
 	_Bool no_load_delay;
+
+	/* Only updated by the thread owning this compile state */
+	unsigned int nb_compile;
+	u64 compile_time_us;
+};
+
+struct lightrec_hw_handler {
+	u32 kaddr, length;
+	const struct lightrec_mem_map_ops *ops;
 };
 
 struct lightrec_state {
@@ -176,11 +233,14 @@ struct lightrec_state {
 	u32 target_cycle;
 	u32 exit_flags;
 	u32 old_cycle_counter;
+	u32 hot_window;
 	u32 cycles_per_op;
 	void *c_wrapper;
 	struct block *dispatcher, *c_wrapper_block;
 	void *c_wrappers[C_WRAPPERS_COUNT];
+	const struct lightrec_mem_map_ops *hw_call_ops;
 	struct blockcache *block_cache;
+	struct diskcache *disk_cache;
 	struct recompiler *rec;
 	struct lightrec_cstate *cstate;
 	struct reaper *reaper;
@@ -192,13 +252,19 @@ struct lightrec_state {
 	void (*get_next_block)(void);
 	struct lightrec_ops ops;
 	unsigned int nb_precompile;
-	unsigned int nb_compile;
+	unsigned int nb_execute;
+	unsigned int nb_lookups;
+	u32 nb_dispatch;
 	unsigned int nb_maps;
 	const struct lightrec_mem_map *maps;
 	uintptr_t offset_ram, offset_bios, offset_scratch, offset_io;
 	u32 opt_flags;
+	struct lightrec_hw_handler hw_handlers[NB_HW_HANDLERS];
+	unsigned int nb_hw_handlers;
 	_Bool with_32bit_lut;
 	_Bool mirrors_mapped;
+	/* Non-zero if the code LUT entries of the RAM page may be non-NULL */
+	u8 code_pages[NB_CODE_PAGES];
 	void *code_lut[];
 };
 
@@ -269,6 +335,11 @@ static inline void lut_write(struct lightrec_state *state, u32 offset, void *ptr
 {
 	void **lut_entry = lut_address(state, offset);
 
+	/* Flag the page before the entry is written, as it may be
+	 * invalidated concurrently */
+	if (ptr && offset < (RAM_SIZE >> 2))
+		state->code_pages[offset >> (CODE_PAGE_SHIFT - 2)] = 1;
+
 	if (lut_is_32bit(state))
 		*(u32 *) lut_entry = (u32)(uintptr_t) ptr;
 	else
@@ -307,8 +378,11 @@ int lightrec_compile_block(struct lightrec_cstate *cstate, struct block *block);
 void lightrec_free_opcode_list(struct lightrec_state *state,
 			       struct opcode *list);
 
-unsigned int lightrec_cycles_of_opcode(const struct lightrec_state *state,
-				       union code code);
+static inline unsigned int
+lightrec_cycles_of_opcode(const struct lightrec_state *state, union code code)
+{
+	return state->cycles_per_op;
+}
 
 static inline u8 get_mult_div_lo(union code c)
 {
@@ -362,6 +436,14 @@ static inline u8 block_clear_flags(struct block *block, u8 mask)
 #endif
 }
 
+static inline _Bool block_can_free_opcode_list(const struct block *block)
+{
+	/* The profiler needs the opcode list to disassemble the block, and
+	 * the blocks that may still become hot need it to be recompiled */
+	return !ENABLE_PROFILER && (!OPT_OPTIMIZE_HOT_BLOCKS || block->is_hot
+				    || block->hot_expired);
+}
+
 static inline _Bool can_sign_extend(s32 value, u8 order)
 {
       return ((u32)(value >> (order - 1)) + 1) < 2;
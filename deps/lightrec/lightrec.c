@@ -7,6 +7,7 @@
 #include "blockcache.h"
 #include "debug.h"
 #include "disassembler.h"
+#include "diskcache.h"
 #include "emitter.h"
 #include "interpreter.h"
 #include "lightrec-config.h"
@@ -17,6 +18,7 @@
 #include "recompiler.h"
 #include "regcache.h"
 #include "optimizer.h"
+#include "profiler.h"
 #include "tlsf/tlsf.h"
 
 #include <errno.h>
@@ -28,6 +30,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
 
 static struct block * lightrec_precompile_block(struct lightrec_state *state,
 						u32 pc);
@@ -215,13 +218,42 @@ static void lightrec_lwc2(struct lightrec_state *state, union code op,
 	lightrec_mtc2(state, op.i.rt, data);
 }
 
+static void lightrec_invalidate_ram(struct lightrec_state *state,
+				    u32 addr, u32 len)
+{
+	u32 start = lut_offset(addr), end = start + (len + 3) / 4;
+	u32 page, page_start, page_end;
+
+	if (end > RAM_SIZE >> 2)
+		end = RAM_SIZE >> 2;
+
+	/* Only clear the LUT entries of the pages that may contain code */
+	for (; start < end; start = page_end) {
+		page = start >> (CODE_PAGE_SHIFT - 2);
+		page_start = page << (CODE_PAGE_SHIFT - 2);
+		page_end = page_start + (1 << (CODE_PAGE_SHIFT - 2));
+
+		if (!state->code_pages[page])
+			continue;
+
+		if (start == page_start && end >= page_end) {
+			/* The whole page is cleared - no entry will be left.
+			 * Clear the flag before the entries, as the threaded
+			 * compiler may write new ones at any time. */
+			state->code_pages[page] = 0;
+		}
+
+		memset(lut_address(state, start), 0,
+		       ((end < page_end ? end : page_end) - start)
+		       * lut_elm_size(state));
+	}
+}
+
 static void lightrec_invalidate_map(struct lightrec_state *state,
 		const struct lightrec_mem_map *map, u32 addr, u32 len)
 {
-	if (map == &state->maps[PSX_MAP_KERNEL_USER_RAM]) {
-		memset(lut_address(state, lut_offset(addr)), 0,
-		       ((len + 3) / 4) * lut_elm_size(state));
-	}
+	if (map == &state->maps[PSX_MAP_KERNEL_USER_RAM])
+		lightrec_invalidate_ram(state, addr, len);
 }
 
 static enum psx_map
@@ -368,13 +400,9 @@ u32 lightrec_rw(struct lightrec_state *state, union code op, u32 base,
 	}
 }
 
-static void lightrec_rw_helper(struct lightrec_state *state,
-			       union code op, u32 *flags,
-			       struct block *block, u16 offset)
+static void lightrec_rw_set_result(struct lightrec_state *state,
+				  union code op, u32 ret)
 {
-	u32 ret = lightrec_rw(state, op, state->regs.gpr[op.i.rs],
-			      state->regs.gpr[op.i.rt], flags, block, offset);
-
 	switch (op.i.op) {
 	case OP_LB:
 	case OP_LBU:
@@ -396,6 +424,16 @@ static void lightrec_rw_helper(struct lightrec_state *state,
 	}
 }
 
+static void lightrec_rw_helper(struct lightrec_state *state,
+			       union code op, u32 *flags,
+			       struct block *block, u16 offset)
+{
+	u32 ret = lightrec_rw(state, op, state->regs.gpr[op.i.rs],
+			      state->regs.gpr[op.i.rt], flags, block, offset);
+
+	lightrec_rw_set_result(state, op, ret);
+}
+
 static void lightrec_rw_cb(struct lightrec_state *state, u32 arg)
 {
 	lightrec_rw_helper(state, (union code) arg, NULL, NULL, 0);
@@ -417,9 +455,61 @@ static void lightrec_rw_generic_cb(struct lightrec_state *state, u32 arg)
 	}
 
 	op = &block->opcode_list[offset];
+
+	if (unlikely(!opcode_is_io(op->c))) {
+		/* The code that called us was compiled before the opcode list
+		 * was rewritten for a hot block; run the original opcode */
+		lightrec_rw_helper(state, lightrec_read_opcode(state,
+					block->pc + (offset << 2)),
+				   NULL, block, offset);
+		return;
+	}
+
 	lightrec_rw_helper(state, op->c, &op->flags, block, offset);
 }
 
+static void lightrec_hw_call_cb(struct lightrec_state *state, u32 arg)
+{
+	const struct lightrec_mem_map_ops *ops = state->hw_call_ops;
+	union code op = (union code) arg;
+	u32 data = state->regs.gpr[op.i.rt];
+	u32 addr, ret;
+
+	/* The handler for this address was selected at compile time, so
+	 * there is no need to look up the memory map. */
+	addr = kunseg(state->regs.gpr[op.i.rs] + (s16) op.i.imm);
+
+	switch (op.i.op) {
+	case OP_SB:
+		ops->sb(state, arg, NULL, addr, data);
+		return;
+	case OP_SH:
+		ops->sh(state, arg, NULL, addr, data);
+		return;
+	case OP_SW:
+		ops->sw(state, arg, NULL, addr, data);
+		return;
+	case OP_LB:
+		ret = (s32) (s8) ops->lb(state, arg, NULL, addr);
+		break;
+	case OP_LBU:
+		ret = ops->lb(state, arg, NULL, addr);
+		break;
+	case OP_LH:
+		ret = (s32) (s16) ops->lh(state, arg, NULL, addr);
+		break;
+	case OP_LHU:
+		ret = ops->lh(state, arg, NULL, addr);
+		break;
+	case OP_LW:
+	default:
+		ret = ops->lw(state, arg, NULL, addr);
+		break;
+	}
+
+	lightrec_rw_set_result(state, op, ret);
+}
+
 static u32 clamp_s32(s32 val, s32 min, s32 max)
 {
 	return val < min ? min : val > max ? max : val;
@@ -719,7 +809,11 @@ static struct block * lightrec_get_block(struct lightrec_state *state, u32 pc)
 			return NULL;
 		}
 
-		lightrec_register_block(state->block_cache, block);
+		if (lightrec_register_block(state->block_cache, block)) {
+			lightrec_free_block(state, block);
+			lightrec_set_exit_flags(state, LIGHTREC_EXIT_NOMEM);
+			return NULL;
+		}
 	}
 
 	return block;
@@ -732,6 +826,8 @@ static void * get_next_block_func(struct lightrec_state *state, u32 pc)
 	void *func;
 	int err;
 
+	state->nb_lookups++;
+
 	do {
 		func = lut_read(state, lut_offset(pc));
 		if (func && func != state->get_next_block)
@@ -748,6 +844,12 @@ static void * get_next_block_func(struct lightrec_state *state, u32 pc)
 			break;
 		}
 
+		if (OPT_OPTIMIZE_HOT_BLOCKS && !block->hot_count &&
+		    !block->is_hot && !block->hot_expired && block->function) {
+			pr_debug("Block at "PC_FMT" is hot\n", pc);
+			block_set_flags(block, BLOCK_SHOULD_RECOMPILE);
+		}
+
 		should_recompile = block_has_flag(block, BLOCK_SHOULD_RECOMPILE) &&
 			!block_has_flag(block, BLOCK_NEVER_COMPILE) &&
 			!block_has_flag(block, BLOCK_IS_DEAD);
@@ -775,7 +877,7 @@ static void * get_next_block_func(struct lightrec_state *state, u32 pc)
 			break;
 
 		if (unlikely(block_has_flag(block, BLOCK_NEVER_COMPILE))) {
-			pc = lightrec_emulate_block(state, block, pc);
+			pc = lightrec_emulate_block_loops(state, block, pc);
 
 		} else if (!ENABLE_THREADED_COMPILER) {
 			/* Block wasn't compiled yet - run the interpreter */
@@ -850,6 +952,39 @@ static void lightrec_free_code(struct lightrec_state *state, void *ptr)
 		lightrec_code_alloc_unlock(state);
 }
 
+static void lightrec_code_walker(void *ptr, size_t size, int used, void *d)
+{
+	size_t *free_size = d;
+
+	if (!used) {
+		free_size[0] += size;
+		if (size > free_size[1])
+			free_size[1] = size;
+	}
+}
+
+static u32 lightrec_get_code_fragmentation(struct lightrec_state *state)
+{
+	size_t free_size[2] = { 0, 0 }; /* Total and largest free chunk */
+
+	if (!ENABLE_CODE_BUFFER || !state->tlsf)
+		return 0;
+
+	if (ENABLE_THREADED_COMPILER)
+		lightrec_code_alloc_lock(state);
+
+	tlsf_walk_pool(tlsf_get_pool(state->tlsf),
+		       lightrec_code_walker, free_size);
+
+	if (ENABLE_THREADED_COMPILER)
+		lightrec_code_alloc_unlock(state);
+
+	if (!free_size[0])
+		return 0;
+
+	return 100 - (u32)(free_size[1] * 100 / free_size[0]);
+}
+
 static char lightning_code_data[0x80000];
 
 static void * lightrec_emit_code(struct lightrec_state *state,
@@ -887,12 +1022,18 @@ static void * lightrec_emit_code(struct lightrec_state *state,
 				return NULL;
 			}
 
-			/* Remove outdated blocks, and try again */
+			/* Evict outdated and cold blocks, and try again */
 			lightrec_remove_outdated_blocks(state->block_cache, block);
 
 			pr_debug("Re-try to alloc %zu bytes...\n", code_size);
 
 			code = lightrec_alloc_code(state, code_size);
+			if (!code) {
+				/* The free space is too fragmented; flush
+				 * everything but the current block. */
+				lightrec_evict_all_blocks(state->block_cache, block);
+				code = lightrec_alloc_code(state, code_size);
+			}
 			if (!code) {
 				pr_err("Could not alloc even after removing old blocks!\n");
 				return NULL;
@@ -1144,6 +1285,13 @@ static struct block * generate_dispatcher(struct lightrec_state *state)
 
 	loop2 = jit_label();
 
+#if ENABLE_PROFILER
+	/* Count the entries from the blocks, chained jumps do not get here */
+	jit_ldxi_ui(JIT_R2, LIGHTREC_REG_STATE, lightrec_offset(nb_dispatch));
+	jit_addi(JIT_R2, JIT_R2, 1);
+	jit_stxi_i(lightrec_offset(nb_dispatch), LIGHTREC_REG_STATE, JIT_R2);
+#endif
+
 	/* Jump to end if state->target_cycle < state->current_cycle */
 	to_end = jit_blei(LIGHTREC_REG_CYCLE, 0);
 
@@ -1336,37 +1484,114 @@ union code lightrec_read_opcode(struct lightrec_state *state, u32 pc)
 	return (union code) LE32TOH(*code);
 }
 
-unsigned int lightrec_cycles_of_opcode(const struct lightrec_state *state,
-				       union code code)
-{
-	return state->cycles_per_op;
-}
-
 void lightrec_free_opcode_list(struct lightrec_state *state, struct opcode *ops)
 {
 	struct opcode_list *list = container_of(ops, struct opcode_list, ops);
 
+	if (list->handlers)
+		lightrec_free(state, MEM_FOR_IR,
+			      list->nb_ops * sizeof(*list->handlers),
+			      list->handlers);
+
 	lightrec_free(state, MEM_FOR_IR,
 		      sizeof(*list) + list->nb_ops * sizeof(struct opcode),
 		      list);
 }
 
+/* Number of entries after which a block is recompiled as a hot block */
+#define BLOCK_HOT_ENTRIES	1024
+
+/* Cycles (about one second) in which a block must reach BLOCK_HOT_ENTRIES
+ * entries to be recompiled as a hot block */
+#define BLOCK_HOT_WINDOW	(1 << 25)
+
+/* Maximum number of opcodes skipped by a forward jump that can be merged */
+#define BLOCK_MERGE_MAX_SKIP	32
+
+static bool lightrec_ends_block(union code c)
+{
+	return is_syscall(c) || c.i.op == OP_META_BIOS || is_unconditional_jump(c);
+}
+
+/*
+ * Check whether the unconditional jump at index 'idx' is the end of the "then"
+ * side of an if/else construct, that can be merged with the rest of the code
+ * into one single block. In that case, return the index of the target opcode.
+ */
+static unsigned int lightrec_get_merged_jump_target(const u32 *src,
+						    unsigned int idx)
+{
+	unsigned int i, target;
+	union code c, ds;
+	s32 offset;
+
+	c.opcode = LE32TOH(src[idx]);
+	ds.opcode = LE32TOH(src[idx + 1]);
+
+	/* Only handle relative branches, and not BAL */
+	if (c.i.op != OP_BEQ && c.i.op != OP_BLEZ
+	    && (c.i.op != OP_REGIMM || c.r.rt != OP_REGIMM_BGEZ))
+		return 0;
+
+	if ((s16)c.i.imm <= 1 || (s16)c.i.imm > BLOCK_MERGE_MAX_SKIP
+	    || has_delay_slot(ds))
+		return 0;
+
+	target = idx + 1 + (s16)c.i.imm;
+
+	/* The skipped opcodes must not end the block, and the target opcode
+	 * must not be in a delay slot */
+	for (i = idx + 2; i < target; i++) {
+		c.opcode = LE32TOH(src[i]);
+
+		if (lightrec_ends_block(c))
+			return 0;
+	}
+
+	if (has_delay_slot(c))
+		return 0;
+
+	/* The skipped opcodes must be the target of a conditional branch
+	 * located before the jump, otherwise they might not even be code */
+	for (i = 0; i < idx; i++) {
+		c.opcode = LE32TOH(src[i]);
+
+		if (!has_delay_slot(c) || c.i.op == OP_J || c.i.op == OP_JAL
+		    || c.i.op == OP_SPECIAL)
+			continue;
+
+		offset = i + 1 + (s16)c.i.imm;
+		if (offset >= (s32)idx + 2 && offset < (s32)target)
+			return target;
+	}
+
+	return 0;
+}
+
 static unsigned int lightrec_get_mips_block_len(const u32 *src)
 {
-	unsigned int i;
+	unsigned int i, target;
 	union code c;
 
-	for (i = 1; ; i++) {
-		c.opcode = LE32TOH(*src++);
+	for (i = 0; ; i++) {
+		c.opcode = LE32TOH(src[i]);
 
 		if (is_syscall(c))
-			return i;
+			return i + 1;
 
 		if (c.i.op == OP_META_BIOS)
-			return i;
-
-		if (is_unconditional_jump(c))
 			return i + 1;
+
+		if (is_unconditional_jump(c)) {
+			target = OPT_EXTEND_BLOCKS ?
+				lightrec_get_merged_jump_target(src, i) : 0;
+			if (!target)
+				return i + 2;
+
+			/* Continue the block at the jump target. The jump
+			 * will then be handled as a local branch. */
+			i = target - 1;
+		}
 	}
 }
 
@@ -1386,6 +1611,7 @@ static struct opcode * lightrec_disassemble(struct lightrec_state *state,
 	}
 
 	list->nb_ops = (u16) length;
+	list->handlers = NULL;
 
 	for (i = 0; i < length; i++) {
 		list->ops[i].opcode = LE32TOH(src[i]);
@@ -1429,11 +1655,25 @@ static struct block * lightrec_precompile_block(struct lightrec_state *state,
 	block->function = NULL;
 	block->opcode_list = list;
 	block->code = code;
-	block->next = NULL;
 	block->flags = 0;
+	block->heat = 0;
+	block->ran = 1;
+	block->is_hot = false;
+	block->hot_count = BLOCK_HOT_ENTRIES;
+	block->hot_expired = false;
+	block->dep_outdated = false;
+	block->dep = NULL;
+	block->dep_next = NULL;
+	block->dependents = NULL;
+#if ENABLE_THREADED_COMPILER
+	block->block_rec = NULL;
+#endif
 	block->code_size = 0;
 	block->precompile_date = state->current_cycle;
 	block->nb_ops = length / sizeof(u32);
+#if ENABLE_PROFILER
+	memset(&block->profile, 0, sizeof(block->profile));
+#endif
 
 	lightrec_optimize(state, block);
 
@@ -1448,6 +1688,12 @@ static struct block * lightrec_precompile_block(struct lightrec_state *state,
 
 	pr_debug("Block size: %hu opcodes\n", block->nb_ops);
 
+	block->hash = lightrec_calculate_block_hash(block);
+
+	/* Restore the I/O modes profiled during a previous session */
+	if (state->disk_cache)
+		lightrec_diskcache_apply(state->disk_cache, block);
+
 	fully_tagged = lightrec_block_is_fully_tagged(block);
 	if (fully_tagged)
 		block_flags |= BLOCK_FULLY_TAGGED;
@@ -1455,15 +1701,14 @@ static struct block * lightrec_precompile_block(struct lightrec_state *state,
 	if (block_flags)
 		block_set_flags(block, block_flags);
 
-	block->hash = lightrec_calculate_block_hash(block);
-
 	if (OPT_REPLACE_MEMSET && block_has_flag(block, BLOCK_IS_MEMSET))
 		addr = state->memset_func;
 	else
 		addr = state->get_next_block;
 	lut_write(state, lut_offset(pc), addr);
 
-	pr_debug("Blocks created: %u\n", ++state->nb_precompile);
+	state->nb_precompile++;
+	pr_debug("Blocks created: %u\n", state->nb_precompile);
 
 	return block;
 }
@@ -1543,16 +1788,56 @@ static void lightrec_reap_opcode_list(struct lightrec_state *state, void *data)
 	lightrec_free_opcode_list(state, data);
 }
 
+static void lightrec_swap_opcode_list(struct lightrec_state *state,
+				      struct block *block, struct opcode *list)
+{
+	struct opcode *old_list = block->opcode_list;
+
+	/* The interpreter and the C wrappers that already got the old list
+	 * keep using it until they return to the main loop, so let the reaper
+	 * free it. The rewritten opcodes compute the same values, so both
+	 * lists can be used with the old and the new code. */
+	atomic_thread_fence(memory_order_release);
+	block->opcode_list = list;
+
+	if (ENABLE_THREADED_COMPILER) {
+		lightrec_reaper_add(state->reaper,
+				    lightrec_reap_opcode_list, old_list);
+	} else {
+		lightrec_free_opcode_list(state, old_list);
+	}
+}
+
+static u64 lightrec_get_time_us(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#elif defined(TIME_UTC)
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return 0;
+#endif
+}
+
 int lightrec_compile_block(struct lightrec_cstate *cstate,
 			   struct block *block)
 {
+	u64 compile_time, start_time = lightrec_get_time_us();
 	struct block *dead_blocks[ARRAY_SIZE(cstate->targets)];
 	u32 was_dead[ARRAY_SIZE(cstate->targets) / 8];
 	struct lightrec_state *state = cstate->state;
 	struct lightrec_branch_target *target;
-	bool fully_tagged = false;
+	bool fully_tagged = false, hot;
 	struct block *block2;
-	struct opcode *elm;
+	struct opcode *elm, *list;
 	jit_state_t *_jit, *oldjit;
 	jit_node_t *start_of_block;
 	bool skip_next = false;
@@ -1562,6 +1847,18 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 	u8 old_flags;
 	u32 offset;
 
+	/* Record the I/O modes of the original opcodes: in the list of a hot
+	 * block, the loads that were forwarded or removed lost theirs */
+	if (state->disk_cache && !block->is_hot)
+		lightrec_diskcache_record(state->disk_cache, block);
+
+	hot = OPT_OPTIMIZE_HOT_BLOCKS && !block->hot_count && !block->hot_expired;
+	if (hot) {
+		list = lightrec_optimize_hot_block(state, block);
+		if (list)
+			lightrec_swap_opcode_list(state, block, list);
+	}
+
 	fully_tagged = lightrec_block_is_fully_tagged(block);
 	if (fully_tagged)
 		block_set_flags(block, BLOCK_FULLY_TAGGED);
@@ -1591,6 +1888,18 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 	jit_prolog();
 	jit_tramp(256);
 
+#if ENABLE_PROFILER
+	/* Before the label, so that loops back to the first opcode are not
+	 * counted as new executions */
+	lightrec_emit_profile_entry(cstate, block);
+	block->profile.skipped_stores = 0;
+#endif
+
+	lightrec_emit_ran_flag(cstate, block);
+
+	if (OPT_OPTIMIZE_HOT_BLOCKS && !hot && !block->hot_expired)
+		lightrec_emit_hot_counter(cstate, block);
+
 	start_of_block = jit_label();
 
 	for (i = 0; i < block->nb_ops; i++) {
@@ -1664,6 +1973,7 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 		lightrec_reaper_pause(state->reaper);
 
 	block->function = new_fn;
+	block->is_hot = hot;
 	block_clear_flags(block, BLOCK_SHOULD_RECOMPILE);
 
 	/* Add compiled function to the LUT */
@@ -1691,6 +2001,12 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 				was_dead[i / 32] |= BIT(i % 32);
 			else
 				was_dead[i / 32] &= ~BIT(i % 32);
+
+			/* The blocks that depend on block2 must be invalidated
+			 * before the LUT entry is overridden */
+			if (OPT_SKIP_DEAD_STORES)
+				lightrec_drop_dependents(state->block_cache,
+							 block2);
 		}
 
 		dead_blocks[i] = block2;
@@ -1735,6 +2051,9 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 		}
 	}
 
+	if (OPT_SKIP_DEAD_STORES)
+		lightrec_validate_deps(state->block_cache, block);
+
 	if (ENABLE_THREADED_COMPILER)
 		lightrec_reaper_continue(state->reaper);
 
@@ -1745,10 +2064,11 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 
 	jit_clear_state();
 
-	if (fully_tagged)
+	if (fully_tagged && block_can_free_opcode_list(block))
 		old_flags = block_set_flags(block, BLOCK_NO_OPCODE_LIST);
 
-	if (fully_tagged && !(old_flags & BLOCK_NO_OPCODE_LIST)) {
+	if (fully_tagged && block_can_free_opcode_list(block)
+	    && !(old_flags & BLOCK_NO_OPCODE_LIST)) {
 		pr_debug("Block "PC_FMT" is fully tagged"
 			 " - free opcode list\n", block->pc);
 
@@ -1778,13 +2098,28 @@ int lightrec_compile_block(struct lightrec_cstate *cstate,
 		lightrec_unregister(MEM_FOR_CODE, old_code_size);
 	}
 
-	pr_debug("Blocks compiled: %u\n", ++state->nb_compile);
+	compile_time = lightrec_get_time_us() - start_time;
+
+#if ENABLE_PROFILER
+	block->profile.cycles = 0;
+	for (i = 0; i < block->nb_ops; i++)
+		block->profile.cycles += lightrec_cycles_of_opcode(state,
+						block->opcode_list[i].c);
+	block->profile.compile_time_us += compile_time;
+	block->profile.nb_compiles++;
+#endif
+
+	cstate->nb_compile++;
+	cstate->compile_time_us += compile_time;
+	pr_debug("Blocks compiled: %u\n", cstate->nb_compile);
 
 	return 0;
 }
 
 static void lightrec_print_info(struct lightrec_state *state)
 {
+	unsigned int hits, misses;
+
 	if ((state->current_cycle & ~0xfffffff) != state->old_cycle_counter) {
 		pr_info("Lightrec RAM usage: IR %u KiB, CODE %u KiB, "
 			"MIPS %u KiB, TOTAL %u KiB, avg. IPI %f\n",
@@ -1793,10 +2128,76 @@ static void lightrec_print_info(struct lightrec_state *state)
 			lightrec_get_mem_usage(MEM_FOR_MIPS_CODE) / 1024,
 			lightrec_get_total_mem_usage() / 1024,
 		       lightrec_get_average_ipi());
+
+		if (state->disk_cache) {
+			lightrec_diskcache_get_stats(state->disk_cache,
+						     &hits, &misses);
+			pr_info("Lightrec block cache: %u hits, %u misses\n",
+				hits, misses);
+		}
+
 		state->old_cycle_counter = state->current_cycle & ~0xfffffff;
 	}
 }
 
+/*
+ * The blocks that did not become hot within BLOCK_HOT_WINDOW cycles of their
+ * creation stop counting their entries: a zero counter is skipped by the
+ * generated code. They no longer need their opcode list to be recompiled as
+ * hot blocks, so it is freed when the block is fully tagged, as it would be
+ * without the hot-block pass.
+ */
+static void lightrec_expire_hot_counters(struct lightrec_state *state)
+{
+	struct block **blocks, *block;
+	unsigned int i, nb;
+	u8 old_flags;
+
+	if ((state->current_cycle & ~(BLOCK_HOT_WINDOW - 1)) == state->hot_window)
+		return;
+
+	state->hot_window = state->current_cycle & ~(BLOCK_HOT_WINDOW - 1);
+
+	blocks = lightrec_get_all_blocks(state->block_cache, &nb);
+	if (!blocks)
+		return;
+
+	for (i = 0; i < nb; i++) {
+		block = blocks[i];
+
+		/* Skip the blocks that are hot, about to be, or not compiled */
+		if (!block->function || block->is_hot || block->hot_expired
+		    || !block->hot_count
+		    || block_has_flag(block, BLOCK_SHOULD_RECOMPILE | BLOCK_IS_DEAD)
+		    || state->current_cycle - block->precompile_date < BLOCK_HOT_WINDOW)
+			continue;
+
+		block->hot_expired = true;
+		block->hot_count = 0;
+
+		if (!block_can_free_opcode_list(block)
+		    || !block_has_flag(block, BLOCK_FULLY_TAGGED))
+			continue;
+
+		old_flags = block_set_flags(block, BLOCK_NO_OPCODE_LIST);
+		if (old_flags & BLOCK_NO_OPCODE_LIST)
+			continue;
+
+		pr_debug("Block "PC_FMT" did not get hot - free opcode list\n",
+			 block->pc);
+
+		if (ENABLE_THREADED_COMPILER) {
+			lightrec_reaper_add(state->reaper,
+					    lightrec_reap_opcode_list,
+					    block->opcode_list);
+		} else {
+			lightrec_free_opcode_list(state, block->opcode_list);
+		}
+	}
+
+	lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*blocks) * nb, blocks);
+}
+
 u32 lightrec_execute(struct lightrec_state *state, u32 pc, u32 target_cycle)
 {
 	s32 (*func)(struct lightrec_state *, u32, void *, s32) = (void *)state->dispatcher->function;
@@ -1804,6 +2205,7 @@ u32 lightrec_execute(struct lightrec_state *state, u32 pc, u32 target_cycle)
 	s32 cycles_delta;
 
 	state->exit_flags = LIGHTREC_EXIT_NORMAL;
+	state->nb_execute++;
 
 	/* Handle the cycle counter overflowing */
 	if (unlikely(target_cycle < state->current_cycle))
@@ -1822,6 +2224,9 @@ u32 lightrec_execute(struct lightrec_state *state, u32 pc, u32 target_cycle)
 		state->current_cycle = state->target_cycle - cycles_delta;
 	}
 
+	if (OPT_OPTIMIZE_HOT_BLOCKS)
+		lightrec_expire_hot_counters(state);
+
 	if (ENABLE_THREADED_COMPILER)
 		lightrec_reaper_reap(state->reaper);
 
@@ -1844,7 +2249,7 @@ u32 lightrec_run_interpreter(struct lightrec_state *state, u32 pc,
 		if (!block)
 			break;
 
-		pc = lightrec_emulate_block(state, block, pc);
+		pc = lightrec_emulate_block_loops(state, block, pc);
 
 		if (ENABLE_THREADED_COMPILER)
 			lightrec_reaper_reap(state->reaper);
@@ -1889,6 +2294,8 @@ struct lightrec_cstate * lightrec_create_cstate(struct lightrec_state *state)
 	}
 
 	cstate->state = state;
+	cstate->nb_compile = 0;
+	cstate->compile_time_us = 0;
 
 	return cstate;
 }
@@ -1992,6 +2399,7 @@ struct lightrec_state * lightrec_init(char *argv0,
 	state->c_wrappers[C_WRAPPER_MFC] = lightrec_mfc_cb;
 	state->c_wrappers[C_WRAPPER_MTC] = lightrec_mtc_cb;
 	state->c_wrappers[C_WRAPPER_CP] = lightrec_cp_cb;
+	state->c_wrappers[C_WRAPPER_HW_CALL] = lightrec_hw_call_cb;
 
 	map = &maps[PSX_MAP_BIOS];
 	state->offset_bios = (uintptr_t)map->address - map->pc;
@@ -2054,6 +2462,12 @@ void lightrec_destroy(struct lightrec_state *state)
 	state->current_cycle = ~state->current_cycle;
 	lightrec_print_info(state);
 
+	if (ENABLE_THREADED_COMPILER) {
+		/* Run the pending reaper jobs while the block cache is alive */
+		lightrec_recompiler_pause(state->rec);
+		lightrec_reaper_reap(state->reaper);
+	}
+
 	lightrec_free_block_cache(state->block_cache);
 	lightrec_free_block(state, state->dispatcher);
 	lightrec_free_block(state, state->c_wrapper_block);
@@ -2065,6 +2479,9 @@ void lightrec_destroy(struct lightrec_state *state)
 		lightrec_free_cstate(state->cstate);
 	}
 
+	if (state->disk_cache)
+		lightrec_free_diskcache(state->disk_cache);
+
 	finish_jit();
 	if (ENABLE_CODE_BUFFER && state->tlsf)
 		tlsf_destroy(state->tlsf);
@@ -2092,12 +2509,12 @@ void lightrec_invalidate(struct lightrec_state *state, u32 addr, u32 len)
 		return;
 	}
 
-	memset(lut_address(state, lut_offset(kaddr)), 0,
-	       ((len + 3) / 4) * lut_elm_size(state));
+	lightrec_invalidate_ram(state, kaddr, len);
 }
 
 void lightrec_invalidate_all(struct lightrec_state *state)
 {
+	memset(state->code_pages, 0, sizeof(state->code_pages));
 	memset(state->code_lut, 0, lut_elm_size(state) * CODE_LUT_SIZE);
 }
 
@@ -2109,6 +2526,57 @@ void lightrec_set_unsafe_opt_flags(struct lightrec_state *state, u32 flags)
 	state->opt_flags = flags;
 }
 
+int lightrec_register_hw_handler(struct lightrec_state *state,
+				 u32 kaddr, u32 length,
+				 const struct lightrec_mem_map_ops *ops)
+{
+	struct lightrec_hw_handler *handler;
+
+	if (!length
+	    || lightrec_get_map_idx(state, kaddr) != PSX_MAP_HW_REGISTERS
+	    || lightrec_get_map_idx(state, kaddr + length - 1) != PSX_MAP_HW_REGISTERS)
+		return -EINVAL;
+
+	if (state->nb_hw_handlers == NB_HW_HANDLERS)
+		return -ENOSPC;
+
+	handler = &state->hw_handlers[state->nb_hw_handlers++];
+	handler->kaddr = kaddr;
+	handler->length = length;
+	handler->ops = ops;
+
+	return 0;
+}
+
+int lightrec_load_block_cache(struct lightrec_state *state, const char *path)
+{
+	if (!state->disk_cache) {
+		state->disk_cache = lightrec_diskcache_init(state);
+		if (!state->disk_cache)
+			return -ENOMEM;
+	}
+
+	return lightrec_diskcache_load(state->disk_cache, path);
+}
+
+int lightrec_save_block_cache(struct lightrec_state *state, const char *path)
+{
+	if (!state->disk_cache)
+		return -EINVAL;
+
+	return lightrec_diskcache_save(state->disk_cache, path);
+}
+
+int lightrec_save_profile(struct lightrec_state *state, const char *path,
+			  enum lightrec_profile_format format)
+{
+#if ENABLE_PROFILER
+	return lightrec_profiler_save(state, path, format);
+#else
+	return -ENOSYS;
+#endif
+}
+
 void lightrec_set_exit_flags(struct lightrec_state *state, u32 flags)
 {
 	if (flags != LIGHTREC_EXIT_NORMAL) {
@@ -2150,6 +2618,36 @@ struct lightrec_registers * lightrec_get_registers(struct lightrec_state *state)
 	return &state->regs;
 }
 
+void lightrec_get_stats(struct lightrec_state *state,
+			struct lightrec_stats *stats)
+{
+	stats->nb_precompile = state->nb_precompile;
+
+	if (ENABLE_THREADED_COMPILER) {
+		lightrec_recompiler_get_stats(state->rec, &stats->nb_compile,
+					      &stats->compile_time_us);
+	} else {
+		stats->nb_compile = state->cstate->nb_compile;
+		stats->compile_time_us = state->cstate->compile_time_us;
+	}
+
+	stats->nb_execute = state->nb_execute;
+	stats->nb_lookups = state->nb_lookups;
+	stats->nb_dispatch = state->nb_dispatch;
+
+	lightrec_blockcache_get_stats(state->block_cache, &stats->nb_evictions,
+				      &stats->nb_recompiles);
+	stats->code_fragmentation = lightrec_get_code_fragmentation(state);
+
+	if (state->disk_cache) {
+		lightrec_diskcache_get_stats(state->disk_cache,
+					     &stats->nb_cache_hits,
+					     &stats->nb_cache_misses);
+	} else {
+		stats->nb_cache_hits = stats->nb_cache_misses = 0;
+	}
+}
+
 void lightrec_set_cycles_per_opcode(struct lightrec_state *state, u32 cycles)
 {
 	if (state->cycles_per_op == cycles)
@@ -123,6 +123,35 @@ struct lightrec_registers {
 	u32 cp2c[32];
 };
 
+enum lightrec_profile_format {
+	LIGHTREC_PROFILE_TEXT,
+	LIGHTREC_PROFILE_CSV,
+};
+
+struct lightrec_stats {
+	/* Number of blocks created, and number of times a block was compiled */
+	u32 nb_precompile;
+	u32 nb_compile;
+	/* Total time spent compiling blocks, in microseconds */
+	u64 compile_time_us;
+	/* Number of calls to lightrec_execute() */
+	u32 nb_execute;
+	/* Number of blocks looked up in C, outside of the dispatcher's LUT */
+	u32 nb_lookups;
+	/* Number of times the dispatcher was entered from a block; only
+	 * counted with ENABLE_PROFILER */
+	u32 nb_dispatch;
+	/* Number of blocks evicted from the code buffer, and number of evicted
+	 * blocks that had to be compiled again */
+	u32 nb_evictions;
+	u32 nb_recompiles;
+	/* Fragmentation of the free space of the code buffer, in percent */
+	u32 code_fragmentation;
+	/* Blocks found and not found in the block cache file, if loaded */
+	u32 nb_cache_hits;
+	u32 nb_cache_misses;
+};
+
 __api struct lightrec_state *lightrec_init(char *argv0,
 					   const struct lightrec_mem_map *map,
 					   size_t nb,
@@ -143,9 +172,28 @@ __api u32 lightrec_exit_flags(struct lightrec_state *state);
 
 __api void lightrec_set_unsafe_opt_flags(struct lightrec_state *state, u32 flags);
 
+/* Registers the I/O handlers called directly for the hardware registers in
+ * [kaddr, kaddr + length). With a length of 4 bytes or less, the handlers are
+ * only called for the accesses at kaddr; otherwise, for the accesses aligned
+ * to their size. The other accesses go through the memory map. */
+__api int lightrec_register_hw_handler(struct lightrec_state *state,
+				       u32 kaddr, u32 length,
+				       const struct lightrec_mem_map_ops *ops);
+
+__api int lightrec_load_block_cache(struct lightrec_state *state,
+				    const char *path);
+__api int lightrec_save_block_cache(struct lightrec_state *state,
+				    const char *path);
+
+__api int lightrec_save_profile(struct lightrec_state *state, const char *path,
+				enum lightrec_profile_format format);
+
 __api __cnst struct lightrec_registers *
 lightrec_get_registers(struct lightrec_state *state);
 
+__api void lightrec_get_stats(struct lightrec_state *state,
+			      struct lightrec_stats *stats);
+
 __api u32 lightrec_current_cycle_count(const struct lightrec_state *state);
 __api void lightrec_reset_cycle_count(struct lightrec_state *state, u32 cycles);
 __api void lightrec_set_target_cycle_count(struct lightrec_state *state,
@@ -10,6 +10,7 @@
 #include "memmanager.h"
 #include "optimizer.h"
 #include "regcache.h"
+#include "ssa.h"
 
 #include <errno.h>
 #include <stdbool.h>
@@ -1369,6 +1370,239 @@ static int lightrec_detect_impossible_branches(struct lightrec_state *state,
 	return ret;
 }
 
+static bool opcode_is_idle_loop_safe(union code c)
+{
+	switch (c.i.op) {
+	case OP_SPECIAL:
+		switch (c.r.op) {
+		case OP_SPECIAL_SLL:
+		case OP_SPECIAL_SRL:
+		case OP_SPECIAL_SRA:
+		case OP_SPECIAL_SLLV:
+		case OP_SPECIAL_SRLV:
+		case OP_SPECIAL_SRAV:
+		case OP_SPECIAL_ADD:
+		case OP_SPECIAL_ADDU:
+		case OP_SPECIAL_SUB:
+		case OP_SPECIAL_SUBU:
+		case OP_SPECIAL_AND:
+		case OP_SPECIAL_OR:
+		case OP_SPECIAL_XOR:
+		case OP_SPECIAL_NOR:
+		case OP_SPECIAL_SLT:
+		case OP_SPECIAL_SLTU:
+			return true;
+		default:
+			return false;
+		}
+	case OP_ADDI:
+	case OP_ADDIU:
+	case OP_SLTI:
+	case OP_SLTIU:
+	case OP_ANDI:
+	case OP_ORI:
+	case OP_XORI:
+	case OP_LUI:
+	case OP_META:
+		return true;
+	default:
+		return opcode_is_load(c) && c.i.op != OP_LWC2;
+	}
+}
+
+static s32 idle_loop_start(const struct block *block, unsigned int offset)
+{
+	const struct opcode *op = &block->opcode_list[offset];
+
+	return offset + 1 + (s16)op->i.imm - !!op_flag_no_ds(op->flags);
+}
+
+static int lightrec_detect_idle_loops(struct lightrec_state *state,
+				      struct block *block)
+{
+	struct opcode *op, *list = block->opcode_list;
+	unsigned int i, j, end;
+	u64 live_in, written;
+	s32 start;
+
+	for (i = 0; i < block->nb_ops; i++) {
+		op = &list[i];
+
+		switch (op->i.op) {
+		case OP_REGIMM:
+			if (op->r.rt == OP_REGIMM_BLTZAL ||
+			    op->r.rt == OP_REGIMM_BGEZAL)
+				continue;
+			fallthrough;
+		case OP_BEQ:
+		case OP_BNE:
+		case OP_BLEZ:
+		case OP_BGTZ:
+			break;
+		default:
+			continue;
+		}
+
+		if (should_emulate(op))
+			continue;
+
+		/* Only backwards branches to an opcode of this block */
+		start = idle_loop_start(block, i);
+		if (start < 0 || start > (s32)i || is_delay_slot(list, start))
+			continue;
+
+		/* The loop body, including the delay slot (if any) */
+		end = i + !op_flag_no_ds(op->flags);
+		if (end >= block->nb_ops)
+			continue;
+
+		live_in = written = 0;
+
+		for (j = start; j <= end; j++) {
+			if (j != i && !opcode_is_idle_loop_safe(list[j].c))
+				break;
+
+			live_in |= opcode_read_mask(list[j].c) & ~written;
+			written |= opcode_write_mask(list[j].c);
+		}
+
+		/*
+		 * The loop can only exit if one of the values it reads from
+		 * memory changes. It must not carry a value from one iteration
+		 * to the next (e.g. a timeout counter), or it could exit on
+		 * its own.
+		 */
+		if (j <= end || (live_in & written & ~BIT(0)))
+			continue;
+
+		pr_debug("Found idle loop at "PC_FMT"\n",
+			 block->pc + (start << 2));
+
+		op->flags |= LIGHTREC_IDLE_LOOP;
+	}
+
+	return 0;
+}
+
+bool lightrec_idle_loop_is_safe(const struct block *block, unsigned int offset)
+{
+	const struct opcode *op = &block->opcode_list[offset];
+	unsigned int i, end = offset + !op_flag_no_ds(op->flags);
+
+	/* The values read by the loop must only change when an event is
+	 * handled: RAM, BIOS and scratchpad accesses are fine, but hardware
+	 * registers may change at any cycle, or have side effects. */
+	for (i = idle_loop_start(block, offset); i <= end; i++) {
+		op = &block->opcode_list[i];
+
+		if (!opcode_is_load(op->c))
+			continue;
+
+		switch (LIGHTREC_FLAGS_GET_IO_MODE(op->flags)) {
+		case LIGHTREC_IO_DIRECT:
+		case LIGHTREC_IO_RAM:
+		case LIGHTREC_IO_BIOS:
+		case LIGHTREC_IO_SCRATCH:
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool opcode_is_dead_reg_scan_safe(union code c)
+{
+	if (c.i.op != OP_META && opcode_is_idle_loop_safe(c))
+		return true;
+
+	switch (c.i.op) {
+	case OP_SPECIAL:
+		switch (c.r.op) {
+		case OP_SPECIAL_JR:
+		case OP_SPECIAL_JALR:
+		case OP_SPECIAL_MFHI:
+		case OP_SPECIAL_MTHI:
+		case OP_SPECIAL_MFLO:
+		case OP_SPECIAL_MTLO:
+		case OP_SPECIAL_MULT:
+		case OP_SPECIAL_MULTU:
+		case OP_SPECIAL_DIV:
+		case OP_SPECIAL_DIVU:
+			return true;
+		default:
+			return false;
+		}
+	case OP_REGIMM:
+		switch (c.r.rt) {
+		case OP_REGIMM_BLTZ:
+		case OP_REGIMM_BGEZ:
+		case OP_REGIMM_BLTZAL:
+		case OP_REGIMM_BGEZAL:
+			return true;
+		default:
+			return false;
+		}
+	case OP_J:
+	case OP_JAL:
+	case OP_BEQ:
+	case OP_BNE:
+	case OP_BLEZ:
+	case OP_BGTZ:
+	case OP_SB:
+	case OP_SH:
+	case OP_SWL:
+	case OP_SW:
+	case OP_SWR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+u64 lightrec_get_dead_regs(const u32 *code, unsigned int nb_ops)
+{
+	u64 read = 0, written = 0, delayed = 0;
+	bool in_ds = false;
+	unsigned int i;
+	union code c;
+
+	/*
+	 * Scan the first basic block of the code, and return the registers
+	 * that it overwrites before reading them. The value of such registers
+	 * before the code runs does not matter.
+	 *
+	 * The scan stops at any opcode that could read the registers in some
+	 * other way (syscalls, coprocessor opcodes), and the target of a load
+	 * only counts as written after the load delay slot.
+	 */
+	for (i = 0; i < nb_ops; i++) {
+		c.opcode = LE32TOH(code[i]);
+
+		if (!opcode_is_dead_reg_scan_safe(c) ||
+		    (in_ds && has_delay_slot(c)))
+			break;
+
+		read |= opcode_read_mask(c) & ~written;
+		written |= delayed;
+
+		if (opcode_has_load_delay(c)) {
+			delayed = opcode_write_mask(c);
+		} else {
+			delayed = 0;
+			written |= opcode_write_mask(c);
+		}
+
+		if (in_ds)
+			break;
+
+		in_ds = has_delay_slot(c);
+	}
+
+	return written & ~read & ~BIT(0);
+}
+
 static bool is_local_branch(const struct block *block, unsigned int idx)
 {
 	const struct opcode *op = &block->opcode_list[idx];
@@ -1606,6 +1840,44 @@ lightrec_early_unload_sync(struct opcode *list, s16 *last_r, s16 *last_w)
 	memset(last_w, 0xff, sizeof(*last_w) * 34);
 }
 
+static u64 lightrec_get_exit_dead_regs(struct lightrec_state *state,
+				       const struct block *block)
+{
+	const struct lightrec_mem_map *map;
+	unsigned int offset = block->nb_ops - 1;
+	const struct opcode *op;
+	void *host;
+	u32 target;
+
+	if (is_delay_slot(block->opcode_list, offset))
+		offset--;
+
+	op = &block->opcode_list[offset];
+
+	if (!is_unconditional_jump(op->c) || op_flag_local_branch(op->flags))
+		return 0;
+
+	switch (op->c.i.op) {
+	case OP_J:
+	case OP_JAL:
+		target = (block->pc & 0xf0000000) | (op->c.j.imm << 2);
+		break;
+	case OP_SPECIAL:
+		/* JR / JALR: unknown target */
+		return 0;
+	default:
+		target = get_branch_pc(block, offset, 1 + (s16)op->c.i.imm);
+		break;
+	}
+
+	map = lightrec_get_map(state, &host, kunseg(target));
+	if (!map)
+		return 0;
+
+	return lightrec_get_dead_regs(host, (map->pc + map->length
+					     - kunseg(target)) >> 2);
+}
+
 static int lightrec_early_unload(struct lightrec_state *state, struct block *block)
 {
 	u16 i, offset;
@@ -1716,12 +1988,87 @@ static int lightrec_early_unload(struct lightrec_state *state, struct block *blo
 		loaded |= mask_r;
 	}
 
+	/* The registers that the next block overwrites are kept until the end
+	 * of the block, where the emitter can skip storing them back. */
+	if (OPT_SKIP_DEAD_STORES && OPT_CHAIN_BLOCKS) {
+		dirty &= lightrec_get_exit_dead_regs(state, block);
+
+		for (reg = 1; reg < 34; reg++) {
+			if (dirty & BIT(reg)) {
+				last_r[reg] = -1;
+				last_w[reg] = -1;
+			}
+		}
+	}
+
 	/* Unload all registers that are dirty or loaded at the end of block. */
 	lightrec_early_unload_sync(block->opcode_list, last_r, last_w);
 
 	return 0;
 }
 
+/* A single register only gets the accesses at its address (not e.g. its upper
+ * half), a bank of registers the accesses aligned to their size */
+static int lightrec_get_hw_handler(const struct lightrec_state *state,
+				   union code c, u32 kaddr)
+{
+	const struct lightrec_mem_map_ops *ops;
+	unsigned int i, size;
+	u32 offset;
+	void *func;
+
+	for (i = 0; i < state->nb_hw_handlers; i++) {
+		offset = kaddr - state->hw_handlers[i].kaddr;
+
+		if (offset >= state->hw_handlers[i].length)
+			continue;
+
+		ops = state->hw_handlers[i].ops;
+
+		switch (c.i.op) {
+		case OP_SB:
+			func = ops->sb;
+			size = 1;
+			break;
+		case OP_SH:
+			func = ops->sh;
+			size = 2;
+			break;
+		case OP_SW:
+			func = ops->sw;
+			size = 4;
+			break;
+		case OP_LB:
+		case OP_LBU:
+			func = ops->lb;
+			size = 1;
+			break;
+		case OP_LH:
+		case OP_LHU:
+			func = ops->lh;
+			size = 2;
+			break;
+		case OP_LW:
+			func = ops->lw;
+			size = 4;
+			break;
+		default:
+			func = NULL;
+			size = 1;
+			break;
+		}
+
+		if (state->hw_handlers[i].length <= 4 ? offset != 0
+		    : offset & (size - 1))
+			continue;
+
+		if (func)
+			return i;
+	}
+
+	return -1;
+}
+
 static int lightrec_flag_io(struct lightrec_state *state, struct block *block)
 {
 	struct opcode *list;
@@ -1730,6 +2077,7 @@ static int lightrec_flag_io(struct lightrec_state *state, struct block *block)
 	unsigned int i;
 	u32 val, kunseg_val;
 	bool no_mask;
+	int handler;
 
 	for (i = 0; i < block->nb_ops; i++) {
 		list = &block->opcode_list[i];
@@ -1781,7 +2129,8 @@ static int lightrec_flag_io(struct lightrec_state *state, struct block *block)
 				if (psx_map != PSX_MAP_UNKNOWN && !is_known(v, list->i.rs))
 					pr_debug("Detected map thanks to bit-level const propagation!\n");
 
-				list->flags &= ~LIGHTREC_IO_MASK;
+				list->flags &= ~(LIGHTREC_IO_MASK |
+						 LIGHTREC_IO_HANDLER_MASK);
 
 				val = v[list->i.rs].value + (s16) list->i.imm;
 				kunseg_val = kunseg(val);
@@ -1829,6 +2178,13 @@ static int lightrec_flag_io(struct lightrec_state *state, struct block *block)
 
 						if (no_mask)
 							list->flags |= LIGHTREC_NO_MASK;
+					} else if (is_known(v, list->i.rs) &&
+						   (handler = lightrec_get_hw_handler(state,
+							list->c, kunseg_val)) >= 0) {
+						pr_debug("Flagging opcode %u as I/O handler call\n",
+							 i);
+						list->flags |= LIGHTREC_IO_MODE(LIGHTREC_IO_HW_CALL)
+							| LIGHTREC_IO_HANDLER(handler);
 					} else {
 						pr_debug("Flagging opcode %u as I/O access\n",
 							 i);
@@ -2347,6 +2703,7 @@ static int (*lightrec_optimizers[])(struct lightrec_state *state, struct block *
 	IF_OPT(OPT_LOCAL_BRANCHES, &lightrec_local_branches),
 	IF_OPT(OPT_TRANSFORM_OPS, &lightrec_transform_ops),
 	IF_OPT(OPT_SWITCH_DELAY_SLOTS, &lightrec_switch_delay_slots),
+	IF_OPT(OPT_DETECT_IDLE_LOOPS, &lightrec_detect_idle_loops),
 	IF_OPT(OPT_FLAG_IO, &lightrec_flag_io),
 	IF_OPT(OPT_FLAG_MULT_DIV, &lightrec_flag_mults_divs),
 	IF_OPT(OPT_EARLY_UNLOAD, &lightrec_early_unload),
@@ -2368,3 +2725,52 @@ int lightrec_optimize(struct lightrec_state *state, struct block *block)
 
 	return 0;
 }
+
+struct opcode * lightrec_optimize_hot_block(struct lightrec_state *state,
+					     const struct block *block)
+{
+	struct opcode_list *list;
+	struct block copy = {};
+	unsigned int i;
+	int ret;
+
+	/* The interpreter and the C wrappers of the current code may read the
+	 * block's opcode list at any time, so rewrite a copy of it */
+	list = lightrec_malloc(state, MEM_FOR_IR, sizeof(*list)
+			       + sizeof(struct opcode) * block->nb_ops);
+	if (!list)
+		return NULL;
+
+	list->nb_ops = block->nb_ops;
+	list->handlers = NULL;
+	memcpy(list->ops, block->opcode_list,
+	       sizeof(struct opcode) * block->nb_ops);
+
+	/* The passes only read the PC, the length and the opcode list of the
+	 * block they are given */
+	copy.pc = block->pc;
+	copy.nb_ops = block->nb_ops;
+	copy.opcode_list = list->ops;
+
+	ret = lightrec_ssa_optimize(state, &copy);
+	if (ret <= 0) {
+		lightrec_free_opcode_list(state, list->ops);
+		return NULL;
+	}
+
+	pr_debug("Rewrote %d opcodes of hot block "PC_FMT"\n", ret, block->pc);
+
+	if (OPT_EARLY_UNLOAD) {
+		/* The registers read by the opcodes changed, so the points
+		 * where they can be unloaded must be computed again */
+		for (i = 0; i < copy.nb_ops; i++) {
+			list->ops[i].flags &= ~(LIGHTREC_REG_RS_MASK |
+						LIGHTREC_REG_RT_MASK |
+						LIGHTREC_REG_RD_MASK);
+		}
+
+		lightrec_early_unload(state, &copy);
+	}
+
+	return list->ops;
+}
@@ -22,7 +22,11 @@ __cnst _Bool is_unconditional_jump(union code c);
 __cnst _Bool is_syscall(union code c);
 
 _Bool should_emulate(const struct opcode *op);
+_Bool lightrec_idle_loop_is_safe(const struct block *block, unsigned int offset);
+u64 lightrec_get_dead_regs(const u32 *code, unsigned int nb_ops);
 
 int lightrec_optimize(struct lightrec_state *state, struct block *block);
+struct opcode * lightrec_optimize_hot_block(struct lightrec_state *state,
+					     const struct block *block);
 
 #endif /* __OPTIMIZER_H__ */
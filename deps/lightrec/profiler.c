@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include "blockcache.h"
+#include "debug.h"
+#include "disassembler.h"
+#include "lightrec-private.h"
+#include "memmanager.h"
+#include "profiler.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * When the profiler is enabled, each compiled block increments its own
+ * execution counter on entry, and every backward local branch adds the
+ * cycles of the loop's body to the block's loop counter. The emulated time
+ * spent in a block is then estimated as the number of executions multiplied
+ * by the cycles of one full pass through the block, plus the loop cycles;
+ * early exits are not accounted for.
+ *
+ * Blocks that have been freed (invalidated, or evicted when running out of
+ * code space) are not part of the report, and the executions of the blocks
+ * by the interpreter are not counted.
+ */
+
+/* Number of blocks whose disassembly is appended to the text report */
+#define PROFILER_NB_DISASM	16
+
+struct profile_entry {
+	struct block *block;
+	u64 cycles;
+};
+
+static int profile_entry_cmp(const void *a, const void *b)
+{
+	const struct profile_entry *e1 = a, *e2 = b;
+
+	if (e1->cycles != e2->cycles)
+		return e1->cycles < e2->cycles ? 1 : -1;
+
+	return (int)(kunseg(e1->block->pc) > kunseg(e2->block->pc))
+		- (int)(kunseg(e1->block->pc) < kunseg(e2->block->pc));
+}
+
+static void profiler_write_csv(FILE *f, const struct profile_entry *entries,
+			       unsigned int nb, u64 total)
+{
+	const struct block *block;
+	unsigned int i;
+
+	fprintf(f, "pc,nb_ops,exec_count,cycles_per_exec,total_cycles,"
+		"percent,code_size,nb_compiles,compile_time_us,"
+		"skipped_stores\n");
+
+	for (i = 0; i < nb; i++) {
+		block = entries[i].block;
+
+		fprintf(f, X32_FMT",%hu,%"PRIu64",%u,%"PRIu64",%.3f,%u,%u,%u,%u\n",
+			block->pc, block->nb_ops, block->profile.exec_count,
+			block->profile.cycles, entries[i].cycles,
+			entries[i].cycles * 100.0 / total, block->code_size,
+			block->profile.nb_compiles,
+			block->profile.compile_time_us,
+			block->profile.skipped_stores);
+	}
+}
+
+static void profiler_write_text(FILE *f, const struct profile_entry *entries,
+				unsigned int nb, u64 total)
+{
+	struct block *block;
+	unsigned int i;
+
+	fprintf(f, "Lightrec profile: %u blocks, %"PRIu64" emulated cycles\n\n",
+		nb, total);
+	fprintf(f, "%-10s %7s %12s %8s %5s %7s %8s %10s %7s\n",
+		"PC", "Time", "Executions", "Cycles", "Ops", "Code",
+		"Compiles", "Compile us", "Skipped");
+
+	for (i = 0; i < nb; i++) {
+		block = entries[i].block;
+
+		fprintf(f, X32_FMT" %6.2f%% %12"PRIu64" %8u %5hu %7u %8u %10u %7u\n",
+			block->pc, entries[i].cycles * 100.0 / total,
+			block->profile.exec_count, block->profile.cycles,
+			block->nb_ops, block->code_size,
+			block->profile.nb_compiles,
+			block->profile.compile_time_us,
+			block->profile.skipped_stores);
+	}
+
+	for (i = 0; i < nb && i < PROFILER_NB_DISASM; i++) {
+		block = entries[i].block;
+
+		fprintf(f, "\nBlock "PC_FMT" (%.2f%%):\n",
+			block->pc, entries[i].cycles * 100.0 / total);
+
+		if (block_has_flag(block, BLOCK_NO_OPCODE_LIST))
+			fprintf(f, "Opcode list not available\n");
+		else
+			lightrec_fprint_disassembly(f, block, block->code);
+	}
+}
+
+int lightrec_profiler_save(struct lightrec_state *state, const char *path,
+			   enum lightrec_profile_format format)
+{
+	const struct block_profile *profile;
+	struct profile_entry *entries;
+	struct block **blocks;
+	unsigned int i, nb_blocks, nb = 0;
+	u64 total = 0;
+	int ret = 0;
+	FILE *f;
+
+	blocks = lightrec_get_all_blocks(state->block_cache, &nb_blocks);
+	if (!blocks && nb_blocks)
+		return -ENOMEM;
+
+	entries = lightrec_malloc(state, MEM_FOR_LIGHTREC,
+				  sizeof(*entries) * nb_blocks);
+	if (!entries && nb_blocks) {
+		ret = -ENOMEM;
+		goto out_free_blocks;
+	}
+
+	for (i = 0; i < nb_blocks; i++) {
+		profile = &blocks[i]->profile;
+
+		if (!profile->exec_count && !profile->loop_cycles)
+			continue;
+
+		entries[nb].block = blocks[i];
+		entries[nb].cycles = profile->exec_count * profile->cycles
+			+ profile->loop_cycles;
+		total += entries[nb++].cycles;
+	}
+
+	qsort(entries, nb, sizeof(*entries), profile_entry_cmp);
+
+	f = fopen(path, "w");
+	if (!f) {
+		ret = -errno;
+		goto out_free_entries;
+	}
+
+	/* Avoid dividing by zero below */
+	if (!total)
+		total = 1;
+
+	if (format == LIGHTREC_PROFILE_CSV)
+		profiler_write_csv(f, entries, nb, total);
+	else
+		profiler_write_text(f, entries, nb, total);
+
+	if (fclose(f))
+		ret = -errno;
+	else
+		pr_info("Saved profile of %u blocks to %s\n", nb, path);
+
+out_free_entries:
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      sizeof(*entries) * nb_blocks, entries);
+out_free_blocks:
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      sizeof(*blocks) * nb_blocks, blocks);
+	return ret;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#ifndef __LIGHTREC_PROFILER_H__
+#define __LIGHTREC_PROFILER_H__
+
+#include "lightrec.h"
+
+struct lightrec_state;
+
+int lightrec_profiler_save(struct lightrec_state *state, const char *path,
+			   enum lightrec_profile_format format);
+
+#endif /* __LIGHTREC_PROFILER_H__ */
@@ -9,40 +9,84 @@
 #include "lightrec-private.h"
 #include "memmanager.h"
 #include "reaper.h"
-#include "slist.h"
 
 #include <errno.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #ifdef __linux__
 #include <unistd.h>
 #endif
 
+/* Initial number of entries of the job queue */
+#define QUEUE_INIT_SIZE		256
+
+/* The jobs are hashed by pages of 64 opcodes of the code they span */
+#define JOB_PAGE_SHIFT		8
+#define JOB_HASH_BITS		8
+
+struct recompiler_thd;
+struct block_rec;
+
+struct job_link {
+	struct block_rec *block_rec;
+	struct job_link *next;
+};
+
 struct block_rec {
 	struct block *block;
-	struct slist_elm slist;
+	struct recompiler_thd *thd;
 	unsigned int requests;
-	bool compiling;
+	/* Position in the heap, or -1 when the block is being compiled */
+	int heap_idx;
+	/* One link per page spanned by the block, in the job hash */
+	unsigned int nb_links;
+	struct job_link links[];
 };
 
 struct recompiler_thd {
 	struct lightrec_cstate *cstate;
 	unsigned int tid;
 	pthread_t thd;
+
+	/* Job being compiled, and condition signaled when it's done */
+	struct block_rec *current;
+	pthread_cond_t done;
 };
 
+/*
+ * The pending jobs are kept in a binary max-heap ordered by number of
+ * requests, so that picking the most requested block, bumping a block's
+ * priority, or cancelling a job are all O(log n). Each queued block points
+ * to its job, so that it can be found without walking the queue. To check
+ * whether a queued or compiling block already covers a new one, the jobs are
+ * also chained in a hash of the pages of code that they span, and only the
+ * jobs that share the page of the new block are looked at.
+ *
+ * All of this is protected by the mutex, which is only held for these short
+ * operations and never while compiling; the jobs and the grown heap are
+ * allocated, and usually freed, without holding it. Cancelling a job that is
+ * being compiled waits on the condition of the worker that compiles it.
+ */
 struct recompiler {
 	struct lightrec_state *state;
 	pthread_cond_t cond;
-	pthread_cond_t cond2;
 	pthread_mutex_t mutex;
 	bool stop, pause, must_flush;
-	struct slist_elm slist;
+
+	struct block_rec **heap;
+	unsigned int heap_len, heap_size;
+
+	struct job_link *jobs[1 << JOB_HASH_BITS];
 
 	pthread_mutex_t alloc_mutex;
 
+	/* Statistics of the workers, collected when their jobs are done */
+	unsigned int nb_compile;
+	u64 compile_time_us;
+
 	unsigned int nb_recs, nb_cpus;
 	struct recompiler_thd thds[];
 };
@@ -65,54 +109,152 @@ static unsigned int get_processors_count(void)
 	return nb < 1 ? 1 : nb;
 }
 
-static struct block_rec * lightrec_get_best_elm(struct slist_elm *head)
+static inline void heap_set(struct recompiler *rec, unsigned int idx,
+			    struct block_rec *block_rec)
+{
+	rec->heap[idx] = block_rec;
+	block_rec->heap_idx = idx;
+}
+
+static void heap_sift_up(struct recompiler *rec, unsigned int idx)
 {
-	struct block_rec *block_rec, *best = NULL;
-	struct slist_elm *elm;
+	struct block_rec *block_rec = rec->heap[idx];
+	unsigned int parent;
 
-	for (elm = slist_first(head); elm; elm = elm->next) {
-		block_rec = container_of(elm, struct block_rec, slist);
+	for (; idx > 0; idx = parent) {
+		parent = (idx - 1) / 2;
 
-		if (!block_rec->compiling
-		    && (!best || block_rec->requests > best->requests))
-			best = block_rec;
+		if (rec->heap[parent]->requests >= block_rec->requests)
+			break;
+
+		heap_set(rec, idx, rec->heap[parent]);
 	}
 
-	return best;
+	heap_set(rec, idx, block_rec);
 }
 
-static bool lightrec_cancel_block_rec(struct recompiler *rec,
-				      struct block_rec *block_rec)
+static void heap_sift_down(struct recompiler *rec, unsigned int idx)
 {
-	if (block_rec->compiling) {
-		/* Block is being recompiled - wait for
-		 * completion */
-		pthread_cond_wait(&rec->cond2, &rec->mutex);
-
-		/* We can't guarantee the signal was for us.
-		 * Since block_rec may have been removed while
-		 * we were waiting on the condition, we cannot
-		 * check block_rec->compiling again. The best
-		 * thing is just to restart the function. */
-		return false;
+	struct block_rec *block_rec = rec->heap[idx];
+	unsigned int child;
+
+	for (; (child = 2 * idx + 1) < rec->heap_len; idx = child) {
+		if (child + 1 < rec->heap_len
+		    && rec->heap[child + 1]->requests > rec->heap[child]->requests)
+			child++;
+
+		if (block_rec->requests >= rec->heap[child]->requests)
+			break;
+
+		heap_set(rec, idx, rec->heap[child]);
 	}
 
-	/* Block is not yet being processed - remove it from the list */
-	slist_remove(&rec->slist, &block_rec->slist);
-	lightrec_free(rec->state, MEM_FOR_LIGHTREC,
-		      sizeof(*block_rec), block_rec);
+	heap_set(rec, idx, block_rec);
+}
+
+/* The caller makes room in the heap first */
+static void heap_push(struct recompiler *rec, struct block_rec *block_rec)
+{
+	heap_set(rec, rec->heap_len++, block_rec);
+	heap_sift_up(rec, rec->heap_len - 1);
+}
+
+static void heap_remove(struct recompiler *rec, struct block_rec *block_rec)
+{
+	unsigned int idx = block_rec->heap_idx;
+	struct block_rec *last;
+
+	block_rec->heap_idx = -1;
+
+	if (idx == --rec->heap_len)
+		return;
+
+	last = rec->heap[rec->heap_len];
+	heap_set(rec, idx, last);
+	heap_sift_down(rec, idx);
+	heap_sift_up(rec, last->heap_idx);
+}
+
+static inline u32 job_first_page(const struct block *block)
+{
+	return kunseg(block->pc) >> JOB_PAGE_SHIFT;
+}
+
+static unsigned int job_nb_links(const struct block *block)
+{
+	u32 last = (kunseg(block->pc) + block->nb_ops * 4 - 1) >> JOB_PAGE_SHIFT;
 
-	return true;
+	return last - job_first_page(block) + 1;
+}
+
+static inline size_t job_size(unsigned int nb_links)
+{
+	return sizeof(struct block_rec) + nb_links * sizeof(struct job_link);
+}
+
+static inline unsigned int job_hash(u32 page)
+{
+	/* Fibonacci hashing */
+	return (page * 0x9e3779b1) >> (32 - JOB_HASH_BITS);
+}
+
+static void job_hash_add(struct recompiler *rec, struct block_rec *block_rec)
+{
+	u32 page = job_first_page(block_rec->block);
+	struct job_link *link;
+	unsigned int i, h;
+
+	for (i = 0; i < block_rec->nb_links; i++) {
+		link = &block_rec->links[i];
+		h = job_hash(page + i);
+
+		link->block_rec = block_rec;
+		link->next = rec->jobs[h];
+		rec->jobs[h] = link;
+	}
+}
+
+static void job_hash_remove(struct recompiler *rec, struct block_rec *block_rec)
+{
+	u32 page = job_first_page(block_rec->block);
+	struct job_link **link;
+	unsigned int i;
+
+	for (i = 0; i < block_rec->nb_links; i++) {
+		for (link = &rec->jobs[job_hash(page + i)];
+		     *link != &block_rec->links[i]; link = &(*link)->next);
+
+		*link = block_rec->links[i].next;
+	}
+}
+
+static void lightrec_free_block_rec(struct recompiler *rec,
+				    struct block_rec *block_rec)
+{
+	job_hash_remove(rec, block_rec);
+	block_rec->block->block_rec = NULL;
+
+	lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+		      job_size(block_rec->nb_links), block_rec);
 }
 
 static void lightrec_cancel_list(struct recompiler *rec)
 {
-	struct block_rec *block_rec;
-	struct slist_elm *elm, *head = &rec->slist;
+	struct recompiler_thd *thd;
+	unsigned int i;
+
+	/* Remove all the pending jobs */
+	while (rec->heap_len) {
+		rec->heap[--rec->heap_len]->heap_idx = -1;
+		lightrec_free_block_rec(rec, rec->heap[rec->heap_len]);
+	}
+
+	/* Then wait for the jobs being compiled */
+	for (i = 0; i < rec->nb_recs; i++) {
+		thd = &rec->thds[i];
 
-	for (elm = slist_first(head); elm; elm = slist_first(head)) {
-		block_rec = container_of(elm, struct block_rec, slist);
-		lightrec_cancel_block_rec(rec, block_rec);
+		while (thd->current)
+			pthread_cond_wait(&thd->done, &rec->mutex);
 	}
 }
 
@@ -124,20 +266,49 @@ static void lightrec_flush_code_buffer(struct lightrec_state *state, void *d)
 	rec->must_flush = false;
 }
 
+/* Detaches the job of the worker and collects its statistics. The job is
+ * returned, so that it can be freed once the mutex is released. */
+static struct block_rec * lightrec_job_done(struct recompiler *rec,
+					    struct recompiler_thd *thd)
+{
+	struct block_rec *block_rec = thd->current;
+
+	rec->nb_compile += thd->cstate->nb_compile;
+	rec->compile_time_us += thd->cstate->compile_time_us;
+	thd->cstate->nb_compile = 0;
+	thd->cstate->compile_time_us = 0;
+
+	job_hash_remove(rec, block_rec);
+	block_rec->block->block_rec = NULL;
+	thd->current = NULL;
+	pthread_cond_broadcast(&thd->done);
+
+	return block_rec;
+}
+
 static void lightrec_compile_list(struct recompiler *rec,
 				  struct recompiler_thd *thd)
 {
-	struct block_rec *block_rec;
+	struct block_rec *block_rec, *done = NULL;
 	struct block *block;
 	int ret;
 
-	while (!rec->pause &&
-	       !!(block_rec = lightrec_get_best_elm(&rec->slist))) {
-		block_rec->compiling = true;
+	while (!rec->pause && rec->heap_len) {
+		block_rec = rec->heap[0];
+		heap_remove(rec, block_rec);
+
+		block_rec->thd = thd;
+		thd->current = block_rec;
 		block = block_rec->block;
 
 		pthread_mutex_unlock(&rec->mutex);
 
+		if (done) {
+			lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+				      job_size(done->nb_links), done);
+			done = NULL;
+		}
+
 		if (likely(!block_has_flag(block, BLOCK_IS_DEAD))) {
 			ret = lightrec_compile_block(thd->cstate, block);
 			if (ret == -ENOMEM) {
@@ -145,8 +316,7 @@ static void lightrec_compile_list(struct recompiler *rec,
 				 * flush it. */
 
 				pthread_mutex_lock(&rec->mutex);
-				block_rec->compiling = false;
-				pthread_cond_broadcast(&rec->cond2);
+				done = lightrec_job_done(rec, thd);
 
 				if (!rec->must_flush) {
 					rec->must_flush = true;
@@ -156,7 +326,7 @@ static void lightrec_compile_list(struct recompiler *rec,
 							    lightrec_flush_code_buffer,
 							    rec);
 				}
-				return;
+				break;
 			}
 
 			if (ret) {
@@ -166,11 +336,12 @@ static void lightrec_compile_list(struct recompiler *rec,
 		}
 
 		pthread_mutex_lock(&rec->mutex);
+		done = lightrec_job_done(rec, thd);
+	}
 
-		slist_remove(&rec->slist, &block_rec->slist);
+	if (done) {
 		lightrec_free(rec->state, MEM_FOR_LIGHTREC,
-			      sizeof(*block_rec), block_rec);
-		pthread_cond_broadcast(&rec->cond2);
+			      job_size(done->nb_links), done);
 	}
 }
 
@@ -182,18 +353,16 @@ static void * lightrec_recompiler_thd(void *d)
 	pthread_mutex_lock(&rec->mutex);
 
 	while (!rec->stop) {
-		do {
+		/* Check the queue before waiting, as the jobs queued while all
+		 * the workers were busy did not wake any of them up */
+		if (rec->pause || !rec->heap_len) {
 			pthread_cond_wait(&rec->cond, &rec->mutex);
-
-			if (rec->stop)
-				goto out_unlock;
-
-		} while (rec->pause || slist_empty(&rec->slist));
+			continue;
+		}
 
 		lightrec_compile_list(rec, thd);
 	}
 
-out_unlock:
 	pthread_mutex_unlock(&rec->mutex);
 	return NULL;
 }
@@ -214,9 +383,17 @@ struct recompiler *lightrec_recompiler_init(struct lightrec_state *state)
 		return NULL;
 	}
 
+	rec->heap = lightrec_malloc(state, MEM_FOR_LIGHTREC,
+				    sizeof(*rec->heap) * QUEUE_INIT_SIZE);
+	if (!rec->heap) {
+		pr_err("Cannot create recompiler: Out of memory\n");
+		goto err_free_rec;
+	}
+
 	for (i = 0; i < nb_recs; i++) {
 		rec->thds[i].tid = i;
 		rec->thds[i].cstate = NULL;
+		rec->thds[i].current = NULL;
 	}
 
 	for (i = 0; i < nb_recs; i++) {
@@ -233,7 +410,11 @@ struct recompiler *lightrec_recompiler_init(struct lightrec_state *state)
 	rec->must_flush = false;
 	rec->nb_recs = nb_recs;
 	rec->nb_cpus = nb_cpus;
-	slist_init(&rec->slist);
+	rec->heap_len = 0;
+	rec->heap_size = QUEUE_INIT_SIZE;
+	memset(rec->jobs, 0, sizeof(rec->jobs));
+	rec->nb_compile = 0;
+	rec->compile_time_us = 0;
 
 	ret = pthread_cond_init(&rec->cond, NULL);
 	if (ret) {
@@ -241,16 +422,18 @@ struct recompiler *lightrec_recompiler_init(struct lightrec_state *state)
 		goto err_free_cstates;
 	}
 
-	ret = pthread_cond_init(&rec->cond2, NULL);
-	if (ret) {
-		pr_err("Cannot init cond variable: %d\n", ret);
-		goto err_cnd_destroy;
+	for (i = 0; i < nb_recs; i++) {
+		ret = pthread_cond_init(&rec->thds[i].done, NULL);
+		if (ret) {
+			pr_err("Cannot init cond variable: %d\n", ret);
+			goto err_done_cnd_destroy;
+		}
 	}
 
 	ret = pthread_mutex_init(&rec->alloc_mutex, NULL);
 	if (ret) {
 		pr_err("Cannot init alloc mutex variable: %d\n", ret);
-		goto err_cnd2_destroy;
+		goto err_done_cnd_destroy;
 	}
 
 	ret = pthread_mutex_init(&rec->mutex, NULL);
@@ -277,16 +460,20 @@ err_mtx_destroy:
 	pthread_mutex_destroy(&rec->mutex);
 err_alloc_mtx_destroy:
 	pthread_mutex_destroy(&rec->alloc_mutex);
-err_cnd2_destroy:
-	pthread_cond_destroy(&rec->cond2);
-err_cnd_destroy:
+err_done_cnd_destroy:
+	while (i-- > 0)
+		pthread_cond_destroy(&rec->thds[i].done);
 	pthread_cond_destroy(&rec->cond);
 err_free_cstates:
 	for (i = 0; i < nb_recs; i++) {
 		if (rec->thds[i].cstate)
 			lightrec_free_cstate(rec->thds[i].cstate);
 	}
-	lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*rec), rec);
+	lightrec_free(state, MEM_FOR_LIGHTREC,
+		      sizeof(*rec->heap) * QUEUE_INIT_SIZE, rec->heap);
+err_free_rec:
+	lightrec_free(state, MEM_FOR_LIGHTREC, sizeof(*rec)
+		      + nb_recs * sizeof(*rec->thds), rec);
 	return NULL;
 }
 
@@ -305,25 +492,50 @@ void lightrec_free_recompiler(struct recompiler *rec)
 	for (i = 0; i < rec->nb_recs; i++)
 		pthread_join(rec->thds[i].thd, NULL);
 
-	for (i = 0; i < rec->nb_recs; i++)
+	for (i = 0; i < rec->nb_recs; i++) {
 		lightrec_free_cstate(rec->thds[i].cstate);
+		pthread_cond_destroy(&rec->thds[i].done);
+	}
 
 	pthread_mutex_destroy(&rec->mutex);
 	pthread_mutex_destroy(&rec->alloc_mutex);
 	pthread_cond_destroy(&rec->cond);
-	pthread_cond_destroy(&rec->cond2);
-	lightrec_free(rec->state, MEM_FOR_LIGHTREC, sizeof(*rec), rec);
+	lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+		      sizeof(*rec->heap) * rec->heap_size, rec->heap);
+	lightrec_free(rec->state, MEM_FOR_LIGHTREC, sizeof(*rec)
+		      + rec->nb_recs * sizeof(*rec->thds), rec);
 }
 
-int lightrec_recompiler_add(struct recompiler *rec, struct block *block)
+/* Returns the job of the queued or compiling block that already covers the
+ * given block, if any */
+static struct block_rec * lightrec_find_covering_job(struct recompiler *rec,
+						      const struct block *block)
 {
-	struct slist_elm *elm;
 	struct block_rec *block_rec;
-	u32 pc1, pc2;
+	struct job_link *link;
+	u32 pc1, pc2 = kunseg(block->pc);
+
+	for (link = rec->jobs[job_hash(job_first_page(block))];
+	     link; link = link->next) {
+		block_rec = link->block_rec;
+
+		pc1 = kunseg(block_rec->block->pc);
+		if (pc2 >= pc1 && pc2 < pc1 + block_rec->block->nb_ops * 4)
+			return block_rec;
+	}
+
+	return NULL;
+}
+
+int lightrec_recompiler_add(struct recompiler *rec, struct block *block)
+{
+	struct block_rec *block_rec, *new_rec = NULL, **heap = NULL, **old_heap;
+	unsigned int heap_size = 0, old_size, nb_links = job_nb_links(block);
 	int ret = 0;
 
 	pthread_mutex_lock(&rec->mutex);
 
+retry:
 	/* If the recompiler must flush the code cache, we can't add the new
 	 * job. It will be re-added next time the block's address is jumped to
 	 * again. */
@@ -335,36 +547,27 @@ int lightrec_recompiler_add(struct recompiler *rec, struct block *block)
 	if (block_has_flag(block, BLOCK_IS_DEAD))
 		goto out_unlock;
 
-	for (elm = slist_first(&rec->slist); elm; elm = elm->next) {
-		block_rec = container_of(elm, struct block_rec, slist);
-
-		if (block_rec->block == block) {
-			/* The block to compile is already in the queue -
-			 * increment its counter to increase its priority */
-			block_rec->requests++;
-
-			if (rec->nb_cpus == 1) {
-				/* On single-core CPUs, if we got a request for
-				 * a block that's already in the queue, we'll
-				 * probably get many more before the compiler
-				 * thread can run, which means that the block
-				 * will be interpreted until then, wasting a lot
-				 * of performance. In that case, it is better to
-				 * just let the compiler thread run now. */
-				pthread_cond_wait(&rec->cond2, &rec->mutex);
-			}
+	block_rec = block->block_rec;
+	if (block_rec) {
+		/* The block is being compiled - nothing to do */
+		if (block_rec->heap_idx < 0)
 			goto out_unlock;
-		}
 
-		pc1 = kunseg(block_rec->block->pc);
-		pc2 = kunseg(block->pc);
-		if (pc2 >= pc1 && pc2 < pc1 + block_rec->block->nb_ops * 4) {
-			/* The block we want to compile is already covered by
-			 * another one in the queue - increment its counter to
-			 * increase its priority */
-			block_rec->requests++;
-			goto out_unlock;
+		/* The block to compile is already in the queue - increment its
+		 * counter to increase its priority */
+		block_rec->requests++;
+		heap_sift_up(rec, block_rec->heap_idx);
+
+		if (rec->nb_cpus == 1) {
+			/* On single-core CPUs, if we got a request for a block
+			 * that's already in the queue, we'll probably get many
+			 * more before the compiler thread can run, which means
+			 * that the block will be interpreted until then,
+			 * wasting a lot of performance. In that case, it is
+			 * better to just let the compiler thread run now. */
+			pthread_cond_wait(&rec->thds[0].done, &rec->mutex);
 		}
+		goto out_unlock;
 	}
 
 	/* By the time this function was called, the block has been recompiled
@@ -372,57 +575,117 @@ int lightrec_recompiler_add(struct recompiler *rec, struct block *block)
 	if (block->function && !block_has_flag(block, BLOCK_SHOULD_RECOMPILE))
 		goto out_unlock;
 
-	block_rec = lightrec_malloc(rec->state, MEM_FOR_LIGHTREC,
-				    sizeof(*block_rec));
-	if (!block_rec) {
-		ret = -ENOMEM;
+	block_rec = lightrec_find_covering_job(rec, block);
+	if (block_rec) {
+		/* The block we want to compile is already covered by another
+		 * one in the queue - increment its counter to increase its
+		 * priority */
+		block_rec->requests++;
+		if (block_rec->heap_idx >= 0)
+			heap_sift_up(rec, block_rec->heap_idx);
 		goto out_unlock;
 	}
 
+	if (!new_rec) {
+		/* Allocate the job without holding the mutex, then check
+		 * everything again */
+		pthread_mutex_unlock(&rec->mutex);
+
+		new_rec = lightrec_malloc(rec->state, MEM_FOR_LIGHTREC,
+					  job_size(nb_links));
+		if (!new_rec)
+			return -ENOMEM;
+
+		pthread_mutex_lock(&rec->mutex);
+		goto retry;
+	}
+
+	if (rec->heap_len == rec->heap_size && heap_size <= rec->heap_size) {
+		/* Grow the heap without holding the mutex either */
+		pthread_mutex_unlock(&rec->mutex);
+
+		if (heap) {
+			lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+				      sizeof(*heap) * heap_size, heap);
+		}
+
+		heap_size = rec->heap_size * 2;
+		heap = lightrec_malloc(rec->state, MEM_FOR_LIGHTREC,
+				       sizeof(*heap) * heap_size);
+		if (!heap) {
+			lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+				      job_size(nb_links), new_rec);
+			return -ENOMEM;
+		}
+
+		pthread_mutex_lock(&rec->mutex);
+		goto retry;
+	}
+
+	if (rec->heap_len == rec->heap_size) {
+		/* Swap in the grown heap, the old one is freed below */
+		memcpy(heap, rec->heap, sizeof(*heap) * rec->heap_len);
+		old_heap = rec->heap;
+		rec->heap = heap;
+		heap = old_heap;
+
+		old_size = rec->heap_size;
+		rec->heap_size = heap_size;
+		heap_size = old_size;
+	}
+
 	pr_debug("Adding block "PC_FMT" to recompiler\n", block->pc);
 
+	block_rec = new_rec;
 	block_rec->block = block;
-	block_rec->compiling = false;
+	block_rec->thd = NULL;
 	block_rec->requests = 1;
+	block_rec->nb_links = nb_links;
 
-	elm = &rec->slist;
+	heap_push(rec, block_rec);
+	job_hash_add(rec, block_rec);
 
-	/* Push the new entry to the front of the queue */
-	slist_append(elm, &block_rec->slist);
+	block->block_rec = block_rec;
+	new_rec = NULL;
 
-	/* Signal the thread */
+	/* Signal one of the threads */
 	pthread_cond_signal(&rec->cond);
 
 out_unlock:
 	pthread_mutex_unlock(&rec->mutex);
 
+	if (new_rec) {
+		lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+			      job_size(nb_links), new_rec);
+	}
+
+	if (heap) {
+		lightrec_free(rec->state, MEM_FOR_LIGHTREC,
+			      sizeof(*heap) * heap_size, heap);
+	}
+
 	return ret;
 }
 
 void lightrec_recompiler_remove(struct recompiler *rec, struct block *block)
 {
 	struct block_rec *block_rec;
-	struct slist_elm *elm;
 
 	pthread_mutex_lock(&rec->mutex);
 
-	while (true) {
-		for (elm = slist_first(&rec->slist); elm; elm = elm->next) {
-			block_rec = container_of(elm, struct block_rec, slist);
-
-			if (block_rec->block == block) {
-				if (lightrec_cancel_block_rec(rec, block_rec))
-					goto out_unlock;
-
-				break;
-			}
+	while ((block_rec = block->block_rec)) {
+		if (block_rec->heap_idx >= 0) {
+			/* Block is not yet being processed - remove it from
+			 * the queue */
+			heap_remove(rec, block_rec);
+			lightrec_free_block_rec(rec, block_rec);
+			break;
 		}
 
-		if (!elm)
-			break;
+		/* Block is being recompiled - wait for completion */
+		pthread_cond_wait(&block_rec->thd->done, &rec->mutex);
 	}
 
-out_unlock:
 	pthread_mutex_unlock(&rec->mutex);
 }
 
@@ -449,7 +712,8 @@ void * lightrec_recompiler_run_first_pass(struct lightrec_state *state,
 		lightrec_recompiler_add(state->rec, block);
 
 	if (likely(block->function)) {
-		if (block_has_flag(block, BLOCK_FULLY_TAGGED)) {
+		if (block_can_free_opcode_list(block) &&
+		    block_has_flag(block, BLOCK_FULLY_TAGGED)) {
 			old_flags = block_set_flags(block, BLOCK_NO_OPCODE_LIST);
 
 			if (!(old_flags & BLOCK_NO_OPCODE_LIST)) {
@@ -470,14 +734,15 @@ void * lightrec_recompiler_run_first_pass(struct lightrec_state *state,
 	old_flags = block_set_flags(block, BLOCK_NO_OPCODE_LIST);
 
 	/* Block wasn't compiled yet - run the interpreter */
-	*pc = lightrec_emulate_block(state, block, *pc);
+	*pc = lightrec_emulate_block_loops(state, block, *pc);
 
 	if (!(old_flags & BLOCK_NO_OPCODE_LIST))
 		block_clear_flags(block, BLOCK_NO_OPCODE_LIST);
 
 	/* The block got compiled while the interpreter was running.
 	 * We can free the opcode list now. */
-	if (block->function && block_has_flag(block, BLOCK_FULLY_TAGGED)) {
+	if (block->function && block_can_free_opcode_list(block) &&
+	    block_has_flag(block, BLOCK_FULLY_TAGGED)) {
 		old_flags = block_set_flags(block, BLOCK_NO_OPCODE_LIST);
 
 		if (!(old_flags & BLOCK_NO_OPCODE_LIST)) {
@@ -501,6 +766,15 @@ void lightrec_code_alloc_unlock(struct lightrec_state *state)
 	pthread_mutex_unlock(&state->rec->alloc_mutex);
 }
 
+void lightrec_recompiler_get_stats(struct recompiler *rec,
+				   u32 *nb_compile, u64 *compile_time_us)
+{
+	pthread_mutex_lock(&rec->mutex);
+	*nb_compile = rec->nb_compile;
+	*compile_time_us = rec->compile_time_us;
+	pthread_mutex_unlock(&rec->mutex);
+}
+
 void lightrec_recompiler_pause(struct recompiler *rec)
 {
 	rec->pause = true;
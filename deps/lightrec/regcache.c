@@ -636,6 +636,13 @@ bool lightrec_reg_is_loaded(struct regcache *cache, u16 reg)
 	return !!find_mapped_reg(cache, reg, false);
 }
 
+bool lightrec_reg_is_dirty(struct regcache *cache, u16 reg)
+{
+	struct native_register *nreg = find_mapped_reg(cache, reg, false);
+
+	return nreg && nreg->prio == REG_IS_DIRTY;
+}
+
 void lightrec_clean_reg_if_loaded(struct regcache *cache, jit_state_t *_jit,
 				  u16 reg, bool unload)
 {
@@ -82,6 +82,7 @@ void lightrec_storeback_regs(struct regcache *cache, jit_state_t *_jit);
 _Bool lightrec_has_dirty_regs(struct regcache *cache);
 
 _Bool lightrec_reg_is_loaded(struct regcache *cache, u16 reg);
+_Bool lightrec_reg_is_dirty(struct regcache *cache, u16 reg);
 void lightrec_clean_reg_if_loaded(struct regcache *cache, jit_state_t *_jit,
 				  u16 reg, _Bool unload);
 void lightrec_discard_reg_if_loaded(struct regcache *cache, u16 reg);
@@ -0,0 +1,682 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include "debug.h"
+#include "disassembler.h"
+#include "lightrec-private.h"
+#include "memmanager.h"
+#include "optimizer.h"
+#include "ssa.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * SSA form of the opcode list, built when recompiling hot blocks.
+ *
+ * Every opcode that produces a value defines a new SSA value, whose operands
+ * are the values held by its source registers; the register file is only a
+ * map from registers to values. Values are hash-consed when they are created,
+ * through a hash table of the constants and of the values of the current
+ * region: an ALU opcode whose operands are constants folds to a constant, and
+ * one that computes an existing value, or a load from RAM, BIOS or scratchpad
+ * that reads an existing value (with no store in between), returns that value.
+ *
+ * The phi functions would be at the branch targets inside the block (the
+ * opcodes with the SYNC flag). The registers are mapped to fresh input values
+ * there instead, so that no value flows across a loop's back-edge.
+ *
+ * The opcodes are then rewritten from their values: an opcode whose value is
+ * already in its target register becomes a NOP, one whose value is a constant
+ * becomes a LUI, ADDIU or ORI, and one whose value is in another register
+ * becomes a MOV. As each opcode still maps to one MIPS opcode, the cycle
+ * counting and the branch targets are not affected.
+ */
+
+enum ssa_kind {
+	SSA_NONE,
+	SSA_INPUT,	/* Value of a register at the start of the region */
+	SSA_CONST,
+	SSA_ALU,
+	SSA_LOAD,	/* Load from RAM, BIOS or scratchpad */
+};
+
+#define SSA_OP_SPECIAL(x)	(0x40 | (x))
+#define SSA_OP_META(x)		(0x80 | (x))
+
+struct ssa_value {
+	u8 kind;
+	u8 op;
+	u16 imm;
+	u16 args[2];
+	/* Value known to be the same as this one (forwarded store) */
+	u16 same;
+	/* Constant, or memory generation of the load */
+	u32 data;
+};
+
+struct ssa {
+	struct ssa_value *values;
+	unsigned int nb_values, max_values;
+	/* Open-addressing hash table of the values, 0 marking a free slot */
+	u16 *table;
+	unsigned int table_mask;
+	/* First value of the current region */
+	unsigned int region;
+	/* Incremented by every opcode that may write memory */
+	u32 mem_gen;
+	/* Value of each register, or 0 if not known yet */
+	u16 regs[34];
+	/* Registers written by a LUI flagged with LIGHTREC_MOVI, whose value
+	 * is not materialized until the next opcode writing them */
+	u64 hidden;
+};
+
+static u16 ssa_resolve(const struct ssa *ssa, u16 idx)
+{
+	return ssa->values[idx].same ?: idx;
+}
+
+static bool ssa_equal(const struct ssa_value *a, const struct ssa_value *b)
+{
+	return a->kind == b->kind && a->op == b->op && a->imm == b->imm
+		&& a->args[0] == b->args[0] && a->args[1] == b->args[1]
+		&& a->data == b->data;
+}
+
+static u32 ssa_hash(const struct ssa_value *v)
+{
+	u32 hash = v->kind | v->op << 8 | (u32)v->imm << 16;
+
+	hash ^= (v->args[0] | (u32)v->args[1] << 16) * 0x9e3779b1;
+	hash ^= v->data * 0x85ebca6b;
+	hash ^= hash >> 15;
+	hash *= 0x2c1b3c6d;
+	hash ^= hash >> 12;
+
+	return hash;
+}
+
+static u16 ssa_add(struct ssa *ssa, const struct ssa_value *v)
+{
+	unsigned int slot = ssa_hash(v) & ssa->table_mask;
+	u16 idx;
+
+	/* The inputs are never shared. The values of the previous regions stay
+	 * in the table, but only the constants are valid across regions. */
+	for (; (idx = ssa->table[slot]); slot = (slot + 1) & ssa->table_mask) {
+		if (v->kind != SSA_INPUT && ssa_equal(&ssa->values[idx], v)
+		    && (idx >= ssa->region || v->kind == SSA_CONST))
+			return ssa_resolve(ssa, idx);
+	}
+
+	/* Out of values: 0 means that the value is unknown */
+	if (ssa->nb_values == ssa->max_values)
+		return 0;
+
+	ssa->values[ssa->nb_values] = *v;
+	ssa->table[slot] = ssa->nb_values;
+
+	return ssa->nb_values++;
+}
+
+static u16 ssa_const(struct ssa *ssa, u32 value)
+{
+	return ssa_add(ssa, &(struct ssa_value){
+		.kind = SSA_CONST,
+		.data = value,
+	});
+}
+
+static u16 ssa_get_reg(struct ssa *ssa, u8 reg)
+{
+	if (reg == 0)
+		return ssa_const(ssa, 0);
+
+	if (!ssa->regs[reg]) {
+		ssa->regs[reg] = ssa_add(ssa, &(struct ssa_value){
+			.kind = SSA_INPUT,
+			.imm = reg,
+		});
+	}
+
+	return ssa->regs[reg];
+}
+
+static bool ssa_is_const(const struct ssa *ssa, u16 idx)
+{
+	return idx && ssa->values[idx].kind == SSA_CONST;
+}
+
+static u32 ssa_eval(u8 op, u32 a, u32 b, u16 imm)
+{
+	switch (op) {
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLL):
+		return b << imm;
+	case SSA_OP_SPECIAL(OP_SPECIAL_SRL):
+		return b >> imm;
+	case SSA_OP_SPECIAL(OP_SPECIAL_SRA):
+		return (s32)b >> imm;
+	case SSA_OP_SPECIAL(OP_SPECIAL_ADDU):
+		return a + b;
+	case SSA_OP_SPECIAL(OP_SPECIAL_SUBU):
+		return a - b;
+	case SSA_OP_SPECIAL(OP_SPECIAL_AND):
+		return a & b;
+	case SSA_OP_SPECIAL(OP_SPECIAL_OR):
+		return a | b;
+	case SSA_OP_SPECIAL(OP_SPECIAL_XOR):
+		return a ^ b;
+	case SSA_OP_SPECIAL(OP_SPECIAL_NOR):
+		return ~(a | b);
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLT):
+		return (s32)a < (s32)b;
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLTU):
+		return a < b;
+	case OP_ADDIU:
+		return a + (s32)(s16)imm;
+	case OP_SLTI:
+		return (s32)a < (s32)(s16)imm;
+	case OP_SLTIU:
+		return a < (u32)(s32)(s16)imm;
+	case OP_ANDI:
+		return a & imm;
+	case OP_ORI:
+		return a | imm;
+	case OP_XORI:
+		return a ^ imm;
+	case OP_LUI:
+		return (u32)imm << 16;
+	case SSA_OP_META(OP_META_EXTC):
+		return (s32)(s8)a;
+	case SSA_OP_META(OP_META_EXTS):
+		return (s32)(s16)a;
+	case SSA_OP_META(OP_META_COM):
+	default:
+		return ~a;
+	}
+}
+
+static u16 ssa_alu(struct ssa *ssa, u8 op, u16 a, u16 b, u16 imm)
+{
+	const struct ssa_value *values = ssa->values;
+	u16 tmp;
+
+	/* The PSX does not raise overflow exceptions */
+	if (op == SSA_OP_SPECIAL(OP_SPECIAL_ADD))
+		op = SSA_OP_SPECIAL(OP_SPECIAL_ADDU);
+	else if (op == SSA_OP_SPECIAL(OP_SPECIAL_SUB))
+		op = SSA_OP_SPECIAL(OP_SPECIAL_SUBU);
+	else if (op == OP_ADDI)
+		op = OP_ADDIU;
+
+	if (!a && op != OP_LUI && op != SSA_OP_SPECIAL(OP_SPECIAL_SLL)
+	    && op != SSA_OP_SPECIAL(OP_SPECIAL_SRL)
+	    && op != SSA_OP_SPECIAL(OP_SPECIAL_SRA))
+		return 0;
+
+	switch (op) {
+	case SSA_OP_META(OP_META_MOV):
+		return a;
+
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLLV):
+	case SSA_OP_SPECIAL(OP_SPECIAL_SRLV):
+	case SSA_OP_SPECIAL(OP_SPECIAL_SRAV):
+		if (!ssa_is_const(ssa, a))
+			break;
+
+		/* Variable shift by a constant: same as the immediate shift */
+		imm = values[a].data & 0x1f;
+		op -= OP_SPECIAL_SLLV - OP_SPECIAL_SLL;
+		a = 0;
+		fallthrough;
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLL):
+	case SSA_OP_SPECIAL(OP_SPECIAL_SRL):
+	case SSA_OP_SPECIAL(OP_SPECIAL_SRA):
+		if (!b)
+			return 0;
+		if (!imm)
+			return b;
+		break;
+
+	case SSA_OP_SPECIAL(OP_SPECIAL_ADDU):
+	case SSA_OP_SPECIAL(OP_SPECIAL_AND):
+	case SSA_OP_SPECIAL(OP_SPECIAL_OR):
+	case SSA_OP_SPECIAL(OP_SPECIAL_XOR):
+	case SSA_OP_SPECIAL(OP_SPECIAL_NOR):
+		if (!b)
+			return 0;
+
+		/* Commutative opcodes: sort the operands, constants first */
+		if (ssa_is_const(ssa, b) > ssa_is_const(ssa, a) ||
+		    (ssa_is_const(ssa, a) == ssa_is_const(ssa, b) && a > b)) {
+			tmp = a;
+			a = b;
+			b = tmp;
+		}
+		fallthrough;
+	case SSA_OP_SPECIAL(OP_SPECIAL_SUBU):
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLT):
+	case SSA_OP_SPECIAL(OP_SPECIAL_SLTU):
+		if (!b)
+			return 0;
+
+		if (a == b) {
+			switch (op) {
+			case SSA_OP_SPECIAL(OP_SPECIAL_AND):
+			case SSA_OP_SPECIAL(OP_SPECIAL_OR):
+				return a;
+			case SSA_OP_SPECIAL(OP_SPECIAL_SUBU):
+			case SSA_OP_SPECIAL(OP_SPECIAL_XOR):
+			case SSA_OP_SPECIAL(OP_SPECIAL_SLT):
+			case SSA_OP_SPECIAL(OP_SPECIAL_SLTU):
+				return ssa_const(ssa, 0);
+			default:
+				break;
+			}
+		}
+
+		if (ssa_is_const(ssa, a) && !values[a].data) {
+			switch (op) {
+			case SSA_OP_SPECIAL(OP_SPECIAL_ADDU):
+			case SSA_OP_SPECIAL(OP_SPECIAL_OR):
+			case SSA_OP_SPECIAL(OP_SPECIAL_XOR):
+				return b;
+			case SSA_OP_SPECIAL(OP_SPECIAL_AND):
+				return a;
+			default:
+				break;
+			}
+		}
+
+		if (ssa_is_const(ssa, b) && !values[b].data
+		    && op == SSA_OP_SPECIAL(OP_SPECIAL_SUBU))
+			return a;
+		break;
+
+	case OP_ADDIU:
+	case OP_ORI:
+	case OP_XORI:
+		if (!imm)
+			return a;
+		break;
+
+	default:
+		break;
+	}
+
+	if ((!a || ssa_is_const(ssa, a)) && (!b || ssa_is_const(ssa, b)))
+		return ssa_const(ssa, ssa_eval(op, a ? values[a].data : 0,
+					       b ? values[b].data : 0, imm));
+
+	return ssa_add(ssa, &(struct ssa_value){
+		.kind = SSA_ALU,
+		.op = op,
+		.imm = imm,
+		.args = { a, b },
+	});
+}
+
+static u16 ssa_load(struct ssa *ssa, u8 op, u16 base, u16 imm)
+{
+	if (!base)
+		return 0;
+
+	return ssa_add(ssa, &(struct ssa_value){
+		.kind = SSA_LOAD,
+		.op = op,
+		.imm = imm,
+		.args = { base },
+		.data = ssa->mem_gen,
+	});
+}
+
+static void ssa_forward_store(struct ssa *ssa, u16 base, u16 imm, u16 value)
+{
+	u16 idx;
+
+	if (!base || !value)
+		return;
+
+	/* A LW from the same address will read the stored value */
+	idx = ssa_load(ssa, OP_LW, base, imm);
+	if (idx && idx != value)
+		ssa->values[idx].same = value;
+}
+
+static void ssa_reset(struct ssa *ssa)
+{
+	memset(ssa->regs, 0, sizeof(ssa->regs));
+	ssa->hidden = 0;
+	ssa->region = ssa->nb_values;
+	ssa->mem_gen++;
+}
+
+static void ssa_clobber(struct ssa *ssa, u64 mask)
+{
+	unsigned int reg;
+
+	for (reg = 1; reg < 34; reg++)
+		if (mask & BIT(reg))
+			ssa->regs[reg] = 0;
+
+	ssa->hidden &= ~mask;
+}
+
+static bool ssa_is_memory(u32 flags)
+{
+	switch (LIGHTREC_FLAGS_GET_IO_MODE(flags)) {
+	case LIGHTREC_IO_DIRECT:
+	case LIGHTREC_IO_RAM:
+	case LIGHTREC_IO_BIOS:
+	case LIGHTREC_IO_SCRATCH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool ssa_is_const_load(union code c)
+{
+	switch (c.i.op) {
+	case OP_LUI:
+		return true;
+	case OP_ADDI:
+	case OP_ADDIU:
+	case OP_ORI:
+		return c.i.rs == 0;
+	default:
+		return false;
+	}
+}
+
+static bool ssa_rewrite(struct ssa *ssa, struct opcode *op, u8 rd, u16 idx)
+{
+	const struct ssa_value *v = &ssa->values[idx];
+	union code c = { .opcode = 0 };
+	bool is_mov;
+	u8 reg;
+
+	if (ssa->regs[rd] == idx && !(ssa->hidden & BIT(rd))) {
+		pr_debug("SSA: Value already in %s, removing opcode\n",
+			 lightrec_reg_name(rd));
+		goto out_rewrite;
+	}
+
+	if (v->kind == SSA_CONST) {
+		if (ssa_is_const_load(op->c))
+			return false;
+
+		if ((s32)(s16)v->data == (s32)v->data) {
+			c.i.op = OP_ADDIU;
+			c.i.imm = (u16)v->data;
+		} else if (!(v->data & 0xffff)) {
+			c.i.op = OP_LUI;
+			c.i.imm = v->data >> 16;
+		} else if (!(v->data >> 16)) {
+			c.i.op = OP_ORI;
+			c.i.imm = v->data;
+		}
+
+		if (c.opcode) {
+			pr_debug("SSA: Folding to constant 0x%08x\n", v->data);
+			c.i.rt = rd;
+			goto out_rewrite;
+		}
+	}
+
+	is_mov = op->i.op == OP_META && op->m.op == OP_META_MOV;
+	if (is_mov)
+		return false;
+
+	for (reg = 1; reg < 32; reg++) {
+		if (ssa->regs[reg] == idx && !(ssa->hidden & BIT(reg)))
+			break;
+	}
+
+	if (reg == 32)
+		return false;
+
+	pr_debug("SSA: Value already in %s, converting to MOV\n",
+		 lightrec_reg_name(reg));
+
+	c.i.op = OP_META;
+	c.m.op = OP_META_MOV;
+	c.m.rs = reg;
+	c.m.rd = rd;
+
+out_rewrite:
+	op->c = c;
+	op->flags &= LIGHTREC_SYNC;
+
+	return true;
+}
+
+static unsigned int ssa_opcode(struct ssa *ssa, struct opcode *op,
+			       bool can_rewrite)
+{
+	union code c = op->c;
+	bool barrier = false;
+	unsigned int changed;
+	u16 idx = 0;
+	u8 rd = 0;
+
+	switch (c.i.op) {
+	case OP_SPECIAL:
+		switch (c.r.op) {
+		case OP_SPECIAL_SLL:
+		case OP_SPECIAL_SRL:
+		case OP_SPECIAL_SRA:
+			rd = c.r.rd;
+			idx = ssa_alu(ssa, SSA_OP_SPECIAL(c.r.op), 0,
+				      ssa_get_reg(ssa, c.r.rt), c.r.imm);
+			break;
+		case OP_SPECIAL_SLLV:
+		case OP_SPECIAL_SRLV:
+		case OP_SPECIAL_SRAV:
+		case OP_SPECIAL_ADD:
+		case OP_SPECIAL_ADDU:
+		case OP_SPECIAL_SUB:
+		case OP_SPECIAL_SUBU:
+		case OP_SPECIAL_AND:
+		case OP_SPECIAL_OR:
+		case OP_SPECIAL_XOR:
+		case OP_SPECIAL_NOR:
+		case OP_SPECIAL_SLT:
+		case OP_SPECIAL_SLTU:
+			rd = c.r.rd;
+			idx = ssa_alu(ssa, SSA_OP_SPECIAL(c.r.op),
+				      ssa_get_reg(ssa, c.r.rs),
+				      ssa_get_reg(ssa, c.r.rt), 0);
+			break;
+		case OP_SPECIAL_MFHI:
+		case OP_SPECIAL_MFLO:
+			/* Copies, but keep the opcodes, as the flags of the
+			 * MULT/DIV opcodes depend on them */
+			rd = c.r.rd;
+			idx = ssa_get_reg(ssa, c.r.op == OP_SPECIAL_MFHI ?
+					  REG_HI : REG_LO);
+			can_rewrite = false;
+			break;
+		case OP_SPECIAL_MTHI:
+		case OP_SPECIAL_MTLO:
+			rd = c.r.op == OP_SPECIAL_MTHI ? REG_HI : REG_LO;
+			idx = ssa_get_reg(ssa, c.r.rs);
+			can_rewrite = false;
+			break;
+		case OP_SPECIAL_JR:
+		case OP_SPECIAL_JALR:
+		case OP_SPECIAL_MULT:
+		case OP_SPECIAL_MULTU:
+		case OP_SPECIAL_DIV:
+		case OP_SPECIAL_DIVU:
+			break;
+		default:
+			barrier = true;
+			break;
+		}
+		break;
+
+	case OP_ADDI:
+	case OP_ADDIU:
+	case OP_SLTI:
+	case OP_SLTIU:
+	case OP_ANDI:
+	case OP_ORI:
+	case OP_XORI:
+		rd = c.i.rt;
+		idx = ssa_alu(ssa, c.i.op, ssa_get_reg(ssa, c.i.rs), 0, c.i.imm);
+		break;
+	case OP_LUI:
+		rd = c.i.rt;
+		idx = ssa_alu(ssa, c.i.op, 0, 0, c.i.imm);
+		break;
+
+	case OP_META:
+		switch (c.m.op) {
+		case OP_META_MOV:
+		case OP_META_EXTC:
+		case OP_META_EXTS:
+		case OP_META_COM:
+			rd = c.m.rd;
+			idx = ssa_alu(ssa, SSA_OP_META(c.m.op),
+				      ssa_get_reg(ssa, c.m.rs), 0, 0);
+			break;
+		default:
+			barrier = true;
+			break;
+		}
+		break;
+
+	case OP_LB:
+	case OP_LBU:
+	case OP_LH:
+	case OP_LHU:
+	case OP_LW:
+		/* Loads whose target is written after the delay slot of the
+		 * branch they are in are left alone */
+		if (!ssa_is_memory(op->flags) || op_flag_load_delay(op->flags)) {
+			barrier = true;
+			break;
+		}
+
+		rd = c.i.rt;
+		idx = ssa_load(ssa, c.i.op, ssa_get_reg(ssa, c.i.rs), c.i.imm);
+		break;
+
+	case OP_SW:
+		ssa->mem_gen++;
+
+		switch (LIGHTREC_FLAGS_GET_IO_MODE(op->flags)) {
+		case LIGHTREC_IO_RAM:
+		case LIGHTREC_IO_SCRATCH:
+			ssa_forward_store(ssa, ssa_get_reg(ssa, c.i.rs),
+					  c.i.imm, ssa_get_reg(ssa, c.i.rt));
+			break;
+		default:
+			break;
+		}
+		return 0;
+
+	case OP_J:
+	case OP_JAL:
+	case OP_BEQ:
+	case OP_BNE:
+	case OP_BLEZ:
+	case OP_BGTZ:
+	case OP_REGIMM:
+	case OP_META_MULT2:
+	case OP_META_MULTU2:
+		break;
+
+	default:
+		/* Other stores, coprocessor opcodes, etc. */
+		barrier = true;
+		break;
+	}
+
+	if (barrier)
+		ssa->mem_gen++;
+
+	if (!rd || !idx) {
+		ssa_clobber(ssa, opcode_write_mask(c));
+		return 0;
+	}
+
+	changed = can_rewrite && !(op->flags & LIGHTREC_MOVI)
+		&& ssa_rewrite(ssa, op, rd, idx);
+
+	ssa->regs[rd] = idx;
+
+	if (c.i.op == OP_LUI && (op->flags & LIGHTREC_MOVI))
+		ssa->hidden |= BIT(rd);
+	else
+		ssa->hidden &= ~BIT(rd);
+
+	return changed;
+}
+
+int lightrec_ssa_optimize(struct lightrec_state *state, struct block *block)
+{
+	struct opcode *op, *list = block->opcode_list;
+	unsigned int i, reset_at = 0, nb_changes = 0, table_size;
+	struct ssa ssa = {};
+	bool can_rewrite;
+
+	/* Each opcode creates at most two inputs, the $zero constant, its own
+	 * value and a forwarded store */
+	ssa.max_values = block->nb_ops * 5 + 1;
+	ssa.values = lightrec_malloc(state, MEM_FOR_IR,
+				     sizeof(*ssa.values) * ssa.max_values);
+	if (!ssa.values)
+		return -ENOMEM;
+
+	/* The table is at most half full */
+	for (table_size = 1; table_size < ssa.max_values * 2; )
+		table_size <<= 1;
+
+	ssa.table = lightrec_calloc(state, MEM_FOR_IR,
+				    sizeof(*ssa.table) * table_size);
+	if (!ssa.table) {
+		lightrec_free(state, MEM_FOR_IR,
+			      sizeof(*ssa.values) * ssa.max_values, ssa.values);
+		return -ENOMEM;
+	}
+
+	ssa.table_mask = table_size - 1;
+
+	/* Value #0 means "unknown" */
+	ssa.nb_values = 1;
+	ssa.region = 1;
+
+	for (i = 0; i < block->nb_ops; i++) {
+		op = &list[i];
+
+		/* The opcodes after an unconditional jump can only be
+		 * reached from a branch */
+		if (op_flag_sync(op->flags) || (reset_at && i == reset_at))
+			ssa_reset(&ssa);
+
+		if (!op->opcode)
+			continue;
+
+		if (has_delay_slot(op->c) && is_unconditional_jump(op->c))
+			reset_at = i + 1 + !op_flag_no_ds(op->flags);
+
+		/* Only rewrite the opcodes that are not branches or in the
+		 * delay slot of a branch */
+		can_rewrite = !has_delay_slot(op->c) && !is_delay_slot(list, i);
+
+		nb_changes += ssa_opcode(&ssa, op, can_rewrite);
+	}
+
+	lightrec_free(state, MEM_FOR_IR,
+		      sizeof(*ssa.table) * table_size, ssa.table);
+	lightrec_free(state, MEM_FOR_IR,
+		      sizeof(*ssa.values) * ssa.max_values, ssa.values);
+
+	return nb_changes;
+}
@@ -10,12 +10,14 @@
 #define ENABLE_FIRST_PASS 1
 #define ENABLE_DISASSEMBLER LIGHTREC_ENABLE_DISASSEMBLER
 #define ENABLE_CODE_BUFFER 1
+#define ENABLE_PROFILER 0
 
 #define HAS_DEFAULT_ELM 1
 
 #define OPT_REMOVE_DIV_BY_ZERO_SEQ 1
 #define OPT_REPLACE_MEMSET LIGHTREC_NO_DEBUG
 #define OPT_DETECT_IMPOSSIBLE_BRANCHES 1
+#define OPT_DETECT_IDLE_LOOPS 1
 #define OPT_HANDLE_LOAD_DELAYS 1
 #define OPT_TRANSFORM_OPS 1
 #define OPT_LOCAL_BRANCHES 1
@@ -24,6 +26,11 @@
 #define OPT_FLAG_MULT_DIV LIGHTREC_NO_DEBUG
 #define OPT_EARLY_UNLOAD 1
 #define OPT_PRELOAD_PC 1
+#define OPT_CHAIN_BLOCKS 1
+#define OPT_SKIP_DEAD_STORES 1
+#define OPT_OPTIMIZE_HOT_BLOCKS 1
+#define OPT_EXTEND_BLOCKS 1
+#define OPT_INLINE_GTE 1
 
 #define OPT_SH4_USE_GBR 0
 
@@ -30,7 +30,10 @@ SOURCES_ASM  :=
 SOURCES_C := $(CORE_DIR)/cdriso.c \
              $(CORE_DIR)/cdrom.c \
              $(CORE_DIR)/cdrom-async.c \
+             $(CORE_DIR)/cdimg_cache.c \
+             $(CORE_DIR)/chd_cache.c \
              $(CORE_DIR)/cheat.c \
+             $(CORE_DIR)/compr_cache.c \
              $(CORE_DIR)/database.c \
              $(CORE_DIR)/decode_xa.c \
              $(CORE_DIR)/mdec.c \
@@ -48,6 +51,7 @@ SOURCES_C := $(CORE_DIR)/cdriso.c \
              $(CORE_DIR)/r3000a.c \
              $(CORE_DIR)/sio.c \
              $(CORE_DIR)/spu.c \
+             $(CORE_DIR)/trace.c \
              $(CORE_DIR)/gpu.c \
              $(CORE_DIR)/gte.c \
              $(CORE_DIR)/gte_nf.c \
@@ -103,6 +107,24 @@ SOURCES_C += \
 	     $(LCHDR_ZSTD)/decompress/zstd_decompress.c
 EXTRA_INCLUDES += $(LCHDR)/include $(LCHDR_LZMA)/include $(LCHDR_ZSTD)
 COREFLAGS += -DHAVE_CHD -DZ7_ST -DZSTD_DISABLE_ASM
+
+# incremental snapshots and rewind
+SOURCES_C += $(CORE_DIR)/snapshot.c \
+	     $(CORE_DIR)/rewind.c \
+	     $(LCHDR_ZSTD)/compress/fse_compress.c \
+	     $(LCHDR_ZSTD)/compress/hist.c \
+	     $(LCHDR_ZSTD)/compress/huf_compress.c \
+	     $(LCHDR_ZSTD)/compress/zstd_compress.c \
+	     $(LCHDR_ZSTD)/compress/zstd_compress_literals.c \
+	     $(LCHDR_ZSTD)/compress/zstd_compress_sequences.c \
+	     $(LCHDR_ZSTD)/compress/zstd_compress_superblock.c \
+	     $(LCHDR_ZSTD)/compress/zstd_double_fast.c \
+	     $(LCHDR_ZSTD)/compress/zstd_fast.c \
+	     $(LCHDR_ZSTD)/compress/zstd_lazy.c \
+	     $(LCHDR_ZSTD)/compress/zstd_ldm.c \
+	     $(LCHDR_ZSTD)/compress/zstd_opt.c
+COREFLAGS += -DHAVE_SNAPSHOT
+
 ifeq (,$(call gte,$(APP_PLATFORM_LEVEL),18))
 ifneq ($(TARGET_ARCH_ABI),arm64-v8a)
 # HACK
@@ -184,12 +206,14 @@ ifeq ($(HAVE_LIGHTREC),1)
   SOURCES_C   += $(DEPS_DIR)/lightrec/blockcache.c \
 					  $(DEPS_DIR)/lightrec/constprop.c \
 					  $(DEPS_DIR)/lightrec/disassembler.c \
+					  $(DEPS_DIR)/lightrec/diskcache.c \
 					  $(DEPS_DIR)/lightrec/emitter.c \
 					  $(DEPS_DIR)/lightrec/interpreter.c \
 					  $(DEPS_DIR)/lightrec/lightrec.c \
 					  $(DEPS_DIR)/lightrec/memmanager.c \
 					  $(DEPS_DIR)/lightrec/optimizer.c \
 					  $(DEPS_DIR)/lightrec/regcache.c \
+					  $(DEPS_DIR)/lightrec/ssa.c \
 					  $(DEPS_DIR)/lightrec/recompiler.c \
 					  $(DEPS_DIR)/lightrec/reaper.c \
 					  $(DEPS_DIR)/lightrec/tlsf/tlsf.c
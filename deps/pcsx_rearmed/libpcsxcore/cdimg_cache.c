@@ -0,0 +1,553 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+ * Pool of decoded blocks of a compressed CD image, with read-ahead, shared by
+ * the CHD (chd_cache.c) and PBP/CBIN (compr_cache.c) images, which only
+ * provide the decoders.
+ *
+ * The pool is an LRU cache sized by a memory budget. The data and
+ * subchannel reads share its entries.
+ *
+ * The data reads are followed as a few streams, so that a game that
+ * alternates between two places of the disc (e.g. data and CDDA or XA
+ * tracks) doesn't look like it seeks all the time: the block each stream is
+ * at is kept in the pool, and each stream has its own read-ahead.
+ *
+ * When the reads of a stream come in sequence, the next blocks in the same
+ * direction are queued, and decoded by worker threads that each have their
+ * own decoder; so is the target of a seek, when the CD-ROM code reports it.
+ * A block that is asked for while a worker decodes it is waited for; a block
+ * that is queued but not started yet is decoded right away by the caller.
+ *
+ * Only the caller assigns blocks to the slots of the pool, the workers only
+ * move queued slots to ready (or to free if they fail), so the slot returned
+ * by the last stream read can be used without locking.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "system.h"
+#include "cdimg_cache.h"
+
+#if defined(USE_C11_THREADS) || defined(HAVE_RTHREADS)
+#define CDIMG_CACHE_THREADED
+#include "sthread.h"
+#endif
+
+enum {
+	BLOCK_FREE,
+	BLOCK_QUEUED,	// waiting for a worker
+	BLOCK_DECODING,
+	BLOCK_READY,
+};
+
+#define CDIMG_CACHE_STREAMS	2
+// the queued seek target counts as one more stream
+#define PREFETCH_STREAM		CDIMG_CACHE_STREAMS
+
+struct cdimg_slot {
+	u32 block;
+	u32 state;
+	u32 seq;	// last use, or queue order for the read-ahead
+	boolean ahead;	// read ahead, not used yet
+	u8 stream;	// that read it ahead
+	u8 *data;
+};
+
+struct cdimg_stream {
+	u32 last_block;
+	s32 direction;
+	u32 slot;	// of last_block, kept in the pool
+	u32 seq;
+};
+
+static struct {
+	const struct cdimg_cache_ops *ops;
+	void *decoder;
+	u32 nb_blocks;
+
+	struct cdimg_slot *slots;
+	u8 *buffer;
+	u32 nb_slots;
+	u32 ahead;
+	u32 seq;
+	u32 current;	// slot of the last stream read
+	struct cdimg_stream streams[CDIMG_CACHE_STREAMS];
+	struct cdimg_cache_stats stats;
+
+#ifdef CDIMG_CACHE_THREADED
+	sthread_t *threads[CDIMG_CACHE_MAX_THREADS];
+	void *worker_dec[CDIMG_CACHE_MAX_THREADS];
+	u32 nb_threads, next_worker;
+	boolean thread_exit;
+	slock_t *lock;
+	scond_t *work_cond;	// a slot was queued
+	scond_t *done_cond;	// a slot was decoded
+#endif
+} ic;
+
+#ifdef CDIMG_CACHE_THREADED
+static void ic_lock(void)
+{
+	if (ic.nb_threads)
+		slock_lock(ic.lock);
+}
+
+static void ic_unlock(void)
+{
+	if (ic.nb_threads)
+		slock_unlock(ic.lock);
+}
+
+static struct cdimg_slot *next_queued(void)
+{
+	struct cdimg_slot *slot = NULL;
+	u32 i;
+
+	for (i = 0; i < ic.nb_slots; i++) {
+		if (ic.slots[i].state == BLOCK_QUEUED
+		    && (!slot || (s32)(ic.slots[i].seq - slot->seq) < 0))
+			slot = &ic.slots[i];
+	}
+
+	return slot;
+}
+
+static void cdimg_cache_thread(void *unused)
+{
+	struct cdimg_slot *slot;
+	void *decoder;
+	int ret;
+
+	slock_lock(ic.lock);
+	decoder = ic.worker_dec[ic.next_worker++];
+
+	while (!ic.thread_exit) {
+		slot = next_queued();
+		if (!slot) {
+			scond_wait(ic.work_cond, ic.lock);
+			continue;
+		}
+
+		slot->state = BLOCK_DECODING;
+		slock_unlock(ic.lock);
+
+		ret = ic.ops->decode(decoder, slot->block, slot->data, -1);
+
+		slock_lock(ic.lock);
+		slot->state = ret ? BLOCK_FREE : BLOCK_READY;
+		scond_broadcast(ic.done_cond);
+	}
+
+	slock_unlock(ic.lock);
+}
+
+static void stop_threads(void)
+{
+	u32 i;
+
+	if (ic.nb_threads) {
+		slock_lock(ic.lock);
+		ic.thread_exit = TRUE;
+		scond_broadcast(ic.work_cond);
+		slock_unlock(ic.lock);
+	}
+
+	for (i = 0; i < CDIMG_CACHE_MAX_THREADS; i++) {
+		if (ic.threads[i])
+			sthread_join(ic.threads[i]);
+		if (ic.worker_dec[i])
+			ic.ops->close(ic.worker_dec[i]);
+	}
+
+	if (ic.done_cond)
+		scond_free(ic.done_cond);
+	if (ic.work_cond)
+		scond_free(ic.work_cond);
+	if (ic.lock)
+		slock_free(ic.lock);
+}
+
+// the threads are optional, if anything fails the blocks are decoded on demand
+static void start_threads(const char *path, u32 threads)
+{
+	u32 i;
+
+	if (threads > CDIMG_CACHE_MAX_THREADS)
+		threads = CDIMG_CACHE_MAX_THREADS;
+
+	for (i = 0; i < threads; i++) {
+		ic.worker_dec[i] = ic.ops->open(path);
+		if (!ic.worker_dec[i])
+			break;
+	}
+
+	ic.lock = slock_new();
+	ic.work_cond = scond_new();
+	ic.done_cond = scond_new();
+	if (i < threads || !ic.lock || !ic.work_cond || !ic.done_cond)
+		goto fail;
+
+	for (i = 0; i < threads; i++) {
+		ic.threads[i] = pcsxr_sthread_create(cdimg_cache_thread, PCSXRT_CDR);
+		if (!ic.threads[i])
+			goto fail;
+
+		ic.nb_threads++;
+	}
+
+	return;
+
+fail:
+	SysPrintf("%s: read-ahead thread init failed.\n", ic.ops->name);
+	stop_threads();
+	memset(ic.threads, 0, sizeof(ic.threads));
+	memset(ic.worker_dec, 0, sizeof(ic.worker_dec));
+	ic.nb_threads = 0;
+	ic.thread_exit = FALSE;
+	ic.lock = NULL;
+	ic.work_cond = ic.done_cond = NULL;
+}
+#else
+#define ic_lock()
+#define ic_unlock()
+#endif
+
+static struct cdimg_slot *find_slot(u32 block)
+{
+	u32 i;
+
+	for (i = 0; i < ic.nb_slots; i++) {
+		if (ic.slots[i].state != BLOCK_FREE && ic.slots[i].block == block)
+			return &ic.slots[i];
+	}
+
+	return NULL;
+}
+
+static boolean is_stream_head(u32 i)
+{
+	u32 j;
+
+	for (j = 0; j < CDIMG_CACHE_STREAMS; j++) {
+		if (ic.streams[j].slot == i && ic.streams[j].last_block != ~0u)
+			return TRUE;
+	}
+
+	return i == ic.current;
+}
+
+/* Picks a free slot, or else the least recently used ready one. The blocks
+ * read ahead and not used yet go last, and only on demand. */
+static struct cdimg_slot *alloc_slot(u32 block, boolean demand)
+{
+	struct cdimg_slot *slot, *lru = NULL;
+	u32 i;
+
+	for (i = 0; i < ic.nb_slots; i++) {
+		slot = &ic.slots[i];
+
+		if (slot->state == BLOCK_FREE) {
+			lru = slot;
+			break;
+		}
+
+		if (slot->state != BLOCK_READY || (slot->ahead && !demand)
+		    || is_stream_head(i))
+			continue;
+
+		if (!lru || (lru->ahead && !slot->ahead)
+		    || (lru->ahead == slot->ahead && (s32)(slot->seq - lru->seq) < 0))
+			lru = slot;
+	}
+
+	if (lru) {
+		if (lru->state != BLOCK_FREE && lru->ahead)
+			ic.stats.ahead_dropped++;
+
+		lru->block = block;
+		lru->state = BLOCK_FREE;
+		lru->ahead = FALSE;
+	}
+
+	return lru;
+}
+
+static int decode_slot(struct cdimg_slot *slot, int sector)
+{
+	int ret;
+
+	slot->state = BLOCK_DECODING;
+	ic_unlock();
+
+	ret = ic.ops->decode(ic.decoder, slot->block, slot->data, sector);
+
+	ic_lock();
+	slot->state = ret ? BLOCK_FREE : BLOCK_READY;
+
+	return ret;
+}
+
+#ifdef CDIMG_CACHE_THREADED
+static boolean queue_block(u32 block, u32 stream, boolean demand)
+{
+	struct cdimg_slot *slot;
+
+	slot = alloc_slot(block, demand);
+	if (!slot)
+		return FALSE;
+
+	slot->state = BLOCK_QUEUED;
+	slot->seq = ++ic.seq;
+	slot->ahead = TRUE;
+	slot->stream = stream;
+
+	return TRUE;
+}
+#endif
+
+static void read_ahead(struct cdimg_stream *stream, u32 block)
+{
+#ifdef CDIMG_CACHE_THREADED
+	u32 i, queued = 0;
+
+	for (i = 1; i <= ic.ahead; i++) {
+		block += stream->direction;
+		if (block >= ic.nb_blocks)
+			break;
+
+		if (find_slot(block))
+			continue;
+
+		if (!queue_block(block, stream - ic.streams, FALSE))
+			break;
+
+		queued++;
+	}
+
+	// one worker per block, waking them all would only get in the way
+	while (queued--)
+		scond_signal(ic.work_cond);
+#endif
+}
+
+// after a seek, the blocks queued for the old position aren't worth decoding
+static void cancel_queued(u32 stream)
+{
+	struct cdimg_slot *slot;
+	u32 i;
+
+	for (i = 0; i < ic.nb_slots; i++) {
+		slot = &ic.slots[i];
+		if (!slot->ahead || slot->stream != stream)
+			continue;
+
+		if (slot->state == BLOCK_QUEUED) {
+			slot->state = BLOCK_FREE;
+			ic.stats.ahead_dropped++;
+		}
+		slot->ahead = FALSE;
+	}
+}
+
+static void follow_stream(u32 block, u32 slot)
+{
+	struct cdimg_stream *stream, *lru = &ic.streams[0];
+	u32 i;
+
+	for (i = 0; i < CDIMG_CACHE_STREAMS; i++) {
+		stream = &ic.streams[i];
+
+		if (block == stream->last_block)
+			break;
+		if (block == stream->last_block + 1) {
+			stream->direction = 1;
+			break;
+		}
+		if (block == stream->last_block - 1) {
+			stream->direction = -1;
+			break;
+		}
+
+		if ((s32)(stream->seq - lru->seq) < 0)
+			lru = stream;
+	}
+
+	if (i == CDIMG_CACHE_STREAMS) {
+		// a seek: the stream unused for the longest time moves there,
+		// assume that its reads continue forward
+		stream = lru;
+		if (stream->last_block != ~0u)
+			cancel_queued(stream - ic.streams);
+		stream->direction = 1;
+	}
+
+	stream->slot = slot;
+	stream->seq = ic.seq;
+
+	if (block != stream->last_block) {
+		stream->last_block = block;
+		read_ahead(stream, block);
+	}
+}
+
+const u8 *cdimg_cache_get(u32 block, boolean stream, int sector)
+{
+	struct cdimg_slot *slot = &ic.slots[ic.current];
+
+	if (slot->block == block && slot->state == BLOCK_READY)
+		return slot->data;
+
+	if (block >= ic.nb_blocks)
+		return NULL;
+
+	ic_lock();
+
+	slot = find_slot(block);
+	if (slot && slot->state == BLOCK_DECODING) {
+		ic.stats.waits++;
+#ifdef CDIMG_CACHE_THREADED
+		while (slot->state == BLOCK_DECODING)
+			scond_wait(ic.done_cond, ic.lock);
+#endif
+		// the worker failed, decode it again to report the error
+		if (slot->state == BLOCK_FREE)
+			slot = NULL;
+	} else if (slot && slot->state == BLOCK_READY) {
+		ic.stats.hits++;
+	} else {
+		// a queued block that no worker started is decoded here
+		ic.stats.misses++;
+	}
+
+	if (!slot) {
+#ifdef CDIMG_CACHE_THREADED
+		// all the slots are in flight
+		while (!(slot = alloc_slot(block, TRUE)))
+			scond_wait(ic.done_cond, ic.lock);
+#else
+		slot = alloc_slot(block, TRUE);
+#endif
+	}
+
+	if (slot->state != BLOCK_READY && decode_slot(slot, sector)) {
+		ic_unlock();
+		return NULL;
+	}
+
+	if (slot->ahead)
+		ic.stats.ahead_used++;
+
+	slot->seq = ++ic.seq;
+	slot->ahead = FALSE;
+
+	if (stream) {
+		ic.current = slot - ic.slots;
+		follow_stream(block, ic.current);
+	}
+
+	ic_unlock();
+
+	return slot->data;
+}
+
+void cdimg_cache_prefetch(u32 block)
+{
+#ifdef CDIMG_CACHE_THREADED
+	if (!ic.nb_threads || block >= ic.nb_blocks)
+		return;
+
+	ic_lock();
+
+	// only the last seek target is worth decoding, drop an older one
+	cancel_queued(PREFETCH_STREAM);
+
+	// it is about to be read, unlike the blocks read ahead it may replace
+	if (!find_slot(block) && queue_block(block, PREFETCH_STREAM, TRUE))
+		scond_signal(ic.work_cond);
+
+	ic_unlock();
+#endif
+}
+
+int cdimg_cache_open(const struct cdimg_cache_ops *ops, void *decoder,
+		     const char *path, u32 nb_blocks, u32 block_size,
+		     u32 cache_size, u32 ahead, u32 threads)
+{
+	u32 i, nb_slots;
+
+	cdimg_cache_close();
+
+	ic.ops = ops;
+	ic.decoder = decoder;
+	ic.nb_blocks = nb_blocks;
+
+#ifdef CDIMG_CACHE_THREADED
+	if (ahead && threads)
+		start_threads(path, threads);
+	if (!ic.nb_threads)
+		ahead = 0;
+#else
+	ahead = 0;
+#endif
+
+	// at least the block of each stream, one more, and the ones read ahead
+	nb_slots = cache_size / block_size;
+	if (nb_slots < CDIMG_CACHE_STREAMS + 1 + ahead)
+		nb_slots = CDIMG_CACHE_STREAMS + 1 + ahead;
+
+	ic.ahead = ahead;
+	ic.nb_slots = nb_slots;
+	ic.slots = calloc(nb_slots, sizeof(*ic.slots));
+	ic.buffer = malloc((size_t)nb_slots * block_size);
+	if (!ic.slots || !ic.buffer) {
+		SysPrintf("%s: unable to allocate %u blocks\n", ops->name, nb_slots);
+		cdimg_cache_close();
+		return -1;
+	}
+
+	for (i = 0; i < nb_slots; i++) {
+		ic.slots[i].block = ~0u;
+		ic.slots[i].data = ic.buffer + i * block_size;
+	}
+
+	for (i = 0; i < CDIMG_CACHE_STREAMS; i++)
+		ic.streams[i].last_block = ~0u;
+
+	ic.stats.nb_blocks = nb_slots;
+	ic.stats.mem_used = nb_slots * block_size;
+
+#ifdef CDIMG_CACHE_THREADED
+	if (ic.nb_threads)
+		SysPrintf("%s: cache of %u blocks, read-ahead of %u, %u threads\n",
+			  ops->name, nb_slots, ic.ahead, ic.nb_threads);
+#endif
+
+	return 0;
+}
+
+void cdimg_cache_close(void)
+{
+#ifdef CDIMG_CACHE_THREADED
+	if (ic.ops)
+		stop_threads();
+#endif
+	free(ic.slots);
+	free(ic.buffer);
+	memset(&ic, 0, sizeof(ic));
+}
+
+void cdimg_cache_get_stats(struct cdimg_cache_stats *stats)
+{
+	*stats = ic.stats;
+}
@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+#ifndef __CDIMG_CACHE_H__
+#define __CDIMG_CACHE_H__
+
+#include "psxcommon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CDIMG_CACHE_MAX_THREADS	4
+
+// Counted when a read moves to another block
+struct cdimg_cache_stats {
+	u32 nb_blocks;		// that the cache holds
+	u32 mem_used;
+	u32 hits;		// blocks found decoded in the cache
+	u32 waits;		// blocks being decoded by a worker, waited for
+	u32 misses;		// blocks decoded on demand
+	u32 ahead_used;		// blocks decoded ahead, then used
+	u32 ahead_dropped;	// blocks decoded ahead, dropped before any use
+};
+
+struct cdimg_cache_ops {
+	const char *name;	// prefix of the messages
+	/* Decodes 'block' into 'data', returns 0 on success. 'sector' is only
+	 * used for the error messages: the workers pass -1, their errors are
+	 * reported when the block is decoded again on demand. */
+	int  (*decode)(void *decoder, u32 block, u8 *data, int sector);
+	/* Opens and closes the decoders of the worker threads */
+	void *(*open)(const char *path);
+	void (*close)(void *decoder);
+};
+
+/* There is a single cache, for the image that cdriso.c has open. It holds
+ * up to 'cache_size' bytes of decoded blocks of 'block_size' bytes, and at
+ * least what the read-ahead needs. 'decoder' is used on the caller's thread.
+ * 'ahead' blocks are decoded ahead of the reads, on 'threads' worker threads
+ * that open their own decoder of 'path'. Without threads, the blocks are
+ * decoded on demand only. */
+int  cdimg_cache_open(const struct cdimg_cache_ops *ops, void *decoder,
+		      const char *path, u32 nb_blocks, u32 block_size,
+		      u32 cache_size, u32 ahead, u32 threads);
+void cdimg_cache_close(void);
+void cdimg_cache_get_stats(struct cdimg_cache_stats *stats);
+
+/* Returns the decoded block, valid until the next call, or NULL on error. A
+ * stream read is one of the data reads, that the read-ahead follows; the
+ * block it returns stays valid until the next stream read. 'sector' is only
+ * used for the error messages. */
+const u8 *cdimg_cache_get(u32 block, boolean stream, int sector);
+
+/* Queues a block that is about to be read, e.g. the target of a seek, to be
+ * decoded by a worker thread. Does nothing without threads. */
+void cdimg_cache_prefetch(u32 block);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __CDIMG_CACHE_H__
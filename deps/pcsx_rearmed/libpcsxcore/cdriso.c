@@ -25,9 +25,10 @@
 #include "ppf.h"
 
 #include <errno.h>
-#include <zlib.h>
+#include "compr_cache.h"
 #ifdef HAVE_CHD
 #include <libchdr/chd.h>
+#include "chd_cache.h"
 #endif
 
 #ifdef _WIN32
@@ -48,8 +49,6 @@
 #define rewind(f_) rfseek(f_, 0, SEEK_SET)
 #endif
 
-#define OFF_T_MSB ((off_t)1 << (sizeof(off_t) * 8 - 1))
-
 unsigned int cdrIsoMultidiskCount;
 unsigned int cdrIsoMultidiskSelect;
 
@@ -72,23 +71,18 @@ static unsigned int pregapOffset;
 
 // compressed image stuff
 static struct {
-	unsigned char buff_raw[16][CD_FRAMESIZE_RAW];
-	unsigned char buff_compressed[CD_FRAMESIZE_RAW * 16 + 100];
-	off_t *index_table;
+	const unsigned char *current;
 	unsigned int index_len;
 	unsigned int block_shift;
-	unsigned int current_block;
 	unsigned int sector_in_blk;
 } *compr_img;
 
 #ifdef HAVE_CHD
 static struct {
-	unsigned char *buffer;
+	const unsigned char *current;
 	chd_file* chd;
 	const chd_header* header;
 	unsigned int sectors_per_hunk;
-	unsigned int current_hunk[2];
-	unsigned int current_buffer;
 	unsigned int sector_in_hunk;
 } *chd_img;
 #else
@@ -710,14 +704,15 @@ static int handlepbp(const char *isofile) {
 		unsigned int offset;
 		unsigned int size;
 		unsigned int dontcare[6];
-	} index_entry;
+	} index_entry[128];
 	char psar_sig[11];
 	off_t psisoimg_offs, cdimg_base;
 	unsigned int t, cd_length;
 	unsigned int offsettab[8];
-	unsigned int psar_offs, index_entry_size, index_entry_offset;
+	unsigned int psar_offs, index_entry_size, index_entry_offset, index_end = 0;
+	unsigned int *index_table = NULL;
 	const char *ext = NULL;
-	int i, ret;
+	int i, j, nb = 0, ret;
 
 	if (strlen(isofile) >= 4)
 		ext = isofile + strlen(isofile) - 4;
@@ -839,36 +834,51 @@ static int handlepbp(const char *isofile) {
 		goto fail_io;
 
 	compr_img->block_shift = 4;
-	compr_img->current_block = (unsigned int)-1;
 
-	compr_img->index_len = (0x100000 - 0x4000) / sizeof(index_entry);
-	compr_img->index_table = malloc((compr_img->index_len + 1) * sizeof(compr_img->index_table[0]));
-	if (compr_img->index_table == NULL)
+	compr_img->index_len = (0x100000 - 0x4000) / sizeof(index_entry[0]);
+	index_table = malloc((compr_img->index_len + 1) * sizeof(index_table[0]));
+	if (index_table == NULL)
 		goto fail_io;
 
+	// read in chunks, kept as 32-bit offsets from cdimg_base
 	cdimg_base = psisoimg_offs + 0x100000;
-	for (i = 0; i < compr_img->index_len; i++) {
-		ret = fread(&index_entry, 1, sizeof(index_entry), cdHandle);
-		if (ret != sizeof(index_entry)) {
+	for (i = 0, j = 0; i < compr_img->index_len; i++, j++) {
+		if (j == nb) {
+			nb = fread(index_entry, sizeof(index_entry[0]),
+				   sizeof(index_entry) / sizeof(index_entry[0]), cdHandle);
+			j = 0;
+		}
+		if (j >= nb) {
 			SysPrintf("failed to read index_entry #%d\n", i);
 			goto fail_index;
 		}
 
-		index_entry_size = SWAP32(index_entry.size);
-		index_entry_offset = SWAP32(index_entry.offset);
+		index_entry_size = SWAP32(index_entry[j].size);
+		index_entry_offset = SWAP32(index_entry[j].offset);
 
 		if (index_entry_size == 0)
 			break;
 
-		compr_img->index_table[i] = cdimg_base + index_entry_offset;
+		index_table[i] = index_entry_offset;
+		index_end = index_entry_offset + index_entry_size;
+		if (index_end & 0x80000000 || index_end < index_entry_offset) {
+			SysPrintf("index_entry #%d is out of range\n", i);
+			goto fail_index;
+		}
 	}
-	compr_img->index_table[i] = cdimg_base + index_entry_offset + index_entry_size;
+	// the blocks past the end, if any, are empty
+	for (; i <= compr_img->index_len; i++)
+		index_table[i] = index_end;
+
+	if (compr_cache_open(cdHandle, isofile, index_table, compr_img->index_len,
+			     cdimg_base, 0, compr_img->block_shift,
+			     Config.COMPR_CacheSize))
+		goto done;
 
 	return 0;
 
 fail_index:
-	free(compr_img->index_table);
-	compr_img->index_table = NULL;
+	free(index_table);
 	goto done;
 
 fail_io:
@@ -896,8 +906,7 @@ static int handlecbin(const char *isofile) {
 	} ciso_hdr;
 	const char *ext = NULL;
 	unsigned int *index_table = NULL;
-	unsigned int index = 0, plain;
-	int i, ret;
+	int ret;
 
 	if (strlen(isofile) >= 5)
 		ext = isofile + strlen(isofile) - 5;
@@ -927,31 +936,23 @@ static int handlecbin(const char *isofile) {
 		goto fail_io;
 
 	compr_img->block_shift = 0;
-	compr_img->current_block = (unsigned int)-1;
 
+	// the index is used as is, it ends with the end of the last block
 	compr_img->index_len = ciso_hdr.total_bytes / ciso_hdr.block_size;
-	index_table = malloc((compr_img->index_len + 1) * sizeof(index_table[0]));
+	index_table = calloc(compr_img->index_len + 1, sizeof(index_table[0]));
 	if (index_table == NULL)
 		goto fail_io;
 
-	ret = fread(index_table, sizeof(index_table[0]), compr_img->index_len, cdHandle);
-	if (ret != compr_img->index_len) {
+	ret = fread(index_table, sizeof(index_table[0]), compr_img->index_len + 1, cdHandle);
+	if (ret < compr_img->index_len) {
 		SysPrintf("failed to read index table\n");
 		goto fail_index;
 	}
 
-	compr_img->index_table = malloc((compr_img->index_len + 1) * sizeof(compr_img->index_table[0]));
-	if (compr_img->index_table == NULL)
-		goto fail_index;
-
-	for (i = 0; i < compr_img->index_len + 1; i++) {
-		index = index_table[i];
-		plain = index & 0x80000000;
-		index &= 0x7fffffff;
-		compr_img->index_table[i] = (off_t)index << ciso_hdr.align;
-		if (plain)
-			compr_img->index_table[i] |= OFF_T_MSB;
-	}
+	if (compr_cache_open(cdHandle, isofile, index_table, compr_img->index_len,
+			     0, ciso_hdr.align, compr_img->block_shift,
+			     Config.COMPR_CacheSize))
+		goto fail_io;
 
 	return 0;
 
@@ -993,13 +994,13 @@ static int handlechd(const char *isofile) {
 
 	chd_img->header = chd_get_header(chd_img->chd);
 
-	chd_img->buffer = malloc(chd_img->header->hunkbytes * 2);
-	if (chd_img->buffer == NULL)
+	// the read-ahead threads would read the file again, not the precached copy
+	if (chd_cache_open(chd_img->chd, isofile, Config.CHD_CacheSize,
+			Config.CHD_Precache ? 0 : Config.CHD_ReadAhead, Config.CHD_Threads))
 		goto fail_io;
 
 	chd_img->sectors_per_hunk = chd_img->header->hunkbytes / (CD_FRAMESIZE_RAW + SUB_FRAMESIZE);
-	chd_img->current_hunk[0] = (unsigned int)-1;
-	chd_img->current_hunk[1] = (unsigned int)-1;
+	chd_img->current = chd_cache_get(0, FALSE);
 
 	cddaBigEndian = TRUE;
 
@@ -1056,7 +1057,7 @@ static int handlechd(const char *isofile) {
 
 fail_io:
 	if (chd_img != NULL) {
-		free(chd_img->buffer);
+		chd_cache_close();
 		free(chd_img);
 		chd_img = NULL;
 	}
@@ -1164,44 +1165,10 @@ fail_io:
 	return -1;
 }
 
-static int uncompress2_pcsx(void *out, unsigned long *out_size, void *in, unsigned long in_size)
-{
-	static z_stream z;
-	int ret = 0;
-
-	if (z.zalloc == NULL) {
-		// XXX: one-time leak here..
-		z.next_in = Z_NULL;
-		z.avail_in = 0;
-		z.zalloc = Z_NULL;
-		z.zfree = Z_NULL;
-		z.opaque = Z_NULL;
-		ret = inflateInit2(&z, -15);
-	}
-	else
-		ret = inflateReset(&z);
-	if (ret != Z_OK)
-		return ret;
-
-	z.next_in = in;
-	z.avail_in = in_size;
-	z.next_out = out;
-	z.avail_out = *out_size;
-
-	ret = inflate(&z, Z_NO_FLUSH);
-	//inflateEnd(&z);
-
-	*out_size -= z.avail_out;
-	return ret == 1 ? 0 : ret;
-}
-
 static int cdread_compressed(FILE *f, unsigned int base, void *dest, int sector)
 {
-	unsigned long cdbuffer_size, cdbuffer_size_expect;
-	unsigned int size;
-	int is_compressed;
-	off_t start_byte;
-	int ret, block;
+	const unsigned char *data;
+	int block;
 
 	if (!cdHandle)
 		return -1;
@@ -1211,92 +1178,46 @@ static int cdread_compressed(FILE *f, unsigned int base, void *dest, int sector)
 	block = sector >> compr_img->block_shift;
 	compr_img->sector_in_blk = sector & ((1 << compr_img->block_shift) - 1);
 
-	if (block == compr_img->current_block) {
-		//printf("hit sect %d\n", sector);
-		goto finish;
-	}
-
 	if (sector >= compr_img->index_len * 16) {
 		SysPrintf("sector %d is past img end\n", sector);
 		return -1;
 	}
 
-	start_byte = compr_img->index_table[block] & ~OFF_T_MSB;
-	if (fseeko(cdHandle, start_byte, SEEK_SET) != 0) {
-		SysPrintf("seek error for block %d at %llx: ",
-			block, (long long)start_byte);
-		perror(NULL);
+	data = compr_cache_get(block, sector);
+	if (data == NULL)
 		return -1;
-	}
 
-	is_compressed = !(compr_img->index_table[block] & OFF_T_MSB);
-	size = (compr_img->index_table[block + 1] & ~OFF_T_MSB) - start_byte;
-	if (size > sizeof(compr_img->buff_compressed)) {
-		SysPrintf("block %d is too large: %u\n", block, size);
-		return -1;
-	}
+	compr_img->current = data;
 
-	if (fread(is_compressed ? compr_img->buff_compressed : compr_img->buff_raw[0],
-				1, size, cdHandle) != size) {
-		SysPrintf("read error for block %d at %lx: ", block, (long)start_byte);
-		perror(NULL);
-		return -1;
-	}
-
-	if (is_compressed) {
-		cdbuffer_size_expect = sizeof(compr_img->buff_raw[0]) << compr_img->block_shift;
-		cdbuffer_size = cdbuffer_size_expect;
-		ret = uncompress2_pcsx(compr_img->buff_raw[0], &cdbuffer_size, compr_img->buff_compressed, size);
-		if (ret != 0) {
-			SysPrintf("uncompress failed with %d for block %d, sector %d\n",
-					ret, block, sector);
-			return -1;
-		}
-		if (cdbuffer_size != cdbuffer_size_expect)
-			SysPrintf("cdbuffer_size: %lu != %lu, sector %d\n", cdbuffer_size,
-					cdbuffer_size_expect, sector);
-	}
-
-	// done at last!
-	compr_img->current_block = block;
-
-finish:
 	if (dest != NULL)
-		memcpy(dest, compr_img->buff_raw[compr_img->sector_in_blk],
+		memcpy(dest, compr_img->current + compr_img->sector_in_blk * CD_FRAMESIZE_RAW,
 			CD_FRAMESIZE_RAW);
 	return CD_FRAMESIZE_RAW;
 }
 
 #ifdef HAVE_CHD
-static unsigned char *chd_get_sector(unsigned int current_buffer, unsigned int sector_in_hunk)
+static const unsigned char *chd_get_sector(const unsigned char *hunk, unsigned int sector_in_hunk)
 {
-	return chd_img->buffer
-		+ current_buffer * chd_img->header->hunkbytes
-		+ sector_in_hunk * (CD_FRAMESIZE_RAW + SUB_FRAMESIZE);
+	return hunk + sector_in_hunk * (CD_FRAMESIZE_RAW + SUB_FRAMESIZE);
 }
 
 static int cdread_chd(FILE *f, unsigned int base, void *dest, int sector)
 {
+	const unsigned char *buffer;
 	int hunk;
 
 	sector += base;
 
 	hunk = sector / chd_img->sectors_per_hunk;
 	chd_img->sector_in_hunk = sector % chd_img->sectors_per_hunk;
+	buffer = chd_cache_get(hunk, TRUE);
+	if (buffer == NULL)
+		return -1;
 
-	if (hunk == chd_img->current_hunk[0])
-		chd_img->current_buffer = 0;
-	else if (hunk == chd_img->current_hunk[1])
-		chd_img->current_buffer = 1;
-	else
-	{
-		chd_read(chd_img->chd, hunk, chd_img->buffer +
-			chd_img->current_buffer * chd_img->header->hunkbytes);
-		chd_img->current_hunk[chd_img->current_buffer] = hunk;
-	}
+	chd_img->current = buffer;
 
 	if (dest != NULL)
-		memcpy(dest, chd_get_sector(chd_img->current_buffer, chd_img->sector_in_hunk),
+		memcpy(dest, chd_get_sector(chd_img->current, chd_img->sector_in_hunk),
 			CD_FRAMESIZE_RAW);
 	return CD_FRAMESIZE_RAW;
 }
@@ -1304,7 +1225,7 @@ static int cdread_chd(FILE *f, unsigned int base, void *dest, int sector)
 static int cdread_sub_chd(FILE *f, int sector, void *buffer_ptr)
 {
 	unsigned int sector_in_hunk;
-	unsigned int buffer;
+	const unsigned char *buffer;
 	int hunk;
 
 	if (!subChanMixed)
@@ -1312,18 +1233,9 @@ static int cdread_sub_chd(FILE *f, int sector, void *buffer_ptr)
 
 	hunk = sector / chd_img->sectors_per_hunk;
 	sector_in_hunk = sector % chd_img->sectors_per_hunk;
-
-	if (hunk == chd_img->current_hunk[0])
-		buffer = 0;
-	else if (hunk == chd_img->current_hunk[1])
-		buffer = 1;
-	else
-	{
-		buffer = chd_img->current_buffer ^ 1;
-		chd_read(chd_img->chd, hunk, chd_img->buffer +
-			buffer * chd_img->header->hunkbytes);
-		chd_img->current_hunk[buffer] = hunk;
-	}
+	buffer = chd_cache_get(hunk, FALSE);
+	if (buffer == NULL)
+		return -1;
 
 	memcpy(buffer_ptr, chd_get_sector(buffer, sector_in_hunk) + CD_FRAMESIZE_RAW, SUB_FRAMESIZE);
 	return 0;
@@ -1357,12 +1269,14 @@ static void * ISOgetBuffer_normal(void) {
 }
 
 static void * ISOgetBuffer_compr(void) {
-       return compr_img->buff_raw[compr_img->sector_in_blk] + 12;
+       if (compr_img->current == NULL)
+               return cdbuffer + 12;
+       return (void *)(compr_img->current + compr_img->sector_in_blk * CD_FRAMESIZE_RAW + 12);
 }
 
 #ifdef HAVE_CHD
 static void * ISOgetBuffer_chd(void) {
-       return chd_get_sector(chd_img->current_buffer, chd_img->sector_in_hunk) + 12;
+       return (void *)(chd_get_sector(chd_img->current, chd_img->sector_in_hunk) + 12);
 }
 #endif
 
@@ -1533,15 +1447,15 @@ int ISOclose(void)
 	}
 
 	if (compr_img != NULL) {
-		free(compr_img->index_table);
+		compr_cache_close();
 		free(compr_img);
 		compr_img = NULL;
 	}
 
 #ifdef HAVE_CHD
 	if (chd_img != NULL) {
+		chd_cache_close();
 		chd_close(chd_img->chd);
-		free(chd_img->buffer);
 		free(chd_img);
 		chd_img = NULL;
 	}
@@ -1666,6 +1580,24 @@ int ISOreadTrack(const unsigned char *time, void *buf)
 	return 0;
 }
 
+// start decoding a sector that is about to be read, e.g. the target of a seek
+void ISOprefetch(const unsigned char *time)
+{
+	int sector = msf2sec(time);
+
+	if (!cdHandle || !compr_img)
+		return;
+	if (numtracks > 1 && sector >= msf2sec(ti[2].start))
+		return;
+
+	sector -= 2 * 75;
+	if (pregapOffset && sector >= pregapOffset)
+		sector -= 2 * 75;
+
+	if (sector >= 0)
+		compr_cache_prefetch(sector >> compr_img->block_shift);
+}
+
 // read subchannel data
 int ISOreadSub(const unsigned char *time, void *buffer)
 {
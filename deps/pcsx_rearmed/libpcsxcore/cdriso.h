@@ -34,6 +34,7 @@ int ISOclose(void);
 int ISOgetTN(unsigned char *buffer);
 int ISOgetTD(int track, unsigned char *buffer);
 int ISOreadTrack(const unsigned char *time, void *buf);
+void ISOprefetch(const unsigned char *time);
 int ISOreadCDDA(const unsigned char *time, void *buffer);
 int ISOreadSub(const unsigned char *time, void *buffer);
 int ISOgetStatus(struct CdrStat *stat);
@@ -42,198 +42,370 @@ static int  rcdrom_isMediaInserted(void *stream) { return 0; }
 
 #endif
 
-#ifdef USE_C11_THREADS
-#include <threads.h>
-
-static int c11_threads_cb_wrapper(void *cb)
-{
-   ((void (*)(void *))cb)(NULL);
-
-   return 0;
-}
-
-#define slock_new() ({ \
-        mtx_t *lock = malloc(sizeof(*lock)); \
-        if (lock) mtx_init(lock, mtx_plain); \
-        lock; \
-})
-
-#define scond_new() ({ \
-        cnd_t *cnd = malloc(sizeof(*cnd)); \
-        if (cnd) cnd_init(cnd); \
-        cnd; \
-})
-
-#define pcsxr_sthread_create(cb, unused) ({ \
-        thrd_t *thd = malloc(sizeof(*thd)); \
-        if (thd) \
-                thrd_create(thd, c11_threads_cb_wrapper, cb); \
-        thd; \
-})
-
-#define sthread_join(thrd) ({ \
-        thrd_join(*thrd, NULL); \
-        free(thrd); \
-})
-
-#define slock_free(lock) free(lock)
-#define slock_lock(lock) mtx_lock(lock)
-#define slock_unlock(lock) mtx_unlock(lock)
-#define scond_free(cond) free(cond)
-#define scond_wait(cond, lock) cnd_wait(cond, lock)
-#define scond_signal(cond) cnd_signal(cond)
-#define slock_t mtx_t
-#define scond_t cnd_t
-#define sthread_t thrd_t
-#else
-#include "../frontend/libretro-rthreads.h"
-#endif
+#include "sthread.h"
 
 #ifdef HAVE_LIBRETRO
 #include "retro_timers.h"
 #endif
 
+#if defined(__GNUC__)
+#define load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define full_barrier()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#include <stdatomic.h>
+#define load_acquire(p)		(*(volatile u32 *)(p))
+#define store_release(p, v)	(*(volatile u32 *)(p) = (v))
+#define full_barrier()		atomic_thread_fence(memory_order_seq_cst)
+#endif
+
+/*
+ * The sectors are read in place into a ring of slots, indexed by lba.
+ *
+ * The thread owns lba and seq: seq is odd while it fills the slot, and is
+ * bumped again when done. The main thread owns refs: a slot that it
+ * references (the sector of the last cdra_readTrack(), or one that it copies
+ * from) is never refilled. Both check the other's variable after a full
+ * barrier, so either the main thread sees the slot busy, or the thread sees
+ * it referenced and leaves it alone.
+ */
 struct cached_buf {
-   u32 lba;
-   u8 buf[CD_FRAMESIZE_RAW];
+   alignas(64) u8 buf[CD_FRAMESIZE_RAW_ALIGNED];
    u8 buf_sub[SUB_FRAMESIZE];
+   u32 lba;
+   u32 seq;
+   u32 gen;        // of the request it was prefetched for
+   u32 fill_uses;  // uses when it was filled, to tell if it was wasted
+   u32 refs;
+   u32 uses;       // main thread
 };
+
+/*
+ * What the thread prefetches, from the main thread: 'window' sectors from
+ * lba, that is at 'pos' in a run of 'len' sectors (or in a sequential
+ * stream if len is 0), the next run starting 'step' sectors after this one.
+ * gen changes when the previous requests turn out wrong, e.g. after a seek.
+ */
+struct prefetch_req {
+   u32 lba, pos, len, window, gen;
+   s32 step;
+};
+
+#define PREFETCH_MIN      2  // sectors read ahead after a random seek
+#define PREFETCH_SEQ_RUN  4  // sectors in sequence to call it a stream
+
 static struct {
    sthread_t *thread;
    slock_t *read_lock;
-   slock_t *buf_lock;
+   slock_t *lock;
    scond_t *cond;
    struct cached_buf *buf_cache;
+   void *buf_cache_mem;
    u32 buf_cnt, thread_exit, do_prefetch, prefetch_failed, have_subchannel;
    u32 total_lba, prefetch_lba;
    int check_eject_delay;
 
+   // access pattern, main thread only
+   u32 last_lba, run_start, run, pattern;
+   s32 step;
+
+   // published to the thread, seq is odd while it's updated
+   struct prefetch_req req;
+   u32 req_seq;
+
+   struct cdra_stats stats;
+
+   // the sector of the last cdra_readTrack(), either in a slot or here
+   struct cached_buf *cur_slot;
+   u8 *cur_buf;
+
    // single sector cache, not touched by the thread
    alignas(64) u8 buf_local[CD_FRAMESIZE_RAW_ALIGNED];
 } acdrom;
 
-static void lbacache_do(u32 lba)
+static int lbacache_claim(struct cached_buf *slot)
+{
+   if (load_acquire(&slot->refs))
+      return 0;
+
+   store_release(&slot->seq, slot->seq + 1);
+   full_barrier();
+   if (load_acquire(&slot->refs)) {
+      store_release(&slot->seq, slot->seq + 1);
+      return 0;
+   }
+
+   return 1;
+}
+
+static void lbacache_do(u32 lba, u32 gen)
 {
-   alignas(64) unsigned char buf[CD_FRAMESIZE_RAW_ALIGNED];
-   unsigned char msf[3], buf_sub[SUB_FRAMESIZE];
-   u32 i = lba % acdrom.buf_cnt;
+   struct cached_buf *slot = &acdrom.buf_cache[lba % acdrom.buf_cnt];
+   unsigned char msf[3];
    int ret;
 
+   if (!lbacache_claim(slot)) {
+      // the main thread is using the slot, it's as far as we can go
+      acdrom.do_prefetch = 0;
+      return;
+   }
+
    lba2msf(lba + 150, &msf[0], &msf[1], &msf[2]);
    slock_lock(acdrom.read_lock);
+   if (load_acquire(&acdrom.req.gen) != gen) {
+      // the main thread seeked elsewhere while we waited, the slot is intact
+      store_release(&slot->seq, slot->seq + 1);
+      slock_unlock(acdrom.read_lock);
+      return;
+   }
+   if (slot->lba != ~0 && load_acquire(&slot->uses) == slot->fill_uses)
+      acdrom.stats.wasted++;
+   acdrom.stats.prefetched++;
    if (g_cd_handle)
-      ret = rcdrom_readSector(g_cd_handle, lba, buf);
+      ret = rcdrom_readSector(g_cd_handle, lba, slot->buf);
    else
-      ret = ISOreadTrack(msf, buf);
+      ret = ISOreadTrack(msf, slot->buf);
    if (acdrom.have_subchannel) {
       if (g_cd_handle)
-         ret |= rcdrom_readSub(g_cd_handle, lba, buf_sub);
+         ret |= rcdrom_readSub(g_cd_handle, lba, slot->buf_sub);
       else
-         ret |= ISOreadSub(msf, buf_sub);
+         ret |= ISOreadSub(msf, slot->buf_sub);
    }
 
-   slock_lock(acdrom.buf_lock);
+   // done before a main thread waiting for the read can look
+   slot->lba = ret ? ~0 : lba;
+   slot->gen = gen;
+   slot->fill_uses = slot->uses;
+   store_release(&slot->seq, slot->seq + 1);
    slock_unlock(acdrom.read_lock);
+
    acdrom_dbg("c  %d:%02d:%02d %2d m%d f%d\n", msf[0], msf[1], msf[2], ret,
-         buf[12+3], ((buf[12+4+2] >> 5) & 1) + 1);
+         slot->buf[12+3], ((slot->buf[12+4+2] >> 5) & 1) + 1);
+
    if (ret) {
       acdrom.do_prefetch = 0;
       acdrom.prefetch_failed = 1;
-      slock_unlock(acdrom.buf_lock);
       SysPrintf("prefetch: read failed for lba %d: %d\n", lba, ret);
       return;
    }
    acdrom.prefetch_failed = 0;
    acdrom.check_eject_delay = 100;
-
-   if (lba != acdrom.buf_cache[i].lba) {
-      acdrom.buf_cache[i].lba = lba;
-      memcpy(acdrom.buf_cache[i].buf, buf, sizeof(acdrom.buf_cache[i].buf));
-      if (acdrom.have_subchannel)
-         memcpy(acdrom.buf_cache[i].buf_sub, buf_sub, sizeof(buf_sub));
-   }
-   slock_unlock(acdrom.buf_lock);
 #ifdef HAVE_LIBRETRO
    if (g_cd_handle)
       retro_sleep(0); // why does the main thread stall without this?
 #endif
 }
 
-static int lbacache_get(unsigned int lba, void *buf, void *sub_buf)
+// main thread only, returns the referenced slot that holds the sector
+static struct cached_buf *lbacache_get(unsigned int lba)
 {
-   unsigned int i;
-   int ret = 0;
+   struct cached_buf *slot = &acdrom.buf_cache[lba % acdrom.buf_cnt];
+   u32 seq;
 
-   i = lba % acdrom.buf_cnt;
-   slock_lock(acdrom.buf_lock);
-   if (lba == acdrom.buf_cache[i].lba) {
-      if (buf)
-         memcpy(buf, acdrom.buf_cache[i].buf, CD_FRAMESIZE_RAW);
-      if (sub_buf)
-         memcpy(sub_buf, acdrom.buf_cache[i].buf_sub, SUB_FRAMESIZE);
-      ret = 1;
+   store_release(&slot->refs, slot->refs + 1);
+   full_barrier();
+   seq = load_acquire(&slot->seq);
+   if (!(seq & 1) && slot->lba == lba) {
+      store_release(&slot->uses, slot->uses + 1);
+      return slot;
    }
-   slock_unlock(acdrom.buf_lock);
-   return ret;
+
+   store_release(&slot->refs, slot->refs - 1);
+   return NULL;
+}
+
+static void lbacache_put(struct cached_buf *slot)
+{
+   store_release(&slot->refs, slot->refs - 1);
+}
+
+static int lbacache_has(u32 lba)
+{
+   const struct cached_buf *slot = &acdrom.buf_cache[lba % acdrom.buf_cnt];
+
+   return !(load_acquire(&slot->seq) & 1) && slot->lba == lba;
+}
+
+static u32 prefetch_req_lba(const struct prefetch_req *req, u32 k)
+{
+   u32 i = req->pos + k;
+
+   if (!req->len)
+      return req->lba + k;
+
+   return req->lba - req->pos + (i / req->len) * req->step + i % req->len;
+}
+
+static void prefetch_req_get(struct prefetch_req *req)
+{
+   u32 seq;
+
+   do {
+      seq = load_acquire(&acdrom.req_seq);
+      *req = acdrom.req;
+      full_barrier();
+   } while ((seq & 1) || seq != load_acquire(&acdrom.req_seq));
+}
+
+static void prefetch_req_set(const struct prefetch_req *req)
+{
+   store_release(&acdrom.req_seq, acdrom.req_seq + 1);
+   full_barrier();
+   acdrom.req = *req;
+   store_release(&acdrom.req_seq, acdrom.req_seq + 1);
+}
+
+/*
+ * Follows the sectors that the drive goes to, and sizes the read-ahead:
+ * - a sequential stream gets half as many sectors ahead as it has read
+ *   already, up to buf_cnt;
+ * - runs that start at a constant distance from each other (strided) get
+ *   the rest of the run and the next one;
+ * - a random seek gets PREFETCH_MIN sectors, and drops what was queued.
+ */
+static void cdra_follow(u32 lba)
+{
+   struct prefetch_req req = acdrom.req;
+   u32 window, len = req.len;
+   s32 step;
+
+   if (lba == acdrom.last_lba)
+      return;
+
+   if (lba == acdrom.last_lba + 1) {
+      acdrom.run++;
+      if (acdrom.pattern == CDRA_PATTERN_STRIDED && acdrom.run > len) {
+         // the run went on past the stride, the next run won't come
+         acdrom.pattern = CDRA_PATTERN_SEQUENTIAL;
+         req.gen++;
+      }
+      else if (acdrom.pattern == CDRA_PATTERN_RANDOM && acdrom.run >= PREFETCH_SEQ_RUN)
+         acdrom.pattern = CDRA_PATTERN_SEQUENTIAL;
+   }
+   else {
+      step = lba - acdrom.run_start;
+      if (step == acdrom.step && step != 0 && acdrom.run_start != ~0) {
+         // the run that ended gives the length of the next ones
+         len = acdrom.run;
+         if (acdrom.pattern != CDRA_PATTERN_STRIDED || len != req.len)
+            req.gen++;
+         acdrom.pattern = CDRA_PATTERN_STRIDED;
+      }
+      else {
+         acdrom.pattern = CDRA_PATTERN_RANDOM;
+         req.gen++;
+      }
+      acdrom.step = step;
+      acdrom.run_start = lba;
+      acdrom.run = 1;
+   }
+   acdrom.last_lba = lba;
+
+   if (acdrom.pattern == CDRA_PATTERN_STRIDED) {
+      window = len * 2;
+      if (window < PREFETCH_SEQ_RUN * 2)
+         window = PREFETCH_SEQ_RUN * 2;
+      req.pos = acdrom.run - 1;
+      req.len = len;
+      req.step = acdrom.step;
+   }
+   else {
+      window = acdrom.run / 2;
+      req.pos = req.len = 0;
+      req.step = 1;
+   }
+   if (window < PREFETCH_MIN)
+      window = PREFETCH_MIN;
+   if (window > acdrom.buf_cnt)
+      window = acdrom.buf_cnt;
+
+   req.lba = lba;
+   req.window = acdrom.stats.window = window;
+   acdrom.stats.pattern = acdrom.pattern;
+   prefetch_req_set(&req);
 }
 
 // note: This has races on some vars but that's ok, main thread can deal
-// with it. Only unsafe buffer accesses and simultaneous reads are prevented.
+// with it. The slots are protected by their seq and refs, the lock is only
+// there to sleep on.
 static void cdra_prefetch_thread(void *unused)
 {
-   u32 buf_cnt, lba, lba_to;
+   const struct cached_buf *slot;
+   struct prefetch_req req;
+   u32 buf_cnt, lba = 0, k;
 
-   slock_lock(acdrom.buf_lock);
+   slock_lock(acdrom.lock);
    while (!acdrom.thread_exit)
    {
 #ifdef __GNUC__
       __asm__ __volatile__("":::"memory"); // barrier
 #endif
       if (!acdrom.do_prefetch)
-         scond_wait(acdrom.cond, acdrom.buf_lock);
+         scond_wait(acdrom.cond, acdrom.lock);
       if (!acdrom.do_prefetch || acdrom.thread_exit)
          continue;
 
       buf_cnt = acdrom.buf_cnt;
-      lba = acdrom.prefetch_lba;
-      lba_to = lba + buf_cnt;
-      if (lba_to > acdrom.total_lba)
-         lba_to = acdrom.total_lba;
-      for (; lba < lba_to; lba++) {
-         if (lba != acdrom.buf_cache[lba % buf_cnt].lba)
+      prefetch_req_get(&req);
+      for (k = 0; k < req.window; k++) {
+         lba = prefetch_req_lba(&req, k);
+         if (lba >= acdrom.total_lba)
             break;
+         slot = &acdrom.buf_cache[lba % buf_cnt];
+         if (lba == slot->lba)
+            continue;
+         // don't evict a sector of this same request before it's used
+         if (slot->lba != ~0 && slot->gen == req.gen
+             && load_acquire(&slot->uses) == slot->fill_uses)
+            k = req.window;
+         break;
       }
-      if (lba == lba_to || lba >= acdrom.total_lba) {
+      if (k == req.window || lba >= acdrom.total_lba) {
          // caching complete
          acdrom.do_prefetch = 0;
          continue;
       }
 
-      slock_unlock(acdrom.buf_lock);
-      lbacache_do(lba);
-      slock_lock(acdrom.buf_lock);
+      slock_unlock(acdrom.lock);
+      lbacache_do(lba, req.gen);
+      slock_lock(acdrom.lock);
    }
-   slock_unlock(acdrom.buf_lock);
+   slock_unlock(acdrom.lock);
+}
+
+// the previous sector stays referenced until the next one is in place
+static void cdra_set_cur(struct cached_buf *slot)
+{
+   if (acdrom.cur_slot)
+      lbacache_put(acdrom.cur_slot);
+   acdrom.cur_slot = slot;
+   acdrom.cur_buf = slot ? slot->buf : acdrom.buf_local;
 }
 
 void cdra_stop_thread(void)
 {
    acdrom.thread_exit = 1;
-   if (acdrom.buf_lock) {
-      slock_lock(acdrom.buf_lock);
+   if (acdrom.lock) {
+      slock_lock(acdrom.lock);
       acdrom.do_prefetch = 0;
       if (acdrom.cond)
          scond_signal(acdrom.cond);
-      slock_unlock(acdrom.buf_lock);
+      slock_unlock(acdrom.lock);
    }
    if (acdrom.thread) {
       sthread_join(acdrom.thread);
       acdrom.thread = NULL;
    }
    if (acdrom.cond) { scond_free(acdrom.cond); acdrom.cond = NULL; }
-   if (acdrom.buf_lock) { slock_free(acdrom.buf_lock); acdrom.buf_lock = NULL; }
+   if (acdrom.lock) { slock_free(acdrom.lock); acdrom.lock = NULL; }
    if (acdrom.read_lock) { slock_free(acdrom.read_lock); acdrom.read_lock = NULL; }
-   free(acdrom.buf_cache);
+   if (acdrom.cur_slot) {
+      // keep cdra_getBuffer() valid
+      memcpy(acdrom.buf_local, acdrom.cur_slot->buf, sizeof(acdrom.buf_local));
+      cdra_set_cur(NULL);
+   }
+   free(acdrom.buf_cache_mem);
+   acdrom.buf_cache_mem = NULL;
    acdrom.buf_cache = NULL;
 }
 
@@ -243,18 +415,24 @@ static void cdra_start_thread(void)
    cdra_stop_thread();
    acdrom.thread_exit = acdrom.prefetch_lba = acdrom.do_prefetch = 0;
    acdrom.prefetch_failed = 0;
+   acdrom.last_lba = acdrom.run_start = ~0;
+   acdrom.run = acdrom.step = 0;
+   acdrom.pattern = CDRA_PATTERN_RANDOM;
+   memset(&acdrom.req, 0, sizeof(acdrom.req));
+   memset(&acdrom.stats, 0, sizeof(acdrom.stats));
    if (acdrom.buf_cnt == 0)
       return;
-   acdrom.buf_cache = calloc(acdrom.buf_cnt, sizeof(acdrom.buf_cache[0]));
-   acdrom.buf_lock = slock_new();
+   acdrom.buf_cache_mem = calloc(1, acdrom.buf_cnt * sizeof(acdrom.buf_cache[0]) + 63);
+   acdrom.buf_cache = (void *)(((uintptr_t)acdrom.buf_cache_mem + 63) & ~(uintptr_t)63);
+   acdrom.lock = slock_new();
    acdrom.read_lock = slock_new();
    acdrom.cond = scond_new();
-   if (acdrom.buf_cache && acdrom.buf_lock && acdrom.read_lock && acdrom.cond)
+   if (acdrom.buf_cache_mem && acdrom.lock && acdrom.read_lock && acdrom.cond)
    {
       int i;
-      acdrom.thread = pcsxr_sthread_create(cdra_prefetch_thread, PCSXRT_CDR);
       for (i = 0; i < acdrom.buf_cnt; i++)
          acdrom.buf_cache[i].lba = ~0;
+      acdrom.thread = pcsxr_sthread_create(cdra_prefetch_thread, PCSXRT_CDR);
    }
    if (acdrom.thread) {
       SysPrintf("cdrom precache: %d buffers%s\n",
@@ -346,37 +524,46 @@ int cdra_prefetch(unsigned char m, unsigned char s, unsigned char f)
    u32 lba = MSF2SECT(m, s, f);
    int ret = 1;
    if (acdrom.cond) {
+      cdra_follow(lba);
+      if (acdrom.cur_slot == &acdrom.buf_cache[lba % acdrom.buf_cnt]
+          && acdrom.cur_slot->lba != lba) {
+         // the sector of cdra_getBuffer() is in the way
+         memcpy(acdrom.buf_local, acdrom.cur_slot->buf, sizeof(acdrom.buf_local));
+         cdra_set_cur(NULL);
+      }
       acdrom.prefetch_lba = lba;
       acdrom.do_prefetch = 1;
       scond_signal(acdrom.cond);
    }
    if (acdrom.buf_cache && !acdrom.prefetch_failed) {
-     u32 c = acdrom.buf_cnt;
-     if (c)
-        ret = acdrom.buf_cache[lba % c].lba == lba;
+     ret = lbacache_has(lba);
      acdrom_dbg("p  %d:%02d:%02d %d\n", m, s, f, ret);
    }
    return ret;
 }
 
-static int cdra_do_read(const unsigned char *time, int cdda,
-      void *buf, void *buf_sub)
+// returns the slot of the sector, referenced, if it was cached
+static struct cached_buf *cdra_do_read(const unsigned char *time, int cdda,
+      void *buf, void *buf_sub, int *ret_out)
 {
    u32 lba = MSF2SECT(time[0], time[1], time[2]);
+   struct cached_buf *slot = NULL;
    int hit = 0, ret = -1, read_locked = 0;
    do
    {
-      if (acdrom.buf_lock) {
-         hit = lbacache_get(lba, buf, buf_sub);
-         if (hit)
+      if (acdrom.buf_cache) {
+         slot = lbacache_get(lba);
+         if (slot) {
+            hit = 1;
             break;
+         }
       }
       if (acdrom.read_lock) {
          // maybe still prefetching
          slock_lock(acdrom.read_lock);
          read_locked = 1;
-         hit = lbacache_get(lba, buf, buf_sub);
-         if (hit) {
+         slot = lbacache_get(lba);
+         if (slot) {
             hit = 2;
             break;
          }
@@ -402,36 +589,65 @@ static int cdra_do_read(const unsigned char *time, int cdda,
       slock_unlock(acdrom.read_lock);
    if (hit)
       ret = 0;
+   if (acdrom.buf_cache && !buf_sub) {
+      if (hit)
+         acdrom.stats.hits++;
+      else
+         acdrom.stats.misses++;
+   }
    acdrom.check_eject_delay = ret ? 0 : 100;
    acdrom_dbg("f%c %d:%02d:%02d %d%s\n",
       buf_sub ? 's' : (cdda ? 'c' : 'd'),
       time[0], time[1], time[2], hit, ret ? " ERR" : "");
-   return ret;
+   *ret_out = ret;
+   return slot;
 }
 
 // time: msf in non-bcd format
 int cdra_readTrack(const unsigned char *time)
 {
+   struct cached_buf *slot;
+   int ret;
+
    if (!acdrom.thread && !g_cd_handle) {
       // just forward to ISOreadTrack to avoid extra copying
       return ISOreadTrack(time, NULL);
    }
-   return cdra_do_read(time, 0, acdrom.buf_local, NULL);
+   // a hit is used in place, a miss is read into buf_local
+   slot = cdra_do_read(time, 0, acdrom.buf_local, NULL, &ret);
+   cdra_set_cur(slot);
+   return ret;
 }
 
 int cdra_readCDDA(const unsigned char *time, void *buffer)
 {
-   return cdra_do_read(time, 1, buffer, NULL);
+   struct cached_buf *slot;
+   int ret;
+
+   slot = cdra_do_read(time, 1, buffer, NULL, &ret);
+   if (slot) {
+      memcpy(buffer, slot->buf, CD_FRAMESIZE_RAW);
+      lbacache_put(slot);
+   }
+   return ret;
 }
 
 int cdra_readSub(const unsigned char *time, void *buffer)
 {
+   struct cached_buf *slot;
+   int ret;
+
    if (!acdrom.thread && !g_cd_handle)
       return ISOreadSub(time, buffer);
    if (!acdrom.have_subchannel)
       return -1;
    acdrom_dbg("s  %d:%02d:%02d\n", time[0], time[1], time[2]);
-   return cdra_do_read(time, 0, NULL, buffer);
+   slot = cdra_do_read(time, 0, NULL, buffer, &ret);
+   if (slot) {
+      memcpy(buffer, slot->buf_sub, SUB_FRAMESIZE);
+      lbacache_put(slot);
+   }
+   return ret;
 }
 
 // pointer to cached buffer from last cdra_readTrack() call
@@ -440,7 +656,7 @@ void *cdra_getBuffer(void)
    //acdrom_dbg("%s\n", __func__);
    if (!acdrom.thread && !g_cd_handle)
       return ISOgetBuffer();
-   return acdrom.buf_local + 12;
+   return (acdrom.cur_buf ? acdrom.cur_buf : acdrom.buf_local) + 12;
 }
 
 int cdra_getStatus(struct CdrStat *stat)
@@ -492,14 +708,19 @@ int cdra_get_buf_cached_approx(void)
    if (left > total)
       left = total;
    for (; lba < total && left > 0; lba++, left--)
-      if (lba == acdrom.buf_cache[lba % buf_cnt].lba)
+      if (lbacache_has(lba))
          buf_use++;
    for (lba = 0; left > 0; lba++, left--)
-      if (lba == acdrom.buf_cache[lba % buf_cnt].lba)
+      if (lbacache_has(lba))
          buf_use++;
 
    return buf_use;
 }
+
+void cdra_get_stats(struct cdra_stats *stats)
+{
+   *stats = acdrom.stats;
+}
 #else
 
 // phys. CD-ROM without a cache is unusable so not implemented
@@ -540,6 +761,10 @@ int cdra_getTD(int track, unsigned char *rt)
 
 int cdra_prefetch(unsigned char m, unsigned char s, unsigned char f)
 {
+   const unsigned char time[3] = { m, s, f };
+
+   // nothing is cached here, but cdriso can start decoding the sector
+   ISOprefetch(time);
    return 1; // always hit
 }
 
@@ -576,6 +801,7 @@ void cdra_stop_thread(void) {}
 void cdra_set_buf_count(int newcount) {}
 int  cdra_get_buf_count(void) { return 0; }
 int  cdra_get_buf_cached_approx(void) { return 0; }
+void cdra_get_stats(struct cdra_stats *stats) { memset(stats, 0, sizeof(*stats)); }
 
 #endif
 
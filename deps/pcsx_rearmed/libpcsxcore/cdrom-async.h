@@ -6,6 +6,21 @@ extern "C" {
 
 struct CdrStat;
 
+enum cdra_pattern {
+	CDRA_PATTERN_RANDOM,
+	CDRA_PATTERN_SEQUENTIAL,
+	CDRA_PATTERN_STRIDED,
+};
+
+struct cdra_stats {
+	u32 hits;	// sectors read from the prefetch buffers
+	u32 misses;	// sectors read from the disc on demand
+	u32 prefetched;
+	u32 wasted;	// prefetched sectors dropped before any use
+	u32 window;	// sectors currently read ahead
+	u32 pattern;	// enum cdra_pattern
+};
+
 #ifdef HAVE_CDROM
 void *rcdrom_open(const char *name, u32 *total_lba, u32 *have_sub);
 void rcdrom_close(void *stream);
@@ -35,6 +50,7 @@ void cdra_stop_thread(void);
 void cdra_set_buf_count(int count);
 int  cdra_get_buf_count(void);
 int  cdra_get_buf_cached_approx(void);
+void cdra_get_stats(struct cdra_stats *stats);
 
 void *cdra_getBuffer(void);
 
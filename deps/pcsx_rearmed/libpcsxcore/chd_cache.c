@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+ * Decoder of the CHD hunks, for the cache of cdimg_cache.c. The worker
+ * threads each open their own chd_file.
+ */
+
+#ifdef HAVE_CHD
+
+#include <libchdr/chd.h>
+#include "cdimg_cache.h"
+#include "chd_cache.h"
+
+// the read errors are ignored, as cdriso.c always did
+static int decode_hunk(void *chd, u32 hunk, u8 *data, int sector)
+{
+	chd_read(chd, hunk, data);
+
+	return 0;
+}
+
+static void *open_chd(const char *path)
+{
+	chd_file *chd;
+
+	if (chd_open(path, CHD_OPEN_READ, NULL, &chd) != CHDERR_NONE)
+		return NULL;
+
+	return chd;
+}
+
+static void close_chd(void *chd)
+{
+	chd_close(chd);
+}
+
+static const struct cdimg_cache_ops chd_ops = {
+	.name = "chd",
+	.decode = decode_hunk,
+	.open = open_chd,
+	.close = close_chd,
+};
+
+const u8 *chd_cache_get(u32 hunk, boolean stream)
+{
+	return cdimg_cache_get(hunk, stream, -1);
+}
+
+int chd_cache_open(chd_file *chd, const char *path, u32 cache_size,
+		   u32 ahead, u32 threads)
+{
+	const chd_header *header = chd_get_header(chd);
+
+	return cdimg_cache_open(&chd_ops, chd, path, header->hunkcount,
+				header->hunkbytes, cache_size, ahead, threads);
+}
+
+void chd_cache_close(void)
+{
+	cdimg_cache_close();
+}
+
+#endif // HAVE_CHD
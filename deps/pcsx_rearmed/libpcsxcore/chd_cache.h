@@ -0,0 +1,28 @@
+#ifndef __CHD_CACHE_H__
+#define __CHD_CACHE_H__
+
+#include "psxcommon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _chd_file;
+
+/* Up to 'cache_size' bytes of decoded hunks are kept. 'ahead' hunks are
+ * decoded ahead of the reads, on 'threads' worker threads that open their
+ * own handle to 'path', up to CDIMG_CACHE_MAX_THREADS. Without threads,
+ * the hunks are decoded on demand only. */
+int  chd_cache_open(struct _chd_file *chd, const char *path, u32 cache_size,
+		    u32 ahead, u32 threads);
+void chd_cache_close(void);
+
+/* Returns the decoded hunk, valid until the next call, or NULL past the end
+ * of the image. A stream read is one of the data reads, that the read-ahead
+ * follows; the hunk it returns stays valid until the next stream read. */
+const u8 *chd_cache_get(u32 hunk, boolean stream);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __CHD_CACHE_H__
@@ -0,0 +1,229 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+ * Decoder of the blocks of the compressed images (PBP, CBIN), for the cache
+ * of cdimg_cache.c. The worker threads each open their own file handle and
+ * z_stream.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "system.h"
+#include "cdrom.h"
+#include "cdimg_cache.h"
+#include "compr_cache.h"
+
+#ifdef USE_LIBRETRO_VFS
+#include <streams/file_stream_transforms.h>
+#undef fseeko
+#define fseeko rfseek
+#endif
+
+#define INDEX_PLAIN	0x80000000
+
+struct compr_decoder {
+	FILE *f;
+	z_stream z;
+	boolean z_init;
+	unsigned char in[CD_FRAMESIZE_RAW * 16 + 100];
+};
+
+static struct {
+	u32 *index;
+	u32 index_len;
+	off_t base;
+	u32 align;
+	u32 block_size;
+
+	struct compr_decoder *dec;	// of the caller's thread, on its file
+} zc;
+
+static off_t block_offset(u32 block)
+{
+	return zc.base + ((off_t)(zc.index[block] & ~INDEX_PLAIN) << zc.align);
+}
+
+static int inflate_block(struct compr_decoder *dec, void *out,
+			 unsigned long *out_size, unsigned long in_size)
+{
+	z_stream *z = &dec->z;
+	int ret;
+
+	if (!dec->z_init) {
+		memset(z, 0, sizeof(*z));
+		ret = inflateInit2(z, -15);
+		dec->z_init = ret == Z_OK;
+	}
+	else
+		ret = inflateReset(z);
+	if (ret != Z_OK)
+		return ret;
+
+	z->next_in = dec->in;
+	z->avail_in = in_size;
+	z->next_out = out;
+	z->avail_out = *out_size;
+
+	ret = inflate(z, Z_NO_FLUSH);
+
+	*out_size -= z->avail_out;
+	return ret == Z_STREAM_END ? 0 : ret;
+}
+
+// the workers pass a negative sector, their errors are reported on demand
+static int decode_block(void *decoder, u32 block, u8 *data, int sector)
+{
+	struct compr_decoder *dec = decoder;
+	boolean verbose = sector >= 0;
+	unsigned long out_size;
+	u32 size;
+	int is_compressed, ret;
+	off_t start_byte;
+
+	start_byte = block_offset(block);
+	if (fseeko(dec->f, start_byte, SEEK_SET) != 0) {
+		if (verbose) {
+			SysPrintf("seek error for block %d at %llx: ",
+				block, (long long)start_byte);
+			perror(NULL);
+		}
+		return -1;
+	}
+
+	is_compressed = !(zc.index[block] & INDEX_PLAIN);
+	size = block_offset(block + 1) - start_byte;
+	if (size > sizeof(dec->in)) {
+		if (verbose)
+			SysPrintf("block %d is too large: %u\n", block, size);
+		return -1;
+	}
+
+	// a plain block is read in place, past its data is the alignment padding
+	if (!is_compressed && size > zc.block_size)
+		size = zc.block_size;
+
+	if (fread(is_compressed ? dec->in : data, 1, size, dec->f) != size) {
+		if (verbose) {
+			SysPrintf("read error for block %d at %lx: ", block, (long)start_byte);
+			perror(NULL);
+		}
+		return -1;
+	}
+
+	out_size = zc.block_size;
+	if (is_compressed) {
+		ret = inflate_block(dec, data, &out_size, size);
+		if (ret != 0) {
+			if (verbose)
+				SysPrintf("uncompress failed with %d for block %d, sector %d\n",
+					ret, block, sector);
+			return -1;
+		}
+	}
+
+	if (verbose && out_size != zc.block_size)
+		SysPrintf("cdbuffer_size: %lu != %lu, sector %d\n", out_size,
+				(unsigned long)zc.block_size, sector);
+
+	return 0;
+}
+
+static void free_decoder(struct compr_decoder *dec)
+{
+	if (dec && dec->z_init)
+		inflateEnd(&dec->z);
+	free(dec);
+}
+
+static void *open_decoder(const char *path)
+{
+	struct compr_decoder *dec = calloc(1, sizeof(*dec));
+
+	if (dec)
+		dec->f = fopen(path, "rb");
+	if (dec && !dec->f) {
+		free(dec);
+		dec = NULL;
+	}
+
+	return dec;
+}
+
+static void close_decoder(void *decoder)
+{
+	struct compr_decoder *dec = decoder;
+
+	fclose(dec->f);
+	free_decoder(dec);
+}
+
+static const struct cdimg_cache_ops compr_ops = {
+	.name = "compr",
+	.decode = decode_block,
+	.open = open_decoder,
+	.close = close_decoder,
+};
+
+const u8 *compr_cache_get(u32 block, int sector)
+{
+	if (block >= zc.index_len) {
+		SysPrintf("sector %d is past img end\n", sector);
+		return NULL;
+	}
+
+	return cdimg_cache_get(block, TRUE, sector);
+}
+
+int compr_cache_open(FILE *f, const char *path, u32 *index, u32 index_len,
+		     off_t base, u32 align, u32 block_shift, u32 cache_size)
+{
+	compr_cache_close();
+
+	zc.index = index;
+	zc.index_len = index_len;
+	zc.base = base;
+	zc.align = align;
+	zc.block_size = CD_FRAMESIZE_RAW << block_shift;
+
+	zc.dec = calloc(1, sizeof(*zc.dec));
+	if (!zc.dec) {
+		compr_cache_close();
+		return -1;
+	}
+
+	zc.dec->f = f;
+
+	// one block is read ahead, the next one of the stream or a seek target
+	if (cdimg_cache_open(&compr_ops, zc.dec, path, index_len, zc.block_size,
+			     cache_size, 1, 1)) {
+		compr_cache_close();
+		return -1;
+	}
+
+	return 0;
+}
+
+void compr_cache_close(void)
+{
+	cdimg_cache_close();
+	free_decoder(zc.dec);
+	free(zc.index);
+	memset(&zc, 0, sizeof(zc));
+}
+
+void compr_cache_prefetch(u32 block)
+{
+	cdimg_cache_prefetch(block);
+}
+
@@ -0,0 +1,33 @@
+#ifndef __COMPR_CACHE_H__
+#define __COMPR_CACHE_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "psxcommon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 'index' has index_len + 1 entries, in the CISO format: the offset of
+ * each block from 'base' in units of 1 << align, with the MSB set for the
+ * blocks that are stored uncompressed. It is freed by compr_cache_close().
+ * 'f' is used on the caller's thread; the worker thread, if any, opens its
+ * own handle to 'path'. Up to 'cache_size' bytes of inflated blocks are
+ * kept, and at least what the read-ahead needs (see cdimg_cache.h). */
+int  compr_cache_open(FILE *f, const char *path, u32 *index, u32 index_len,
+		      off_t base, u32 align, u32 block_shift, u32 cache_size);
+void compr_cache_close(void);
+
+/* Returns the decoded block, valid until the next call, or NULL on error.
+ * 'sector' is only used for the error messages. */
+const u8 *compr_cache_get(u32 block, int sector);
+
+/* Queues a block that is about to be read, e.g. the target of a seek, to be
+ * inflated by the worker thread. Does nothing without threads. */
+void compr_cache_prefetch(u32 block);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __COMPR_CACHE_H__
@@ -0,0 +1,156 @@
+/***************************************************************************
+ *   Copyright (C) 2026 PCSX team                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02111-1307 USA.           *
+ ***************************************************************************/
+
+#ifndef __EVENT_HEAP_H__
+#define __EVENT_HEAP_H__
+
+/*
+ * Binary min-heap of event deadlines, indexed by event so that an event
+ * can be rescheduled or cancelled in O(log n). Deadlines are cycle counts
+ * that wrap around, they are compared relative to each other.
+ */
+
+#include "psxcommon.h"
+
+#define EVENT_HEAP_SIZE		32
+#define EVENT_HEAP_NONE		0xff
+
+struct event_heap {
+	u32 deadline[EVENT_HEAP_SIZE];	// by heap slot
+	u8 event[EVENT_HEAP_SIZE];	// by heap slot
+	u8 slot[EVENT_HEAP_SIZE];	// by event, EVENT_HEAP_NONE if not queued
+	u32 count;
+};
+
+// Record of the event trace, see EVENTS_TRACE in psxevents.c
+enum {
+	EVENT_TRACE_QUEUE,	// event 'e' set to fire at 'cycle'
+	EVENT_TRACE_SCHEDULE,	// schedule_timeslice() at 'cycle'
+	EVENT_TRACE_TEST,	// irq_test() at 'cycle'
+};
+
+struct event_trace {
+	u32 op;
+	u32 e;
+	u32 cycle;
+	u32 pending;		// psxRegs.interrupt
+};
+
+static inline void event_heap_init(struct event_heap *h)
+{
+	memset(h->slot, EVENT_HEAP_NONE, sizeof(h->slot));
+	h->count = 0;
+}
+
+static inline int event_heap_before(u32 a, u32 b)
+{
+	return (s32)(a - b) < 0;
+}
+
+static inline void event_heap_set(struct event_heap *h, u32 i, u32 e, u32 deadline)
+{
+	h->deadline[i] = deadline;
+	h->event[i] = e;
+	h->slot[e] = i;
+}
+
+static inline void event_heap_sift(struct event_heap *h, u32 i)
+{
+	u32 e = h->event[i], deadline = h->deadline[i];
+	u32 parent, child;
+
+	for (; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!event_heap_before(deadline, h->deadline[parent]))
+			break;
+
+		event_heap_set(h, i, h->event[parent], h->deadline[parent]);
+	}
+
+	for (; (child = 2 * i + 1) < h->count; i = child) {
+		if (child + 1 < h->count
+		    && event_heap_before(h->deadline[child + 1], h->deadline[child]))
+			child++;
+
+		if (!event_heap_before(h->deadline[child], deadline))
+			break;
+
+		event_heap_set(h, i, h->event[child], h->deadline[child]);
+	}
+
+	event_heap_set(h, i, e, deadline);
+}
+
+static inline void event_heap_queue(struct event_heap *h, u32 e, u32 deadline)
+{
+	u32 i = h->slot[e];
+
+	if (i == EVENT_HEAP_NONE)
+		i = h->count++;
+
+	h->event[i] = e;
+	h->deadline[i] = deadline;
+	event_heap_sift(h, i);
+}
+
+static inline void event_heap_remove(struct event_heap *h, u32 e)
+{
+	u32 i = h->slot[e], last;
+
+	if (i == EVENT_HEAP_NONE)
+		return;
+
+	h->slot[e] = EVENT_HEAP_NONE;
+	last = --h->count;
+
+	if (i != last) {
+		h->event[i] = h->event[last];
+		h->deadline[i] = h->deadline[last];
+		event_heap_sift(h, i);
+	}
+}
+
+/* Mask of the queued events that are in 'pending' and due at 'cycle' */
+static inline u32 event_heap_due(const struct event_heap *h, u32 pending,
+				 u32 cycle)
+{
+	u32 stack[EVENT_HEAP_SIZE], sp = 0, i, mask = 0;
+
+	if (h->count)
+		stack[sp++] = 0;
+
+	while (sp) {
+		i = stack[--sp];
+
+		// nothing below a slot that isn't due is due
+		if (event_heap_before(cycle, h->deadline[i]))
+			continue;
+
+		mask |= (1u << h->event[i]) & pending;
+
+		if (2 * i + 1 < h->count)
+			stack[sp++] = 2 * i + 1;
+		if (2 * i + 2 < h->count)
+			stack[sp++] = 2 * i + 2;
+	}
+
+	return mask;
+}
+
+#endif // __EVENT_HEAP_H__
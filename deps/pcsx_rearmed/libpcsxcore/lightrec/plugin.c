@@ -14,6 +14,7 @@
 #include "../gpu.h"
 #include "../gte.h"
 #include "../mdec.h"
+#include "../misc.h"
 #include "../psxdma.h"
 #include "../psxhw.h"
 #include "../psxmem.h"
@@ -79,6 +80,8 @@ static bool block_stepping;
 static bool ram_disabled;
 static bool lightrec_debug, lightrec_very_debug;
 static u32 lightrec_begin_cycles;
+static const char *lightrec_cache_dir;
+static char lightrec_cache_file[MAXPATHLEN];
 
 extern u32 lightrec_hacks;
 
@@ -235,17 +238,17 @@ static u16 hw_read_half(struct lightrec_state *state,
 	return val;
 }
 
-static u32 hw_read_word(struct lightrec_state *state,
-			u32 op, void *host, u32 mem)
+static u32 hw_read_gpu_status(struct lightrec_state *state,
+			      u32 op, void *host, u32 mem)
 {
 	static u32 old_cycle, oldold_cycle, old_gpusr;
 	u32 val, diff;
 
 	lightrec_tansition_to_pcsx(state);
 
-	val = psxHwRead32(mem);
+	val = psxHwReadGpuSR();
 
-	if (GPUSTATUS_POLLING_THRESHOLD > 0 && mem == 0x1f801814) {
+	if (GPUSTATUS_POLLING_THRESHOLD > 0) {
 		diff = psxRegs.cycle - old_cycle;
 
 		if (diff > 0
@@ -253,7 +256,7 @@ static u32 hw_read_word(struct lightrec_state *state,
 		    && diff == old_cycle - oldold_cycle) {
 			while (psxRegs.next_interupt > psxRegs.cycle && val == old_gpusr) {
 				psxRegs.cycle += diff;
-				val = psxHwRead32(mem);
+				val = psxHwReadGpuSR();
 			}
 		}
 
@@ -267,6 +270,23 @@ static u32 hw_read_word(struct lightrec_state *state,
 	return val;
 }
 
+static u32 hw_read_word(struct lightrec_state *state,
+			u32 op, void *host, u32 mem)
+{
+	u32 val;
+
+	if (mem == 0x1f801814)
+		return hw_read_gpu_status(state, op, host, mem);
+
+	lightrec_tansition_to_pcsx(state);
+
+	val = psxHwRead32(mem);
+
+	lightrec_tansition_from_pcsx(state);
+
+	return val;
+}
+
 static struct lightrec_mem_map_ops hw_regs_ops = {
 	.sb = hw_write_byte,
 	.sh = hw_write_half,
@@ -276,6 +296,147 @@ static struct lightrec_mem_map_ops hw_regs_ops = {
 	.lw = hw_read_word,
 };
 
+/*
+ * Handlers bound to a single hardware register (or to the SPU range).
+ * Lightrec calls them directly when the address of a load or store is known
+ * at compile time, which skips the decoding of the generic handlers above.
+ */
+#define HW_WRITE_HANDLER(name, expr)					\
+static void name(struct lightrec_state *state,				\
+		 u32 op, void *host, u32 mem, u32 val)			\
+{									\
+	lightrec_tansition_to_pcsx(state);				\
+	expr;								\
+	lightrec_tansition_from_pcsx(state);				\
+}
+
+#define HW_READ_HANDLER(name, type, expr)				\
+static type name(struct lightrec_state *state,				\
+		 u32 op, void *host, u32 mem)				\
+{									\
+	type val;							\
+									\
+	lightrec_tansition_to_pcsx(state);				\
+	val = expr;							\
+	lightrec_tansition_from_pcsx(state);				\
+									\
+	return val;							\
+}
+
+HW_READ_HANDLER(hw_read_gpu_data, u32, GPU_readData())
+HW_WRITE_HANDLER(hw_write_gpu_data, GPU_writeData(val))
+HW_WRITE_HANDLER(hw_write_gpu_status, psxHwWriteGpuSR(val))
+
+HW_WRITE_HANDLER(hw_write_istat, psxHwWriteIstat(val))
+HW_WRITE_HANDLER(hw_write_imask, psxHwWriteImask(val))
+
+HW_WRITE_HANDLER(hw_write_chcr0, psxHwWriteChcr0(val))
+HW_WRITE_HANDLER(hw_write_chcr1, psxHwWriteChcr1(val))
+HW_WRITE_HANDLER(hw_write_chcr2, psxHwWriteChcr2(val))
+HW_WRITE_HANDLER(hw_write_chcr3, psxHwWriteChcr3(val))
+HW_WRITE_HANDLER(hw_write_chcr4, psxHwWriteChcr4(val))
+HW_WRITE_HANDLER(hw_write_chcr6, psxHwWriteChcr6(val))
+HW_WRITE_HANDLER(hw_write_dma_pcr, psxHwWriteDmaPcr32(val))
+HW_WRITE_HANDLER(hw_write_dma_icr, psxHwWriteDmaIcr32(val))
+
+HW_READ_HANDLER(hw_read_rcnt0_half, u16, psxRcntRcount0())
+HW_READ_HANDLER(hw_read_rcnt0_word, u32, psxRcntRcount0())
+HW_READ_HANDLER(hw_read_rcnt1_half, u16, psxRcntRcount1())
+HW_READ_HANDLER(hw_read_rcnt1_word, u32, psxRcntRcount1())
+HW_READ_HANDLER(hw_read_rcnt2_half, u16, psxRcntRcount2())
+HW_READ_HANDLER(hw_read_rcnt2_word, u32, psxRcntRcount2())
+HW_READ_HANDLER(hw_read_rmode0_half, u16, psxRcntRmode(0))
+HW_READ_HANDLER(hw_read_rmode0_word, u32, psxRcntRmode(0))
+HW_READ_HANDLER(hw_read_rmode1_half, u16, psxRcntRmode(1))
+HW_READ_HANDLER(hw_read_rmode1_word, u32, psxRcntRmode(1))
+HW_READ_HANDLER(hw_read_rmode2_half, u16, psxRcntRmode(2))
+HW_READ_HANDLER(hw_read_rmode2_word, u32, psxRcntRmode(2))
+
+HW_READ_HANDLER(hw_read_spu_half, u16, SPU_readRegister(mem, psxRegs.cycle))
+HW_WRITE_HANDLER(hw_write_spu_half, SPU_writeRegister(mem, val, psxRegs.cycle))
+
+static void hw_write_spu_word(struct lightrec_state *state,
+			      u32 op, void *host, u32 mem, u32 val)
+{
+	lightrec_tansition_to_pcsx(state);
+
+	SPU_writeRegister(mem, val & 0xffff, psxRegs.cycle);
+	SPU_writeRegister(mem + 2, val >> 16, psxRegs.cycle);
+
+	lightrec_tansition_from_pcsx(state);
+}
+
+#define HW_OPS_WRITE(_name, _func)					\
+static const struct lightrec_mem_map_ops _name = {			\
+	.sh = _func,							\
+	.sw = _func,							\
+}
+
+#define HW_OPS_READ(_name, _half, _word)				\
+static const struct lightrec_mem_map_ops _name = {			\
+	.lh = _half,							\
+	.lw = _word,							\
+}
+
+static const struct lightrec_mem_map_ops hw_gpu_data_ops = {
+	.sw = hw_write_gpu_data,
+	.lw = hw_read_gpu_data,
+};
+
+static const struct lightrec_mem_map_ops hw_gpu_status_ops = {
+	.sw = hw_write_gpu_status,
+	.lw = hw_read_gpu_status,
+};
+
+static const struct lightrec_mem_map_ops hw_spu_ops = {
+	.sh = hw_write_spu_half,
+	.sw = hw_write_spu_word,
+	.lh = hw_read_spu_half,
+};
+
+HW_OPS_WRITE(hw_istat_ops, hw_write_istat);
+HW_OPS_WRITE(hw_imask_ops, hw_write_imask);
+HW_OPS_WRITE(hw_chcr0_ops, hw_write_chcr0);
+HW_OPS_WRITE(hw_chcr1_ops, hw_write_chcr1);
+HW_OPS_WRITE(hw_chcr2_ops, hw_write_chcr2);
+HW_OPS_WRITE(hw_chcr3_ops, hw_write_chcr3);
+HW_OPS_WRITE(hw_chcr4_ops, hw_write_chcr4);
+HW_OPS_WRITE(hw_chcr6_ops, hw_write_chcr6);
+HW_OPS_WRITE(hw_dma_pcr_ops, hw_write_dma_pcr);
+HW_OPS_WRITE(hw_dma_icr_ops, hw_write_dma_icr);
+
+HW_OPS_READ(hw_rcnt0_ops, hw_read_rcnt0_half, hw_read_rcnt0_word);
+HW_OPS_READ(hw_rcnt1_ops, hw_read_rcnt1_half, hw_read_rcnt1_word);
+HW_OPS_READ(hw_rcnt2_ops, hw_read_rcnt2_half, hw_read_rcnt2_word);
+HW_OPS_READ(hw_rmode0_ops, hw_read_rmode0_half, hw_read_rmode0_word);
+HW_OPS_READ(hw_rmode1_ops, hw_read_rmode1_half, hw_read_rmode1_word);
+HW_OPS_READ(hw_rmode2_ops, hw_read_rmode2_half, hw_read_rmode2_word);
+
+static const struct {
+	u32 addr, length;
+	const struct lightrec_mem_map_ops *ops;
+} hw_handlers[] = {
+	{ 0x1f801070, 4, &hw_istat_ops },
+	{ 0x1f801074, 4, &hw_imask_ops },
+	{ 0x1f801088, 4, &hw_chcr0_ops },
+	{ 0x1f801098, 4, &hw_chcr1_ops },
+	{ 0x1f8010a8, 4, &hw_chcr2_ops },
+	{ 0x1f8010b8, 4, &hw_chcr3_ops },
+	{ 0x1f8010c8, 4, &hw_chcr4_ops },
+	{ 0x1f8010e8, 4, &hw_chcr6_ops },
+	{ 0x1f8010f0, 4, &hw_dma_pcr_ops },
+	{ 0x1f8010f4, 4, &hw_dma_icr_ops },
+	{ 0x1f801100, 4, &hw_rcnt0_ops },
+	{ 0x1f801104, 4, &hw_rmode0_ops },
+	{ 0x1f801110, 4, &hw_rcnt1_ops },
+	{ 0x1f801114, 4, &hw_rmode1_ops },
+	{ 0x1f801120, 4, &hw_rcnt2_ops },
+	{ 0x1f801124, 4, &hw_rmode2_ops },
+	{ 0x1f801810, 4, &hw_gpu_data_ops },
+	{ 0x1f801814, 4, &hw_gpu_status_ops },
+	{ 0x1f801c00, 0x400, &hw_spu_ops },
+};
+
 static u32 cache_ctrl;
 
 static void cache_ctrl_write_word(struct lightrec_state *state,
@@ -462,6 +623,8 @@ static const struct lightrec_ops lightrec_ops = {
 
 static int lightrec_plugin_init(void)
 {
+	unsigned int i;
+
 	lightrec_map[PSX_MAP_KERNEL_USER_RAM].address = psxM;
 	lightrec_map[PSX_MAP_BIOS].address = psxR;
 	lightrec_map[PSX_MAP_SCRATCH_PAD].address = psxH;
@@ -491,6 +654,7 @@ static int lightrec_plugin_init(void)
 	lightrec_map[PSX_MAP_CODE_BUFFER].address = code_buffer;
 
 	use_lightrec_interpreter = !!getenv("LIGHTREC_INTERPRETER");
+	lightrec_cache_dir = getenv("LIGHTREC_CACHE_DIR");
 
 #ifdef LIGHTREC_DEBUG
 	char *cycles = getenv("LIGHTREC_BEGIN_CYCLES");
@@ -506,6 +670,12 @@ static int lightrec_plugin_init(void)
 			lightrec_map, ARRAY_SIZE(lightrec_map),
 			&lightrec_ops);
 
+	for (i = 0; i < ARRAY_SIZE(hw_handlers); i++) {
+		lightrec_register_hw_handler(lightrec_state, hw_handlers[i].addr,
+					     hw_handlers[i].length,
+					     hw_handlers[i].ops);
+	}
+
 	// fprintf(stderr, "M=0x%lx, P=0x%lx, R=0x%lx, H=0x%lx\n",
 	// 		(uintptr_t) psxM,
 	// 		(uintptr_t) psxP,
@@ -692,8 +862,32 @@ static void lightrec_plugin_execute_internal(bool block_only)
 	}
 }
 
+static void lightrec_plugin_update_block_cache(void)
+{
+	char path[MAXPATHLEN];
+	int ret;
+
+	if (!lightrec_cache_dir || !CdromId[0])
+		return;
+
+	snprintf(path, sizeof(path), "%s/%.9s.lrc", lightrec_cache_dir, CdromId);
+	if (!strcmp(path, lightrec_cache_file))
+		return;
+
+	if (lightrec_cache_file[0])
+		lightrec_save_block_cache(lightrec_state, lightrec_cache_file);
+
+	strcpy(lightrec_cache_file, path);
+
+	ret = lightrec_load_block_cache(lightrec_state, path);
+	if (ret)
+		SysPrintf("lightrec: unable to load block cache %s: %d\n", path, ret);
+}
+
 static void lightrec_plugin_execute(psxRegisters *regs)
 {
+	lightrec_plugin_update_block_cache();
+
 	while (!regs->stop)
 		lightrec_plugin_execute_internal(lightrec_very_debug);
 }
@@ -755,6 +949,11 @@ static void lightrec_plugin_apply_config()
 
 static void lightrec_plugin_shutdown(void)
 {
+	if (lightrec_cache_file[0]) {
+		lightrec_save_block_cache(lightrec_state, lightrec_cache_file);
+		lightrec_cache_file[0] = '\0';
+	}
+
 	lightrec_destroy(lightrec_state);
 
 	if (!LIGHTREC_CUSTOM_MAP) {
@@ -804,6 +1003,28 @@ static void lightrec_plugin_sync_regs_to_pcsx(bool need_cp2)
 		memcpy(&psxRegs.CP2, regs->cp2d, sizeof(regs->cp2d) + sizeof(regs->cp2c));
 }
 
+void lightrec_plugin_get_stats(struct lightrec_stats *stats)
+{
+	if (lightrec_state)
+		lightrec_get_stats(lightrec_state, stats);
+	else
+		memset(stats, 0, sizeof(*stats));
+}
+
+int lightrec_plugin_save_profile(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+	enum lightrec_profile_format format = LIGHTREC_PROFILE_TEXT;
+
+	if (!lightrec_state)
+		return -EINVAL;
+
+	if (ext && !strcmp(ext, ".csv"))
+		format = LIGHTREC_PROFILE_CSV;
+
+	return lightrec_save_profile(lightrec_state, path, format);
+}
+
 R3000Acpu psxRec =
 {
 	lightrec_plugin_init,
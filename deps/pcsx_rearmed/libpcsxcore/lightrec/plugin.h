@@ -10,6 +10,11 @@
 
 #define drc_is_lightrec() 1
 
+struct lightrec_stats;
+
+void lightrec_plugin_get_stats(struct lightrec_stats *stats);
+int lightrec_plugin_save_profile(const char *path);
+
 #else /* if !LIGHTREC */
 
 #define drc_is_lightrec() 0
@@ -19,6 +19,12 @@
  ***************************************************************************/
 
 #include "mdec.h"
+#include "trace.h"
+
+#if defined(__SSE2__)
+#include <x86intrin.h>
+#define MDEC_SIMD
+#endif
 
 /* memory speed is 1 byte per MDEC_BIAS psx clock
  * That mean (PSXCLK / MDEC_BIAS) B/s
@@ -207,6 +213,187 @@ static void idct(int *block,int used_col) {
 	}
 }
 
+#ifdef MDEC_SIMD
+/*
+ * Same computations as idct(), on a whole row of the block at once (half a
+ * row without AVX2). The 32-bit fixed point of idct() is kept as is so that
+ * the output is bit-identical, so are the wraparounds on overflow.
+ */
+#ifdef __AVX2__
+typedef __m256i vint;
+#define VLANES		8
+#define vload(p)	_mm256_loadu_si256((const __m256i *)(p))
+#define vstore(p, v)	_mm256_storeu_si256((__m256i *)(p), v)
+#define vset1		_mm256_set1_epi32
+#define vadd		_mm256_add_epi32
+#define vsub		_mm256_sub_epi32
+#define vmul		_mm256_mullo_epi32
+#define vsra		_mm256_srai_epi32
+#else
+typedef __m128i vint;
+#define VLANES		4
+#define vload(p)	_mm_loadu_si128((const __m128i *)(p))
+#define vstore(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+#define vset1		_mm_set1_epi32
+#define vadd		_mm_add_epi32
+#define vsub		_mm_sub_epi32
+#define vmul		mullo_epi32
+#define vsra		_mm_srai_epi32
+#endif
+
+static inline __m128i mullo_epi32(__m128i a, __m128i b) {
+#ifdef __SSE4_1__
+	return _mm_mullo_epi32(a, b);
+#else
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+
+#define VMULS(v, c)	vsra(vmul(v, vset1(c)), AAN_CONST_BITS)
+
+static inline void idct_1d_simd(vint *p) {
+	vint tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	vint z5, z10, z11, z12, z13;
+
+	z10 = vadd(p[0], p[4]);
+	z11 = vsub(p[0], p[4]);
+	z13 = vadd(p[2], p[6]);
+	z12 = vsub(VMULS(vsub(p[2], p[6]), FIX_1_414213562), z13);
+
+	tmp0 = vadd(z10, z13);
+	tmp3 = vsub(z10, z13);
+	tmp1 = vadd(z11, z12);
+	tmp2 = vsub(z11, z12);
+
+	z13 = vadd(p[3], p[5]);
+	z10 = vsub(p[3], p[5]);
+	z11 = vadd(p[1], p[7]);
+	z12 = vsub(p[1], p[7]);
+
+	tmp7 = vadd(z11, z13);
+	z5 = vmul(vsub(z12, z10), vset1(FIX_1_847759065));
+	tmp6 = vsub(vsra(vadd(vmul(z10, vset1(FIX_2_613125930)), z5),
+			 AAN_CONST_BITS), tmp7);
+	tmp5 = vsub(VMULS(vsub(z11, z13), FIX_1_414213562), tmp6);
+	tmp4 = vadd(vsra(vsub(vmul(z12, vset1(FIX_1_082392200)), z5),
+			 AAN_CONST_BITS), tmp5);
+
+	p[0] = vadd(tmp0, tmp7);
+	p[7] = vsub(tmp0, tmp7);
+	p[1] = vadd(tmp1, tmp6);
+	p[6] = vsub(tmp1, tmp6);
+	p[2] = vadd(tmp2, tmp5);
+	p[5] = vsub(tmp2, tmp5);
+	p[4] = vadd(tmp3, tmp4);
+	p[3] = vsub(tmp3, tmp4);
+}
+
+#ifdef __AVX2__
+static inline void transpose_simd(vint *r) {
+	vint t[8], u[8];
+	int i;
+
+	for (i = 0; i < 8; i += 4) {
+		t[i + 0] = _mm256_unpacklo_epi32(r[i + 0], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i + 0], r[i + 1]);
+		t[i + 2] = _mm256_unpacklo_epi32(r[i + 2], r[i + 3]);
+		t[i + 3] = _mm256_unpackhi_epi32(r[i + 2], r[i + 3]);
+
+		u[i + 0] = _mm256_unpacklo_epi64(t[i + 0], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i + 0], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+
+	for (i = 0; i < 4; i++) {
+		r[i + 0] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+#else
+static inline void transpose4_simd(vint *r) {
+	vint t0 = _mm_unpacklo_epi32(r[0], r[1]);
+	vint t1 = _mm_unpacklo_epi32(r[2], r[3]);
+	vint t2 = _mm_unpackhi_epi32(r[0], r[1]);
+	vint t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+	r[0] = _mm_unpacklo_epi64(t0, t1);
+	r[1] = _mm_unpackhi_epi64(t0, t1);
+	r[2] = _mm_unpacklo_epi64(t2, t3);
+	r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+// l[]: columns 0-3 of the rows, r[]: columns 4-7
+static inline void transpose_simd(vint *l, vint *r) {
+	vint t;
+	int i;
+
+	transpose4_simd(l);
+	transpose4_simd(l + 4);
+	transpose4_simd(r);
+	transpose4_simd(r + 4);
+
+	for (i = 0; i < 4; i++) {
+		t = l[i + 4];
+		l[i + 4] = r[i];
+		r[i] = t;
+	}
+}
+#endif
+
+/* The shortcuts of idct() for the empty columns and rows give the same
+ * result as the full computation, only the DC-only blocks are worth it
+ * here. */
+static void idct_simd(int *block, int used_col) {
+	vint l[8];
+#ifndef __AVX2__
+	vint r[8];
+#endif
+	int i;
+
+	if (used_col == -1) {
+		vint v = vset1(block[0]);
+		for (i = 0; i < DSIZE2; i += VLANES)
+			vstore(block + i, v);
+		return;
+	}
+
+#ifdef __AVX2__
+	for (i = 0; i < DSIZE; i++)
+		l[i] = vload(block + DSIZE * i);
+
+	idct_1d_simd(l);
+	transpose_simd(l);
+	idct_1d_simd(l);
+	transpose_simd(l);
+
+	for (i = 0; i < DSIZE; i++)
+		vstore(block + DSIZE * i, l[i]);
+#else
+	for (i = 0; i < DSIZE; i++) {
+		l[i] = vload(block + DSIZE * i);
+		r[i] = vload(block + DSIZE * i + 4);
+	}
+
+	idct_1d_simd(l);
+	idct_1d_simd(r);
+	transpose_simd(l, r);
+	idct_1d_simd(l);
+	idct_1d_simd(r);
+	transpose_simd(l, r);
+
+	for (i = 0; i < DSIZE; i++) {
+		vstore(block + DSIZE * i, l[i]);
+		vstore(block + DSIZE * i + 4, r[i]);
+	}
+#endif
+}
+#endif // MDEC_SIMD
+
 // mdec0: command register
 #define MDEC0_STP			0x02000000
 #define MDEC0_RGB24			0x08000000
@@ -270,7 +457,8 @@ static void iqtab_init(int *iqtab, const unsigned char *iq_y) {
 
 #define	MDEC_END_OF_DATA	0xfe00
 
-static const unsigned short *rl2blk(int *blk, const unsigned short *mdec_rl) {
+static inline const unsigned short *rl2blk(int *blk, const unsigned short *mdec_rl,
+					  void (*idct)(int *, int)) {
 	int i, k, q_scale, rl, used_col;
  	int *iqtab;
 
@@ -453,6 +641,152 @@ static void yuv2rgb24(int *blk, u8 *image) {
 	}
 }
 
+#ifdef MDEC_SIMD
+/* YUV to RGB conversion of two lines of pixels sharing the same row of
+ * chroma samples, 8 pixels at a time. Same computations as putquadrgb15()
+ * and putquadrgb24(). */
+static inline void yuv2rgb_simd(const int *blk, int cy, int half,
+				__m128i *R, __m128i *G, __m128i *B) {
+	__m128i cr = _mm_loadu_si128((const __m128i *)(blk + cy * DSIZE + half * 4));
+	__m128i cb = _mm_loadu_si128((const __m128i *)(blk + DSIZE2 + cy * DSIZE + half * 4));
+
+	*R = mullo_epi32(cr, _mm_set1_epi32(1434));
+	*G = _mm_sub_epi32(mullo_epi32(cb, _mm_set1_epi32(-351)),
+			   mullo_epi32(cr, _mm_set1_epi32(728)));
+	*B = mullo_epi32(cb, _mm_set1_epi32(1807));
+}
+
+static inline const int *yuv2rgb_simd_yblk(const int *blk, int y, int half) {
+	return blk + DSIZE2 * (2 + half + (y >= 8) * 2) + (y & 7) * DSIZE;
+}
+
+// SCALER(), then to 16 bits, the results fit
+static inline __m128i yuv2rgb_simd_scale(__m128i y0, __m128i y1, __m128i c,
+					 int bits) {
+	__m128i round = _mm_set1_epi32(1 << (bits - 1));
+
+	y0 = _mm_add_epi32(y0, _mm_unpacklo_epi32(c, c));
+	y1 = _mm_add_epi32(y1, _mm_unpackhi_epi32(c, c));
+
+	return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(y0, round), bits),
+			       _mm_srai_epi32(_mm_add_epi32(y1, round), bits));
+}
+
+static inline __m128i clamp5_simd(__m128i v) {
+	v = _mm_add_epi16(v, _mm_set1_epi16(16));
+	v = _mm_max_epi16(v, _mm_setzero_si128());
+	return _mm_min_epi16(v, _mm_set1_epi16(31));
+}
+
+static void yuv2rgb15_simd(int *blk, u16 *image) {
+	__m128i A = _mm_set1_epi16((mdec.reg0 & MDEC0_STP) ? 0x8000 : 0);
+	__m128i R, G, B, r, g, b, y0, y1;
+	const int *Yblk;
+	int cy, half, y;
+
+	if (Config.Mdec) {
+		yuv2rgb15(blk, image);
+		return;
+	}
+
+	for (cy = 0; cy < 8; cy++) {
+		for (half = 0; half < 2; half++) {
+			yuv2rgb_simd(blk, cy, half, &R, &G, &B);
+
+			for (y = cy * 2; y < cy * 2 + 2; y++) {
+				Yblk = yuv2rgb_simd_yblk(blk, y, half);
+				y0 = _mm_slli_epi32(_mm_loadu_si128((const __m128i *)Yblk), 10);
+				y1 = _mm_slli_epi32(_mm_loadu_si128((const __m128i *)(Yblk + 4)), 10);
+
+				r = clamp5_simd(yuv2rgb_simd_scale(y0, y1, R, 23));
+				g = clamp5_simd(yuv2rgb_simd_scale(y0, y1, G, 23));
+				b = clamp5_simd(yuv2rgb_simd_scale(y0, y1, B, 23));
+
+				r = _mm_or_si128(_mm_or_si128(r, A),
+						 _mm_or_si128(_mm_slli_epi16(g, 5),
+							      _mm_slli_epi16(b, 10)));
+				_mm_storeu_si128((__m128i *)(image + y * 16 + half * 8), r);
+			}
+		}
+	}
+}
+
+static void yuv2rgb24_simd(int *blk, u8 *image) {
+	__m128i R, G, B, r, g, b, y0, y1, c128 = _mm_set1_epi16(128);
+	u32 px[8];
+	const int *Yblk;
+	int cy, half, y, i;
+	u8 *dst;
+
+	if (Config.Mdec) {
+		yuv2rgb24(blk, image);
+		return;
+	}
+
+	for (cy = 0; cy < 8; cy++) {
+		for (half = 0; half < 2; half++) {
+			yuv2rgb_simd(blk, cy, half, &R, &G, &B);
+
+			for (y = cy * 2; y < cy * 2 + 2; y++) {
+				Yblk = yuv2rgb_simd_yblk(blk, y, half);
+				y0 = _mm_slli_epi32(_mm_loadu_si128((const __m128i *)Yblk), 10);
+				y1 = _mm_slli_epi32(_mm_loadu_si128((const __m128i *)(Yblk + 4)), 10);
+
+				// clamp8() is the unsigned saturation
+				r = _mm_add_epi16(yuv2rgb_simd_scale(y0, y1, R, 20), c128);
+				g = _mm_add_epi16(yuv2rgb_simd_scale(y0, y1, G, 20), c128);
+				b = _mm_add_epi16(yuv2rgb_simd_scale(y0, y1, B, 20), c128);
+
+				r = _mm_unpacklo_epi8(_mm_packus_epi16(r, r),
+						      _mm_packus_epi16(g, g));
+				b = _mm_unpacklo_epi8(_mm_packus_epi16(b, b),
+						      _mm_setzero_si128());
+
+				_mm_storeu_si128((__m128i *)px, _mm_unpacklo_epi16(r, b));
+				_mm_storeu_si128((__m128i *)(px + 4), _mm_unpackhi_epi16(r, b));
+
+				// the 4th byte is overwritten by the next pixel
+				dst = image + (y * 16 + half * 8) * 3;
+				for (i = 0; i < 7; i++)
+					memcpy(dst + i * 3, &px[i], 4);
+				memcpy(dst + 7 * 3, &px[7], 3);
+			}
+		}
+	}
+}
+#endif // MDEC_SIMD
+
+static const u16 *decode_macroblock(const u16 *rl, u8 *image, boolean simd) {
+	int blk[DSIZE2 * 6];
+
+#ifdef MDEC_SIMD
+	if (simd) {
+		rl = rl2blk(blk, rl, idct_simd);
+		if (mdec.reg0 & MDEC0_RGB24)
+			yuv2rgb15_simd(blk, (u16 *)image);
+		else
+			yuv2rgb24_simd(blk, image);
+		return rl;
+	}
+#endif
+
+	rl = rl2blk(blk, rl, idct);
+	if (mdec.reg0 & MDEC0_RGB24)
+		yuv2rgb15(blk, (u16 *)image);
+	else
+		yuv2rgb24(blk, image);
+	return rl;
+}
+
+void mdecSetQuantTables(const u8 *tables) {
+	iqtab_init(iq_y, tables);
+	iqtab_init(iq_uv, tables + 64);
+}
+
+const u16 *mdecDecodeMacroblock(const u16 *rl, void *image, boolean simd) {
+	return decode_macroblock(rl, image, simd);
+}
+
 void mdecInit(void) {
 	memset(&mdec, 0, sizeof(mdec));
 	memset(iq_y, 0, sizeof(iq_y));
@@ -484,6 +818,22 @@ u32 mdecRead1(void) {
 	return v;
 }
 
+#ifdef MDEC_TRACE
+/* Records the commands sent to the MDEC to the file named by
+ * $PCSX_MDEC_TRACE, to be checked with host/mdec_check.c */
+static struct trace_file mdec_trace_file = {
+	"PCSX_MDEC_TRACE", "mdec.trace",
+};
+
+static void mdec_trace(u32 cmd, const void *mem, u32 words) {
+	trace_write(&mdec_trace_file, &cmd, sizeof(cmd));
+	trace_write(&mdec_trace_file, &words, sizeof(words));
+	trace_write(&mdec_trace_file, mem, words * 4);
+}
+#else
+#define mdec_trace(...)
+#endif
+
 void psxDma0(u32 adr, u32 bcr, u32 chcr) {
 	u32 cmd = mdec.reg0, words_max = 0;
 	const void *mem;
@@ -507,6 +857,8 @@ void psxDma0(u32 adr, u32 bcr, u32 chcr) {
 		return;
 	}
 
+	mdec_trace(cmd, mem, size);
+
 	switch (cmd >> 28) {
 		case 0x3: // decode 15/24bpp
 			mdec.rl = mem;
@@ -533,8 +885,7 @@ void psxDma0(u32 adr, u32 bcr, u32 chcr) {
 				// printf("uploading new quantization table\n");
 				// printmatrixu8(p);
 				// printmatrixu8(p + 64);
-				iqtab_init(iq_y, p);
-				iqtab_init(iq_uv, p + 64);
+				mdecSetQuantTables(p);
 			}
 			break;
 
@@ -564,7 +915,6 @@ void mdec0Interrupt()
 
 void psxDma1(u32 adr, u32 bcr, u32 chcr) {
 	u32 words, words_max = 0;
-	int blk[DSIZE2 * 6];
 	u8 * image;
 	int size;
 
@@ -610,15 +960,13 @@ void psxDma1(u32 adr, u32 bcr, u32 chcr) {
 		}
 
 		while(size >= SIZE_OF_16B_BLOCK) {
-			mdec.rl = rl2blk(blk, mdec.rl);
-			yuv2rgb15(blk, (u16 *)image);
+			mdec.rl = decode_macroblock(mdec.rl, image, TRUE);
 			image += SIZE_OF_16B_BLOCK;
 			size -= SIZE_OF_16B_BLOCK;
 		}
 
 		if(size != 0) {
-			mdec.rl = rl2blk(blk, mdec.rl);
-			yuv2rgb15(blk, (u16 *)mdec.block_buffer);
+			mdec.rl = decode_macroblock(mdec.rl, mdec.block_buffer, TRUE);
 			memcpy(image, mdec.block_buffer, size);
 			mdec.block_buffer_pos = mdec.block_buffer + size;
 		}
@@ -639,15 +987,13 @@ void psxDma1(u32 adr, u32 bcr, u32 chcr) {
 		}
 
 		while(size >= SIZE_OF_24B_BLOCK) {
-			mdec.rl = rl2blk(blk, mdec.rl);
-			yuv2rgb24(blk, image);
+			mdec.rl = decode_macroblock(mdec.rl, image, TRUE);
 			image += SIZE_OF_24B_BLOCK;
 			size -= SIZE_OF_24B_BLOCK;
 		}
 
 		if(size != 0) {
-			mdec.rl = rl2blk(blk, mdec.rl);
-			yuv2rgb24(blk, mdec.block_buffer);
+			mdec.rl = decode_macroblock(mdec.rl, mdec.block_buffer, TRUE);
 			memcpy(image, mdec.block_buffer, size);
 			mdec.block_buffer_pos = mdec.block_buffer + size;
 		}
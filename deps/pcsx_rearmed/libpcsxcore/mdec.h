@@ -40,6 +40,10 @@ void mdec0Interrupt();
 void mdec1Interrupt();
 int mdecFreeze(void *f, int Mode);
 
+// Decodes one macroblock in the format set by mdecWrite0()
+void mdecSetQuantTables(const u8 *tables);
+const u16 *mdecDecodeMacroblock(const u16 *rl, void *image, boolean simd);
+
 #ifdef __cplusplus
 }
 #endif
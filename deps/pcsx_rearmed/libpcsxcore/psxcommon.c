@@ -23,6 +23,9 @@
 
 #include "cheat.h"
 #include "ppf.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "trace.h"
 
 PcsxConfig Config;
 boolean NetOpened = FALSE;
@@ -47,8 +50,13 @@ void EmuShutdown() {
 	FreeCheatSearchMem();
 
 	FreePPFCache();
+#ifdef HAVE_SNAPSHOT
+	snapshot_reset();
+	rewind_shutdown();
+#endif
 
 	psxShutdown();
+	trace_close_all();
 }
 
 void EmuUpdate() {
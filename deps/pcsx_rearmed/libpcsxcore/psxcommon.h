@@ -130,7 +130,11 @@ typedef struct {
 	boolean Mdec;
 	boolean PsxAuto;
 	boolean Cdda;
+	u32 COMPR_CacheSize; /* bytes of inflated PBP/CBIN blocks to keep, at least the read-ahead */
 	boolean CHD_Precache; /* loads disk image into memory, works with CHD only. */
+	u32 CHD_CacheSize; /* bytes of decoded CHD hunks to keep, at least the read-ahead */
+	u8 CHD_ReadAhead; /* CHD hunks decoded ahead of the reads, 0 to disable */
+	u8 CHD_Threads; /* threads decoding them */
 	boolean HLE;
 	boolean SlowBoot;
 	boolean Debug;
@@ -23,6 +23,11 @@
 
 #include "psxdma.h"
 #include "gpu.h"
+#include "trace.h"
+
+#ifdef __SSE2__
+#include <x86intrin.h>
+#endif
 
 #ifndef min
 #define min(a, b) ((b) < (a) ? (b) : (a))
@@ -133,6 +138,40 @@ static u32 gpuDmaChainSize(u32 addr) {
 }
 #endif
 
+#ifdef GPUDMA_TRACE
+/* Records the nodes of the display lists sent to the GPU to the file named
+ * by $PCSX_GPUDMA_TRACE, to be replayed by host/gpu_dma_bench.c */
+static struct trace_file gpu_dma_trace_file = {
+	"PCSX_GPUDMA_TRACE", "gpudma.trace",
+};
+
+static void gpu_dma_trace(u32 madr) {
+	struct trace_file *f = &gpu_dma_trace_file;
+	u32 addr, count, len, end = ~0;
+	const u32 *node;
+
+	trace_write(f, &madr, sizeof(madr));
+
+	// bounded, in case the list loops
+	for (addr = madr, count = 0; !(addr & 0x800000) && count < 0x100000; count++) {
+		node = (u32 *)psxM + (addr & 0x1fffff) / 4;
+		len = 1 + (SWAP32(node[0]) >> 24);
+		if (len > (0x200000 - (addr & 0x1fffff)) / 4)
+			len = (0x200000 - (addr & 0x1fffff)) / 4;
+
+		trace_write(f, &addr, sizeof(addr));
+		trace_write(f, &len, sizeof(len));
+		trace_write(f, node, len * 4);
+
+		addr = SWAP32(node[0]) & 0xffffff;
+	}
+
+	trace_write(f, &end, sizeof(end));
+}
+#else
+#define gpu_dma_trace(...)
+#endif
+
 void psxDma2(u32 madr, u32 bcr, u32 chcr) { // GPU
 	u32 *ptr, madr_next, *madr_next_p;
 	u32 words, words_left, words_max, words_copy;
@@ -200,6 +239,7 @@ void psxDma2(u32 madr, u32 bcr, u32 chcr) { // GPU
 				do_walking = Config.hacks.gpu_slow_list_walking;
 			madr_next_p = do_walking ? &madr_next : NULL;
 
+			gpu_dma_trace(madr & 0x1fffff);
 			cycles_sum = GPU_dmaChain((u32 *)psxM, madr & 0x1fffff,
 					madr_next_p, &cycles_last_cmd);
 
@@ -257,7 +297,7 @@ void psxAbortDma2() {
 }
 
 void psxDma6(u32 madr, u32 bcr, u32 chcr) {
-	u32 words, words_max;
+	u32 words, words_max, i, n;
 	u32 *mem;
 
 	PSXDMA_LOG("*** DMA6 OT *** %x addr = %x size = %x\n", chcr, madr, bcr);
@@ -275,11 +315,29 @@ void psxDma6(u32 madr, u32 bcr, u32 chcr) {
 		// already 32-bit size
 		words = bcr;
 
-		while (bcr-- && mem > (u32 *)psxM) {
-			*mem-- = SWAP32((madr - 4) & 0xffffff);
-			madr -= 4;
+		// the table is written downwards, stopping at the start of RAM
+		n = min(bcr, mem - (u32 *)psxM);
+		madr -= n * 4;
+		mem -= n;
+
+		// filled upwards, so that it can be vectorized
+		i = 2;
+#ifdef __SSE2__
+		{
+			__m128i link = _mm_add_epi32(_mm_set1_epi32(madr + 4),
+						     _mm_setr_epi32(0, 4, 8, 12));
+
+			for (; i + 3 <= n; i += 4) {
+				_mm_storeu_si128((__m128i *)(mem + i),
+						 _mm_and_si128(link, _mm_set1_epi32(0xffffff)));
+				link = _mm_add_epi32(link, _mm_set1_epi32(16));
+			}
 		}
-		*++mem = SWAP32(0xffffff);
+#endif
+		for (; i <= n; i++)
+			mem[i] = SWAP32((madr + i * 4 - 4) & 0xffffff);
+
+		mem[1] = SWAP32(0xffffff);
 
 		// halted
 		psxRegs.cycle += words;
@@ -1,10 +1,13 @@
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "r3000a.h"
 #include "cdrom.h"
 #include "psxdma.h"
 #include "mdec.h"
 #include "psxevents.h"
+#include "event_heap.h"
+#include "trace.h"
 
 //#define evprintf printf
 #define evprintf(...)
@@ -19,7 +22,34 @@ static psxRegisters *cp0TOpsxRegs(psxCP0Regs *cp0)
 #endif
 }
 
-u32 schedule_timeslice(psxRegisters *regs)
+// Pending events by deadline. psxRegs.interrupt stays the reference: events
+// are cancelled by clearing their bit, their heap slots are dropped lazily.
+static struct event_heap events;
+
+#ifdef EVENTS_TRACE
+/* Records the event stream to the file named by $PCSX_EVENTS_TRACE, to be
+ * replayed by host/events_bench.c */
+static struct trace_file events_trace_file = {
+	"PCSX_EVENTS_TRACE", "events.trace",
+};
+
+static void events_trace(u32 op, u32 e, u32 cycle, u32 pending)
+{
+	struct event_trace rec = { op, e, cycle, pending };
+
+	trace_write(&events_trace_file, &rec, sizeof(rec));
+}
+#else
+#define events_trace(...)
+#endif
+
+void events_queue(u32 e, u32 abs)
+{
+	events_trace(EVENT_TRACE_QUEUE, e, abs, 0);
+	event_heap_queue(&events, e, abs);
+}
+
+static s32 schedule_timeslice_scan(psxRegisters *regs)
 {
 	u32 i, c = regs->cycle;
 	u32 irqs = regs->interrupt;
@@ -34,6 +64,33 @@ u32 schedule_timeslice(psxRegisters *regs)
 		if (0 < dif && dif < min)
 			min = dif;
 	}
+	return min;
+}
+
+u32 schedule_timeslice(psxRegisters *regs)
+{
+	u32 e, c = regs->cycle;
+	s32 min = PSXCLK, dif;
+
+	events_trace(EVENT_TRACE_SCHEDULE, 0, c, regs->interrupt);
+
+	while (events.count) {
+		e = events.event[0];
+		if (regs->interrupt & (1u << e))
+			break;
+		event_heap_remove(&events, e);
+	}
+
+	if (events.count) {
+		dif = events.deadline[0] - c;
+		if (dif <= 0) {
+			// overdue events are skipped, look for the next one
+			min = schedule_timeslice_scan(regs);
+		} else if (dif < min) {
+			min = dif;
+		}
+	}
+
 	regs->next_interupt = c + min;
 	return regs->next_interupt;
 }
@@ -67,12 +124,22 @@ void irq_test(psxCP0Regs *cp0)
 	u32 cycle = regs->cycle;
 	u32 irq, irq_bits;
 
-	for (irq = 0, irq_bits = regs->interrupt; irq_bits != 0; irq++, irq_bits >>= 1) {
+	events_trace(EVENT_TRACE_TEST, 0, cycle, regs->interrupt);
+
+	// the heap tells if anything is due; the handlers then run as a scan of
+	// the events pending on entry would run them
+	if (!event_heap_due(&events, regs->interrupt, cycle))
+		irq_bits = 0;
+	else
+		irq_bits = regs->interrupt;
+
+	for (irq = 0; irq_bits != 0; irq++, irq_bits >>= 1) {
 		if (!(irq_bits & 1))
 			continue;
 		if ((s32)(cycle - regs->event_cycles[irq]) >= 0) {
 			// note: irq_funcs() also modify regs->interrupt
 			regs->interrupt &= ~(1u << irq);
+			event_heap_remove(&events, irq);
 			irq_funcs[irq]();
 		}
 	}
@@ -107,4 +174,17 @@ void events_restore(void)
 	psxRegs.event_cycles[PSXINT_RCNT] = psxRegs.psxNextsCounter + psxRegs.psxNextCounter;
 	psxRegs.interrupt |=  1 << PSXINT_RCNT;
 	psxRegs.interrupt &= (1 << PSXINT_COUNT) - 1;
+
+	events_reset();
+}
+
+void events_reset(void)
+{
+	int i;
+
+	event_heap_init(&events);
+
+	for (i = 0; i < PSXINT_COUNT; i++)
+		if (psxRegs.interrupt & (1u << i))
+			event_heap_queue(&events, i, psxRegs.event_cycles[i]);
 }
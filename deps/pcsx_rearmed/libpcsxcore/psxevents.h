@@ -26,6 +26,7 @@ enum {
 	u32 abs_ = abs; \
 	s32 di_ = psxRegs.next_interupt - abs_; \
 	psxRegs.event_cycles[e] = abs_; \
+	events_queue(e, abs_); \
 	if (di_ > 0) { \
 		/*printf("%u: next_interupt %u -> %u\n", psxRegs.cycle, psxRegs.next_interupt, abs_);*/ \
 		psxRegs.next_interupt = abs_; \
@@ -42,9 +43,12 @@ enum {
 union psxCP0Regs_;
 struct psxRegisters;
 
+void events_queue(u32 e, u32 abs);
+
 u32  schedule_timeslice(struct psxRegisters *regs);
 void irq_test(union psxCP0Regs_ *cp0);
 void gen_interupt(union psxCP0Regs_ *cp0);
 void events_restore(void);
+void events_reset(void);
 
 #endif // __PSXEVENTS_H__
@@ -67,6 +67,7 @@ void psxReset() {
 	psxMemReset();
 
 	memset(&psxRegs, 0, sizeof(psxRegs));
+	events_reset();
 
 	psxRegs.pc = 0xbfc00000; // Start in bootstrap
 
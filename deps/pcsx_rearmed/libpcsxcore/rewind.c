@@ -0,0 +1,439 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+ * In-memory rewind.
+ *
+ * The latest state is kept in full; every older state is stored as the XOR
+ * of the pages that differ from the state captured after it, compressed
+ * with zstd, in a ring buffer of fixed size. Stepping back restores the
+ * latest state and XORs the newest delta into it, which turns it into the
+ * state captured before. When the ring buffer is full, the oldest deltas
+ * are dropped.
+ *
+ * SaveState() writes the new state through a SaveFuncs backend that
+ * compares it with the latest one as it comes, while it is still in the
+ * cache, and updates the latest state in place; the state is only walked
+ * once per capture.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zstd.h>
+#include "system.h"
+#include "misc.h"
+#include "snapshot.h"
+#include "rewind.h"
+
+#define REWIND_MAX_STATES	4096
+
+// the "file" that SaveState() writes the latest state to, through RewindFuncs
+#define REWIND_FILE_NAME	"(rewind)"
+#define REWIND_ZSTD_LEVEL	1
+
+struct rewind_entry {
+	u32 offset;		// in the ring buffer
+	u32 size;		// page bitmap + compressed XOR of the pages
+};
+
+static struct {
+	struct snapshot_buf cur;	// latest state
+	boolean have_cur;
+
+	// capture in progress
+	boolean diffing;
+	u32 last_dirty;
+	u32 xor_size;
+
+	u8 *ring;
+	u32 ring_size;
+	struct rewind_entry entries[REWIND_MAX_STATES];
+	u32 first, count;
+
+	u8 *xor_buf;
+	u32 xor_alloc;
+	u8 *comp;
+	size_t comp_alloc;
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+
+	u32 interval, frames;
+	struct rewind_stats stats;
+} rw;
+
+static u32 get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline u32 page_len(u32 size, u32 page)
+{
+	u32 len = size - page * SNAPSHOT_PAGE_SIZE;
+
+	return len < SNAPSHOT_PAGE_SIZE ? len : SNAPSHOT_PAGE_SIZE;
+}
+
+static void xor_page(u8 *dst, const u8 *a, const u8 *b, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = a[i] ^ b[i];
+}
+
+int rewind_init(u32 budget, u32 interval)
+{
+	rewind_shutdown();
+
+	rw.ring = malloc(budget);
+	rw.cctx = ZSTD_createCCtx();
+	rw.dctx = ZSTD_createDCtx();
+
+	if (!rw.ring || !rw.cctx || !rw.dctx) {
+		SysPrintf("rewind: unable to allocate %u bytes\n", budget);
+		rewind_shutdown();
+		return -1;
+	}
+
+	rw.ring_size = budget;
+	rw.interval = interval;
+
+	return 0;
+}
+
+void rewind_shutdown(void)
+{
+	snapshot_buf_free(&rw.cur);
+	free(rw.ring);
+	free(rw.xor_buf);
+	free(rw.comp);
+	ZSTD_freeCCtx(rw.cctx);
+	ZSTD_freeDCtx(rw.dctx);
+	memset(&rw, 0, sizeof(rw));
+}
+
+void rewind_reset(void)
+{
+	rw.have_cur = FALSE;
+	rw.first = rw.count = 0;
+	rw.frames = 0;
+	rw.stats.mem_used = 0;
+}
+
+void rewind_frame(void)
+{
+	if (rw.interval && ++rw.frames >= rw.interval) {
+		rw.frames = 0;
+		rewind_capture();
+	}
+}
+
+static void rewind_drop_oldest(void)
+{
+	rw.stats.mem_used -= rw.entries[rw.first].size;
+	rw.first = (rw.first + 1) % REWIND_MAX_STATES;
+	rw.count--;
+}
+
+static int rewind_push(const u8 *data, u32 size)
+{
+	const struct rewind_entry *newest, *oldest;
+	struct rewind_entry *entry;
+	u32 offset = 0;
+
+	if (size > rw.ring_size) {
+		// the older deltas can't be reached anymore
+		rw.first = rw.count = 0;
+		rw.stats.mem_used = 0;
+		return -1;
+	}
+
+	if (rw.count) {
+		newest = &rw.entries[(rw.first + rw.count - 1) % REWIND_MAX_STATES];
+		offset = newest->offset + newest->size;
+		if (offset + size > rw.ring_size)
+			offset = 0;
+	}
+
+	/* The entries following the write offset in the ring buffer are always
+	 * the oldest ones, drop them until the new one fits. */
+	while (rw.count) {
+		oldest = &rw.entries[rw.first];
+
+		if (rw.count < REWIND_MAX_STATES
+		    && (oldest->offset >= offset + size
+			|| oldest->offset + oldest->size <= offset))
+			break;
+
+		rewind_drop_oldest();
+	}
+
+	memcpy(rw.ring + offset, data, size);
+
+	entry = &rw.entries[(rw.first + rw.count) % REWIND_MAX_STATES];
+	entry->offset = offset;
+	entry->size = size;
+	rw.count++;
+	rw.stats.mem_used += size;
+
+	return 0;
+}
+
+static int rewind_reserve(u32 state_size)
+{
+	size_t comp_size = (state_size / SNAPSHOT_PAGE_SIZE + 8) / 8
+		+ ZSTD_compressBound(state_size);
+	void *ptr;
+
+	if (state_size > rw.xor_alloc) {
+		ptr = realloc(rw.xor_buf, state_size);
+		if (!ptr)
+			return -1;
+
+		rw.xor_buf = ptr;
+		rw.xor_alloc = state_size;
+	}
+
+	if (comp_size > rw.comp_alloc) {
+		ptr = realloc(rw.comp, comp_size);
+		if (!ptr)
+			return -1;
+
+		rw.comp = ptr;
+		rw.comp_alloc = comp_size;
+	}
+
+	return 0;
+}
+
+static void *rw_open(const char *name, const char *mode)
+{
+	if (strcmp(name, REWIND_FILE_NAME) || mode[0] != 'w')
+		return NULL;
+
+	rw.cur.pos = 0;
+	rw.cur.error = FALSE;
+	rw.last_dirty = ~0;
+	rw.xor_size = 0;
+
+	return &rw.cur;
+}
+
+static int rw_write(void *file, const void *in, u32 len)
+{
+	struct snapshot_buf *buf = file;
+	u32 page, offs, chunk, slot;
+	const u8 *src = in;
+	u32 alloc;
+	u8 *data;
+
+	if (buf->error)
+		return -1;
+
+	if (!rw.diffing || len > buf->size - buf->pos) {
+		// first capture, or the state grew: no delta this time
+		rw.diffing = FALSE;
+
+		if (len > buf->alloc - buf->pos) {
+			alloc = (buf->pos + len) * 2;
+			alloc = (alloc + SNAPSHOT_PAGE_SIZE - 1) & ~(SNAPSHOT_PAGE_SIZE - 1);
+
+			data = realloc(buf->data, alloc);
+			if (!data) {
+				buf->error = TRUE;
+				return -1;
+			}
+
+			buf->data = data;
+			buf->alloc = alloc;
+		}
+
+		memcpy(buf->data + buf->pos, in, len);
+		buf->pos += len;
+
+		return len;
+	}
+
+	while (len) {
+		page = buf->pos / SNAPSHOT_PAGE_SIZE;
+		offs = buf->pos % SNAPSHOT_PAGE_SIZE;
+		chunk = SNAPSHOT_PAGE_SIZE - offs;
+		if (chunk > len)
+			chunk = len;
+
+		data = buf->data + buf->pos;
+
+		if (memcmp(data, src, chunk)) {
+			// SaveState() writes sequentially, pages come in order
+			if (page != rw.last_dirty) {
+				rw.last_dirty = page;
+				rw.comp[page >> 3] |= 1 << (page & 7);
+
+				memset(rw.xor_buf + rw.xor_size, 0,
+				       page_len(buf->size, page));
+				rw.xor_size += page_len(buf->size, page);
+			}
+
+			slot = rw.xor_size - page_len(buf->size, page) + offs;
+			xor_page(rw.xor_buf + slot, data, src, chunk);
+			memcpy(data, src, chunk);
+		}
+
+		buf->pos += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+
+	return src - (const u8 *)in;
+}
+
+static int rw_read(void *file, void *out, u32 len)
+{
+	return -1;
+}
+
+static long rw_seek(void *file, long offs, int whence)
+{
+	return -1;
+}
+
+static void rw_close(void *file)
+{
+}
+
+static const struct PcsxSaveFuncs RewindFuncs = {
+	rw_open, rw_read, rw_write, rw_seek, rw_close,
+};
+
+int rewind_capture(void)
+{
+	struct PcsxSaveFuncs old = SaveFuncs;
+	u32 nb_pages, bitmap_size, start;
+	size_t comp_size;
+	int ret;
+
+	if (!rw.ring)
+		return -1;
+
+	start = get_time_us();
+
+	if (rewind_reserve(rw.cur.size))
+		return -1;
+
+	nb_pages = (rw.cur.size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+	bitmap_size = (nb_pages + 7) / 8;
+	memset(rw.comp, 0, bitmap_size);
+
+	rw.diffing = rw.have_cur;
+
+	SaveFuncs = RewindFuncs;
+	ret = SaveState(REWIND_FILE_NAME);
+	SaveFuncs = old;
+
+	if (ret || rw.cur.error) {
+		// the latest state was partially overwritten
+		rewind_reset();
+		return -1;
+	}
+
+	if (!rw.diffing || rw.cur.pos != rw.cur.size) {
+		rewind_reset();
+		rw.cur.size = rw.cur.pos;
+		rw.stats.last_size = 0;
+		goto out;
+	}
+
+	comp_size = ZSTD_compressCCtx(rw.cctx, rw.comp + bitmap_size,
+				      rw.comp_alloc - bitmap_size, rw.xor_buf,
+				      rw.xor_size, REWIND_ZSTD_LEVEL);
+	if (ZSTD_isError(comp_size)) {
+		rewind_reset();
+		return -1;
+	}
+
+	rewind_push(rw.comp, bitmap_size + comp_size);
+	rw.stats.last_size = bitmap_size + comp_size;
+
+out:
+	rw.have_cur = TRUE;
+
+	rw.stats.last_time_us = get_time_us() - start;
+	rw.stats.total_time_us += rw.stats.last_time_us;
+	if (rw.stats.last_time_us > rw.stats.max_time_us)
+		rw.stats.max_time_us = rw.stats.last_time_us;
+	rw.stats.nb_captures++;
+
+	return 0;
+}
+
+int rewind_step(void)
+{
+	const struct rewind_entry *entry;
+	u32 i, len, nb_pages, bitmap_size;
+	const u8 *bitmap, *src;
+	size_t size;
+	u8 *dst;
+
+	if (!rw.have_cur)
+		return -1;
+
+	if (snapshot_restore(&rw.cur))
+		return -1;
+
+	rw.frames = 0;
+
+	if (!rw.count) {
+		rw.have_cur = FALSE;
+		return 0;
+	}
+
+	// turn the latest state into the one captured before it
+	entry = &rw.entries[(rw.first + rw.count - 1) % REWIND_MAX_STATES];
+	nb_pages = (rw.cur.size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+	bitmap_size = (nb_pages + 7) / 8;
+	bitmap = rw.ring + entry->offset;
+
+	size = ZSTD_decompressDCtx(rw.dctx, rw.xor_buf, rw.xor_alloc,
+				   bitmap + bitmap_size, entry->size - bitmap_size);
+
+	rw.stats.mem_used -= entry->size;
+	rw.count--;
+
+	if (ZSTD_isError(size)) {
+		SysPrintf("rewind: corrupted delta, dropping the history\n");
+		rewind_reset();
+		return 0;
+	}
+
+	for (i = 0, src = rw.xor_buf; i < nb_pages; i++) {
+		if (!(bitmap[i >> 3] & (1 << (i & 7))))
+			continue;
+
+		dst = rw.cur.data + i * SNAPSHOT_PAGE_SIZE;
+		len = page_len(rw.cur.size, i);
+		xor_page(dst, dst, src, len);
+		src += len;
+	}
+
+	return 0;
+}
+
+void rewind_get_stats(struct rewind_stats *stats)
+{
+	*stats = rw.stats;
+	stats->nb_states = rw.count + rw.have_cur;
+}
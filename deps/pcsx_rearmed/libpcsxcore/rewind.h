@@ -0,0 +1,34 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include "psxcommon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rewind_stats {
+	u32 nb_states;		// states that can be rewound to
+	u32 mem_used;		// bytes used by the deltas in the ring buffer
+	u32 last_size;		// size of the last delta
+	u32 nb_captures;
+	u32 last_time_us;	// time spent capturing the last state
+	u32 max_time_us;
+	u64 total_time_us;
+};
+
+int  rewind_init(u32 budget, u32 interval);
+void rewind_shutdown(void);
+void rewind_reset(void);
+
+// Called once per frame, outside of psxCpu->Execute()
+void rewind_frame(void);
+
+int  rewind_capture(void);
+int  rewind_step(void);
+void rewind_get_stats(struct rewind_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,554 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+ * Incremental snapshots.
+ *
+ * The state is serialized to memory with SaveState() and compared page by
+ * page with the previous snapshot; only the pages that changed are
+ * compressed with zstd and appended to the snapshot file. The dynarecs
+ * write to RAM directly and the GPU/SPU plugins own their memories, so
+ * there is no write hook to track dirty pages with; comparing against the
+ * previous image finds them for RAM, VRAM, SPU RAM and the small plugin
+ * states alike.
+ *
+ * A snapshot file is a header followed by a base record (all pages) and
+ * the deltas saved after it. A new base is started every
+ * SNAPSHOT_MAX_DELTAS snapshots, so that loading never replays too many
+ * records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zstd.h>
+#include "system.h"
+#include "misc.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAX_DELTAS	64
+#define SNAPSHOT_ZSTD_LEVEL	1
+
+#define SNAPSHOT_FLAG_BASE	(1 << 0)
+
+// the "file" that SaveState()/LoadState() open through SnapshotFuncs
+#define SNAPSHOT_FILE_NAME	"(snapshot)"
+
+static const char SnapshotHeader[8] = "PCSXSNAP";
+static const u32 SnapshotVersion = 1;
+
+struct snapshot_record {
+	u32 flags;
+	u32 state_size;		// size of the serialized state
+	u32 nb_pages;		// pages set in the bitmap that follows
+	u32 comp_size;		// size of the compressed pages
+};
+
+static struct {
+	struct snapshot_buf prev;	// state of the last snapshot saved/loaded
+	struct snapshot_buf cur;
+	struct snapshot_buf *file;	// buffer that SNAPSHOT_FILE_NAME opens
+	char *path;			// file the deltas are appended to
+	u32 nb_deltas;
+	u8 *bitmap;
+	u32 bitmap_alloc;
+	u8 *comp;
+	size_t comp_alloc;
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+	struct snapshot_stats stats;
+} snap;
+
+/* SaveFuncs backend writing to / reading from a struct snapshot_buf */
+
+static void *snap_open(const char *name, const char *mode)
+{
+	struct snapshot_buf *buf = snap.file;
+
+	if (!buf || strcmp(name, SNAPSHOT_FILE_NAME))
+		return NULL;
+
+	buf->pos = 0;
+	buf->error = FALSE;
+	if (mode[0] == 'w')
+		buf->size = 0;
+
+	return buf;
+}
+
+static int snap_read(void *file, void *out, u32 len)
+{
+	struct snapshot_buf *buf = file;
+
+	if (len > buf->size - buf->pos)
+		len = buf->size - buf->pos;
+
+	memcpy(out, buf->data + buf->pos, len);
+	buf->pos += len;
+
+	return len;
+}
+
+static int snap_write(void *file, const void *in, u32 len)
+{
+	struct snapshot_buf *buf = file;
+	u32 alloc;
+	u8 *data;
+
+	if (buf->error)
+		return -1;
+
+	if (len > buf->alloc - buf->pos) {
+		alloc = (buf->pos + len) * 2;
+		alloc = (alloc + SNAPSHOT_PAGE_SIZE - 1) & ~(SNAPSHOT_PAGE_SIZE - 1);
+
+		data = realloc(buf->data, alloc);
+		if (!data) {
+			buf->error = TRUE;
+			return -1;
+		}
+
+		buf->data = data;
+		buf->alloc = alloc;
+	}
+
+	memcpy(buf->data + buf->pos, in, len);
+	buf->pos += len;
+	if (buf->pos > buf->size)
+		buf->size = buf->pos;
+
+	return len;
+}
+
+static long snap_seek(void *file, long offs, int whence)
+{
+	struct snapshot_buf *buf = file;
+
+	switch (whence) {
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		offs += buf->pos;
+		break;
+	case SEEK_END:
+		offs += buf->size;
+		break;
+	default:
+		return -1;
+	}
+
+	if (offs < 0 || offs > buf->size)
+		return -1;
+
+	buf->pos = offs;
+
+	return offs;
+}
+
+static void snap_close(void *file)
+{
+}
+
+static const struct PcsxSaveFuncs SnapshotFuncs = {
+	snap_open, snap_read, snap_write, snap_seek, snap_close,
+};
+
+int snapshot_capture(struct snapshot_buf *buf)
+{
+	struct PcsxSaveFuncs old = SaveFuncs;
+	int ret;
+
+	SaveFuncs = SnapshotFuncs;
+	snap.file = buf;
+	ret = SaveState(SNAPSHOT_FILE_NAME);
+	snap.file = NULL;
+	SaveFuncs = old;
+
+	if (buf->error)
+		ret = -1;
+
+	return ret;
+}
+
+int snapshot_restore(struct snapshot_buf *buf)
+{
+	struct PcsxSaveFuncs old = SaveFuncs;
+	int ret;
+
+	SaveFuncs = SnapshotFuncs;
+	snap.file = buf;
+	ret = LoadState(SNAPSHOT_FILE_NAME);
+	snap.file = NULL;
+	SaveFuncs = old;
+
+	return ret;
+}
+
+void snapshot_buf_free(struct snapshot_buf *buf)
+{
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+}
+
+static u32 get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int snap_reserve(u32 state_size, size_t comp_size)
+{
+	u32 bitmap_size = (state_size / SNAPSHOT_PAGE_SIZE + 8) / 8;
+	void *ptr;
+
+	if (bitmap_size > snap.bitmap_alloc) {
+		ptr = realloc(snap.bitmap, bitmap_size);
+		if (!ptr)
+			return -1;
+
+		snap.bitmap = ptr;
+		snap.bitmap_alloc = bitmap_size;
+	}
+
+	if (comp_size > snap.comp_alloc) {
+		ptr = realloc(snap.comp, comp_size);
+		if (!ptr)
+			return -1;
+
+		snap.comp = ptr;
+		snap.comp_alloc = comp_size;
+	}
+
+	return 0;
+}
+
+static void snap_swap(void)
+{
+	struct snapshot_buf tmp = snap.prev;
+
+	snap.prev = snap.cur;
+	snap.cur = tmp;
+}
+
+static int snap_set_path(const char *file)
+{
+	char *path;
+
+	if (snap.path && !strcmp(snap.path, file))
+		return 0;
+
+	path = strdup(file);
+	if (!path)
+		return -1;
+
+	free(snap.path);
+	snap.path = path;
+
+	return 0;
+}
+
+static int snap_compress(u32 nb_pages, size_t *comp_size)
+{
+	ZSTD_outBuffer out = { snap.comp, snap.comp_alloc, 0 };
+	ZSTD_inBuffer in;
+	u32 i, offs;
+	size_t ret;
+
+	if (!snap.cctx) {
+		snap.cctx = ZSTD_createCCtx();
+		if (!snap.cctx)
+			return -1;
+
+		ZSTD_CCtx_setParameter(snap.cctx, ZSTD_c_compressionLevel,
+				       SNAPSHOT_ZSTD_LEVEL);
+	}
+
+	ZSTD_CCtx_reset(snap.cctx, ZSTD_reset_session_only);
+
+	for (i = 0; i < nb_pages; i++) {
+		if (!(snap.bitmap[i >> 3] & (1 << (i & 7))))
+			continue;
+
+		offs = i * SNAPSHOT_PAGE_SIZE;
+		in.src = snap.cur.data + offs;
+		in.size = snap.cur.size - offs;
+		if (in.size > SNAPSHOT_PAGE_SIZE)
+			in.size = SNAPSHOT_PAGE_SIZE;
+		in.pos = 0;
+
+		while (in.pos < in.size) {
+			ret = ZSTD_compressStream2(snap.cctx, &out, &in,
+						   ZSTD_e_continue);
+			if (ZSTD_isError(ret))
+				return -1;
+		}
+	}
+
+	in.src = NULL;
+	in.size = in.pos = 0;
+
+	do {
+		ret = ZSTD_compressStream2(snap.cctx, &out, &in, ZSTD_e_end);
+		if (ZSTD_isError(ret))
+			return -1;
+	} while (ret);
+
+	*comp_size = out.pos;
+
+	return 0;
+}
+
+static int snap_decompress(u32 nb_pages, u32 comp_size)
+{
+	ZSTD_inBuffer in = { snap.comp, comp_size, 0 };
+	ZSTD_outBuffer out;
+	size_t ret, pos;
+	u32 i, offs;
+
+	if (!snap.dctx) {
+		snap.dctx = ZSTD_createDCtx();
+		if (!snap.dctx)
+			return -1;
+	}
+
+	ZSTD_DCtx_reset(snap.dctx, ZSTD_reset_session_only);
+
+	for (i = 0; i < nb_pages; i++) {
+		if (!(snap.bitmap[i >> 3] & (1 << (i & 7))))
+			continue;
+
+		offs = i * SNAPSHOT_PAGE_SIZE;
+		out.dst = snap.cur.data + offs;
+		out.size = snap.cur.size - offs;
+		if (out.size > SNAPSHOT_PAGE_SIZE)
+			out.size = SNAPSHOT_PAGE_SIZE;
+		out.pos = 0;
+
+		while (out.pos < out.size) {
+			pos = out.pos;
+
+			ret = ZSTD_decompressStream(snap.dctx, &out, &in);
+			if (ZSTD_isError(ret))
+				return -1;
+
+			if (out.pos == pos && in.pos == in.size)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+int snapshot_save(const char *file)
+{
+	struct snapshot_record rec = { 0, };
+	u32 i, offs, len, nb_pages, start;
+	size_t comp_size;
+	boolean base;
+	int write_error;
+	FILE *f;
+
+	start = get_time_us();
+
+	if (snapshot_capture(&snap.cur)) {
+		SysPrintf("snapshot: failed to serialize the state\n");
+		goto err_invalidate;
+	}
+
+	nb_pages = (snap.cur.size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+
+	base = !snap.path || strcmp(snap.path, file)
+		|| snap.prev.size != snap.cur.size
+		|| snap.nb_deltas >= SNAPSHOT_MAX_DELTAS;
+
+	if (snap_reserve(snap.cur.size, 0))
+		goto err_invalidate;
+
+	memset(snap.bitmap, 0, (nb_pages + 7) / 8);
+
+	for (i = 0; i < nb_pages; i++) {
+		offs = i * SNAPSHOT_PAGE_SIZE;
+		len = snap.cur.size - offs;
+		if (len > SNAPSHOT_PAGE_SIZE)
+			len = SNAPSHOT_PAGE_SIZE;
+
+		if (base || memcmp(snap.prev.data + offs,
+				   snap.cur.data + offs, len)) {
+			snap.bitmap[i >> 3] |= 1 << (i & 7);
+			rec.nb_pages++;
+		}
+	}
+
+	if (snap_reserve(snap.cur.size,
+			 ZSTD_compressBound(rec.nb_pages * SNAPSHOT_PAGE_SIZE))
+	    || snap_compress(nb_pages, &comp_size)) {
+		SysPrintf("snapshot: compression failed\n");
+		goto err_invalidate;
+	}
+
+	rec.flags = base ? SNAPSHOT_FLAG_BASE : 0;
+	rec.state_size = snap.cur.size;
+	rec.comp_size = comp_size;
+
+	f = fopen(file, base ? "wb" : "ab");
+	if (!f) {
+		SysPrintf("snapshot: can't open %s\n", file);
+		goto err_invalidate;
+	}
+
+	if (base) {
+		fwrite(SnapshotHeader, sizeof(SnapshotHeader), 1, f);
+		fwrite(&SnapshotVersion, sizeof(SnapshotVersion), 1, f);
+	}
+
+	fwrite(&rec, sizeof(rec), 1, f);
+	fwrite(snap.bitmap, (nb_pages + 7) / 8, 1, f);
+	fwrite(snap.comp, comp_size, 1, f);
+
+	write_error = ferror(f);
+	if (fclose(f) || write_error) {
+		SysPrintf("snapshot: error writing %s\n", file);
+		goto err_invalidate;
+	}
+
+	if (snap_set_path(file))
+		goto err_invalidate;
+
+	snap_swap();
+	snap.nb_deltas = base ? 0 : snap.nb_deltas + 1;
+
+	snap.stats.size = sizeof(rec) + (nb_pages + 7) / 8 + comp_size;
+	if (base)
+		snap.stats.size += sizeof(SnapshotHeader) + sizeof(SnapshotVersion);
+	snap.stats.dirty_pages = rec.nb_pages;
+	snap.stats.total_pages = nb_pages;
+	snap.stats.time_us = get_time_us() - start;
+	snap.stats.is_base = base;
+
+	SysPrintf("snapshot: %s %u/%u pages, %u bytes, %u.%03u ms\n",
+		  base ? "base" : "delta", rec.nb_pages, nb_pages,
+		  snap.stats.size, snap.stats.time_us / 1000,
+		  snap.stats.time_us % 1000);
+
+	return 0;
+
+err_invalidate:
+	// the file no longer matches the previous image, start a new base
+	snap.prev.size = 0;
+	return -1;
+}
+
+int snapshot_load(const char *file)
+{
+	struct snapshot_record rec;
+	u32 version, nb_pages, nb_deltas = 0;
+	boolean have_state = FALSE, truncated = FALSE;
+	char header[sizeof(SnapshotHeader)];
+	u8 *data;
+	FILE *f;
+
+	f = fopen(file, "rb");
+	if (!f)
+		return -1;
+
+	if (fread(header, sizeof(header), 1, f) != 1
+	    || memcmp(header, SnapshotHeader, sizeof(header))
+	    || fread(&version, sizeof(version), 1, f) != 1
+	    || version != SnapshotVersion) {
+		SysPrintf("%s: is not a snapshot?\n", file);
+		goto err_close;
+	}
+
+	// the image is rebuilt in cur, prev is no longer a valid reference
+	snap.prev.size = 0;
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (!(rec.flags & SNAPSHOT_FLAG_BASE)
+		    && (!have_state || rec.state_size != snap.cur.size)) {
+			truncated = TRUE;
+			break;
+		}
+
+		if (rec.state_size > snap.cur.alloc) {
+			data = realloc(snap.cur.data, rec.state_size);
+			if (!data)
+				goto err_close;
+
+			snap.cur.data = data;
+			snap.cur.alloc = rec.state_size;
+		}
+
+		nb_pages = (rec.state_size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+
+		if (snap_reserve(rec.state_size, rec.comp_size))
+			goto err_close;
+
+		if (fread(snap.bitmap, (nb_pages + 7) / 8, 1, f) != 1
+		    || (rec.comp_size && fread(snap.comp, rec.comp_size, 1, f) != 1)) {
+			truncated = TRUE;
+			break;
+		}
+
+		snap.cur.size = rec.state_size;
+
+		if (snap_decompress(nb_pages, rec.comp_size)) {
+			SysPrintf("%s: corrupted snapshot\n", file);
+			goto err_close;
+		}
+
+		nb_deltas = (rec.flags & SNAPSHOT_FLAG_BASE) ? 0 : nb_deltas + 1;
+		have_state = TRUE;
+	}
+
+	fclose(f);
+
+	if (!have_state)
+		return -1;
+
+	if (truncated)
+		SysPrintf("%s: truncated snapshot, using the last complete one\n", file);
+
+	if (snapshot_restore(&snap.cur) || snap_set_path(file))
+		return -1;
+
+	snap_swap();
+
+	// a damaged tail can't be appended to, the next save starts a new base
+	snap.nb_deltas = truncated ? SNAPSHOT_MAX_DELTAS : nb_deltas;
+
+	return 0;
+
+err_close:
+	fclose(f);
+	return -1;
+}
+
+void snapshot_reset(void)
+{
+	snapshot_buf_free(&snap.prev);
+	snapshot_buf_free(&snap.cur);
+	free(snap.path);
+	free(snap.bitmap);
+	free(snap.comp);
+	ZSTD_freeCCtx(snap.cctx);
+	ZSTD_freeDCtx(snap.dctx);
+	memset(&snap, 0, sizeof(snap));
+}
+
+const struct snapshot_stats *snapshot_last_stats(void)
+{
+	return &snap.stats;
+}
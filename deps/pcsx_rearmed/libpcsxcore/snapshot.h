@@ -0,0 +1,41 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "psxcommon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SNAPSHOT_PAGE_SIZE	4096
+
+// Serialized emulator state, as written by SaveState()
+struct snapshot_buf {
+	u8 *data;
+	u32 size;
+	u32 alloc;
+	u32 pos;
+	boolean error;
+};
+
+struct snapshot_stats {
+	u32 size;		// bytes written to the snapshot file
+	u32 dirty_pages;	// pages stored in the snapshot
+	u32 total_pages;	// pages of the full state
+	u32 time_us;		// time spent saving the snapshot
+	boolean is_base;	// full state, not a delta
+};
+
+int  snapshot_capture(struct snapshot_buf *buf);
+int  snapshot_restore(struct snapshot_buf *buf);
+void snapshot_buf_free(struct snapshot_buf *buf);
+
+int  snapshot_save(const char *file);
+int  snapshot_load(const char *file);
+void snapshot_reset(void);
+const struct snapshot_stats *snapshot_last_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
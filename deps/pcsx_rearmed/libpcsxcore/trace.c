@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+ * Trace files recorded for the host tools. The files opened so far are
+ * chained, so that EmuShutdown() can flush and close them all.
+ */
+
+#include <stdlib.h>
+#include "system.h"
+#include "trace.h"
+
+static struct trace_file *traces;
+
+void trace_write(struct trace_file *trace, const void *data, size_t size)
+{
+	const char *path;
+
+	if (!trace->f) {
+		// don't try again on each record, nor truncate a closed trace
+		if (trace->closed)
+			return;
+
+		path = getenv(trace->env);
+		if (!path)
+			path = trace->name;
+
+		trace->f = fopen(path, "wb");
+		if (!trace->f) {
+			SysPrintf("trace: can't open %s\n", path);
+			trace->closed = TRUE;
+			return;
+		}
+
+		trace->next = traces;
+		traces = trace;
+	}
+
+	fwrite(data, 1, size, trace->f);
+}
+
+void trace_close_all(void)
+{
+	struct trace_file *trace;
+
+	for (trace = traces; trace; trace = trace->next) {
+		fclose(trace->f);
+		trace->f = NULL;
+		trace->closed = TRUE;
+	}
+
+	traces = NULL;
+}
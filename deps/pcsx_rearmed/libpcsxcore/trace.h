@@ -0,0 +1,29 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include "psxcommon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Trace file of the host tools, e.g. EVENTS_TRACE in psxevents.c, named by
+ * the environment variable 'env' or else 'name'. It is opened on the first
+ * write, and flushed and closed by trace_close_all() at shutdown. */
+struct trace_file {
+	const char *env;
+	const char *name;
+	FILE *f;
+	boolean closed;		// failed to open, or closed at shutdown
+	struct trace_file *next;
+};
+
+void trace_write(struct trace_file *trace, const void *data, size_t size);
+void trace_close_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __TRACE_H__
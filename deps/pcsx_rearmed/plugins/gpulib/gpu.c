@@ -785,6 +785,24 @@ void GPUwriteData(uint32_t data)
     flush_cmd_buffer(&gpu);
 }
 
+// number of empty ordering table entries, as written by the OT clear DMA
+// (no command, linked to the previous word), starting at addr
+static int ot_empty_run(const uint32_t *rambase, uint32_t addr, int max)
+{
+  const uint32_t *list = rambase + (addr & 0x1fffff) / 4;
+  int n;
+
+  // stop at the start of RAM, the link of the entry there wraps around
+  if (max > (int)(addr & 0x1fffff) / 4 + 1)
+    max = (addr & 0x1fffff) / 4 + 1;
+
+  for (n = 0; n < max; n++, addr -= 4)
+    if (list[-n] != HTOLE32((addr - 4) & 0xffffff))
+      break;
+
+  return n;
+}
+
 long GPUdmaChain(uint32_t *rambase, uint32_t start_addr,
   uint32_t *progress_addr, int32_t *cycles_last_cmd)
 {
@@ -792,6 +810,7 @@ long GPUdmaChain(uint32_t *rambase, uint32_t start_addr,
   int len, left, count, ld_count = 32;
   int cpu_cycles_sum = 0;
   int cpu_cycles_last = 0;
+  int n, max, node_cycles;
 
   preload(rambase + (start_addr & 0x1fffff) / 4);
 
@@ -803,6 +822,44 @@ long GPUdmaChain(uint32_t *rambase, uint32_t start_addr,
   for (count = 0; (addr & 0x800000) == 0; count++)
   {
     list = rambase + (addr & 0x1fffff) / 4;
+
+    if (gpu.cmd_len == 0 && list[0] == HTOLE32((addr - 4) & 0xffffff)) {
+      /* Run of empty OT entries: walk it in one go, with the same
+       * accounting as below. It is cut short where the loop below
+       * would stop, or move the loop detection point. */
+      node_cycles = 10;
+      if (progress_addr && (gpu.status & PSX_GPU_STATUS_DHEIGHT))
+        node_cycles += 5;
+
+      max = ld_count - count + 1;
+      if (max <= 0)
+        max = 0x7fffffff;
+      if (progress_addr) {
+        n = cpu_cycles_sum > 512 ? 1 : (512 - cpu_cycles_sum) / node_cycles + 1;
+        if (max > n)
+          max = n;
+      }
+      if (addr > ld_addr && !((addr - ld_addr) & 3) && max > (addr - ld_addr) / 4)
+        max = (addr - ld_addr) / 4;
+
+      n = ot_empty_run(rambase, addr, max);
+      addr = (addr - n * 4) & 0xffffff;
+      count += n - 1;
+      cpu_cycles_sum += n * node_cycles;
+
+      if (progress_addr && cpu_cycles_sum > 512)
+        break;
+      if (addr == ld_addr) {
+        log_anomaly(&gpu, "GPUdmaChain: loop @ %08x, cnt=%u\n", addr, count);
+        break;
+      }
+      if (count == ld_count) {
+        ld_addr = addr;
+        ld_count *= 2;
+      }
+      continue;
+    }
+
     len = LE32TOH(list[0]) >> 24;
     addr = LE32TOH(list[0]) & 0xffffff;
     preload(rambase + (addr & 0x1fffff) / 4);
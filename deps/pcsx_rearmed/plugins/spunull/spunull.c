@@ -18,6 +18,7 @@
 // 7. Shutdown
 /////////////////////////////////////////////////////////
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -403,8 +404,8 @@ char * SPUgetLibInfos(void)
 typedef struct
 {
  char          szSPUName[8];
- unsigned long ulFreezeVersion;
- unsigned long ulFreezeSize;
+ uint32_t      ulFreezeVersion;
+ uint32_t      ulFreezeSize;
  unsigned char cSPUPort[0x200];
  unsigned char cSPURam[0x80000];
  xa_decode_t   xaS;     
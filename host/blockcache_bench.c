@@ -0,0 +1,425 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replays the block cache operations of Lightrec through the chained LUT that
+ * blockcache.c used to have, and through the current block index, checks
+ * that they find the same blocks, and compares the time they take.
+ *
+ * The operations are either recorded by a build with BLOCKCACHE_TRACE, or
+ * generated.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blockcache.h"
+#include "lightrec-private.h"
+#include "reaper.h"
+
+/* Size of the chained LUT of the old implementation */
+#define OLD_LUT_SIZE	0x4000
+
+/* The old implementation chained the blocks through a pointer in the block
+ * structure; embed the real one, so that both replays touch as much memory */
+struct old_block {
+	struct block block;
+	struct old_block *next;
+};
+
+/* Trace operation, with the block it refers to resolved to its position in
+ * the pool of blocks */
+struct replay_op {
+	u32 op;
+	u32 pc;
+	u32 len;
+	u32 block;
+};
+
+struct replay_result {
+	u64 sum;
+	double time;
+};
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct old_block * old_find(struct old_block **lut, u32 pc)
+{
+	struct old_block *block;
+
+	for (block = lut[(pc >> 2) & (OLD_LUT_SIZE - 1)];
+	     block; block = block->next)
+		if (block->block.pc == pc)
+			return block;
+
+	return NULL;
+}
+
+static struct old_block * old_find_from_lut(struct old_block **lut,
+					    u16 lut_entry, u32 addr)
+{
+	struct old_block *block;
+
+	for (block = lut[lut_entry]; block; block = block->next)
+		if (addr >= block->block.pc &&
+		    addr < block->block.pc + (block->block.nb_ops << 2))
+			return block;
+
+	return NULL;
+}
+
+static void old_register(struct old_block **lut, struct old_block *block)
+{
+	struct old_block **head = &lut[(block->block.pc >> 2) & (OLD_LUT_SIZE - 1)];
+
+	block->next = *head;
+	*head = block;
+}
+
+static void old_unregister(struct old_block **lut, struct old_block *block)
+{
+	struct old_block **prev = &lut[(block->block.pc >> 2) & (OLD_LUT_SIZE - 1)];
+
+	for (; *prev; prev = &(*prev)->next) {
+		if (*prev == block) {
+			*prev = block->next;
+			return;
+		}
+	}
+}
+
+static void replay_old(const struct replay_op *ops, size_t nb,
+		       unsigned int nb_blocks, struct replay_result *res)
+{
+	struct old_block **lut, *pool, *block = NULL;
+	const struct replay_op *op;
+	double start;
+	u64 sum = 0;
+	size_t n;
+
+	lut = calloc(OLD_LUT_SIZE, sizeof(*lut));
+	pool = calloc(nb_blocks, sizeof(*pool));
+	if (!lut || !pool)
+		exit(EXIT_FAILURE);
+
+	start = get_time();
+
+	for (n = 0; n < nb; n++) {
+		op = &ops[n];
+
+		switch (op->op) {
+		case BLOCKCACHE_TRACE_REGISTER:
+			pool[op->block].block.pc = op->pc;
+			pool[op->block].block.nb_ops = op->len >> 2;
+			old_register(lut, &pool[op->block]);
+			continue;
+		case BLOCKCACHE_TRACE_UNREGISTER:
+			old_unregister(lut, &pool[op->block]);
+			continue;
+		case BLOCKCACHE_TRACE_FIND:
+			block = old_find(lut, op->pc);
+			break;
+		case BLOCKCACHE_TRACE_FIND_FROM_LUT:
+			block = old_find_from_lut(lut, op->len, op->pc);
+			break;
+		}
+
+		sum = sum * 31 + (block ? block - pool + 1 : 0);
+	}
+
+	res->time = get_time() - start;
+	res->sum = sum;
+
+	free(pool);
+	free(lut);
+}
+
+static void replay_new(const struct replay_op *ops, size_t nb,
+		       unsigned int nb_blocks, struct replay_result *res)
+{
+	struct block *pool, *block = NULL;
+	struct lightrec_state *state;
+	bool *live;
+	struct blockcache *cache;
+	const struct replay_op *op;
+	double start;
+	u64 sum = 0;
+	size_t n;
+
+	/* The block cache only uses the reaper of the state */
+	state = calloc(1, sizeof(*state));
+	pool = calloc(nb_blocks, sizeof(*pool));
+	live = calloc(nb_blocks, sizeof(*live));
+	if (!state || !pool || !live)
+		exit(EXIT_FAILURE);
+
+	if (ENABLE_THREADED_COMPILER) {
+		state->reaper = lightrec_reaper_init(state);
+		if (!state->reaper)
+			exit(EXIT_FAILURE);
+	}
+
+	cache = lightrec_blockcache_init(state);
+	if (!cache)
+		exit(EXIT_FAILURE);
+
+	start = get_time();
+
+	for (n = 0; n < nb; n++) {
+		op = &ops[n];
+
+		switch (op->op) {
+		case BLOCKCACHE_TRACE_REGISTER:
+			pool[op->block].pc = op->pc;
+			pool[op->block].nb_ops = op->len >> 2;
+			lightrec_register_block(cache, &pool[op->block]);
+			live[op->block] = true;
+			continue;
+		case BLOCKCACHE_TRACE_UNREGISTER:
+			lightrec_unregister_block(cache, &pool[op->block]);
+			live[op->block] = false;
+			continue;
+		case BLOCKCACHE_TRACE_FIND:
+			block = lightrec_find_block(cache, op->pc);
+			break;
+		case BLOCKCACHE_TRACE_FIND_FROM_LUT:
+			block = lightrec_find_block_from_lut(cache, op->len, op->pc);
+			break;
+		}
+
+		sum = sum * 31 + (block ? block - pool + 1 : 0);
+	}
+
+	res->time = get_time() - start;
+	res->sum = sum;
+
+	/* The blocks are not Lightrec's; unregister them before the cache
+	 * tries to free them */
+	for (n = 0; n < nb_blocks; n++)
+		if (live[n])
+			lightrec_unregister_block(cache, &pool[n]);
+
+	if (ENABLE_THREADED_COMPILER)
+		lightrec_reaper_reap(state->reaper);
+
+	lightrec_free_block_cache(cache);
+
+	if (ENABLE_THREADED_COMPILER)
+		lightrec_reaper_destroy(state->reaper);
+
+	free(live);
+	free(pool);
+	free(state);
+}
+
+/* Resolves the IDs of the blocks into positions in a pool. Returns the size
+ * of the pool, or 0 on error. */
+static unsigned int prepare(const struct blockcache_trace *trace, size_t nb,
+			    struct replay_op *ops)
+{
+	unsigned int i, nb_blocks = 0, nb_live = 0, size = 1 << 16;
+	u32 *ids, *blocks;
+	size_t n;
+
+	ids = malloc(size * sizeof(*ids));
+	blocks = malloc(size * sizeof(*blocks));
+	if (!ids || !blocks)
+		return 0;
+
+	for (n = 0; n < nb; n++) {
+		ops[n].op = trace[n].op;
+		ops[n].pc = trace[n].pc;
+		ops[n].len = trace[n].len;
+		ops[n].block = 0;
+
+		if (trace[n].op > BLOCKCACHE_TRACE_UNREGISTER)
+			continue;
+
+		if (trace[n].op == BLOCKCACHE_TRACE_REGISTER) {
+			if (nb_live == size) {
+				free(ids);
+				free(blocks);
+				return 0;
+			}
+
+			ids[nb_live] = trace[n].id;
+			blocks[nb_live++] = nb_blocks;
+			ops[n].block = nb_blocks++;
+			continue;
+		}
+
+		/* Live blocks, searched linearly from the most recent one */
+		for (i = nb_live; i-- > 0; )
+			if (ids[i] == trace[n].id)
+				break;
+
+		if (i != -1u) {
+			ops[n].block = blocks[i];
+			ids[i] = ids[--nb_live];
+			blocks[i] = blocks[nb_live];
+		} else {
+			/* Unregistered block that was never registered */
+			ops[n].op = BLOCKCACHE_TRACE_FIND;
+		}
+	}
+
+	free(ids);
+	free(blocks);
+
+	return nb_blocks;
+}
+
+/* Mimics a game: a few thousand blocks looked up with a strong locality, one
+ * of them invalidated and registered again every 'interval' lookups, and the
+ * lookups of the blocks that contain the addresses written to. */
+static struct blockcache_trace *generate(size_t nb, unsigned int interval)
+{
+	enum { NB_BLOCKS = 6000 };
+	struct blockcache_trace *trace, *t;
+	u32 pcs[NB_BLOCKS], lens[NB_BLOCKS], ids[NB_BLOCKS];
+	u32 seed = 0x12345678, pc = 0x10000, next_id = 1, k;
+	size_t n = 0;
+
+	trace = malloc(nb * sizeof(*trace));
+	if (!trace)
+		return NULL;
+
+#define EMIT(o, p, l, i) do { \
+	if (n == nb) return trace; \
+	t = &trace[n++]; \
+	t->op = o; t->pc = p; t->len = l; t->id = i; \
+} while (0)
+#define RND() (seed = seed * 1103515245 + 12345, seed >> 8)
+
+	for (k = 0; k < NB_BLOCKS; k++) {
+		lens[k] = (2 + RND() % 30) << 2;
+		pcs[k] = pc;
+		ids[k] = 0;
+		pc += lens[k] + (RND() % 4 ? 0 : (RND() % 64) << 2);
+	}
+
+	for (;;) {
+		/* Skewed towards the first blocks */
+		k = RND() % NB_BLOCKS;
+		k = k * (RND() % NB_BLOCKS) / NB_BLOCKS;
+		k = k * (RND() % NB_BLOCKS) / NB_BLOCKS;
+
+		if (!ids[k]) {
+			ids[k] = next_id++;
+			EMIT(BLOCKCACHE_TRACE_FIND, pcs[k], 0, 0);
+			EMIT(BLOCKCACHE_TRACE_REGISTER, pcs[k], lens[k], ids[k]);
+			continue;
+		}
+
+		EMIT(BLOCKCACHE_TRACE_FIND, pcs[k], 0, 0);
+
+		if (RND() % 128 == 0) {
+			pc = pcs[k] + (RND() % (lens[k] >> 2) << 2);
+			EMIT(BLOCKCACHE_TRACE_FIND_FROM_LUT, pc,
+			     (pcs[k] >> 2) & (OLD_LUT_SIZE - 1), 0);
+		}
+
+		if (RND() % interval == 0) {
+			EMIT(BLOCKCACHE_TRACE_UNREGISTER, pcs[k], 0, ids[k]);
+			ids[k] = 0;
+		}
+	}
+
+#undef RND
+#undef EMIT
+}
+
+static struct blockcache_trace *load(const char *path, size_t *nb)
+{
+	struct blockcache_trace *trace;
+	long size;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	*nb = size / sizeof(*trace);
+	trace = malloc(*nb * sizeof(*trace));
+	if (trace && fread(trace, sizeof(*trace), *nb, f) != *nb) {
+		free(trace);
+		trace = NULL;
+	}
+
+	fclose(f);
+
+	return trace;
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_result old = { 0 }, new = { 0 }, res;
+	unsigned int i, nb_blocks, runs = 10, interval = 512;
+	struct blockcache_trace *trace;
+	struct replay_op *ops;
+	size_t nb = 10000000;
+	char *end;
+
+	/* Either a recorded trace, or the invalidation interval of the
+	 * generated one */
+	if (argc > 1)
+		interval = strtoul(argv[1], &end, 0);
+
+	if (argc > 1 && (*end || !interval)) {
+		trace = load(argv[1], &nb);
+		if (!trace) {
+			fprintf(stderr, "Unable to read trace %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+	} else {
+		trace = generate(nb, interval);
+		if (!trace)
+			return EXIT_FAILURE;
+	}
+
+	ops = malloc(nb * sizeof(*ops));
+	nb_blocks = ops ? prepare(trace, nb, ops) : 0;
+	free(trace);
+
+	if (!nb_blocks) {
+		fprintf(stderr, "Unable to prepare the trace\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < runs; i++) {
+		replay_old(ops, nb, nb_blocks, &res);
+		old.time += res.time;
+		old.sum = res.sum;
+
+		replay_new(ops, nb, nb_blocks, &res);
+		new.time += res.time;
+		new.sum = res.sum;
+	}
+
+	free(ops);
+
+	printf("%zu records, %u blocks, %u runs\n", nb, nb_blocks, runs);
+	printf("chained LUT: %.2f ns/record\n", old.time * 1e9 / (nb * runs));
+	printf("block index: %.2f ns/record\n", new.time * 1e9 / (nb * runs));
+
+	if (old.sum != new.sum) {
+		printf("Results differ!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Streams all the sectors of a CHD image through the hunk pool of
+ * chd_cache.c and cdimg_cache.c, like cdriso.c reads them, with and without read-ahead, and
+ * reports the throughput and the worst time spent waiting for a sector.
+ *
+ * An optional delay between two sectors, in microseconds, stands for the
+ * time between two reads of the emulated drive (e.g. 6667 at 2x speed), that
+ * the read-ahead can use even on a single core while the emulator idles.
+ * An optional cache size, in KiB, is the memory budget of the pool.
+ *
+ * The image is streamed twice: once from start to end, then as two halves
+ * read in alternance, like a game that loads data while it plays XA audio.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libchdr/chd.h>
+#include <libpcsxcore/cdimg_cache.h>
+#include <libpcsxcore/chd_cache.h>
+
+#define SECTOR_SIZE	2352
+#define FRAME_SIZE	(SECTOR_SIZE + 96)
+
+struct bench_config {
+	u32 ahead, threads;
+};
+
+static const struct bench_config configs[] = {
+	{ 0, 0 }, { 8, 1 }, { 16, 2 }, { 16, 4 },
+};
+
+void SysPrintf(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void delay(double us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1e6,
+		.tv_nsec = (long)(us * 1e3) % 1000000000,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+static const char * const modes[] = { "linear", "ping-pong" };
+
+static u32 hash(u32 h, const u8 *buf, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ buf[i]) * 16777619;
+
+	return h;
+}
+
+int main(int argc, char **argv)
+{
+	double start, t, elapsed, latency, worst, delay_us = 0;
+	u32 c, m, i, sector, nb_sectors, sectors_per_hunk, sum, ref[2] = { 0 };
+	u32 cache_size = 0;
+	struct cdimg_cache_stats stats;
+	const chd_header *header;
+	const u8 *hunk;
+	u8 buf[SECTOR_SIZE];
+	chd_file *chd;
+	int ret = EXIT_SUCCESS;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <image.chd> [delay_us] [cache_kb]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		delay_us = strtod(argv[2], NULL);
+	if (argc > 3)
+		cache_size = strtoul(argv[3], NULL, 0) * 1024;
+
+	if (chd_open(argv[1], CHD_OPEN_READ, NULL, &chd) != CHDERR_NONE) {
+		fprintf(stderr, "Unable to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	header = chd_get_header(chd);
+	sectors_per_hunk = header->hunkbytes / FRAME_SIZE;
+	nb_sectors = header->hunkcount * sectors_per_hunk;
+
+	printf("%u sectors, %u per hunk, %.0f us between sectors\n",
+	       nb_sectors, sectors_per_hunk, delay_us);
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		if (chd_cache_open(chd, argv[1], cache_size, configs[c].ahead,
+				   configs[c].threads)) {
+			ret = EXIT_FAILURE;
+			goto out_close;
+		}
+
+		sum = 2166136261;
+		worst = 0;
+		latency = 0;
+		start = get_time();
+
+		for (i = 0; i < nb_sectors; i++) {
+			sector = i;
+			if (m == 1)
+				sector = i / 2 + (i & 1) * (nb_sectors / 2);
+
+			t = get_time();
+
+			hunk = chd_cache_get(sector / sectors_per_hunk, TRUE);
+			memcpy(buf, hunk + (sector % sectors_per_hunk) * FRAME_SIZE, SECTOR_SIZE);
+
+			t = get_time() - t;
+			latency += t;
+			if (t > worst)
+				worst = t;
+
+			sum = hash(sum, buf, SECTOR_SIZE);
+
+			if (delay_us)
+				delay(delay_us);
+		}
+
+		elapsed = get_time() - start;
+		cdimg_cache_get_stats(&stats);
+		chd_cache_close();
+
+		printf("%-9s ahead %2u, %u threads: %7.1f MB/s, %6.1f us/sector avg, %8.1f us worst\n",
+		       modes[m], configs[c].ahead, configs[c].threads,
+		       nb_sectors * (double)SECTOR_SIZE / elapsed / 1e6,
+		       latency * 1e6 / nb_sectors, worst * 1e6);
+		printf("          %u hunks (%u KiB): %u hits, %u waits, %u misses, "
+		       "read ahead %u used, %u dropped\n",
+		       stats.nb_blocks, stats.mem_used / 1024, stats.hits, stats.waits,
+		       stats.misses, stats.ahead_used, stats.ahead_dropped);
+
+		if (!c)
+			ref[m] = sum;
+		else if (sum != ref[m]) {
+			printf("Data differs!\n");
+			ret = EXIT_FAILURE;
+		}
+	}
+
+out_close:
+	chd_close(chd);
+
+	return ret;
+}
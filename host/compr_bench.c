@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Compresses a raw CD image (.bin) into CBIN-like images of 1-sector blocks,
+ * packed and aligned to 32 bytes, and a PBP-like image of 16-sector blocks,
+ * then reads every sector of them through the block cache of compr_cache.c
+ * and cdimg_cache.c, and through a plain decoder that inflates each block on
+ * demand and keeps only the last one, like cdriso.c used to. The sectors read both ways are hashed against the source image.
+ *
+ * The time spent reading each sector is measured. The sectors are read from
+ * start to end, at random, in alternance from two streams (4 sectors each),
+ * and at random with the target of each read reported ahead of time (like a
+ * seek) through compr_cache_prefetch().
+ *
+ * An optional delay between two sectors, in microseconds, stands for the time
+ * between two reads of the emulated drive, that the worker thread can use
+ * even on a single core while the emulator idles. An optional cache size, in
+ * KiB, is the memory budget of the block cache.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <libpcsxcore/cdimg_cache.h>
+#include <libpcsxcore/compr_cache.h>
+
+#define SECTOR_SIZE	2352
+#define INDEX_PLAIN	0x80000000
+
+enum {
+	MODE_LINEAR,
+	MODE_RANDOM,
+	MODE_PING_PONG,
+	MODE_SEEK,
+	MODE_COUNT,
+};
+
+static const char * const modes[] = {
+	"linear", "random", "ping-pong", "seek",
+};
+
+struct layout {
+	const char *name;
+	u32 block_shift;
+	u32 align;
+};
+
+static const struct layout layouts[] = {
+	{ "CBIN", 0, 0 }, { "CBIN/32", 0, 5 }, { "PBP", 4, 0 },
+};
+
+struct plain_decoder {
+	FILE *f;
+	const u32 *index;
+	u32 align;
+	u32 block;
+	z_stream z;
+	u8 in[SECTOR_SIZE * 16];
+	u8 out[SECTOR_SIZE * 16];
+};
+
+void SysPrintf(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void delay(double us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1e6,
+		.tv_nsec = (long)(us * 1e3) % 1000000000,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+static u32 hash(u32 h, const u8 *buf, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ buf[i]) * 16777619;
+
+	return h;
+}
+
+static u32 xorshift(u32 *state)
+{
+	u32 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+/* Returns the sector read at step 'i' of the given mode */
+static u32 get_sector(unsigned int mode, u32 i, u32 nb_sectors, u32 *seed)
+{
+	switch (mode) {
+	case MODE_LINEAR:
+		return i;
+	case MODE_PING_PONG:
+		return (i / 8) * 4 + i % 4 + ((i / 4) & 1) * (nb_sectors / 2);
+	default:
+		return xorshift(seed) % nb_sectors;
+	}
+}
+
+/* Writes the blocks of 1 << shift sectors as raw deflate streams, or plain
+ * when they do not shrink, each one padded to 1 << align bytes, and returns
+ * the index in the CISO format */
+static u32 * write_image(FILE *f, const u8 *src, u32 nb_sectors, u32 shift,
+			 u32 align, u32 *index_len)
+{
+	u32 i, nb_blocks, block_size = SECTOR_SIZE << shift, size, offset = 0;
+	static const u8 padding[1 << 5];
+	static u8 out[SECTOR_SIZE * 16];
+	z_stream z = { 0 };
+	u32 *index;
+
+	nb_blocks = nb_sectors >> shift;
+	index = malloc((nb_blocks + 1) * sizeof(*index));
+	if (!index)
+		return NULL;
+
+	if (deflateInit2(&z, 9, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(index);
+		return NULL;
+	}
+
+	for (i = 0; i < nb_blocks; i++) {
+		deflateReset(&z);
+		z.next_in = (u8 *)src + i * block_size;
+		z.avail_in = block_size;
+		z.next_out = out;
+		z.avail_out = sizeof(out);
+
+		if (deflate(&z, Z_FINISH) == Z_STREAM_END
+		    && z.total_out < block_size) {
+			size = z.total_out;
+			index[i] = offset >> align;
+			fwrite(out, 1, size, f);
+		} else {
+			size = block_size;
+			index[i] = offset >> align | INDEX_PLAIN;
+			fwrite(z.next_in - z.total_in, 1, size, f);
+		}
+
+		offset += size;
+
+		size = -offset & ((1 << align) - 1);
+		fwrite(padding, 1, size, f);
+		offset += size;
+	}
+
+	index[nb_blocks] = offset >> align;
+	*index_len = nb_blocks;
+
+	deflateEnd(&z);
+	fflush(f);
+
+	return index;
+}
+
+static const u8 * plain_get(struct plain_decoder *dec, u32 block, u32 block_size)
+{
+	u32 start = (dec->index[block] & ~INDEX_PLAIN) << dec->align;
+	u32 size = ((dec->index[block + 1] & ~INDEX_PLAIN) << dec->align) - start;
+
+	if (block == dec->block)
+		return dec->out;
+
+	if (fseeko(dec->f, start, SEEK_SET) != 0)
+		return NULL;
+
+	if (dec->index[block] & INDEX_PLAIN) {
+		size = block_size;
+		if (fread(dec->out, 1, size, dec->f) != size)
+			return NULL;
+	} else {
+		if (fread(dec->in, 1, size, dec->f) != size)
+			return NULL;
+
+		inflateReset(&dec->z);
+		dec->z.next_in = dec->in;
+		dec->z.avail_in = size;
+		dec->z.next_out = dec->out;
+		dec->z.avail_out = block_size;
+
+		if (inflate(&dec->z, Z_NO_FLUSH) != Z_STREAM_END)
+			return NULL;
+	}
+
+	dec->block = block;
+
+	return dec->out;
+}
+
+int main(int argc, char **argv)
+{
+	double t, worst, latency[2], delay_us = 0;
+	u32 l, m, i, k, sector, next, nb_sectors, index_len, shift, seed;
+	u32 *index, *index_copy, sum[3], cache_size = 0;
+	struct cdimg_cache_stats stats;
+	struct plain_decoder dec;
+	const u8 *block;
+	char path[] = "/tmp/compr-bench-XXXXXX";
+	long src_size;
+	u8 *src;
+	FILE *f;
+	int fd, ret = EXIT_SUCCESS;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <image.bin> [delay_us] [cache_kb]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		delay_us = strtod(argv[2], NULL);
+	if (argc > 3)
+		cache_size = strtoul(argv[3], NULL, 0) * 1024;
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		fprintf(stderr, "Unable to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fseek(f, 0, SEEK_END);
+	src_size = ftell(f);
+	rewind(f);
+
+	/* Whole blocks of 16 sectors only, so that both layouts match */
+	nb_sectors = (src_size / SECTOR_SIZE) & ~15;
+	src = malloc((size_t)nb_sectors * SECTOR_SIZE);
+	if (!nb_sectors || !src
+	    || fread(src, SECTOR_SIZE, nb_sectors, f) != nb_sectors) {
+		fprintf(stderr, "Unable to read %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fclose(f);
+
+	printf("%u sectors, %.0f us between sectors\n", nb_sectors, delay_us);
+
+	memset(&dec, 0, sizeof(dec));
+	if (inflateInit2(&dec.z, -15) != Z_OK)
+		return EXIT_FAILURE;
+
+	for (l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+		shift = layouts[l].block_shift;
+
+		fd = mkstemp(path);
+		f = fd < 0 ? NULL : fdopen(fd, "w+b");
+		if (!f) {
+			fprintf(stderr, "Unable to create %s\n", path);
+			return EXIT_FAILURE;
+		}
+
+		index = write_image(f, src, nb_sectors, shift, layouts[l].align,
+				    &index_len);
+		if (!index) {
+			fprintf(stderr, "Unable to compress %s\n", argv[1]);
+			ret = EXIT_FAILURE;
+			goto out_close;
+		}
+
+		printf("%s: %u blocks of %u sectors, %.1f%% of the image\n",
+		       layouts[l].name, index_len, 1 << shift,
+		       100.0 * ((u64)index[index_len] << layouts[l].align)
+		       / ((double)nb_sectors * SECTOR_SIZE));
+
+		for (m = 0; m < MODE_COUNT; m++) {
+			/* The compressed image through the old and new code */
+			for (k = 0; k < 2; k++) {
+				if (k == 0) {
+					dec.f = f;
+					dec.index = index;
+					dec.align = layouts[l].align;
+					dec.block = ~0u;
+				} else {
+					index_copy = malloc((index_len + 1) * sizeof(*index));
+					if (!index_copy) {
+						ret = EXIT_FAILURE;
+						goto out_free_index;
+					}
+
+					memcpy(index_copy, index, (index_len + 1) * sizeof(*index));
+
+					/* The cache frees the index */
+					if (compr_cache_open(f, path, index_copy, index_len,
+							     0, layouts[l].align, shift,
+							     cache_size)) {
+						ret = EXIT_FAILURE;
+						goto out_free_index;
+					}
+				}
+
+				seed = 0x12345678;
+				sector = get_sector(m, 0, nb_sectors, &seed);
+				sum[k + 1] = 2166136261;
+				worst = 0;
+				latency[k] = 0;
+
+				for (i = 0; i < nb_sectors; i++) {
+					next = get_sector(m, i + 1, nb_sectors, &seed);
+					t = get_time();
+
+					if (k == 0)
+						block = plain_get(&dec, sector >> shift,
+								  SECTOR_SIZE << shift);
+					else
+						block = compr_cache_get(sector >> shift, sector);
+					if (!block) {
+						fprintf(stderr, "Unable to read sector %u\n", sector);
+						ret = EXIT_FAILURE;
+						break;
+					}
+
+					block += (sector & ((1 << shift) - 1)) * SECTOR_SIZE;
+
+					/* The next read is known now, the seek takes the delay */
+					if (k == 1 && m == MODE_SEEK)
+						compr_cache_prefetch(next >> shift);
+
+					t = get_time() - t;
+					latency[k] += t;
+					if (t > worst)
+						worst = t;
+
+					sum[k + 1] = hash(sum[k + 1], block, SECTOR_SIZE);
+
+					if (delay_us)
+						delay(delay_us);
+
+					sector = next;
+				}
+
+				if (k == 1) {
+					cdimg_cache_get_stats(&stats);
+					compr_cache_close();
+				}
+			}
+
+			/* The source sectors, in the same order */
+			seed = 0x12345678;
+			sum[0] = 2166136261;
+
+			for (i = 0; i < nb_sectors; i++) {
+				sector = get_sector(m, i, nb_sectors, &seed);
+				sum[0] = hash(sum[0], src + (size_t)sector * SECTOR_SIZE,
+					      SECTOR_SIZE);
+			}
+
+			printf("%-7s %-10s old %7.2f us/sector, new %7.2f us/sector "
+			       "(worst %6.0f us), %u hits, %u waits, %u misses, "
+			       "%u ahead: %s\n", layouts[l].name, modes[m],
+			       latency[0] * 1e6 / nb_sectors,
+			       latency[1] * 1e6 / nb_sectors, worst * 1e6,
+			       stats.hits, stats.waits, stats.misses, stats.ahead_used,
+			       sum[1] == sum[0] && sum[2] == sum[0] ? "OK" : "MISMATCH");
+
+			if (sum[1] != sum[0] || sum[2] != sum[0])
+				ret = EXIT_FAILURE;
+		}
+
+out_free_index:
+		free(index);
+out_close:
+		fclose(f);
+		unlink(path);
+		strcpy(path, "/tmp/compr-bench-XXXXXX");
+
+		if (ret != EXIT_SUCCESS)
+			break;
+	}
+
+	inflateEnd(&dec.z);
+	free(src);
+
+	return ret;
+}
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replays a stream of PSX events through the bitmask scan that psxevents.c
+ * used to do, and through the event heap, and compares the time they take.
+ *
+ * The stream is either recorded by a build with EVENTS_TRACE, or generated.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libpcsxcore/event_heap.h>
+
+#define NB_EVENTS	15
+#define CLOCK		33868800
+
+struct replay_result {
+	u64 sum;
+	double time;
+};
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static u32 scan_next(const u32 *event_cycles, u32 pending, u32 cycle)
+{
+	s32 min = CLOCK, dif;
+	u32 i;
+
+	for (i = 0; pending != 0; i++, pending >>= 1) {
+		if (!(pending & 1))
+			continue;
+		dif = event_cycles[i] - cycle;
+		if (0 < dif && dif < min)
+			min = dif;
+	}
+
+	return cycle + min;
+}
+
+static u32 scan_due(const u32 *event_cycles, u32 pending, u32 cycle)
+{
+	u32 i, due = 0;
+
+	for (i = 0; pending >> i; i++)
+		if ((pending & (1u << i)) && (s32)(cycle - event_cycles[i]) >= 0)
+			due |= 1u << i;
+
+	return due;
+}
+
+static u32 heap_next(struct event_heap *h, const u32 *event_cycles,
+		     u32 pending, u32 cycle)
+{
+	s32 dif;
+
+	while (h->count && !(pending & (1u << h->event[0])))
+		event_heap_remove(h, h->event[0]);
+
+	if (!h->count)
+		return cycle + CLOCK;
+
+	dif = h->deadline[0] - cycle;
+	if (dif <= 0)
+		return scan_next(event_cycles, pending, cycle);
+
+	return cycle + (dif < CLOCK ? dif : CLOCK);
+}
+
+static void replay(const struct event_trace *trace, size_t nb, int use_heap,
+		   struct replay_result *res)
+{
+	u32 event_cycles[32] = { 0 }, due, i;
+	struct event_heap heap;
+	double start;
+	u64 sum = 0;
+	size_t n;
+
+	event_heap_init(&heap);
+	start = get_time();
+
+	for (n = 0; n < nb; n++) {
+		const struct event_trace *t = &trace[n];
+
+		switch (t->op) {
+		case EVENT_TRACE_QUEUE:
+			event_cycles[t->e] = t->cycle;
+			if (use_heap)
+				event_heap_queue(&heap, t->e, t->cycle);
+			break;
+		case EVENT_TRACE_SCHEDULE:
+			if (use_heap)
+				sum += heap_next(&heap, event_cycles, t->pending, t->cycle);
+			else
+				sum += scan_next(event_cycles, t->pending, t->cycle);
+			break;
+		case EVENT_TRACE_TEST:
+			if (!use_heap) {
+				sum += scan_due(event_cycles, t->pending, t->cycle);
+				break;
+			}
+
+			due = event_heap_due(&heap, t->pending, t->cycle);
+			for (i = 0; due >> i; i++)
+				if (due & (1u << i))
+					event_heap_remove(&heap, i);
+			sum += due;
+			break;
+		}
+	}
+
+	res->time = get_time() - start;
+	res->sum = sum;
+}
+
+/* Mimics a busy game: the root counters and the SPU update are always
+ * pending, the other events get queued, rescheduled and cancelled. */
+static struct event_trace *generate(size_t nb)
+{
+	static const u32 periods[NB_EVENTS] = {
+		2000, 40000, 13000, 3000, 9000, 1500, 9000, 500,
+		4000, 0, 0, 800, 64000, 1700, 2150,
+	};
+	u32 event_cycles[NB_EVENTS], pending = 0, cycle = 0, next, due, i;
+	struct event_trace *trace, *t;
+	u32 seed = 0x12345678;
+	size_t n = 0;
+
+	trace = malloc(nb * sizeof(*trace));
+	if (!trace)
+		return NULL;
+
+#define EMIT(o, ev, c, p) do { \
+	if (n == nb) return trace; \
+	t = &trace[n++]; \
+	t->op = o; t->e = ev; t->cycle = c; t->pending = p; \
+} while (0)
+
+	for (;;) {
+		for (i = 0; i < NB_EVENTS; i++) {
+			if (!periods[i] || (pending & (1u << i)))
+				continue;
+
+			seed = seed * 1103515245 + 12345;
+			if (i < 12 && (seed >> 16) % 4)
+				continue;
+
+			event_cycles[i] = cycle + periods[i] / 2
+				+ (seed >> 8) % periods[i];
+			pending |= 1u << i;
+			EMIT(EVENT_TRACE_QUEUE, i, event_cycles[i], 0);
+		}
+
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 8 == 0)
+			pending &= ~(1u << ((seed >> 20) % 12));
+
+		EMIT(EVENT_TRACE_SCHEDULE, 0, cycle, pending);
+		next = scan_next(event_cycles, pending, cycle);
+		cycle = next + (seed >> 24) % 16;
+
+		EMIT(EVENT_TRACE_TEST, 0, cycle, pending);
+		due = scan_due(event_cycles, pending, cycle);
+		pending &= ~due;
+	}
+
+#undef EMIT
+}
+
+static struct event_trace *load(const char *path, size_t *nb)
+{
+	struct event_trace *trace;
+	long size;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	*nb = size / sizeof(*trace);
+	trace = malloc(*nb * sizeof(*trace));
+	if (trace && fread(trace, sizeof(*trace), *nb, f) != *nb) {
+		free(trace);
+		trace = NULL;
+	}
+
+	fclose(f);
+
+	return trace;
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_result scan = { 0 }, heap = { 0 }, res;
+	unsigned int i, runs = 10;
+	struct event_trace *trace;
+	size_t nb = 10000000;
+
+	if (argc > 1) {
+		trace = load(argv[1], &nb);
+		if (!trace) {
+			fprintf(stderr, "Unable to read trace %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+	} else {
+		trace = generate(nb);
+		if (!trace)
+			return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < runs; i++) {
+		replay(trace, nb, 0, &res);
+		scan.time += res.time;
+		scan.sum = res.sum;
+
+		replay(trace, nb, 1, &res);
+		heap.time += res.time;
+		heap.sum = res.sum;
+	}
+
+	free(trace);
+
+	printf("%zu records, %u runs\n", nb, runs);
+	printf("scan: %.2f ns/record\n", scan.time * 1e9 / (nb * runs));
+	printf("heap: %.2f ns/record\n", heap.time * 1e9 / (nb * runs));
+
+	if (scan.sum != heap.sum) {
+		printf("Results differ!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replays display lists through GPUdmaChain() of gpulib, with the null
+ * renderer, and reports how many nodes of the lists are walked per second.
+ *
+ * The lists are either recorded by a build with GPUDMA_TRACE, or a
+ * generated frame: an ordering table cleared by the OT DMA, with some
+ * primitives sorted in.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gpulib/gpu.h>
+
+#define RAM_SIZE	0x200000
+#define OT_ADDR		0x1c0000
+#define OT_LEN		4096
+#define PACKETS_ADDR	0x100000
+#define NB_PRIMS	800
+
+struct dma_list {
+	uint32_t start;
+	uint32_t nb_nodes;
+	uint32_t *nodes;	// address, length, then the words of each node
+	size_t size;
+};
+
+static uint32_t ram[RAM_SIZE / 4];
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_nodes(const struct dma_list *list, int clear)
+{
+	const uint32_t *p = list->nodes;
+	uint32_t addr, len;
+
+	while (p < list->nodes + list->size) {
+		addr = p[0] & 0x1fffff;
+		len = p[1];
+
+		if (clear)
+			memset(&ram[addr / 4], 0, len * 4);
+		else
+			memcpy(&ram[addr / 4], p + 2, len * 4);
+
+		p += 2 + len;
+	}
+}
+
+/* Same as psxDma6() */
+static void clear_ot(uint32_t addr, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 1; i < len; i++)
+		ram[addr / 4 + i] = HTOLE32((addr + i * 4 - 4) & 0xffffff);
+
+	ram[addr / 4] = HTOLE32(0xffffff);
+}
+
+static int generate(struct dma_list *list)
+{
+	uint32_t i, slot, pkt, addr, len, seed = 0x12345678;
+	uint32_t *p;
+
+	clear_ot(OT_ADDR, OT_LEN);
+
+	// flat quads, sorted in like addPrim() does
+	for (i = 0; i < NB_PRIMS; i++) {
+		seed = seed * 1103515245 + 12345;
+		slot = OT_ADDR / 4 + (seed >> 8) % OT_LEN;
+		pkt = PACKETS_ADDR / 4 + i * 6;
+
+		ram[pkt] = HTOLE32((5 << 24) | (LE32TOH(ram[slot]) & 0xffffff));
+		ram[pkt + 1] = HTOLE32(0x28808080);
+		ram[pkt + 2] = HTOLE32(0x00000000);
+		ram[pkt + 3] = HTOLE32(0x00000010);
+		ram[pkt + 4] = HTOLE32(0x00100000);
+		ram[pkt + 5] = HTOLE32(0x00100010);
+		ram[slot] = HTOLE32(pkt * 4);
+	}
+
+	list->start = OT_ADDR + (OT_LEN - 1) * 4;
+	list->nb_nodes = OT_LEN + NB_PRIMS;
+	list->size = OT_LEN * 3 + NB_PRIMS * 8;
+	list->nodes = p = malloc(list->size * 4);
+	if (!p)
+		return -1;
+
+	for (addr = list->start; !(addr & 0x800000); addr = LE32TOH(ram[addr / 4]) & 0xffffff) {
+		len = 1 + (LE32TOH(ram[addr / 4]) >> 24);
+		*p++ = addr;
+		*p++ = len;
+		memcpy(p, &ram[addr / 4], len * 4);
+		p += len;
+	}
+
+	memset(ram, 0, sizeof(ram));
+
+	return 0;
+}
+
+static struct dma_list *load(const char *path, unsigned int *nb)
+{
+	struct dma_list *lists = NULL, *list;
+	uint32_t hdr[2], *nodes;
+	size_t alloc;
+	void *tmp;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	for (*nb = 0; fread(hdr, sizeof(hdr[0]), 1, f) == 1; (*nb)++) {
+		tmp = realloc(lists, (*nb + 1) * sizeof(*lists));
+		if (!tmp)
+			break;
+
+		lists = tmp;
+		list = &lists[*nb];
+		memset(list, 0, sizeof(*list));
+		list->start = hdr[0];
+		alloc = 0;
+
+		while (fread(hdr, sizeof(hdr[0]), 1, f) == 1 && hdr[0] != ~0u) {
+			if (fread(&hdr[1], sizeof(hdr[1]), 1, f) != 1)
+				break;
+
+			if (list->size + 2 + hdr[1] > alloc) {
+				alloc = (list->size + 2 + hdr[1]) * 2;
+				tmp = realloc(list->nodes, alloc * 4);
+				if (!tmp)
+					break;
+				list->nodes = tmp;
+			}
+
+			nodes = list->nodes + list->size;
+			nodes[0] = hdr[0];
+			nodes[1] = hdr[1];
+			if (fread(nodes + 2, 4, hdr[1], f) != hdr[1])
+				break;
+
+			list->size += 2 + hdr[1];
+			list->nb_nodes++;
+		}
+	}
+
+	fclose(f);
+
+	return lists;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i, run, runs, nb = 1;
+	struct dma_list *lists;
+	double start, elapsed = 0;
+	uint64_t nodes = 0;
+	int32_t cycles_last;
+	long cycles = 0;
+
+	if (argc > 1) {
+		lists = load(argv[1], &nb);
+		if (!lists || !nb) {
+			fprintf(stderr, "Unable to read trace %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+	} else {
+		lists = malloc(sizeof(*lists));
+		if (!lists || generate(lists))
+			return EXIT_FAILURE;
+	}
+
+	GPUinit();
+
+	for (i = 0; i < nb; i++)
+		nodes += lists[i].nb_nodes;
+
+	// about 200M nodes
+	runs = 200000000 / (nodes + 1) + 1;
+
+	for (i = 0; i < nb; i++) {
+		write_nodes(&lists[i], 0);
+
+		start = get_time();
+
+		for (run = 0; run < runs; run++)
+			cycles += GPUdmaChain(ram, lists[i].start, NULL, &cycles_last);
+
+		elapsed += get_time() - start;
+
+		write_nodes(&lists[i], 1);
+	}
+
+	printf("%u lists, %llu nodes, %u runs, %ld cycles\n", nb,
+	       (unsigned long long)nodes, runs, cycles / runs);
+	printf("%.1f M nodes/s\n", nodes * runs / elapsed / 1e6);
+
+	GPUshutdown();
+
+	for (i = 0; i < nb; i++)
+		free(lists[i].nodes);
+	free(lists);
+
+	return EXIT_SUCCESS;
+}
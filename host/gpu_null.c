@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Null renderer for gpulib, used by the headless host runner
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdint.h>
+
+#include <gpulib/gpu.h>
+#include <gpulib/gpu_timing.h>
+
+int renderer_init(void)
+{
+	return 0;
+}
+
+void renderer_finish(void)
+{
+}
+
+void renderer_sync_ecmds(uint32_t *ecmds)
+{
+}
+
+void renderer_update_caches(int x, int y, int w, int h, int state_changed)
+{
+}
+
+void renderer_flush_queues(void)
+{
+}
+
+void renderer_set_interlace(int enable, int is_odd)
+{
+}
+
+void renderer_set_config(const struct rearmed_cbs *config)
+{
+}
+
+void renderer_notify_res_change(void)
+{
+}
+
+void renderer_notify_update_lace(int updated)
+{
+}
+
+void renderer_sync(void)
+{
+}
+
+void renderer_notify_scanout_change(int x, int y)
+{
+}
+
+static unsigned int poly_line_len(const uint32_t *list,
+				  const uint32_t *list_end, unsigned int stride)
+{
+	unsigned int len = 0;
+
+	for (; list < list_end; list += stride, len += stride) {
+		if ((*list & HTOLE32(0xf000f000)) == HTOLE32(0x50005000))
+			return len;
+	}
+
+	return -1;
+}
+
+/*
+ * Skip over the primitives, only keeping track of the E1-E6 state registers
+ * and of the (rough) timings, so that the emulated CPU sees the same GPU
+ * busy times as with a real renderer.
+ */
+int do_cmd_list(uint32_t *list, int list_len,
+		int *cycles_sum_out, int *cycles_last, int *last_cmd)
+{
+	int cpu_cycles_sum = 0, cpu_cycles = *cycles_last;
+	uint32_t *list_start = list, *list_end = list + list_len;
+	unsigned int cmd = 0, len, extra;
+	const int16_t *slist;
+
+	for (; list < list_end; list += 1 + len) {
+		slist = (const int16_t *)list;
+		cmd = LE32TOH(list[0]) >> 24;
+		len = cmd_lengths[cmd];
+
+		if (list + 1 + len > list_end) {
+			cmd = -1;
+			break;
+		}
+
+		if (0x80 <= cmd && cmd < 0xe0)
+			break; /* image i/o, forward to upper layer */
+
+		if ((cmd & 0xf8) == 0xe0)
+			gpu.ex_regs[cmd & 7] = LE32TOH(list[0]);
+
+		switch (cmd) {
+		case 0x02:
+			gput_sum(cpu_cycles_sum, cpu_cycles,
+				 gput_fill(LE16TOH(slist[4]) & 0x3ff,
+					   LE16TOH(slist[5]) & 0x1ff));
+			break;
+		case 0x20 ... 0x23:
+		case 0x28 ... 0x2b:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_poly_base());
+			break;
+		case 0x24 ... 0x27:
+		case 0x2c ... 0x2f:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_poly_base_t());
+			break;
+		case 0x30 ... 0x33:
+		case 0x38 ... 0x3b:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_poly_base_g());
+			break;
+		case 0x34 ... 0x37:
+		case 0x3c ... 0x3f:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_poly_base_gt());
+			break;
+		case 0x40 ... 0x47:
+		case 0x50 ... 0x57:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_line(0));
+			break;
+		case 0x48 ... 0x4f:
+		case 0x58 ... 0x5f:
+			/* Poly-lines: extra vertices up to the terminator */
+			extra = poly_line_len(&list[3 + (cmd >= 0x58)],
+					      list_end, 1 + (cmd >= 0x58));
+			if (extra == -1) {
+				cmd = -1;
+				goto out;
+			}
+
+			gput_sum(cpu_cycles_sum, cpu_cycles,
+				 gput_line(0) * (extra / (1 + (cmd >= 0x58)) + 1));
+			len += extra;
+			break;
+		case 0x60 ... 0x63:
+			gput_sum(cpu_cycles_sum, cpu_cycles,
+				 gput_sprite(LE16TOH(slist[4]) & 0x3ff,
+					     LE16TOH(slist[5]) & 0x1ff));
+			break;
+		case 0x64 ... 0x67:
+			gput_sum(cpu_cycles_sum, cpu_cycles,
+				 gput_sprite(LE16TOH(slist[6]) & 0x3ff,
+					     LE16TOH(slist[7]) & 0x1ff));
+			break;
+		case 0x68 ... 0x6b:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_sprite(1, 1));
+			break;
+		case 0x70 ... 0x77:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_sprite(8, 8));
+			break;
+		case 0x78 ... 0x7f:
+			gput_sum(cpu_cycles_sum, cpu_cycles, gput_sprite(16, 16));
+			break;
+		default:
+			break;
+		}
+	}
+
+out:
+	*cycles_sum_out += cpu_cycles_sum;
+	*cycles_last = cpu_cycles;
+	*last_cmd = cmd;
+	return list - list_start;
+}
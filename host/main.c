@@ -0,0 +1,648 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Bloom! headless host runner
+ *
+ * Boots a PS-EXE or a disc image with null GPU/SPU/pad plugins for a given
+ * number of frames, and reports the CPU emulation speed along with the
+ * Lightrec statistics.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <frontend/plugin_lib.h>
+#include <libpcsxcore/cdrom-async.h>
+#include <libpcsxcore/lightrec/plugin.h>
+#include <libpcsxcore/misc.h>
+#include <libpcsxcore/plugins.h>
+#include <libpcsxcore/psxcommon.h>
+#include <libpcsxcore/psxcounters.h>
+#include <libpcsxcore/psxmem.h>
+#include <libpcsxcore/r3000a.h>
+#include <libpcsxcore/rewind.h>
+#include <libpcsxcore/snapshot.h>
+#include <psemu_plugin_defs.h>
+
+#include <lightrec.h>
+
+#include "testexe.h"
+
+#define PSX_CPU_CLOCK 33868800.0
+
+static unsigned int frames, max_frames = 600;
+static unsigned long gpuDisp;
+static bool verbose;
+static const char *profile_path;
+static const char *cache_dir;
+static const char *load_path;
+
+static const char *snapshot_path = "bloom-host.snap";
+static unsigned int snapshot_interval;
+static bool snapshot_pending, frame_pending;
+
+static unsigned int rewind_interval, rewind_budget_mb = 64;
+
+static unsigned int nb_snapshots;
+static u64 snapshot_bytes, snapshot_time_us;
+static u32 snapshot_max_time_us;
+
+static u64 total_cycles;
+static u32 last_cycle;
+
+/* Result area of the psx-testexe programs, read when the emulator stops */
+static u32 result[RESULT_WORDS];
+
+unsigned short in_keystate[8];
+int in_type[8] = {
+	PSE_PAD_TYPE_STANDARD, PSE_PAD_TYPE_NONE,
+	PSE_PAD_TYPE_NONE, PSE_PAD_TYPE_NONE,
+	PSE_PAD_TYPE_NONE, PSE_PAD_TYPE_NONE,
+	PSE_PAD_TYPE_NONE, PSE_PAD_TYPE_NONE,
+};
+
+void SysPrintf(const char *fmt, ...)
+{
+	va_list list;
+
+	if (!verbose)
+		return;
+
+	va_start(list, fmt);
+	vfprintf(stderr, fmt, list);
+	va_end(list);
+}
+
+void SysMessage(const char *fmt, ...)
+{
+	va_list list;
+
+	va_start(list, fmt);
+	vfprintf(stderr, fmt, list);
+	va_end(list);
+	fputc('\n', stderr);
+}
+
+static int host_vout_open(void)
+{
+	return 0;
+}
+
+static void host_vout_close(void)
+{
+}
+
+static void host_vout_set_mode(int w, int h, int raw_w, int raw_h, int bpp)
+{
+}
+
+static void host_update_cycles(void)
+{
+	/* psxRegs.cycle wraps around every ~2 minutes of emulated time */
+	total_cycles += psxRegs.cycle - last_cycle;
+	last_cycle = psxRegs.cycle;
+}
+
+static void host_vout_flip(const void *vram, int offset, int bgr24,
+			   int x, int y, int w, int h, int dims_changed)
+{
+}
+
+static struct rearmed_cbs host_rearmed_cbs = {
+	.pl_vout_open		= host_vout_open,
+	.pl_vout_close		= host_vout_close,
+	.pl_vout_set_mode	= host_vout_set_mode,
+	.pl_vout_flip		= host_vout_flip,
+
+	.gpu_hcnt		= (unsigned int *)&hSyncCount,
+	.gpu_frame_count	= (unsigned int *)&frame_counter,
+	.gpu_state_change	= gpu_state_change,
+};
+
+void plugin_call_rearmed_cbs(void)
+{
+	extern void *hGPUDriver;
+	void (*rearmed_set_cbs)(const struct rearmed_cbs *cbs);
+
+	rearmed_set_cbs = SysLoadSym(hGPUDriver, "GPUrearmedCallbacks");
+	if (rearmed_set_cbs != NULL)
+		rearmed_set_cbs(&host_rearmed_cbs);
+}
+
+/* Called on every VBlank, even when the display is disabled */
+void pl_frame_limit(void)
+{
+	host_update_cycles();
+
+	if (++frames >= max_frames) {
+		psxRegs.stop = 1;
+	} else {
+		snapshot_pending = snapshot_interval
+			&& frames % snapshot_interval == 0;
+
+		/* Rewind states and snapshots are saved from main(), outside
+		 * of the CPU loop */
+		if (rewind_interval || snapshot_pending) {
+			frame_pending = true;
+			psxRegs.stop = 1;
+		}
+	}
+}
+
+static void host_save_snapshot(void)
+{
+	const struct snapshot_stats *stats;
+
+	if (snapshot_save(snapshot_path)) {
+		SysMessage("Unable to save snapshot %s", snapshot_path);
+		return;
+	}
+
+	stats = snapshot_last_stats();
+
+	nb_snapshots++;
+	snapshot_bytes += stats->size;
+	snapshot_time_us += stats->time_us;
+	if (stats->time_us > snapshot_max_time_us)
+		snapshot_max_time_us = stats->time_us;
+}
+
+int OpenPlugins(void)
+{
+	void SPUirq(int);
+	int ret;
+
+	plugin_call_rearmed_cbs();
+
+	/* No disc image when booting a PS-EXE */
+	ret = UsingIso() ? cdra_open() : 0;
+	if (ret < 0) { SysMessage("Error Opening CDR Plugin"); return -1; }
+	ret = SPU_open();
+	if (ret < 0) { SysMessage("Error Opening SPU Plugin"); return -1; }
+	SPU_registerCallback(SPUirq);
+	SPU_registerScheduleCb(SPUschedule);
+	ret = GPU_open(&gpuDisp, "PCSX", NULL);
+	if (ret < 0) { SysMessage("Error Opening GPU Plugin"); return -1; }
+
+	return 0;
+}
+
+void ClosePlugins(void)
+{
+	cdra_close();
+	SPU_close();
+	GPU_close();
+}
+
+void ResetPlugins(void)
+{
+	cdra_shutdown();
+	GPU_shutdown();
+	SPU_shutdown();
+
+	cdra_init();
+	GPU_init();
+	SPU_init();
+}
+
+long PAD__open(void)
+{
+	return PSE_PAD_ERR_SUCCESS;
+}
+
+long PAD__close(void)
+{
+	return PSE_PAD_ERR_SUCCESS;
+}
+
+static long host_read_port(PadDataS *pad, unsigned int port)
+{
+	pad->controllerType = in_type[port];
+	pad->buttonStatus = ~in_keystate[port];
+
+	return 0;
+}
+
+long PAD1_readPort(PadDataS *pad)
+{
+	return host_read_port(pad, 0);
+}
+
+long PAD2_readPort(PadDataS *pad)
+{
+	return host_read_port(pad, 1);
+}
+
+void plat_trigger_vibrate(int pad, int low, int high)
+{
+}
+
+void pl_gun_byte2(int port, unsigned char byte)
+{
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-f frames] [-b bios] [-p profile] [-s frames] [-S file]\n"
+		"          [-l file] [-r frames] [-R MiB] [-c dir [-w]] [-d] [-i] [-v]\n"
+		"          <image|exe>\n"
+		"  -f frames  Number of frames to emulate (default: %u)\n"
+		"  -b bios    Path to a BIOS file (default: HLE BIOS)\n"
+		"  -p profile Save Lightrec's per-block profile (.txt or .csv)\n"
+		"  -s frames  Save an incremental snapshot every N frames\n"
+		"  -S file    Snapshot file (default: %s)\n"
+		"  -l file    Resume from the last state of a snapshot file\n"
+		"  -r frames  Capture a rewind state every N frames\n"
+		"  -R MiB     Memory budget of the rewind buffer (default: %u)\n"
+		"  -c dir     Load and save Lightrec's block cache files in dir\n"
+		"  -w         Boot twice, with an empty then a warm block cache\n"
+		"  -d         Run a psx-testexe program with the interpreter then\n"
+		"             with Lightrec, and check that the results match\n"
+		"  -i         Use the interpreter instead of Lightrec\n"
+		"  -v         Print the emulator's log messages\n",
+		argv0, max_frames, snapshot_path, rewind_budget_mb);
+}
+
+static void print_rewind_report(void)
+{
+	struct rewind_stats stats;
+	double start, elapsed;
+	int ret;
+
+	rewind_get_stats(&stats);
+
+	printf("Rewind states:    %u (%u KiB)\n",
+	       stats.nb_states, stats.mem_used / 1024);
+
+	if (stats.nb_captures) {
+		printf("Rewind capture:   %.3f ms avg, %.3f ms max\n",
+		       stats.total_time_us / 1e3 / stats.nb_captures,
+		       stats.max_time_us / 1e3);
+	}
+
+	/* Step back twice, to time the restore of a delta */
+	start = get_time();
+	ret = rewind_step() || rewind_step();
+	elapsed = get_time() - start;
+
+	if (!ret)
+		printf("Rewind restore:   %.3f ms\n", elapsed * 1e3 / 2.0);
+}
+
+static void print_report(double elapsed, u64 cycles)
+{
+	struct lightrec_stats stats;
+	double cps = cycles / elapsed;
+
+	printf("Frames:           %u\n", frames);
+	printf("Wall time:        %.3f s\n", elapsed);
+	printf("Emulated cycles:  %llu\n", (unsigned long long)cycles);
+	printf("Cycles/sec:       %.0f (%.1f%% of real hardware)\n",
+	       cps, cps * 100.0 / PSX_CPU_CLOCK);
+	printf("Frames/sec:       %.1f\n", frames / elapsed);
+
+	if (nb_snapshots) {
+		printf("Snapshots:        %u (%llu bytes avg)\n", nb_snapshots,
+		       (unsigned long long)(snapshot_bytes / nb_snapshots));
+		printf("Snapshot time:    %.3f ms avg, %.3f ms max\n",
+		       snapshot_time_us / 1e3 / nb_snapshots,
+		       snapshot_max_time_us / 1e3);
+	}
+
+	if (rewind_interval)
+		print_rewind_report();
+
+	if (Config.Cpu != CPU_DYNAREC)
+		return;
+
+	lightrec_plugin_get_stats(&stats);
+
+	printf("Blocks compiled:  %u (%u first-pass)\n",
+	       stats.nb_compile, stats.nb_precompile);
+	printf("Compile time:     %.3f s\n", stats.compile_time_us / 1e6);
+	printf("Execute calls:    %u\n", stats.nb_execute);
+	printf("Block lookups:    %u\n", stats.nb_lookups);
+
+	/* Only counted when Lightrec is built with ENABLE_PROFILER */
+	if (stats.nb_dispatch) {
+		printf("Dispatcher entries: %u (%.1f per frame)\n",
+		       stats.nb_dispatch, (double)stats.nb_dispatch / frames);
+	}
+	printf("Evictions:        %u (%u recompiled)\n",
+	       stats.nb_evictions, stats.nb_recompiles);
+	printf("Code buffer frag: %u%%\n", stats.code_fragmentation);
+
+	if (cache_dir) {
+		printf("Block cache:      %u hits, %u misses\n",
+		       stats.nb_cache_hits, stats.nb_cache_misses);
+	}
+}
+
+static void reset_counters(void)
+{
+	frames = 0;
+	total_cycles = 0;
+	nb_snapshots = 0;
+	snapshot_bytes = snapshot_time_us = 0;
+	snapshot_max_time_us = 0;
+	snapshot_pending = frame_pending = false;
+}
+
+/* Boots the image and runs it, then shuts the emulator down, which saves the
+ * block cache. With 'cold_cache', the block cache file is removed first. */
+static int run(const char *path, bool is_exe, bool cold_cache,
+	       struct lightrec_stats *lr_stats, double *elapsed_out)
+{
+	char cache_path[MAXPATHLEN];
+	double start, elapsed;
+	int ret;
+
+	reset_counters();
+
+	if (EmuInit() == -1) {
+		SysMessage("Could not initialize PCSX core");
+		return -1;
+	}
+
+	if (LoadPlugins() < 0) {
+		SysMessage("Could not load plugins");
+		return -1;
+	}
+
+	plugin_call_rearmed_cbs();
+
+	if (!is_exe)
+		SetIsoFile(path);
+
+	if (OpenPlugins() < 0) {
+		SysMessage("Could not open plugins");
+		return -1;
+	}
+
+	if (!is_exe && CheckCdrom() != 0) {
+		SysMessage("Could not read disc image %s", path);
+		return -1;
+	}
+
+	EmuReset();
+
+	if (is_exe ? Load(path) : LoadCdrom()) {
+		SysMessage("Could not load %s", path);
+		return -1;
+	}
+
+	if (cold_cache) {
+		/* PS-EXEs all use the ID of Load(), SLUS99999 */
+		snprintf(cache_path, sizeof(cache_path), "%s/%.9s.lrc",
+			 cache_dir, CdromId);
+		if (remove(cache_path) && errno != ENOENT) {
+			SysMessage("Could not remove %s", cache_path);
+			return -1;
+		}
+	}
+
+	if (load_path && snapshot_load(load_path)) {
+		SysMessage("Could not load snapshot %s", load_path);
+		return -1;
+	}
+
+	if (rewind_interval && rewind_init(rewind_budget_mb << 20, rewind_interval)) {
+		SysMessage("Could not allocate the rewind buffer");
+		return -1;
+	}
+
+	start = get_time();
+	last_cycle = psxRegs.cycle;
+
+	psxRegs.stop = 0;
+
+	for (;;) {
+		while (!psxRegs.stop)
+			psxCpu->Execute(&psxRegs);
+
+		if (!frame_pending)
+			break;
+
+		frame_pending = false;
+		psxRegs.stop = 0;
+
+		if (rewind_interval)
+			rewind_frame();
+
+		if (snapshot_pending) {
+			snapshot_pending = false;
+			host_save_snapshot();
+		}
+	}
+
+	elapsed = get_time() - start;
+	host_update_cycles();
+
+	print_report(elapsed, total_cycles);
+
+	if (profile_path && Config.Cpu == CPU_DYNAREC) {
+		ret = lightrec_plugin_save_profile(profile_path);
+		if (ret == -ENOSYS)
+			SysMessage("Lightrec was built without ENABLE_PROFILER");
+		else if (ret)
+			SysMessage("Unable to save profile: %s", strerror(-ret));
+	}
+
+	if (Config.Cpu == CPU_DYNAREC)
+		lightrec_plugin_get_stats(lr_stats);
+	*elapsed_out = elapsed;
+
+	memcpy(result, psxM + (RESULT_ADDR & 0x1fffff), sizeof(result));
+
+	ClosePlugins();
+	EmuShutdown();
+	ReleasePlugins();
+
+	return 0;
+}
+
+/* Runs a psx-testexe program with the interpreter then with Lightrec, and
+ * compares the results */
+static int diff_run(const char *path)
+{
+	u32 interp_result[RESULT_WORDS];
+	struct lightrec_stats stats;
+	double elapsed;
+	unsigned int i;
+
+	printf("Interpreter:\n");
+	Config.Cpu = CPU_INTERPRETER;
+	if (run(path, true, false, &stats, &elapsed))
+		return -1;
+
+	memcpy(interp_result, result, sizeof(result));
+
+	printf("\nLightrec:\n");
+	Config.Cpu = CPU_DYNAREC;
+	if (run(path, true, false, &stats, &elapsed))
+		return -1;
+
+	if (interp_result[0] != RESULT_MAGIC || result[0] != RESULT_MAGIC) {
+		SysMessage("The program did not complete, run more frames");
+		return -1;
+	}
+
+	printf("\nResult:          ");
+	for (i = 1; i < RESULT_WORDS; i++)
+		printf(" 0x%08x", interp_result[i]);
+	printf("\n");
+
+	if (memcmp(interp_result, result, sizeof(result))) {
+		printf("Mismatch:        ");
+		for (i = 1; i < RESULT_WORDS; i++)
+			printf(" 0x%08x", result[i]);
+		printf("\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void print_warm_report(const struct lightrec_stats *cold, double cold_time,
+			      const struct lightrec_stats *warm, double warm_time)
+{
+	printf("\nCold vs. warm block cache:\n");
+	printf("Wall time:        %.3f s -> %.3f s\n", cold_time, warm_time);
+	printf("Compile time:     %.3f s -> %.3f s\n",
+	       cold->compile_time_us / 1e6, warm->compile_time_us / 1e6);
+	printf("Blocks compiled:  %u -> %u (%u -> %u first-pass)\n",
+	       cold->nb_compile, warm->nb_compile,
+	       cold->nb_precompile, warm->nb_precompile);
+}
+
+int main(int argc, char **argv)
+{
+	struct lightrec_stats stats, cold_stats;
+	double elapsed, cold_time;
+	bool is_exe, warm_test = false, diff_test = false;
+	const char *path;
+	int opt;
+
+	memset(&Config, 0, sizeof(Config));
+
+	Config.PsxAuto = 1;
+	Config.cycle_multiplier = CYCLE_MULT_DEFAULT;
+	Config.GpuListWalking = -1;
+	Config.FractionalFramerate = -1;
+
+	strcpy(Config.Mcd1, "none");
+	strcpy(Config.Mcd2, "none");
+	strcpy(Config.Bios, "HLE");
+
+	strcpy(Config.PluginsDir, "plugins");
+	strcpy(Config.Gpu, "builtin_gpu");
+	strcpy(Config.Spu, "builtin_spu");
+
+	while ((opt = getopt(argc, argv, "f:b:p:s:S:l:r:R:c:wdiv")) != -1) {
+		switch (opt) {
+		case 'f':
+			max_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			/* psxMemReset() opens BiosDir/Bios */
+			strcpy(Config.BiosDir, optarg[0] == '/' ? "" : ".");
+			snprintf(Config.Bios, sizeof(Config.Bios), "%s", optarg);
+			break;
+		case 'p':
+			profile_path = optarg;
+			break;
+		case 's':
+			snapshot_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			snapshot_path = optarg;
+			break;
+		case 'l':
+			load_path = optarg;
+			break;
+		case 'r':
+			rewind_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			rewind_budget_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cache_dir = optarg;
+			break;
+		case 'w':
+			warm_test = true;
+			break;
+		case 'd':
+			diff_test = true;
+			break;
+		case 'i':
+			Config.Cpu = CPU_INTERPRETER;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	path = argv[optind];
+	is_exe = !!strstr(path, ".exe") || !!strstr(path, ".EXE");
+
+	if (diff_test) {
+		if (!is_exe || warm_test) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		return diff_run(path) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (cache_dir) {
+		/* Read by the Lightrec plugin when it is initialized */
+		setenv("LIGHTREC_CACHE_DIR", cache_dir, 1);
+	} else if (warm_test) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (warm_test) {
+		printf("Cold start:\n");
+		if (run(path, is_exe, true, &cold_stats, &cold_time))
+			return EXIT_FAILURE;
+
+		printf("\nWarm start:\n");
+	}
+
+	if (run(path, is_exe, false, &stats, &elapsed))
+		return EXIT_FAILURE;
+
+	if (warm_test && Config.Cpu == CPU_DYNAREC)
+		print_warm_report(&cold_stats, cold_time, &stats, elapsed);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Feeds MDEC streams through the scalar and the SIMD decoders, checks that
+ * their output is identical, and compares the time they take.
+ *
+ * The streams are either recorded by a build with MDEC_TRACE, or generated.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libpcsxcore/mdec.h>
+#include <libpcsxcore/psxevents.h>
+
+#define MDEC_END_OF_DATA	0xfe00
+#define MACROBLOCK_SIZE		(16 * 16 * 3)
+
+/* Output formats: 24bpp, 15bpp, 15bpp with the mask bit set */
+static const u32 formats[] = { 0x30000000, 0x38000000, 0x3a000000 };
+
+struct check_result {
+	u32 nb_blocks;
+	u32 nb_errors;
+	double time[2];
+};
+
+/* mdec.c is built in, with the bits of the emulator that it uses */
+PcsxConfig Config;
+struct PcsxSaveFuncs SaveFuncs;
+psxRegisters psxRegs;
+s8 *psxM, *psxH;
+
+void events_queue(u32 e, u32 abs)
+{
+}
+
+static u32 seed = 0x12345678;
+
+static u32 rnd(u32 max)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 8) % max;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const u16 *decode_stream(const u16 *rl, const u16 *end, u8 *out,
+				u32 *nb, boolean simd)
+{
+	u32 i = 0;
+
+	while (rl < end && *rl != MDEC_END_OF_DATA && i < *nb)
+		rl = mdecDecodeMacroblock(rl, out + i++ * MACROBLOCK_SIZE, simd);
+
+	*nb = i;
+
+	return rl;
+}
+
+/* The stream must be followed by enough MDEC_END_OF_DATA to terminate
+ * a macroblock. */
+static void check_stream(const u16 *rl, u32 words, struct check_result *res)
+{
+	const u16 *end = rl + words;
+	u32 i, f, nb, nb_simd, max = words / 12 + 1;
+	u8 *out[2];
+	double start;
+
+	out[0] = malloc(max * MACROBLOCK_SIZE);
+	out[1] = malloc(max * MACROBLOCK_SIZE);
+	if (!out[0] || !out[1])
+		goto out_free;
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		mdecWrite0(formats[f]);
+		memset(out[0], 0, max * MACROBLOCK_SIZE);
+		memset(out[1], 0, max * MACROBLOCK_SIZE);
+
+		nb = max;
+		start = get_time();
+		decode_stream(rl, end, out[0], &nb, FALSE);
+		res->time[0] += get_time() - start;
+
+		nb_simd = max;
+		start = get_time();
+		decode_stream(rl, end, out[1], &nb_simd, TRUE);
+		res->time[1] += get_time() - start;
+
+		res->nb_blocks += nb;
+
+		if (nb != nb_simd) {
+			res->nb_errors++;
+			continue;
+		}
+
+		for (i = 0; i < nb; i++) {
+			if (memcmp(out[0] + i * MACROBLOCK_SIZE,
+				   out[1] + i * MACROBLOCK_SIZE, MACROBLOCK_SIZE)) {
+				if (!res->nb_errors)
+					printf("Mismatch: format %08x, macroblock %u\n",
+					       formats[f], i);
+				res->nb_errors++;
+			}
+		}
+	}
+
+out_free:
+	free(out[0]);
+	free(out[1]);
+}
+
+static u32 gen_block(u16 *rl)
+{
+	u32 n = 0, k = 0, density = rnd(4), run;
+
+	rl[n++] = (rnd(64) << 10) | rnd(1024);
+
+	/* DC only, sparse, dense, or random runs that may go past the end
+	 * of the block */
+	while (density && n < 80) {
+		run = density == 1 ? rnd(20) : density == 2 ? rnd(2) : rnd(64);
+		k += run + 1;
+		if (k > 63 && density != 3)
+			break;
+
+		rl[n++] = (run << 10) | rnd(1024);
+		if (k > 63)
+			return n;
+	}
+
+	rl[n++] = MDEC_END_OF_DATA;
+
+	return n;
+}
+
+static void check_generated(u32 nb_streams, struct check_result *res)
+{
+	u32 s, i, b, words, nb_blocks;
+	u8 tables[128];
+	u16 *rl;
+
+	rl = malloc(256 * 6 * 82 * sizeof(*rl) + 64 * sizeof(*rl));
+	if (!rl)
+		return;
+
+	for (s = 0; s < nb_streams; s++) {
+		for (i = 0; i < sizeof(tables); i++)
+			tables[i] = s & 1 ? rnd(256) : 1 + rnd(32);
+		mdecSetQuantTables(tables);
+
+		nb_blocks = 1 + rnd(256);
+		for (b = 0, words = 0; b < nb_blocks * 6; b++)
+			words += gen_block(rl + words);
+
+		for (i = 0; i < 64; i++)
+			rl[words + i] = MDEC_END_OF_DATA;
+
+		check_stream(rl, words, res);
+	}
+
+	free(rl);
+}
+
+static int check_trace(const char *path, struct check_result *res)
+{
+	u32 hdr[2], i;
+	u16 *rl;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -1;
+
+	while (fread(hdr, sizeof(hdr), 1, f) == 1) {
+		rl = malloc(hdr[1] * 4 + 64 * sizeof(*rl));
+		if (!rl || fread(rl, 4, hdr[1], f) != hdr[1]) {
+			free(rl);
+			break;
+		}
+
+		if ((hdr[0] >> 28) == 0x4)
+			mdecSetQuantTables((const u8 *)rl);
+		else if ((hdr[0] >> 28) == 0x3) {
+			for (i = 0; i < 64; i++)
+				rl[hdr[1] * 2 + i] = MDEC_END_OF_DATA;
+			check_stream(rl, hdr[1] * 2, res);
+		}
+
+		free(rl);
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct check_result res = { 0 };
+
+	mdecInit();
+
+	if (argc > 1) {
+		if (check_trace(argv[1], &res)) {
+			fprintf(stderr, "Unable to read trace %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+	} else {
+		check_generated(2000, &res);
+
+		Config.Mdec = 1;
+		check_generated(100, &res);
+	}
+
+	printf("%u macroblocks, %u mismatches\n", res.nb_blocks, res.nb_errors);
+	if (res.nb_blocks) {
+		printf("scalar: %.0f ns/macroblock\n", res.time[0] * 1e9 / res.nb_blocks);
+		printf("simd:   %.0f ns/macroblock\n", res.time[1] * 1e9 / res.nb_blocks);
+	}
+
+	return res.nb_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
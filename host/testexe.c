@@ -0,0 +1,784 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Generates the PS-EXE test programs used to benchmark and check the CPU
+ * emulation with bloom-host.
+ *
+ * Each program does a given amount of work, then writes its checksums at
+ * RESULT_ADDR, so that running it with the interpreter and with Lightrec
+ * (bloom-host -d) must give the same result.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testexe.h"
+
+#define EXE_BASE		0x80010000
+#define EXE_STACK		0x801ffff0
+#define EXE_HEADER_SIZE		2048
+
+/* The programs must not overlap with the result area */
+#define MAX_WORDS		((RESULT_ADDR - EXE_BASE) / 4)
+
+#define ARRAY_SIZE(x)		(sizeof(x) / sizeof((x)[0]))
+
+enum {
+	ZERO, AT, V0, V1, A0, A1, A2, A3,
+	T0, T1, T2, T3, T4, T5, T6, T7,
+	S0, S1, S2, S3, S4, S5, S6, S7,
+	T8, T9, K0, K1, GP, SP, FP, RA,
+};
+
+static uint32_t code[MAX_WORDS];
+static unsigned int len;
+
+static unsigned int emit(uint32_t opcode)
+{
+	if (len == MAX_WORDS) {
+		fprintf(stderr, "Program too large\n");
+		exit(EXIT_FAILURE);
+	}
+
+	code[len] = opcode;
+
+	return len++;
+}
+
+static uint32_t addr_of(unsigned int idx)
+{
+	return EXE_BASE + idx * 4;
+}
+
+static uint32_t op_r(unsigned int rs, unsigned int rt, unsigned int rd,
+		     unsigned int sa, unsigned int fn)
+{
+	return rs << 21 | rt << 16 | rd << 11 | sa << 6 | fn;
+}
+
+static uint32_t op_i(unsigned int op, unsigned int rs, unsigned int rt,
+		     uint32_t imm)
+{
+	return op << 26 | rs << 21 | rt << 16 | (imm & 0xffff);
+}
+
+static uint32_t op_j(unsigned int op, unsigned int target)
+{
+	return op << 26 | (addr_of(target) >> 2 & 0x3ffffff);
+}
+
+/* Branches and jumps go to an instruction index */
+static unsigned int branch(unsigned int op, unsigned int rs, unsigned int rt,
+			   unsigned int target)
+{
+	return emit(op_i(op, rs, rt, target - len - 1));
+}
+
+#define NOP()			emit(0)
+#define SLL(rd, rt, sa)		emit(op_r(0, rt, rd, sa, 0x00))
+#define SRL(rd, rt, sa)		emit(op_r(0, rt, rd, sa, 0x02))
+#define SRA(rd, rt, sa)		emit(op_r(0, rt, rd, sa, 0x03))
+#define SLLV(rd, rt, rs)	emit(op_r(rs, rt, rd, 0, 0x04))
+#define SRAV(rd, rt, rs)	emit(op_r(rs, rt, rd, 0, 0x07))
+#define JR(rs)			emit(op_r(rs, 0, 0, 0, 0x08))
+#define MFHI(rd)		emit(op_r(0, 0, rd, 0, 0x10))
+#define MFLO(rd)		emit(op_r(0, 0, rd, 0, 0x12))
+#define MULT(rs, rt)		emit(op_r(rs, rt, 0, 0, 0x18))
+#define MULTU(rs, rt)		emit(op_r(rs, rt, 0, 0, 0x19))
+#define DIV(rs, rt)		emit(op_r(rs, rt, 0, 0, 0x1a))
+#define DIVU(rs, rt)		emit(op_r(rs, rt, 0, 0, 0x1b))
+#define ADDU(rd, rs, rt)	emit(op_r(rs, rt, rd, 0, 0x21))
+#define SUBU(rd, rs, rt)	emit(op_r(rs, rt, rd, 0, 0x23))
+#define AND(rd, rs, rt)		emit(op_r(rs, rt, rd, 0, 0x24))
+#define OR(rd, rs, rt)		emit(op_r(rs, rt, rd, 0, 0x25))
+#define XOR(rd, rs, rt)		emit(op_r(rs, rt, rd, 0, 0x26))
+#define NOR(rd, rs, rt)		emit(op_r(rs, rt, rd, 0, 0x27))
+#define SLT(rd, rs, rt)		emit(op_r(rs, rt, rd, 0, 0x2a))
+#define SLTU(rd, rs, rt)	emit(op_r(rs, rt, rd, 0, 0x2b))
+#define J(target)		emit(op_j(0x02, target))
+#define JAL(target)		emit(op_j(0x03, target))
+#define BEQ(rs, rt, target)	branch(0x04, rs, rt, target)
+#define BNE(rs, rt, target)	branch(0x05, rs, rt, target)
+#define ADDIU(rt, rs, imm)	emit(op_i(0x09, rs, rt, imm))
+#define SLTIU(rt, rs, imm)	emit(op_i(0x0b, rs, rt, imm))
+#define ANDI(rt, rs, imm)	emit(op_i(0x0c, rs, rt, imm))
+#define ORI(rt, rs, imm)	emit(op_i(0x0d, rs, rt, imm))
+#define LUI(rt, imm)		emit(op_i(0x0f, 0, rt, imm))
+#define LB(rt, off, rs)		emit(op_i(0x20, rs, rt, off))
+#define LH(rt, off, rs)		emit(op_i(0x21, rs, rt, off))
+#define LW(rt, off, rs)		emit(op_i(0x23, rs, rt, off))
+#define LBU(rt, off, rs)	emit(op_i(0x24, rs, rt, off))
+#define LHU(rt, off, rs)	emit(op_i(0x25, rs, rt, off))
+#define SB(rt, off, rs)		emit(op_i(0x28, rs, rt, off))
+#define SH(rt, off, rs)		emit(op_i(0x29, rs, rt, off))
+#define SW(rt, off, rs)		emit(op_i(0x2b, rs, rt, off))
+#define MFC0(rt, rd)		emit(op_r(0x10 << 5 | 0, rt, rd, 0, 0))
+#define MTC0(rt, rd)		emit(op_r(0x10 << 5 | 4, rt, rd, 0, 0))
+#define RFE()			emit(op_r(0x10 << 5 | 0x10, 0, 0, 0, 0x10))
+#define MFC2(rt, rd)		emit(op_r(0x12 << 5 | 0, rt, rd, 0, 0))
+#define CFC2(rt, rd)		emit(op_r(0x12 << 5 | 2, rt, rd, 0, 0))
+#define MTC2(rt, rd)		emit(op_r(0x12 << 5 | 4, rt, rd, 0, 0))
+#define CTC2(rt, rd)		emit(op_r(0x12 << 5 | 6, rt, rd, 0, 0))
+#define COP2(cmd)		emit(0x4a000000 | (cmd))
+
+/* Loads the 32-bit constant 'imm' into 'rt' */
+static void li(unsigned int rt, uint32_t imm)
+{
+	LUI(rt, imm >> 16);
+	ORI(rt, rt, imm);
+}
+
+/* Advances the xorshift32 generator in 'rt', using T9 as a temporary.
+ * Returns the index of its first instruction. */
+static unsigned int xorshift(unsigned int rt)
+{
+	unsigned int idx = SLL(T9, rt, 13);
+
+	XOR(rt, rt, T9);
+	SRL(T9, rt, 17);
+	XOR(rt, rt, T9);
+	SLL(T9, rt, 5);
+	XOR(rt, rt, T9);
+
+	return idx;
+}
+
+/* Mixes 'rt' into the checksum: S7 = rotl(S7, 5) ^ rt, using T8 */
+static void mix(unsigned int rt)
+{
+	SLL(T8, S7, 5);
+	SRL(S7, S7, 27);
+	OR(S7, S7, T8);
+	XOR(S7, S7, rt);
+}
+
+/* Writes the checksum S7 and the registers S5-S6 to the result area, then
+ * the magic value, and spins forever. */
+static void finish(void)
+{
+	li(T8, RESULT_ADDR);
+	SW(S7, 4, T8);
+	SW(S5, 8, T8);
+	SW(S6, 12, T8);
+	li(T9, RESULT_MAGIC);
+	SW(T9, 0, T8);
+
+	BEQ(ZERO, ZERO, len);
+	NOP();
+}
+
+/*
+ * alu: integer ALU, multiplier/divider and RAM loads/stores in a tight loop.
+ */
+static void gen_alu(unsigned int count)
+{
+	unsigned int loop;
+
+	LUI(S0, 0x8010);
+	li(S1, count);
+	li(S4, 0x12345678);
+	ADDIU(S7, ZERO, 1);
+	ADDIU(S5, ZERO, 0x7fff);
+
+	loop = xorshift(S4);
+	ADDU(T0, S7, S4);
+	SLL(T1, T0, 3);
+	XOR(T2, T1, T0);
+	ANDI(T3, T2, 0xff0f);
+	SRL(T4, T3, 5);
+	OR(T5, T4, T2);
+	SW(T5, 0x100, S0);
+	LW(T0, 0x100, S0);
+	MULTU(T5, S5);
+	ADDU(S7, T0, S7);
+	ORI(S7, S7, 0x11);
+	SLTU(T2, S7, T1);
+	ADDU(S7, S7, T2);
+	DIVU(S7, S5);
+	MFLO(T6);
+	MFHI(T7);
+	mix(T6);
+	ADDU(S6, S6, T7);
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, loop);
+	NOP();
+
+	finish();
+}
+
+/*
+ * chain: a ring of 64 small blocks, ending with jumps, taken branches and
+ * not-taken branches to the next one, whose targets are all static.
+ */
+static void gen_chain(unsigned int count)
+{
+	unsigned int i, first;
+
+	li(S1, count);
+
+	for (i = 0, first = len; i < 64; i++) {
+		ADDIU(T0, S7, i * 0x111);
+		mix(T0);
+
+		/* The target is the instruction after the delay slot */
+		switch (i % 3) {
+		case 0:
+			J(len + 2);
+			break;
+		case 1:
+			BEQ(ZERO, ZERO, len + 2);
+			break;
+		default:
+			BNE(S7, S7, first);
+			break;
+		}
+		NOP();
+	}
+
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, first);
+	NOP();
+
+	finish();
+}
+
+/*
+ * gte: NCLIP, AVSZ3 and AVSZ4 on pseudo-random screen coordinates, Z values
+ * and scale factors, alternately full-range (saturating) and masked to small
+ * values; the MAC0, OTZ and FLAG registers are mixed into the checksum.
+ */
+static void gen_gte(unsigned int count)
+{
+	static const uint8_t data_regs[] = { 12, 13, 14, 16, 17, 18, 19 };
+	static const uint8_t ctrl_regs[] = { 29, 30 };
+	static const uint32_t cmds[] = { 0x1400006, 0x158002d, 0x168002e };
+	unsigned int i, loop;
+
+	li(S1, count);
+	li(S4, 0x9e3779b9);
+	ADDIU(S3, ZERO, -1);
+	li(S2, 0xff00ff00);
+
+	/* S3 alternates between all ones and 0x00ff00ff */
+	loop = XOR(S3, S3, S2);
+
+	for (i = 0; i < ARRAY_SIZE(data_regs); i++) {
+		xorshift(S4);
+		AND(T0, S4, S3);
+		MTC2(T0, data_regs[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ctrl_regs); i++) {
+		xorshift(S4);
+		AND(T0, S4, S3);
+		CTC2(T0, ctrl_regs[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cmds); i++) {
+		COP2(cmds[i]);
+		NOP();
+
+		MFC2(T0, 24);
+		NOP();
+		mix(T0);
+		MFC2(T0, 7);
+		NOP();
+		mix(T0);
+		CFC2(T0, 31);
+		NOP();
+		mix(T0);
+		ADDU(S6, S6, T0);
+	}
+
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, loop);
+	NOP();
+
+	finish();
+}
+
+/*
+ * io: 16-bit and 32-bit accesses to the hardware registers that have direct
+ * handlers in Lightrec, including the upper half of 32-bit registers, which
+ * must not reach the handler of the register.
+ */
+static void gen_io(unsigned int count)
+{
+	unsigned int loop;
+
+	li(S1, count);
+	li(S4, 0x12345678);
+	li(S2, 0x007f7fff);
+
+	/* Set the base in the loop's block, so that the addresses are known
+	 * when compiling it */
+	loop = LUI(S0, 0x1f80);
+
+	/* DMA ICR, without the bits that could raise an interrupt */
+	xorshift(S4);
+	AND(T0, S4, S2);
+	SW(T0, 0x10f4, S0);
+	LW(T0, 0x10f4, S0);
+	NOP();
+	mix(T0);
+
+	/* Upper half of DMA ICR, only the enable bits */
+	SRL(T0, S4, 16);
+	ANDI(T0, T0, 0x7f);
+	SH(T0, 0x10f6, S0);
+	LW(T0, 0x10f4, S0);
+	NOP();
+	mix(T0);
+
+	/* Lower then upper half of IMASK */
+	xorshift(S4);
+	SH(S4, 0x1074, S0);
+	LHU(T0, 0x1074, S0);
+	NOP();
+	mix(T0);
+	SRL(T0, S4, 16);
+	SH(T0, 0x1076, S0);
+	LW(T0, 0x1074, S0);
+	NOP();
+	mix(T0);
+	LHU(T0, 0x1076, S0);
+	NOP();
+	mix(T0);
+
+	/* Upper half of the counter 0 */
+	LH(T0, 0x1102, S0);
+	NOP();
+	mix(T0);
+
+	SW(ZERO, 0x1074, S0);
+	SW(ZERO, 0x1070, S0);
+
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, loop);
+	NOP();
+
+	finish();
+}
+
+/*
+ * idle: waits for a RAM counter, incremented by the VBlank interrupt handler,
+ * to change; the polling loop can be skipped until the next event.
+ */
+static void gen_idle(unsigned int count)
+{
+	unsigned int skip, handler, loop, wait;
+
+	skip = J(0);
+	NOP();
+
+	/* Acknowledge the interrupt, increment the counter, and return */
+	handler = LUI(K0, 0x1f80);
+	SW(ZERO, 0x1070, K0);
+	LUI(K0, 0x8010);
+	LW(K1, 0x200, K0);
+	NOP();
+	ADDIU(K1, K1, 1);
+	SW(K1, 0x200, K0);
+	MFC0(K0, 14);
+	NOP();
+	JR(K0);
+	RFE();
+
+	code[skip] = op_j(0x02, len);
+
+	/* Point the exception vector to the handler */
+	LUI(T0, 0x8000);
+	li(T1, op_j(0x02, handler));
+	SW(T1, 0x80, T0);
+	SW(ZERO, 0x84, T0);
+
+	LUI(S0, 0x8010);
+	SW(ZERO, 0x200, S0);
+
+	/* Enable the VBlank interrupt only */
+	LUI(T0, 0x1f80);
+	ADDIU(T1, ZERO, 1);
+	SW(ZERO, 0x1070, T0);
+	SW(T1, 0x1074, T0);
+	ORI(T2, ZERO, 0x401);
+	MTC0(T2, 12);
+
+	li(S1, count);
+
+	loop = LW(T3, 0x200, S0);
+
+	/* The base is set in the loop, so that the load is known to hit RAM */
+	wait = LUI(S0, 0x8010);
+	LW(T4, 0x200, S0);
+	NOP();
+	BEQ(T4, T3, wait);
+	NOP();
+
+	mix(T4);
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, loop);
+	NOP();
+
+	/* Disable the interrupts before writing the result */
+	MTC0(ZERO, 12);
+
+	finish();
+}
+
+/*
+ * dead: calls a function whose first opcode is periodically rewritten, so
+ * that it either overwrites T0 (which the caller then does not have to store
+ * back) or reads it; the caller must see each new version of the function.
+ * The function is in another code page than the caller, so that rewriting it
+ * does not invalidate the caller.
+ */
+static void gen_dead(unsigned int count)
+{
+	unsigned int func = 0x1000 / 4, loop, to_call, to_put, to_call2, put;
+	uint32_t overwrite = op_i(0x09, ZERO, T0, 5);
+	uint32_t read = op_r(T0, S2, T0, 0, 0x21);
+
+	li(S2, count);
+	li(S3, overwrite);
+	li(S4, read);
+	li(S0, addr_of(func));
+
+	/* Every 1024 calls, swap the first opcode of the function */
+	loop = ANDI(T2, S2, 0x3ff);
+	to_call = BNE(T2, ZERO, len);
+	NOP();
+	LW(T3, 0, S0);
+	NOP();
+	to_put = BNE(T3, S3, len);
+	NOP();
+	SW(S4, 0, S0);
+	to_call2 = BEQ(ZERO, ZERO, len);
+	NOP();
+	put = SW(S3, 0, S0);
+
+	code[to_put] = op_i(0x05, T3, S3, put - to_put - 1);
+	code[to_call] = op_i(0x05, T2, ZERO, len - to_call - 1);
+	code[to_call2] = op_i(0x04, ZERO, ZERO, len - to_call2 - 1);
+
+	ADDU(T0, S7, S2);
+	XOR(T1, T0, S2);
+	JAL(func);
+	NOP();
+	ADDIU(S2, S2, -1);
+	BNE(S2, ZERO, loop);
+	NOP();
+
+	finish();
+
+	while (len < func)
+		NOP();
+
+	emit(overwrite);
+	ADDU(T1, T0, S2);
+	mix(T0);
+	mix(T1);
+	JR(RA);
+	NOP();
+}
+
+/*
+ * ssa: a function doing the same loads and computations several times, with
+ * stores in between, which the hot block optimizations rewrite into moves
+ * and constants.
+ */
+static void gen_ssa(unsigned int count)
+{
+	unsigned int func = 0x1000 / 4, loop;
+
+	LUI(S0, 0x8010);
+	ORI(S0, S0, 0x1000);
+	li(S2, count);
+
+	/* Each call uses one of 16 slots of the buffer, seeded with S2 */
+	loop = ANDI(T0, S2, 0xf);
+	SLL(T0, T0, 4);
+	ADDU(A0, S0, T0);
+	SW(S2, 0, A0);
+	JAL(func);
+	NOP();
+	mix(A1);
+	ADDIU(S2, S2, -1);
+	BNE(S2, ZERO, loop);
+	NOP();
+
+	finish();
+
+	while (len < func)
+		NOP();
+
+	/* No opcode reads the target of the load right before it, so that the
+	 * result does not depend on how load delays are emulated. */
+	LW(T0, 0, A0);
+	LW(T2, 0, A0);		/* MOV from T0 */
+	ADDU(T1, T0, A1);
+	ADDU(T3, T2, A1);	/* MOV from T1 */
+	XOR(T4, T3, T1);	/* Constant 0 */
+	SW(T3, 4, A0);
+	LW(T5, 4, A0);		/* Forwarded from the store: MOV from T3 */
+	ADDIU(AT, ZERO, 3);
+	ADDU(T6, T5, T4);	/* MOV from T3 */
+	SLL(T7, T6, 2);
+	SLL(T8, T6, 2);		/* MOV from T7 */
+	SUBU(T9, T7, T8);	/* Constant 0 */
+	ADDU(V0, T6, T9);	/* MOV from T3 */
+	SLLV(V1, V0, AT);
+	SLL(T0, V0, 3);		/* MOV from V1 */
+	SB(V1, 8, A0);
+	LW(T2, 0, A0);		/* Kept, as the store may overlap */
+	LBU(T5, 8, A0);
+	ADDU(A1, A1, V0);
+	XOR(A1, A1, T0);
+	ADDU(A1, A1, T2);
+	ADDU(A1, A1, T5);
+	ADDU(A1, A1, T9);
+	ADDU(A1, A1, T4);
+	SLL(A1, A1, 1);
+	ADDU(A1, A1, T0);
+	JR(RA);
+	NOP();
+}
+
+/*
+ * ev: rounds of OTC, GPU and SPU DMA transfers and CD-ROM commands, each
+ * followed by a loop reading the counter 0 and the DMA ICR, so that many
+ * events are pending and fire while the program runs.
+ */
+static void gen_ev(unsigned int count)
+{
+	unsigned int loop, spin;
+
+	LUI(S0, 0x8010);
+	LUI(S3, 0x1f80);
+	li(S1, count);
+
+	/* Enable all the DMA channels */
+	li(T0, 0x08888888);
+	SW(T0, 0x10f0, S3);
+
+	/* OTC DMA (channel 6) of 256 entries ending at 0x80101000 */
+	loop = LUI(T0, 0x8010);
+	ORI(T0, T0, 0x1000);
+	SW(T0, 0x10e0, S3);
+	ADDIU(T0, ZERO, 0x100);
+	SW(T0, 0x10e4, S3);
+	li(T0, 0x11000002);
+	SW(T0, 0x10e8, S3);
+
+	/* GPU DMA (channel 2) of the linked list built by the OTC DMA */
+	li(T0, 0x80100ffc);
+	SW(T0, 0x10a0, S3);
+	SW(ZERO, 0x10a4, S3);
+	li(T0, 0x01000401);
+	SW(T0, 0x10a8, S3);
+
+	/* SPU DMA (channel 4) to the SPU RAM address 0x1000 */
+	ADDIU(T0, ZERO, 0x200);
+	SH(T0, 0x1da6, S3);
+	li(T0, 0x80102000);
+	SW(T0, 0x10c0, S3);
+	li(T0, 0x00040010);
+	SW(T0, 0x10c4, S3);
+	li(T0, 0x01000201);
+	SW(T0, 0x10c8, S3);
+
+	/* Acknowledge the CD-ROM interrupts, then send GetStat */
+	ADDIU(T0, ZERO, 1);
+	SB(T0, 0x1800, S3);
+	ADDIU(T0, ZERO, 0x1f);
+	SB(T0, 0x1803, S3);
+	SB(ZERO, 0x1800, S3);
+	ADDIU(T0, ZERO, 1);
+	SB(T0, 0x1801, S3);
+
+	/* The values read while the events fire depend on the timings of the
+	 * CPU emulation, so only their number is checked */
+	ADDIU(T4, ZERO, 200);
+	spin = LW(T1, 0x1100, S3);
+	LW(T2, 0x10f4, S3);
+	ADDIU(T4, T4, -1);
+	BNE(T4, ZERO, spin);
+	ADDIU(S6, S6, 1);
+
+	/* By now the transfers are done; each round mixes its number with
+	 * the values, so that the rounds do not cancel out */
+	LW(T0, 0x10a8, S3);
+	NOP();
+	XOR(T0, T0, S1);
+	mix(T0);
+	LW(T0, 0x10c8, S3);
+	NOP();
+	XOR(T0, T0, S1);
+	mix(T0);
+	LW(T0, 0x10e8, S3);
+	NOP();
+	XOR(T0, T0, S1);
+	mix(T0);
+	LW(T0, 0x10f4, S3);
+	NOP();
+	XOR(T0, T0, S1);
+	mix(T0);
+	LW(T0, 0xff8, S0);
+	NOP();
+	XOR(T0, T0, S1);
+	mix(T0);
+
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, loop);
+	NOP();
+
+	finish();
+}
+
+/*
+ * evict: rounds of calls to more small functions than the code buffer can
+ * hold, each one followed by a call to the same hot function, so that the
+ * code buffer has to be cleaned while the hot blocks keep running.
+ */
+#define EVICT_FUNCS		6144
+#define EVICT_FUNC_LEN		24
+
+static void gen_evict(unsigned int count)
+{
+	unsigned int i, k, skip, funcs, hot, loop;
+
+	skip = J(0);
+	NOP();
+
+	for (i = 0, funcs = len; i < EVICT_FUNCS; i++) {
+		for (k = 0; k < (EVICT_FUNC_LEN - 2) / 5; k++) {
+			ADDIU(T0, ZERO, (i * 7 + k * 13) & 0x7fff);
+			ADDU(S7, S7, T0);
+			SLL(T1, S7, 3);
+			SRL(T2, S7, 29);
+			OR(S7, T1, T2);
+		}
+
+		while (len - funcs < (i + 1) * EVICT_FUNC_LEN - 2)
+			NOP();
+
+		JR(RA);
+		NOP();
+	}
+
+	hot = ADDIU(S6, S6, 1);
+	JR(RA);
+	NOP();
+
+	code[skip] = op_j(0x02, len);
+	li(S1, count);
+
+	for (i = 0, loop = len; i < EVICT_FUNCS; i++) {
+		JAL(funcs + i * EVICT_FUNC_LEN);
+		NOP();
+		JAL(hot);
+		NOP();
+	}
+
+	ADDIU(S1, S1, -1);
+	BNE(S1, ZERO, loop);
+	NOP();
+
+	finish();
+}
+
+struct program {
+	const char *name;
+	const char *desc;
+	unsigned int def_count;
+	void (*gen)(unsigned int count);
+};
+
+static const struct program programs[] = {
+	{ "alu", "ALU, mult/div and RAM access loop", 0x100000, gen_alu },
+	{ "chain", "Blocks ending with a jump to a known target", 0x10000, gen_chain },
+	{ "gte", "NCLIP, AVSZ3 and AVSZ4 on random inputs", 0x10000, gen_gte },
+	{ "io", "Accesses to the hardware registers with direct handlers", 0x8000, gen_io },
+	{ "idle", "Polling loop waiting for the VBlank interrupt", 200, gen_idle },
+	{ "dead", "Calls to a function whose first opcode changes", 0x10000, gen_dead },
+	{ "ssa", "Redundant loads and computations in a hot block", 0x10000, gen_ssa },
+	{ "ev", "DMA transfers and CD-ROM commands firing many events", 64, gen_ev },
+	{ "evict", "Calls to more functions than the code buffer can hold", 16, gen_evict },
+};
+
+static int write_exe(const char *path)
+{
+	uint8_t header[EXE_HEADER_SIZE] = "PS-X EXE";
+	uint32_t size = (len * 4 + EXE_HEADER_SIZE - 1) & ~(EXE_HEADER_SIZE - 1);
+	uint8_t pad[EXE_HEADER_SIZE] = { 0 };
+	FILE *f;
+	int ret;
+
+	/* Entry point, GP, load address and size, then the stack */
+	memcpy(&header[0x10], &(uint32_t[]){ EXE_BASE, 0, EXE_BASE, size }, 16);
+	memcpy(&header[0x30], &(uint32_t[]){ EXE_STACK, 0 }, 8);
+
+	f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	ret = fwrite(header, sizeof(header), 1, f) != 1
+		|| fwrite(code, 4, len, f) != len
+		|| fwrite(pad, 1, size - len * 4, f) != size - len * 4;
+
+	if (fclose(f) || ret) {
+		fprintf(stderr, "Unable to write %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	unsigned int i;
+
+	fprintf(stderr, "Usage: %s <program> <out.exe> [count]\n\n"
+		"Programs:\n", argv0);
+
+	for (i = 0; i < ARRAY_SIZE(programs); i++) {
+		fprintf(stderr, "  %-8s %s (count: %u)\n", programs[i].name,
+			programs[i].desc, programs[i].def_count);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const struct program *prog = NULL;
+	unsigned int i, count;
+
+	if (argc < 3 || argc > 4) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(programs); i++) {
+		if (!strcmp(argv[1], programs[i].name))
+			prog = &programs[i];
+	}
+
+	if (!prog) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	count = argc == 4 ? strtoul(argv[3], NULL, 0) : prog->def_count;
+
+	/* The checksum registers start from a known state */
+	ADDU(S5, ZERO, ZERO);
+	ADDU(S6, ZERO, ZERO);
+	ADDU(S7, ZERO, ZERO);
+
+	prog->gen(count);
+
+	return write_exe(argv[2]) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Layout shared by the test programs of psx-testexe and by bloom-host.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ */
+
+#ifndef __HOST_TESTEXE_H__
+#define __HOST_TESTEXE_H__
+
+/* Once done, a test program writes RESULT_MAGIC at RESULT_ADDR, followed by
+ * RESULT_WORDS - 1 words of checksums, then spins forever. */
+#define RESULT_ADDR		0x801f0000
+#define RESULT_MAGIC		0x600df00d
+#define RESULT_WORDS		4
+
+#endif /* __HOST_TESTEXE_H__ */
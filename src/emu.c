@@ -69,6 +69,10 @@ static void init_config(void)
 	Config.cycle_multiplier = CYCLE_MULT_DEFAULT;
 	Config.GpuListWalking = -1;
 	Config.FractionalFramerate = -1;
+	Config.COMPR_CacheSize = WITH_COMPR_CACHE_SIZE * 1024;
+	Config.CHD_ReadAhead = WITH_CHD_READ_AHEAD;
+	Config.CHD_Threads = WITH_CHD_THREADS;
+	Config.CHD_CacheSize = WITH_CHD_CACHE_SIZE * 1024;
 
 	strcpy(Config.Mcd1, WITH_MCD1_PATH);
 	strcpy(Config.Mcd2, WITH_MCD2_PATH);